@@ -0,0 +1,136 @@
+// 属性事件包装微基准: 比较快速拼接路径、cJSON 解析-序列化路径 (直接 malloc 和使用临时内存块)
+// 和等价的 transform 模板, 并逐字节校验三者输出一致。
+//
+// 用法: envelope_bench [迭代次数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "event_envelope.h"
+#include "logger.h"
+#include "scratch_arena.h"
+#include "transform.h"
+
+// 与 EventCall 输出相同的模板
+static const char event_template[] =
+    "{\"data\":${payload},\"operationType\":\"uploadRtd\",\"projectID\":\"${const.projectID}\","
+    "\"requestType\":\"wrequest\",\"serialNo\":0,\"webtalkID\":\"${topic[-1]}\"}";
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 生成约 size 字节的属性事件负载
+static char *make_payload(size_t size)
+{
+    char  *payload = malloc(size + 128);
+    size_t len     = (size_t)sprintf(payload, "{\"seq\":1,\"props\":[");
+    for (int i = 0; len < size; i++)
+    {
+        len += (size_t)sprintf(payload + len, "%s{\"name\":\"p%d\",\"value\":\"%d\",\"q\":true}",
+                               i ? "," : "", i, i * 7);
+    }
+    len += (size_t)sprintf(payload + len, "]}");
+    return payload;
+}
+
+int main(int argc, char *argv[])
+{
+    int          iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    const size_t sizes[]    = {64, 512, 4096, 32768};
+    const char  *topic      = "/ge/web/device-0001";
+    int          failed     = 0;
+
+    current_log_level = LOG_LEVEL_ERROR;
+    scratch_init_hooks();
+
+    cJSON *spec      = cJSON_CreateObject();
+    cJSON *constants = cJSON_CreateObject();
+    cJSON_AddStringToObject(spec, "template", event_template);
+    cJSON_AddStringToObject(constants, "projectID", "X2View");
+    cJSON_AddItemToObject(spec, "constants", constants);
+    transform_t *transform = transform_compile("bench", spec);
+    cJSON_Delete(spec);
+    if (!transform)
+    {
+        fprintf(stderr, "Failed to compile template\n");
+        return 1;
+    }
+
+    printf("%-10s %14s %14s %14s %14s %10s\n", "payload", "cjson ns/msg", "arena ns/msg", "fast ns/msg",
+           "tmpl ns/msg", "speedup");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        char  *payload = make_payload(sizes[s]);
+        int    len     = (int)strlen(payload);
+        int    rounds  = (int)(iterations / (1 + sizes[s] / 512));
+        char  *expected;
+        size_t expected_len;
+        const char *actual;
+        size_t      actual_len;
+
+        if (event_envelope_build_cjson(topic, payload, len, &expected, &expected_len) != EVENT_ENVELOPE_OK
+            || event_envelope_build(topic, payload, len, &actual, &actual_len) != EVENT_ENVELOPE_OK
+            || expected_len != actual_len || memcmp(expected, actual, actual_len) != 0)
+        {
+            fprintf(stderr, "Output mismatch for %zu byte payload\n", sizes[s]);
+            failed = 1;
+        }
+        if (transform_apply(transform, topic, payload, len, &actual, &actual_len) != TRANSFORM_OK
+            || expected_len != actual_len || memcmp(expected, actual, actual_len) != 0)
+        {
+            fprintf(stderr, "Template output mismatch for %zu byte payload\n", sizes[s]);
+            failed = 1;
+        }
+        cJSON_free(expected);
+
+        double start = now_ns();
+        for (int i = 0; i < rounds; i++)
+        {
+            char  *out;
+            size_t out_len;
+            event_envelope_build_cjson(topic, payload, len, &out, &out_len);
+            cJSON_free(out);
+        }
+        double cjson_ns = (now_ns() - start) / rounds;
+
+        // 与转发时一样, 每条消息在临时内存块中完成解析和序列化
+        start = now_ns();
+        for (int i = 0; i < rounds; i++)
+        {
+            char  *out;
+            size_t out_len;
+            scratch_begin();
+            event_envelope_build_cjson(topic, payload, len, &out, &out_len);
+            cJSON_free(out);
+            scratch_end();
+        }
+        double arena_ns = (now_ns() - start) / rounds;
+
+        start = now_ns();
+        for (int i = 0; i < rounds; i++)
+        {
+            event_envelope_build(topic, payload, len, &actual, &actual_len);
+        }
+        double fast_ns = (now_ns() - start) / rounds;
+
+        start = now_ns();
+        for (int i = 0; i < rounds; i++)
+        {
+            transform_apply(transform, topic, payload, len, &actual, &actual_len);
+        }
+        double template_ns = (now_ns() - start) / rounds;
+
+        printf("%-10d %14.1f %14.1f %14.1f %14.1f %9.1fx\n", len, cjson_ns, arena_ns, fast_ns, template_ns,
+               cjson_ns / fast_ns);
+        free(payload);
+    }
+    transform_free(transform);
+    return failed;
+}
@@ -0,0 +1,632 @@
+// 转发路径进程内基准: 用合成的 mosquitto_message 直接调用 on_message,
+// 覆盖规则匹配、EventCall / CommandCall / TransformCall 和 forward_publish,
+// 网络相关的 libmosquitto 调用由本文件替换 (发布只计数, 不发送)。
+//
+// 报告每种组合的 ns/msg、allocs/msg、单核 msg/s 和按 MQTT 报文格式计算的出站字节数 (PUBLISH 报文,
+// 不含 TCP/IP 开销), 可输出 JSON 便于比较不同构建。
+//
+// 用法: mqtt_forwarder_bench [选项]
+//   -w, --workloads=LIST   event,command,transform,event-batch,event-v5,event-loose (默认全部)
+//   -p, --payloads=LIST    负载字节数 (默认 64,512,4096)
+//   -t, --topics=LIST      不同主题 (设备) 数 (默认 1,1000)
+//   -r, --rules=LIST       源客户端上的规则数, 其中一条匹配 (默认 1,100)
+//   -n, --messages=N       每种组合的消息数 (默认 200000)
+//   -j, --json=FILE        结果写入 JSON 文件 ("-" 表示标准输出)
+
+#include <getopt.h>
+#include <mosquitto.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "logger.h"
+#include "message_handlers.h"
+#include "mqtt_engine.h"
+#include "scratch_arena.h"
+
+#define MAX_LIST 16
+
+// mqtt_engine.c 中的 libmosquitto 回调
+void on_connect(struct mosquitto *mosq, void *userdata, int result);
+void on_connect_v5(struct mosquitto *mosq, void *userdata, int result, int flags, const mosquitto_property *props);
+void on_message(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message);
+
+typedef enum
+{
+    WORKLOAD_EVENT = 0,
+    WORKLOAD_COMMAND,
+    WORKLOAD_TRANSFORM,
+    WORKLOAD_BATCH,      // EventCall 按目标主题合并, 每批 BENCH_BATCH_MESSAGES 条
+    WORKLOAD_EVENT_V5,   // EventCall 发布到 MQTT v5 目标, 使用主题别名
+    WORKLOAD_EVENT_LOOSE, // EventCall, 负载带空白 (非规范形式), 走 cJSON 路径
+    WORKLOAD_COUNT
+} workload_t;
+
+static const char *const workload_names[WORKLOAD_COUNT] = {"event", "command", "transform", "event-batch",
+                                                           "event-v5", "event-loose"};
+
+#define BENCH_BATCH_MESSAGES 100
+
+// 与 EventCall 输出相同的模板
+static const char event_template[] =
+    "{\"data\":${payload},\"operationType\":\"uploadRtd\",\"projectID\":\"${const.projectID}\","
+    "\"requestType\":\"wrequest\",\"serialNo\":0,\"webtalkID\":\"${topic[-1]}\"}";
+
+typedef struct
+{
+    int list[MAX_LIST];
+    int count;
+} int_list_t;
+
+typedef struct
+{
+    workload_t workload;
+    int        payload_bytes;
+    int        topics;
+    int        rules;
+    long       messages;
+    double     ns_per_msg;
+    double     allocs_per_msg;
+    double     msgs_per_sec;
+    double     wire_bytes_per_msg;  // 每条发布的 PUBLISH 报文字节数
+    long       published;
+} result_t;
+
+// ---------------------------------------------------------------------------
+// 替换 libmosquitto 的网络调用, 其余函数 (mosquitto_new 等) 仍使用真实实现
+// ---------------------------------------------------------------------------
+
+static long          published_count = 0;
+static unsigned long published_bytes = 0;
+static unsigned long published_check = 0;   // 读取负载, 避免发布路径的写入被优化掉
+
+// 变长整数编码的字节数
+static int varint_size(int value)
+{
+    return value < 128 ? 1 : value < 16384 ? 2 : value < 2097152 ? 3 : 4;
+}
+
+// 记录一条 PUBLISH 报文: 固定头 + 主题 + 报文标识符 (QoS > 0) + 属性 (v5) + 负载
+static void count_wire(const char *topic, int payloadlen, const void *payload, int qos, int props_len)
+{
+    int remaining = 2 + (topic ? (int)strlen(topic) : 0) + (qos > 0 ? 2 : 0) + payloadlen;
+    if (props_len >= 0)
+    {
+        remaining += varint_size(props_len) + props_len;
+    }
+    published_count++;
+    published_bytes += (unsigned long)(1 + varint_size(remaining) + remaining);
+    published_check += ((const unsigned char *)payload)[0];
+}
+
+int mosquitto_publish(struct mosquitto *mosq, int *mid, const char *topic, int payloadlen,
+                      const void *payload, int qos, bool retain)
+{
+    // 按 MQTT v3.1.1 报文计 (没有属性长度字段); event-v5 的发布都经过 mosquitto_publish_v5
+    count_wire(topic, payloadlen, payload, qos, -1);
+    return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_publish_v5(struct mosquitto *mosq, int *mid, const char *topic, int payloadlen,
+                         const void *payload, int qos, bool retain, const mosquitto_property *properties)
+{
+    int props_len = 0;
+    for (const mosquitto_property *p = properties; p; p = mosquitto_property_next(p))
+    {
+        uint16_t    alias = 0;
+        uint32_t    expiry;
+        char       *name  = NULL;
+        char       *value = NULL;
+        switch (mosquitto_property_identifier(p))
+        {
+        case MQTT_PROP_TOPIC_ALIAS:
+            mosquitto_property_read_int16(p, MQTT_PROP_TOPIC_ALIAS, &alias, false);
+            props_len += 3;
+            break;
+        case MQTT_PROP_MESSAGE_EXPIRY_INTERVAL:
+            mosquitto_property_read_int32(p, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, &expiry, false);
+            props_len += 5;
+            break;
+        case MQTT_PROP_USER_PROPERTY:
+            mosquitto_property_read_string_pair(p, MQTT_PROP_USER_PROPERTY, &name, &value, false);
+            props_len += 5 + (int)(strlen(name) + strlen(value));
+            free(name);
+            free(value);
+            break;
+        default:
+            break;
+        }
+    }
+    count_wire(topic, payloadlen, payload, qos, props_len);
+    return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_connect_async(struct mosquitto *mosq, const char *host, int port, int keepalive)
+{
+    return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_loop_start(struct mosquitto *mosq)
+{
+    return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_loop_stop(struct mosquitto *mosq, bool force)
+{
+    return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_subscribe(struct mosquitto *mosq, int *mid, const char *sub, int qos)
+{
+    return MOSQ_ERR_SUCCESS;
+}
+
+int mosquitto_unsubscribe(struct mosquitto *mosq, int *mid, const char *sub)
+{
+    return MOSQ_ERR_SUCCESS;
+}
+
+// ---------------------------------------------------------------------------
+// 分配计数: 替换 malloc 系列函数, 转发到 glibc 的实现 (其他 C 库上不统计, 显示为0)
+// ---------------------------------------------------------------------------
+
+static atomic_ulong allocations = 0;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void  __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// 场景构造
+// ---------------------------------------------------------------------------
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 生成约 size 字节的负载: 属性事件为 {"seq":1,"props":[...]}, 指令为 {"data":[...]};
+// event-loose 在分隔符后加空格, 与 cJSON 的紧凑输出不同
+static char *make_payload(workload_t workload, int size)
+{
+    char *payload = malloc((size_t)size + 160);
+    if (!payload)
+    {
+        return NULL;
+    }
+    if (workload == WORKLOAD_COMMAND)
+    {
+        int len = sprintf(payload, "{\"data\":[{\"name\":\"site.line.dev.switch\",\"value\":\"1\"}");
+        for (int i = 0; len < size; i++)
+        {
+            len += sprintf(payload + len, ",{\"name\":\"site.line.dev.p%d\",\"value\":\"%d\"}", i, i * 7);
+        }
+        sprintf(payload + len, "]}");
+        return payload;
+    }
+
+    if (workload == WORKLOAD_EVENT_LOOSE)
+    {
+        int len = sprintf(payload, "{\"seq\": 1, \"props\": [");
+        for (int i = 0; len < size; i++)
+        {
+            len += sprintf(payload + len, "%s{\"name\": \"p%d\", \"value\": \"%d\", \"q\": true}",
+                           i ? ", " : "", i, i * 7);
+        }
+        sprintf(payload + len, "]}");
+        return payload;
+    }
+
+    int len = sprintf(payload, "{\"seq\":1,\"props\":[");
+    for (int i = 0; len < size; i++)
+    {
+        len += sprintf(payload + len, "%s{\"name\":\"p%d\",\"value\":\"%d\",\"q\":true}", i ? "," : "", i, i * 7);
+    }
+    sprintf(payload + len, "]}");
+    return payload;
+}
+
+static transform_t *compile_event_template(void)
+{
+    cJSON *spec      = cJSON_CreateObject();
+    cJSON *constants = cJSON_CreateObject();
+    cJSON_AddStringToObject(spec, "template", event_template);
+    cJSON_AddStringToObject(constants, "projectID", "X2View");
+    cJSON_AddItemToObject(spec, "constants", constants);
+    transform_t *transform = transform_compile("bench", spec);
+    cJSON_Delete(spec);
+    return transform;
+}
+
+// 建立源/目标两个客户端和 rules 条规则 (最后一条匹配 /bench/match/#), 并启动引擎
+static mqtt_client_t *setup_engine(workload_t workload, int rules, const transform_t *transform)
+{
+    static const mqtt_config_t mqtt = {.port = 1883, .keepalive = 60, .clean_session = 1};
+    client_config_t            source_cfg = {.name = "bench-source", .ip = "127.0.0.1", .port = 1883,
+                                             .client_id = "bench-source"};
+    client_config_t            target_cfg = {.name = "bench-target", .ip = "127.0.0.2", .port = 1883,
+                                             .client_id = "bench-target"};
+    if (workload == WORKLOAD_EVENT_V5)
+    {
+        target_cfg.protocol        = PROTOCOL_MQTT5;
+        target_cfg.topic_alias_max = TOPIC_ALIAS_DEFAULT_MAX;
+    }
+    engine_config_t            engine     = {.mode = ENGINE_MODE_THREADED, .loops = 1};
+
+    mosquitto_lib_init();
+    mqtt_client_t *source = mqtt_connect(&source_cfg, &mqtt);
+    mqtt_client_t *target = mqtt_connect(&target_cfg, &mqtt);
+    if (!source || !target)
+    {
+        return NULL;
+    }
+
+    forward_callback_t callback = workload == WORKLOAD_EVENT || workload == WORKLOAD_BATCH
+                                          || workload == WORKLOAD_EVENT_V5
+                                          || workload == WORKLOAD_EVENT_LOOSE ? EventCall
+                                : workload == WORKLOAD_COMMAND             ? CommandCall
+                                                                           : TransformCall;
+    // 只按条数发出: 基准不运行定时任务, 延迟上限取最大值
+    publish_config_t publish = {.batch = {.enabled      = workload == WORKLOAD_BATCH,
+                                          .max_messages = BENCH_BATCH_MESSAGES,
+                                          .max_bytes    = MAX_MESSAGE_SIZE,
+                                          .max_delay_ms = BATCH_MAX_DELAY_MS},
+                                .priority = PRIORITY_NORMAL};
+    for (int i = 0; i < rules; i++)
+    {
+        char name[64];
+        char topic[64];
+        snprintf(name, sizeof(name), "bench-rule-%d", i);
+        if (i == rules - 1)
+        {
+            snprintf(topic, sizeof(topic), "/bench/match/#");
+        }
+        else
+        {
+            snprintf(topic, sizeof(topic), "/bench/other-%d/+/#", i);
+        }
+        if (add_forward_rule(source, topic, target, topic, callback,
+                             workload == WORKLOAD_TRANSFORM ? transform : NULL, &publish, name) != 0)
+        {
+            return NULL;
+        }
+    }
+
+    if (mqtt_engine_start(&engine) != 0)
+    {
+        return NULL;
+    }
+    on_connect(source->mosq, source, 0);
+    if (workload == WORKLOAD_EVENT_V5)
+    {
+        // Broker 在 CONNACK 中允许的别名数
+        mosquitto_property *connack = NULL;
+        mosquitto_property_add_int16(&connack, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, TOPIC_ALIAS_MAX);
+        on_connect_v5(target->mosq, target, 0, 0, connack);
+        mosquitto_property_free_all(&connack);
+    }
+    else
+    {
+        on_connect(target->mosq, target, 0);
+    }
+    return source;
+}
+
+static int run_case(result_t *result, long messages, const transform_t *transform)
+{
+    char *payload = make_payload(result->workload, result->payload_bytes);
+    if (!payload)
+    {
+        return -1;
+    }
+
+    // 不同主题对应不同设备, 按轮转顺序发送
+    struct mosquitto_message *batch = calloc((size_t)result->topics, sizeof(struct mosquitto_message));
+    for (int i = 0; batch && i < result->topics; i++)
+    {
+        char topic[64];
+        snprintf(topic, sizeof(topic), "/bench/match/device-%06d", i);
+        batch[i].topic      = strdup(topic);
+        batch[i].payload    = payload;
+        batch[i].payloadlen = (int)strlen(payload);
+    }
+
+    mqtt_client_t *source = batch ? setup_engine(result->workload, result->rules, transform) : NULL;
+    if (!source)
+    {
+        fprintf(stderr, "Failed to set up %s case\n", workload_names[result->workload]);
+        cleanup_forwarder();
+        free(payload);
+        free(batch);
+        return -1;
+    }
+
+    // 预热: 填充线程私有缓冲区、规则索引缓存和指标分片
+    long warmup = messages / 10 > result->topics ? messages / 10 : result->topics;
+    for (long i = 0; i < warmup; i++)
+    {
+        on_message(source->mosq, source, &batch[i % result->topics]);
+    }
+
+    published_count          = 0;
+    published_bytes          = 0;
+    unsigned long allocs0    = atomic_load(&allocations);
+    double        start      = now_ns();
+    for (long i = 0; i < messages; i++)
+    {
+        on_message(source->mosq, source, &batch[i % result->topics]);
+    }
+    double        elapsed    = now_ns() - start;
+    unsigned long allocs     = atomic_load(&allocations) - allocs0;
+
+    result->messages           = messages;
+    result->published          = published_count;
+    result->ns_per_msg         = elapsed / messages;
+    result->allocs_per_msg     = (double)allocs / messages;
+    result->msgs_per_sec       = messages * 1e9 / elapsed;
+    result->wire_bytes_per_msg = published_count ? (double)published_bytes / published_count : 0;
+
+    cleanup_forwarder();
+    for (int i = 0; i < result->topics; i++)
+    {
+        free(batch[i].topic);
+    }
+    free(batch);
+    free(payload);
+
+    // 合并发布时预热留下的未满批使发布数有偏差, 每个主题最多一批
+    long expected  = messages;
+    long tolerance = 0;
+    if (result->workload == WORKLOAD_BATCH)
+    {
+        expected  = messages / BENCH_BATCH_MESSAGES;
+        tolerance = result->topics;
+    }
+    if (published_count < expected - tolerance || published_count > expected + tolerance)
+    {
+        fprintf(stderr, "%s case published %ld messages, expected %ld\n",
+                workload_names[result->workload], published_count, expected);
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// 参数与输出
+// ---------------------------------------------------------------------------
+
+static int parse_int_list(const char *arg, int_list_t *list)
+{
+    list->count = 0;
+    for (const char *p = arg; *p && list->count < MAX_LIST;)
+    {
+        char *end;
+        long  value = strtol(p, &end, 10);
+        if (end == p || value <= 0 || value > 100000000)
+        {
+            return -1;
+        }
+        list->list[list->count++] = (int)value;
+        p = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',')
+        {
+            return -1;
+        }
+    }
+    return list->count > 0 ? 0 : -1;
+}
+
+static int parse_workloads(const char *arg, int enabled[WORKLOAD_COUNT])
+{
+    memset(enabled, 0, sizeof(int) * WORKLOAD_COUNT);
+    char *copy = strdup(arg);
+    char *save = NULL;
+    for (char *name = strtok_r(copy, ",", &save); name; name = strtok_r(NULL, ",", &save))
+    {
+        int found = 0;
+        for (int w = 0; w < WORKLOAD_COUNT; w++)
+        {
+            if (strcmp(name, workload_names[w]) == 0)
+            {
+                enabled[w] = found = 1;
+            }
+        }
+        if (!found)
+        {
+            fprintf(stderr, "Unknown workload: %s\n", name);
+            free(copy);
+            return -1;
+        }
+    }
+    free(copy);
+    return 0;
+}
+
+static void write_json(FILE *out, const result_t *results, int count)
+{
+    fprintf(out, "{\n  \"benchmark\": \"mqtt_forwarder_bench\",\n");
+#ifdef __VERSION__
+    fprintf(out, "  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+    fprintf(out, "  \"results\": [\n");
+    for (int i = 0; i < count; i++)
+    {
+        const result_t *r = &results[i];
+        fprintf(out,
+                "    {\"workload\": \"%s\", \"payload_bytes\": %d, \"topics\": %d, \"rules\": %d, "
+                "\"messages\": %ld, \"ns_per_msg\": %.1f, \"allocs_per_msg\": %.2f, \"msgs_per_sec_per_core\": %.0f, "
+                "\"wire_bytes_per_msg\": %.1f}%s\n",
+                workload_names[r->workload], r->payload_bytes, r->topics, r->rules, r->messages,
+                r->ns_per_msg, r->allocs_per_msg, r->msgs_per_sec, r->wire_bytes_per_msg, i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void print_usage(const char *program_name)
+{
+    printf("Usage: %s [OPTIONS]\n", program_name);
+    printf("  -w, --workloads=LIST   event,command,transform,event-batch,event-v5,event-loose (default: all)\n");
+    printf("  -p, --payloads=LIST    payload sizes in bytes (default: 64,512,4096)\n");
+    printf("  -t, --topics=LIST      distinct topic counts (default: 1,1000)\n");
+    printf("  -r, --rules=LIST       rules on the source client, one of which matches (default: 1,100)\n");
+    printf("  -n, --messages=N       messages per case (default: 200000)\n");
+    printf("  -j, --json=FILE        write results as JSON (\"-\" for stdout)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"workloads", required_argument, 0, 'w'},
+        {"payloads", required_argument, 0, 'p'},
+        {"topics", required_argument, 0, 't'},
+        {"rules", required_argument, 0, 'r'},
+        {"messages", required_argument, 0, 'n'},
+        {"json", required_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+
+    int         enabled[WORKLOAD_COUNT] = {1, 1, 1, 1, 1, 1};
+    int_list_t  payloads                = {{64, 512, 4096}, 3};
+    int_list_t  topics                  = {{1, 1000}, 2};
+    int_list_t  rules                   = {{1, 100}, 2};
+    long        messages                = 200000;
+    const char *json_file               = NULL;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "w:p:t:r:n:j:h", long_options, NULL)) != -1)
+    {
+        int bad = 0;
+        switch (c)
+        {
+        case 'w':
+            bad = parse_workloads(optarg, enabled);
+            break;
+        case 'p':
+            bad = parse_int_list(optarg, &payloads);
+            break;
+        case 't':
+            bad = parse_int_list(optarg, &topics);
+            break;
+        case 'r':
+            bad = parse_int_list(optarg, &rules);
+            break;
+        case 'n':
+            messages = atol(optarg);
+            bad      = messages <= 0;
+            break;
+        case 'j':
+            json_file = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        default:
+            bad = 1;
+            break;
+        }
+        if (bad)
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    current_log_level = LOG_LEVEL_ERROR;
+    scratch_init_hooks();
+
+    transform_t *transform = enabled[WORKLOAD_TRANSFORM] ? compile_event_template() : NULL;
+    if (enabled[WORKLOAD_TRANSFORM] && !transform)
+    {
+        fprintf(stderr, "Failed to compile template\n");
+        return 1;
+    }
+
+    int       capacity = WORKLOAD_COUNT * payloads.count * topics.count * rules.count;
+    result_t *results  = calloc((size_t)capacity, sizeof(result_t));
+    int       count    = 0;
+    int       failed   = 0;
+    FILE     *table    = json_file && strcmp(json_file, "-") == 0 ? stderr : stdout;
+
+    fprintf(table, "%-10s %8s %8s %6s %12s %12s %14s %12s\n",
+            "workload", "payload", "topics", "rules", "ns/msg", "allocs/msg", "msg/s/core", "wire B/msg");
+    for (int w = 0; w < WORKLOAD_COUNT; w++)
+    {
+        for (int p = 0; enabled[w] && p < payloads.count; p++)
+        {
+            for (int t = 0; t < topics.count; t++)
+            {
+                for (int r = 0; r < rules.count; r++)
+                {
+                    result_t *result = &results[count];
+                    *result          = (result_t){.workload      = (workload_t)w,
+                                                  .payload_bytes = payloads.list[p],
+                                                  .topics        = topics.list[t],
+                                                  .rules         = rules.list[r]};
+                    if (run_case(result, messages, transform) != 0)
+                    {
+                        failed = 1;
+                        continue;
+                    }
+                    fprintf(table, "%-10s %8d %8d %6d %12.1f %12.2f %14.0f %12.1f\n",
+                            workload_names[w], result->payload_bytes, result->topics, result->rules,
+                            result->ns_per_msg, result->allocs_per_msg, result->msgs_per_sec,
+                            result->wire_bytes_per_msg);
+                    count++;
+                }
+            }
+        }
+    }
+
+    if (json_file)
+    {
+        FILE *out = strcmp(json_file, "-") == 0 ? stdout : fopen(json_file, "w");
+        if (!out)
+        {
+            perror(json_file);
+            failed = 1;
+        }
+        else
+        {
+            write_json(out, results, count);
+            if (out != stdout)
+            {
+                fclose(out);
+            }
+        }
+    }
+
+    free(results);
+    transform_free(transform);
+    return failed;
+}
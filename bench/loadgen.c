@@ -0,0 +1,643 @@
+// 端到端负载生成器: N 个发布连接向源 Broker 发送带序号和时间戳的消息,
+// 一个订阅连接从目标 Broker 接收转发器的输出, 统计送达速率、丢失、乱序和延迟分位数。
+//
+// 负载为 {"lg":{"c":连接,"s":序号,"t":发送时间},"pad":"..."}, 要求转发规则原样携带负载
+// (EventCall 或包含 ${payload} 的 transform 模板)。发送方和接收方在同一进程内, 共用单调时钟。
+//
+// 速率:
+//   --rate=R (R>0)  按计划时间发送 (开环), 延迟从计划发送时间算起, 发送端落后时不会掩盖排队延迟
+//   --rate=0        闭环饱和: 未送达消息达到 --window 时暂停发送, 测量最大吞吐
+//
+// 用法: mqtt_loadgen --pub-port=18831 --sub-port=18832 --rate=10000 --duration=10 [--json=FILE]
+
+#include <getopt.h>
+#include <mosquitto.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROBE_CONNECTION -1        // 预热探测消息的连接号
+#define PROBE_TIMEOUT_MS 10000
+#define CONNECT_TIMEOUT_MS 5000
+#define WINDOW_STALL_MS 100        // 闭环窗口等待上限, 丢失的消息不会永久占用窗口
+
+typedef struct
+{
+    const char *pub_host;
+    int         pub_port;
+    const char *sub_host;
+    int         sub_port;
+    const char *pub_topic;   // 发布主题前缀, 每个连接发布到 <前缀>/dev-<i>
+    const char *sub_topic;
+    int         connections;
+    long        rate;        // 总速率 (msg/s), 0 表示闭环饱和
+    long        window;      // 闭环模式下允许的未送达消息数
+    double      duration;    // 发送时长 (秒)
+    double      drain;       // 发送结束后等待送达的时长 (秒)
+    int         payload_bytes;
+    int         qos;
+    const char *json_file;
+    const char *label;
+} options_t;
+
+typedef struct
+{
+    struct mosquitto *mosq;
+    int               index;
+    atomic_bool       connected;
+    char              topic[256];
+    long              sent;
+    long              publish_errors;
+    pthread_t         thread;
+} publisher_t;
+
+typedef struct
+{
+    struct mosquitto *mosq;
+    atomic_bool       subscribed;
+    atomic_bool       probe_seen;
+    atomic_long       received;     // 测量消息数 (不含探测消息)
+    atomic_long       lost;         // 尚未补上的序号空洞, 用于区分乱序和重复
+    long              reordered;
+    long              duplicates;
+    long              malformed;
+    long             *next_seq;     // 每个发布连接期望的下一个序号
+    unsigned int     *latencies;    // 微秒
+    long              latency_count;
+    long              latency_capacity;
+    long long         last_ns;      // 最后一条测量消息送达的时间
+} subscriber_t;
+
+static options_t    options;
+static publisher_t *publishers;
+static subscriber_t subscriber;
+static atomic_long  total_sent   = 0;
+static long long    start_ns     = 0;
+static atomic_bool  stop_sending = false;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(long long deadline_ns)
+{
+    long long delay = deadline_ns - now_ns();
+    if (delay > 0)
+    {
+        struct timespec ts = {delay / 1000000000LL, delay % 1000000000LL};
+        nanosleep(&ts, NULL);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 接收端
+// ---------------------------------------------------------------------------
+
+static void record_latency(long long latency_ns)
+{
+    if (subscriber.latency_count == subscriber.latency_capacity)
+    {
+        long          capacity = subscriber.latency_capacity ? subscriber.latency_capacity * 2 : 65536;
+        unsigned int *grown    = realloc(subscriber.latencies, sizeof(unsigned int) * (size_t)capacity);
+        if (!grown)
+        {
+            return;
+        }
+        subscriber.latencies        = grown;
+        subscriber.latency_capacity = capacity;
+    }
+    long long us = latency_ns > 0 ? latency_ns / 1000 : 0;
+    subscriber.latencies[subscriber.latency_count++] = us > 0xffffffffLL ? 0xffffffffu : (unsigned int)us;
+}
+
+// 在订阅连接的网络线程上调用
+static void on_sub_message(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message)
+{
+    long long   received_ns = now_ns();
+    const char *marker      = message->payloadlen > 0 ? strstr((const char *)message->payload, "\"lg\":{\"c\":")
+                                                      : NULL;
+    long        connection;
+    long        seq;
+    long long   sent_ns;
+    if (!marker || sscanf(marker, "\"lg\":{\"c\":%ld,\"s\":%ld,\"t\":%lld", &connection, &seq, &sent_ns) != 3)
+    {
+        subscriber.malformed++;
+        return;
+    }
+    if (connection == PROBE_CONNECTION)
+    {
+        atomic_store(&subscriber.probe_seen, true);
+        return;
+    }
+    if (connection < 0 || connection >= options.connections)
+    {
+        subscriber.malformed++;
+        return;
+    }
+
+    long *next = &subscriber.next_seq[connection];
+    if (seq == *next)
+    {
+        (*next)++;
+    }
+    else if (seq > *next)
+    {
+        subscriber.lost += seq - *next;   // 暂记为丢失, 迟到时扣回
+        *next = seq + 1;
+    }
+    else if (subscriber.lost > 0)
+    {
+        subscriber.reordered++;
+        subscriber.lost--;
+    }
+    else
+    {
+        subscriber.duplicates++;
+        return;
+    }
+
+    subscriber.last_ns = received_ns;
+    record_latency(received_ns - sent_ns);
+    atomic_fetch_add(&subscriber.received, 1);
+}
+
+static void on_sub_connect(struct mosquitto *mosq, void *userdata, int result)
+{
+    if (result == 0)
+    {
+        mosquitto_subscribe(mosq, NULL, options.sub_topic, options.qos);
+    }
+}
+
+static void on_sub_subscribe(struct mosquitto *mosq, void *userdata, int mid, int qos_count, const int *granted_qos)
+{
+    atomic_store(&subscriber.subscribed, true);
+}
+
+// ---------------------------------------------------------------------------
+// 发送端
+// ---------------------------------------------------------------------------
+
+static void on_pub_connect(struct mosquitto *mosq, void *userdata, int result)
+{
+    publisher_t *publisher = (publisher_t *)userdata;
+    atomic_store(&publisher->connected, result == 0);
+}
+
+static void on_pub_disconnect(struct mosquitto *mosq, void *userdata, int result)
+{
+    publisher_t *publisher = (publisher_t *)userdata;
+    atomic_store(&publisher->connected, false);
+}
+
+// 负载头部之后用 'x' 填充到 payload_bytes
+static int format_payload(char *buffer, size_t size, long connection, long seq, long long sent_ns)
+{
+    int len = snprintf(buffer, size, "{\"lg\":{\"c\":%ld,\"s\":%ld,\"t\":%lld},\"pad\":\"", connection, seq, sent_ns);
+    while ((size_t)len + 3 < size && len + 2 < options.payload_bytes)
+    {
+        buffer[len++] = 'x';
+    }
+    buffer[len++] = '"';
+    buffer[len++] = '}';
+    buffer[len]   = '\0';
+    return len;
+}
+
+static void *publisher_main(void *arg)
+{
+    publisher_t *publisher = (publisher_t *)arg;
+    size_t       size      = (size_t)options.payload_bytes + 128;
+    char        *payload   = malloc(size);
+    if (!payload)
+    {
+        return NULL;
+    }
+
+    // 开环: 每个连接分担 rate/N, 按固定间隔的计划时间发送
+    double interval_ns = options.rate > 0 ? 1e9 * options.connections / options.rate : 0;
+    long long end_ns   = start_ns + (long long)(options.duration * 1e9);
+
+    for (long seq = 0; !atomic_load(&stop_sending); seq++)
+    {
+        long long scheduled_ns;
+        if (interval_ns > 0)
+        {
+            scheduled_ns = start_ns + (long long)(seq * interval_ns + publisher->index * interval_ns / options.connections);
+            if (scheduled_ns >= end_ns)
+            {
+                break;
+            }
+            sleep_until(scheduled_ns);
+        }
+        else
+        {
+            // 已知的序号空洞不计入在途消息; 尾部丢失无法发现, 等待超时后继续发送
+            long long stall_end = now_ns() + WINDOW_STALL_MS * 1000000LL;
+            while (atomic_load(&total_sent) - atomic_load(&subscriber.received) - atomic_load(&subscriber.lost)
+                       >= options.window
+                   && !atomic_load(&stop_sending) && now_ns() < stall_end)
+            {
+                usleep(50);
+            }
+            scheduled_ns = now_ns();
+            if (scheduled_ns >= end_ns)
+            {
+                break;
+            }
+        }
+
+        int len = format_payload(payload, size, publisher->index, seq, scheduled_ns);
+        int ret = mosquitto_publish(publisher->mosq, NULL, publisher->topic, len, payload, options.qos, false);
+        if (ret == MOSQ_ERR_SUCCESS)
+        {
+            publisher->sent++;
+            atomic_fetch_add(&total_sent, 1);
+        }
+        else
+        {
+            publisher->publish_errors++;
+            seq--;   // 发送失败不占用序号, 避免被记为丢失
+            usleep(1000);
+        }
+    }
+    free(payload);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// 连接建立
+// ---------------------------------------------------------------------------
+
+static int wait_for(atomic_bool *flag, int timeout_ms)
+{
+    for (int waited = 0; waited < timeout_ms; waited += 10)
+    {
+        if (atomic_load(flag))
+        {
+            return 0;
+        }
+        usleep(10000);
+    }
+    return -1;
+}
+
+static int start_subscriber(void)
+{
+    subscriber.next_seq = calloc((size_t)options.connections, sizeof(long));
+    subscriber.mosq     = mosquitto_new(NULL, true, &subscriber);
+    if (!subscriber.next_seq || !subscriber.mosq)
+    {
+        return -1;
+    }
+    mosquitto_connect_callback_set(subscriber.mosq, on_sub_connect);
+    mosquitto_subscribe_callback_set(subscriber.mosq, on_sub_subscribe);
+    mosquitto_message_callback_set(subscriber.mosq, on_sub_message);
+    if (mosquitto_connect(subscriber.mosq, options.sub_host, options.sub_port, 60) != MOSQ_ERR_SUCCESS
+        || mosquitto_loop_start(subscriber.mosq) != MOSQ_ERR_SUCCESS)
+    {
+        fprintf(stderr, "Failed to connect subscriber to %s:%d\n", options.sub_host, options.sub_port);
+        return -1;
+    }
+    if (wait_for(&subscriber.subscribed, CONNECT_TIMEOUT_MS) != 0)
+    {
+        fprintf(stderr, "Timed out subscribing to %s\n", options.sub_topic);
+        return -1;
+    }
+    return 0;
+}
+
+static int start_publishers(void)
+{
+    publishers = calloc((size_t)options.connections, sizeof(publisher_t));
+    if (!publishers)
+    {
+        return -1;
+    }
+    for (int i = 0; i < options.connections; i++)
+    {
+        publisher_t *publisher = &publishers[i];
+        publisher->index       = i;
+        snprintf(publisher->topic, sizeof(publisher->topic), "%s/dev-%d", options.pub_topic, i);
+        publisher->mosq = mosquitto_new(NULL, true, publisher);
+        if (!publisher->mosq)
+        {
+            return -1;
+        }
+        mosquitto_connect_callback_set(publisher->mosq, on_pub_connect);
+        mosquitto_disconnect_callback_set(publisher->mosq, on_pub_disconnect);
+        // QoS 1/2 时不让 libmosquitto 默认的20条窗口限制发送速率, 闭环模式由 --window 控制
+        mosquitto_max_inflight_messages_set(publisher->mosq, 0);
+        if (mosquitto_connect(publisher->mosq, options.pub_host, options.pub_port, 60) != MOSQ_ERR_SUCCESS
+            || mosquitto_loop_start(publisher->mosq) != MOSQ_ERR_SUCCESS)
+        {
+            fprintf(stderr, "Failed to connect publisher %d to %s:%d\n", i, options.pub_host, options.pub_port);
+            return -1;
+        }
+    }
+    for (int i = 0; i < options.connections; i++)
+    {
+        if (wait_for(&publishers[i].connected, CONNECT_TIMEOUT_MS) != 0)
+        {
+            fprintf(stderr, "Timed out connecting publisher %d\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 转发器订阅完成之前发出的消息会丢失: 先发探测消息直到接收端收到
+static int wait_for_forwarder(void)
+{
+    char payload[256];
+    for (int waited = 0; waited < PROBE_TIMEOUT_MS; waited += 100)
+    {
+        int len = format_payload(payload, sizeof(payload), PROBE_CONNECTION, 0, now_ns());
+        mosquitto_publish(publishers[0].mosq, NULL, publishers[0].topic, len, payload, options.qos, false);
+        usleep(100000);
+        if (atomic_load(&subscriber.probe_seen))
+        {
+            return 0;
+        }
+    }
+    fprintf(stderr, "No probe message came back through the forwarder within %d ms\n", PROBE_TIMEOUT_MS);
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// 结果
+// ---------------------------------------------------------------------------
+
+static int compare_uint(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(double q)
+{
+    if (subscriber.latency_count == 0)
+    {
+        return 0;
+    }
+    long index = (long)(q * (double)(subscriber.latency_count - 1) + 0.5);
+    return subscriber.latencies[index] / 1000.0;
+}
+
+static void report(double send_seconds)
+{
+    long sent      = atomic_load(&total_sent);
+    long received  = atomic_load(&subscriber.received);
+    long errors    = 0;
+    for (int i = 0; i < options.connections; i++)
+    {
+        errors += publishers[i].publish_errors;
+    }
+    // 送达速率按开始发送到最后一条送达的时间计算
+    double receive_seconds = subscriber.last_ns > start_ns ? (subscriber.last_ns - start_ns) / 1e9 : send_seconds;
+    double sent_rate       = sent / send_seconds;
+    double delivered_rate  = received / receive_seconds;
+    long   lost            = sent > received ? sent - received : 0;
+
+    qsort(subscriber.latencies, (size_t)subscriber.latency_count, sizeof(unsigned int), compare_uint);
+
+    printf("target_rate=%ld connections=%d payload=%d qos=%d\n", options.rate, options.connections,
+           options.payload_bytes, options.qos);
+    printf("sent=%ld (%.0f msg/s) delivered=%ld (%.0f msg/s) lost=%ld (%.3f%%) reordered=%ld duplicates=%ld "
+           "publish_errors=%ld malformed=%ld\n",
+           sent, sent_rate, received, delivered_rate, lost, sent ? 100.0 * lost / sent : 0.0,
+           subscriber.reordered, subscriber.duplicates, errors, subscriber.malformed);
+    printf("latency_ms p50=%.3f p90=%.3f p99=%.3f p999=%.3f max=%.3f\n",
+           percentile_ms(0.5), percentile_ms(0.9), percentile_ms(0.99), percentile_ms(0.999), percentile_ms(1.0));
+
+    if (!options.json_file)
+    {
+        return;
+    }
+    FILE *out = strcmp(options.json_file, "-") == 0 ? stdout : fopen(options.json_file, "a");
+    if (!out)
+    {
+        perror(options.json_file);
+        return;
+    }
+    // 每次运行追加一行, 多次运行 (不同速率) 组成饱和曲线
+    fprintf(out,
+            "{\"label\": \"%s\", \"target_rate\": %ld, \"connections\": %d, \"payload_bytes\": %d, \"qos\": %d, "
+            "\"duration_s\": %.1f, \"sent\": %ld, \"sent_rate\": %.0f, \"delivered\": %ld, \"delivered_rate\": %.0f, "
+            "\"lost\": %ld, \"reordered\": %ld, \"duplicates\": %ld, \"publish_errors\": %ld, "
+            "\"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f}}\n",
+            options.label, options.rate, options.connections, options.payload_bytes, options.qos,
+            options.duration, sent, sent_rate, received, delivered_rate, lost, subscriber.reordered,
+            subscriber.duplicates, errors, percentile_ms(0.5), percentile_ms(0.9), percentile_ms(0.99),
+            percentile_ms(0.999), percentile_ms(1.0));
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+}
+
+static void print_usage(const char *program_name)
+{
+    printf("Usage: %s [OPTIONS]\n", program_name);
+    printf("  --pub-host=HOST      broker the forwarder subscribes to (default: 127.0.0.1)\n");
+    printf("  --pub-port=PORT      (default: 1883)\n");
+    printf("  --sub-host=HOST      broker the forwarder publishes to (default: 127.0.0.1)\n");
+    printf("  --sub-port=PORT      (default: 1884)\n");
+    printf("  --pub-topic=PREFIX   publish to PREFIX/dev-<i> (default: /ge/web/loadgen)\n");
+    printf("  --sub-topic=FILTER   (default: /ge/web/#)\n");
+    printf("  -c, --connections=N  publisher connections (default: 4)\n");
+    printf("  -r, --rate=R         total msg/s, 0 for closed-loop saturation (default: 10000)\n");
+    printf("  --window=N           in-flight limit for --rate=0 (default: 1000)\n");
+    printf("  -d, --duration=S     seconds to send (default: 10)\n");
+    printf("  --drain=S            seconds to wait for stragglers (default: 2)\n");
+    printf("  -s, --payload=BYTES  (default: 256)\n");
+    printf("  -q, --qos=0|1|2      (default: 0)\n");
+    printf("  -j, --json=FILE      append one JSON line per run (\"-\" for stdout)\n");
+    printf("  --label=TEXT         label stored in the JSON line\n");
+}
+
+static int parse_arguments(int argc, char *argv[])
+{
+    enum
+    {
+        OPT_PUB_HOST = 256,
+        OPT_PUB_PORT,
+        OPT_SUB_HOST,
+        OPT_SUB_PORT,
+        OPT_PUB_TOPIC,
+        OPT_SUB_TOPIC,
+        OPT_WINDOW,
+        OPT_DRAIN,
+        OPT_LABEL
+    };
+    static struct option long_options[] = {
+        {"pub-host", required_argument, 0, OPT_PUB_HOST},
+        {"pub-port", required_argument, 0, OPT_PUB_PORT},
+        {"sub-host", required_argument, 0, OPT_SUB_HOST},
+        {"sub-port", required_argument, 0, OPT_SUB_PORT},
+        {"pub-topic", required_argument, 0, OPT_PUB_TOPIC},
+        {"sub-topic", required_argument, 0, OPT_SUB_TOPIC},
+        {"connections", required_argument, 0, 'c'},
+        {"rate", required_argument, 0, 'r'},
+        {"window", required_argument, 0, OPT_WINDOW},
+        {"duration", required_argument, 0, 'd'},
+        {"drain", required_argument, 0, OPT_DRAIN},
+        {"payload", required_argument, 0, 's'},
+        {"qos", required_argument, 0, 'q'},
+        {"json", required_argument, 0, 'j'},
+        {"label", required_argument, 0, OPT_LABEL},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+
+    options = (options_t){.pub_host      = "127.0.0.1",
+                          .pub_port      = 1883,
+                          .sub_host      = "127.0.0.1",
+                          .sub_port      = 1884,
+                          .pub_topic     = "/ge/web/loadgen",
+                          .sub_topic     = "/ge/web/#",
+                          .connections   = 4,
+                          .rate          = 10000,
+                          .window        = 1000,
+                          .duration      = 10,
+                          .drain         = 2,
+                          .payload_bytes = 256,
+                          .qos           = 0,
+                          .label         = ""};
+
+    int c;
+    while ((c = getopt_long(argc, argv, "c:r:d:s:q:j:h", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case OPT_PUB_HOST:
+            options.pub_host = optarg;
+            break;
+        case OPT_PUB_PORT:
+            options.pub_port = atoi(optarg);
+            break;
+        case OPT_SUB_HOST:
+            options.sub_host = optarg;
+            break;
+        case OPT_SUB_PORT:
+            options.sub_port = atoi(optarg);
+            break;
+        case OPT_PUB_TOPIC:
+            options.pub_topic = optarg;
+            break;
+        case OPT_SUB_TOPIC:
+            options.sub_topic = optarg;
+            break;
+        case 'c':
+            options.connections = atoi(optarg);
+            break;
+        case 'r':
+            options.rate = atol(optarg);
+            break;
+        case OPT_WINDOW:
+            options.window = atol(optarg);
+            break;
+        case 'd':
+            options.duration = atof(optarg);
+            break;
+        case OPT_DRAIN:
+            options.drain = atof(optarg);
+            break;
+        case 's':
+            options.payload_bytes = atoi(optarg);
+            break;
+        case 'q':
+            options.qos = atoi(optarg);
+            break;
+        case 'j':
+            options.json_file = optarg;
+            break;
+        case OPT_LABEL:
+            options.label = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(0);
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (options.connections < 1 || options.rate < 0 || options.window < 1 || options.duration <= 0
+        || options.drain < 0 || options.qos < 0 || options.qos > 2)
+    {
+        print_usage(argv[0]);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (parse_arguments(argc, argv) != 0)
+    {
+        return 1;
+    }
+
+    mosquitto_lib_init();
+    int ret = 1;
+    if (start_subscriber() != 0 || start_publishers() != 0 || wait_for_forwarder() != 0)
+    {
+        goto cleanup;
+    }
+    usleep(200000);   // 让迟到的探测消息先到达
+
+    start_ns = now_ns();
+    for (int i = 0; i < options.connections; i++)
+    {
+        pthread_create(&publishers[i].thread, NULL, publisher_main, &publishers[i]);
+    }
+    for (int i = 0; i < options.connections; i++)
+    {
+        pthread_join(publishers[i].thread, NULL);
+    }
+    double send_seconds = (now_ns() - start_ns) / 1e9;
+
+    // 等待在途消息送达, 全部到达后提前结束
+    long long drain_end = now_ns() + (long long)(options.drain * 1e9);
+    while (now_ns() < drain_end && atomic_load(&subscriber.received) < atomic_load(&total_sent))
+    {
+        usleep(10000);
+    }
+    atomic_store(&stop_sending, true);
+
+    mosquitto_loop_stop(subscriber.mosq, true);
+    report(send_seconds);
+    ret = 0;
+
+cleanup:
+    atomic_store(&stop_sending, true);
+    for (int i = 0; publishers && i < options.connections; i++)
+    {
+        if (publishers[i].mosq)
+        {
+            mosquitto_disconnect(publishers[i].mosq);
+            mosquitto_loop_stop(publishers[i].mosq, true);
+            mosquitto_destroy(publishers[i].mosq);
+        }
+    }
+    if (subscriber.mosq)
+    {
+        mosquitto_loop_stop(subscriber.mosq, true);
+        mosquitto_destroy(subscriber.mosq);
+    }
+    free(publishers);
+    free(subscriber.next_seq);
+    free(subscriber.latencies);
+    mosquitto_lib_cleanup();
+    return ret;
+}
@@ -0,0 +1,353 @@
+#include "command_convert.h"
+
+#include <cjson/cJSON.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// 快速扫描的中间结果
+typedef struct
+{
+    int data_seen;        // 已遇到第一个 "data" 键 (cJSON_GetObjectItem 取第一个匹配)
+    int data_is_array;
+    int data_has_item;
+    int name_seen;
+    int name_is_string;
+    int value_seen;
+    int value_is_string;
+    int value_truncated;
+} command_fields_t;
+
+// 键比较规则与 cJSON_GetObjectItem 相同: ASCII 大小写不敏感
+static int key_is(const char *key, int truncated, const char *name)
+{
+    return !truncated && strcasecmp(key, name) == 0;
+}
+
+// p 位于'{'或','之后: 读取键 (只保留短前缀用于比较) 并跳过':', 返回值的起始位置
+static const char *read_key(const char *p, const char *end, char *key, size_t cap, int *truncated)
+{
+    p = json_unescape(json_skip_ws(p, end), end, key, cap, truncated);
+    if (!p)
+    {
+        return NULL;
+    }
+    p = json_skip_ws(p, end);
+    if (p >= end || *p != ':')
+    {
+        return NULL;
+    }
+    return json_skip_ws(p + 1, end);
+}
+
+// 成员/元素之后: 遇到 close 置 *done, 遇到','继续; p 为NULL (前一个值有语法错误) 时原样返回
+static const char *next_member(const char *p, const char *end, char close, int *done)
+{
+    if (!p)
+    {
+        return NULL;
+    }
+    p = json_skip_ws(p, end);
+    if (p >= end)
+    {
+        return NULL;
+    }
+    if (*p == close)
+    {
+        *done = 1;
+        return p + 1;
+    }
+    return *p == ',' ? p + 1 : NULL;
+}
+
+// 容器起始符之后: 空容器时置 *done
+static const char *open_container(const char *p, const char *end, char close, int *done)
+{
+    p = json_skip_ws(p + 1, end);
+    if (p < end && *p == close)
+    {
+        *done = 1;
+        return p + 1;
+    }
+    return p;
+}
+
+// 扫描 data[0] 对象, 反转义第一个 name 和 value
+static const char *scan_item(const char       *p,
+                             const char       *end,
+                             command_fields_t *fields,
+                             command_output_t *output,
+                             char             *value)
+{
+    int done = 0;
+    for (p = open_container(p, end, '}', &done); p && !done; p = next_member(p, end, '}', &done))
+    {
+        char key[8];
+        int  truncated;
+        int  ignored;
+
+        p = read_key(p, end, key, sizeof(key), &truncated);
+        if (!p || p >= end)
+        {
+            return NULL;
+        }
+        if (!fields->name_seen && key_is(key, truncated, "name"))
+        {
+            fields->name_seen      = 1;
+            fields->name_is_string = *p == '"';
+            p = fields->name_is_string
+                    ? json_unescape(p, end, output->name, sizeof(output->name), &ignored)
+                    : json_skip_value(p, end);
+        }
+        else if (!fields->value_seen && key_is(key, truncated, "value"))
+        {
+            fields->value_seen      = 1;
+            fields->value_is_string = *p == '"';
+            p = fields->value_is_string
+                    ? json_unescape(p, end, value, COMMAND_VALUE_MAX, &fields->value_truncated)
+                    : json_skip_value(p, end);
+        }
+        else
+        {
+            p = json_skip_value(p, end);
+        }
+    }
+    return p;
+}
+
+// 扫描 data 的值, 只深入第一个元素
+static const char *scan_data(const char       *p,
+                             const char       *end,
+                             command_fields_t *fields,
+                             command_output_t *output,
+                             char             *value)
+{
+    if (*p != '[')
+    {
+        return json_skip_value(p, end);
+    }
+    fields->data_is_array = 1;
+
+    int done = 0;
+    p        = open_container(p, end, ']', &done);
+    if (done)
+    {
+        return p;
+    }
+    if (p >= end)
+    {
+        return NULL;
+    }
+    fields->data_has_item = 1;
+    p = *p == '{' ? scan_item(p, end, fields, output, value) : json_skip_value(p, end);
+
+    while (p)
+    {
+        p = next_member(p, end, ']', &done);
+        if (!p || done)
+        {
+            break;
+        }
+        p = json_skip_value(p, end);
+    }
+    return p;
+}
+
+// 严格语法检查整个负载的第一个JSON值并提取字段, 返回0成功, -1表示需要退回 cJSON 路径。
+// 与 cJSON_ParseWithLength 一样忽略值之后的内容。
+static int scan_command(const char *payload, int payloadlen, command_fields_t *fields,
+                        command_output_t *output, char *value)
+{
+    const char *end = payload + payloadlen;
+    const char *p   = json_skip_ws(payload, end);
+
+    if (p >= end || *p != '{')
+    {
+        // 顶层不是对象时找不到 data
+        return json_skip_value(p, end) ? 0 : -1;
+    }
+
+    int done = 0;
+    for (p = open_container(p, end, '}', &done); p && !done; p = next_member(p, end, '}', &done))
+    {
+        char key[8];
+        int  truncated;
+
+        p = read_key(p, end, key, sizeof(key), &truncated);
+        if (!p || p >= end)
+        {
+            return -1;
+        }
+        if (!fields->data_seen && key_is(key, truncated, "data"))
+        {
+            fields->data_seen = 1;
+            p = scan_data(p, end, fields, output, value);
+        }
+        else
+        {
+            p = json_skip_value(p, end);
+        }
+    }
+    return p ? 0 : -1;
+}
+
+static int count_dots(const char *name)
+{
+    int dot_count = 0;
+    for (const char *p = name; *p; p++)
+    {
+        if (*p == '.')
+            dot_count++;
+    }
+    return dot_count;
+}
+
+// 把 name 拆成 rt (前三段, '.'替换为'|') 和 key (最后一段), 原地修改
+static const char *split_name(char *name)
+{
+    char *last_dot = strrchr(name, '.');
+    *last_dot      = '\0';
+
+    for (char *p = name; *p; p++)
+    {
+        if (*p == '.')
+            *p = '|';
+    }
+    return last_dot + 1;
+}
+
+static char *append(char *p, const char *text)
+{
+    size_t len = strlen(text);
+    memcpy(p, text, len);
+    return p + len;
+}
+
+command_convert_status_t command_convert_cjson(const void       *payload,
+                                               int               payloadlen,
+                                               command_output_t *output)
+{
+    output->data      = NULL;
+    output->len       = 0;
+    output->allocated = NULL;
+
+    cJSON *input_json = cJSON_ParseWithLength((const char *)payload, payloadlen);
+    if (!input_json)
+    {
+        return COMMAND_CONVERT_PARSE_ERROR;
+    }
+
+    command_convert_status_t status      = COMMAND_CONVERT_OK;
+    cJSON                   *output_json = NULL;
+
+    cJSON *data_array = cJSON_GetObjectItem(input_json, "data");
+    if (!cJSON_IsArray(data_array) || cJSON_GetArraySize(data_array) == 0)
+    {
+        status = COMMAND_CONVERT_INVALID_DATA;
+        goto cleanup;
+    }
+
+    cJSON      *data_item = cJSON_GetArrayItem(data_array, 0);
+    const char *name      = cJSON_GetStringValue(cJSON_GetObjectItem(data_item, "name"));
+    const char *value     = cJSON_GetStringValue(cJSON_GetObjectItem(data_item, "value"));
+
+    if (!name || !value)
+    {
+        status = COMMAND_CONVERT_MISSING_FIELD;
+        goto cleanup;
+    }
+
+    snprintf(output->name, sizeof(output->name), "%s", name);
+
+    output->dot_count = count_dots(output->name);
+    if (output->dot_count != 3)
+    {
+        status = COMMAND_CONVERT_BAD_NAME;
+        goto cleanup;
+    }
+
+    const char *key = split_name(output->name);
+
+    output_json        = cJSON_CreateObject();
+    cJSON *body_obj    = cJSON_CreateObject();
+    cJSON *dl_obj      = cJSON_CreateObject();
+    cJSON *header_obj  = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(dl_obj, key, value);
+    cJSON_AddItemToObject(body_obj, "dl", dl_obj);
+    cJSON_AddItemToObject(output_json, "b", body_obj);
+
+    cJSON_AddStringToObject(header_obj, "rt", output->name);
+    cJSON_AddItemToObject(output_json, "h", header_obj);
+
+    output->allocated = cJSON_PrintUnformatted(output_json);
+    if (!output->allocated)
+    {
+        status = COMMAND_CONVERT_SERIALIZE_ERROR;
+        goto cleanup;
+    }
+    output->data = output->allocated;
+    output->len  = strlen(output->allocated);
+
+cleanup:
+    if (output_json)
+        cJSON_Delete(output_json);
+    cJSON_Delete(input_json);
+    return status;
+}
+
+command_convert_status_t command_convert(const void *payload, int payloadlen, command_output_t *output)
+{
+    command_fields_t fields = {0};
+    char             value[COMMAND_VALUE_MAX];
+
+    output->data      = NULL;
+    output->len       = 0;
+    output->allocated = NULL;
+
+    if (scan_command((const char *)payload, payloadlen, &fields, output, value) != 0)
+    {
+        return command_convert_cjson(payload, payloadlen, output);
+    }
+    if (!fields.data_is_array || !fields.data_has_item)
+    {
+        return COMMAND_CONVERT_INVALID_DATA;
+    }
+    if (!fields.name_is_string || !fields.value_is_string)
+    {
+        return COMMAND_CONVERT_MISSING_FIELD;
+    }
+    if (fields.value_truncated)
+    {
+        return command_convert_cjson(payload, payloadlen, output);
+    }
+
+    output->dot_count = count_dots(output->name);
+    if (output->dot_count != 3)
+    {
+        return COMMAND_CONVERT_BAD_NAME;
+    }
+
+    const char *key = split_name(output->name);
+    char       *p   = output->buffer;
+
+    p = append(p, "{\"b\":{\"dl\":{\"");
+    p += json_escape(p, key, strlen(key));
+    p = append(p, "\":\"");
+    p += json_escape(p, value, strlen(value));
+    p = append(p, "\"}},\"h\":{\"rt\":\"");
+    p += json_escape(p, output->name, strlen(output->name));
+    p = append(p, "\"}}");
+    *p = '\0';
+
+    output->data = output->buffer;
+    output->len  = (size_t)(p - output->buffer);
+    return COMMAND_CONVERT_OK;
+}
+
+void command_output_release(command_output_t *output)
+{
+    cJSON_free(output->allocated);
+    output->allocated = NULL;
+}
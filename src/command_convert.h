@@ -0,0 +1,51 @@
+#ifndef COMMAND_CONVERT_H
+#define COMMAND_CONVERT_H
+
+#include <stddef.h>
+
+#include "json_scan.h"
+
+// 指令名 "a.b.c.key" 的最大长度 (含结尾'\0'), 超出部分被截断
+#define COMMAND_NAME_MAX 256
+// 快速路径可处理的最大指令值长度 (含结尾'\0'), 更长的值退回 cJSON 路径
+#define COMMAND_VALUE_MAX 1024
+// {"b":{"dl":{key:value}},"h":{"rt":...}}: key 和 rt 来自同一个指令名
+#define COMMAND_OUTPUT_MAX (64 + 6 * (COMMAND_NAME_MAX - 1) + 6 * (COMMAND_VALUE_MAX - 1))
+
+// 指令转换结果
+typedef enum
+{
+    COMMAND_CONVERT_OK = 0,
+    COMMAND_CONVERT_PARSE_ERROR,       // 负载不是合法JSON
+    COMMAND_CONVERT_INVALID_DATA,      // data 不是非空数组
+    COMMAND_CONVERT_MISSING_FIELD,     // data[0] 缺少字符串类型的 name 或 value
+    COMMAND_CONVERT_BAD_NAME,          // name 不是恰好包含3个点
+    COMMAND_CONVERT_SERIALIZE_ERROR
+} command_convert_status_t;
+
+// 转换输出, 通常放在调用方栈上
+typedef struct
+{
+    const char *data;        // 输出JSON, 指向 buffer 或 allocated
+    size_t      len;
+    char       *allocated;   // 退回 cJSON 路径时 cJSON 分配的缓冲区
+    int         dot_count;   // COMMAND_CONVERT_BAD_NAME 时有效
+    char        name[COMMAND_NAME_MAX];   // 错误信息中使用的指令名
+    char        buffer[COMMAND_OUTPUT_MAX];
+} command_output_t;
+
+// 将上游指令 {"data":[{"name":"a.b.c.key","value":...}]} 转换为
+// {"b":{"dl":{"key":value}},"h":{"rt":"a|b|c"}}。
+// 单次扫描负载, 只反转义 data[0] 的 name/value, 其余部分仅做语法检查;
+// 遇到严格语法之外的输入 (cJSON 的宽松写法、超长值) 时退回 cJSON 路径,
+// 因此结果和错误分支与原实现一致。
+command_convert_status_t command_convert(const void *payload, int payloadlen, command_output_t *output);
+
+// 原有的 cJSON 解析-转换-序列化实现
+command_convert_status_t command_convert_cjson(const void       *payload,
+                                               int               payloadlen,
+                                               command_output_t *output);
+
+void command_output_release(command_output_t *output);
+
+#endif
@@ -4,9 +4,110 @@
 #include <stdlib.h>
 
 // 系统限制
-#define MAX_CLIENTS 10
-#define MAX_FORWARD_RULES 20
 #define MAX_MESSAGE_SIZE 1048576
 #define RECONNECT_DELAY 5
 
+// QoS 1/2 发布窗口 (客户端配置 max_inflight): libmosquitto 默认只有20, 高延迟链路上会限制吞吐
+#define MQTT_DEFAULT_MAX_INFLIGHT 1000
+#define MQTT_MAX_INFLIGHT 65535          // 报文标识符只有16位
+
+// 发布连接池 (客户端配置 connections > 1): 按主题哈希把发往该客户端的消息分到多个连接
+#define PUBLISH_MAX_CONNECTIONS 16
+
+// MQTT v5 (客户端配置 protocol = "mqttv5")
+#define TOPIC_ALIAS_DEFAULT_MAX 1024     // 每个连接的出站主题别名数, 实际取与 Broker 上限的较小者
+#define TOPIC_ALIAS_MAX 65535
+#define TOPIC_ALIAS_MIN_TOPIC 8          // 更短的主题不使用别名 (别名属性本身占3字节)
+#define TOPIC_ALIAS_WINDOW 1024          // 统计命中率的查找次数窗口
+#define TOPIC_ALIAS_THRASH_ADMIT 16      // 表满且命中率低时每16个未命中的主题替换一个别名
+#define MESSAGE_PROPS_MAX_USER 32        // 每条消息转发的用户属性上限, 超出的丢弃
+
+// 规则索引精确主题缓存 (每个源客户端)
+#define TOPIC_CACHE_SIZE 2048       // 必须为2的幂
+#define TOPIC_CACHE_KEY_MAX 128     // 超过此长度的主题不进缓存
+#define TOPIC_CACHE_MAX_VALUES 4    // 匹配规则数超过此值的结果不进缓存
+
+// 消息处理临时内存: 每个处理线程一块, cJSON 的分配在其中顺序切分, 每条消息处理完后复位
+#define SCRATCH_ARENA_INITIAL_BYTES (64 * 1024)
+#define SCRATCH_ARENA_MAX_BYTES (4 * 1024 * 1024)   // 更大的消息超出部分直接 malloc
+
+// 目标主题改写: 源主题中通配符所在层级的上限
+#define TOPIC_REWRITE_MAX_LEVELS 32
+
+// 异步日志
+#define LOG_RING_SIZE 256           // 每线程缓冲条数, 必须为2的幂
+#define LOG_MESSAGE_MAX 512         // 单条日志正文最大长度, 超出截断
+#define LOG_FLUSH_INTERVAL_MS 10    // 写线程空闲轮询间隔
+
+// 离线队列默认值 (可在客户端配置的 queue 字段中覆盖)
+#define QUEUE_DEFAULT_MAX_MESSAGES 10000
+#define QUEUE_DEFAULT_MAX_BYTES (16 * 1024 * 1024)
+#define QUEUE_DEFAULT_REPLAY_RATE 10000  // 条/秒, 应高于正常消息速率
+
+// 磁盘溢出日志默认值 (客户端配置 spill.dir 非空时启用)
+#define SPILL_DEFAULT_SEGMENT_BYTES (16 * 1024 * 1024)
+#define SPILL_DEFAULT_MAX_SEGMENTS 64
+#define SPILL_DEFAULT_FSYNC_EVERY 256
+#define SPILL_DEFAULT_FSYNC_INTERVAL_MS 1000
+#define SPILL_MIN_SEGMENT_BYTES (MAX_MESSAGE_SIZE + 4096)  // 至少容纳一条最大消息
+
+// 消息处理线程池 (客户端配置 workers > 0 时启用, 0 表示在网络线程上直接处理)
+#define WORKER_MAX_THREADS 32
+#define WORKER_DEFAULT_QUEUE_DEPTH 1024  // 每个工作线程的队列深度, 向上取整为2的幂
+#define WORKER_SPIN_ROUNDS 64            // 空闲/队列满时让出CPU的轮数, 之后休眠
+#define WORKER_IDLE_WAIT_MS 100          // 空闲线程的最长等待时间
+#define WORKER_BACKOFF_US 50             // 队列满时提交方的休眠间隔
+
+// 优先级通道 (规则配置 priority, 客户端配置 scheduling): 工作线程队列和离线队列按通道分开
+#define PRIORITY_LANES 3                 // high, normal, low
+#define LANE_DEFAULT_WEIGHT_HIGH 8       // 加权调度时各通道每轮可处理的条数
+#define LANE_DEFAULT_WEIGHT_NORMAL 2
+#define LANE_DEFAULT_WEIGHT_LOW 1
+#define LANE_MAX_WEIGHT 1000
+
+// 运行指标
+#define METRICS_BLOCK_SERIES 16          // 线程分片按块分配, 每块容纳的指标对象数
+#define METRICS_MAX_BLOCKS 1024          // 指标对象上限为 METRICS_BLOCK_SERIES * METRICS_MAX_BLOCKS
+#define METRICS_HISTOGRAM_SUB_BITS 3     // 每个2的幂区间细分为8档, 相对误差不超过12.5%
+#define METRICS_HISTOGRAM_MAX_BITS 36    // 可记录的最大延迟约68秒 (纳秒)
+#define METRICS_EXPORT_POLL_MS 200       // 导出线程检查 SIGUSR1 请求的间隔
+#define METRICS_HTTP_TIMEOUT_MS 1000     // 读取 HTTP 请求的超时
+
+// 事件批量发布默认值 (规则配置 batch 字段时启用)
+#define BATCH_DEFAULT_MAX_MESSAGES 100
+#define BATCH_DEFAULT_MAX_BYTES (256 * 1024)
+#define BATCH_DEFAULT_MAX_DELAY_MS 50
+#define BATCH_MAX_DELAY_MS 60000
+#define BATCH_MAX_TOPICS 1024       // 每条规则同时合并的目标主题数上限, 超出时先发出全部批; 必须为2的幂
+
+// 最新值合并默认值 (规则配置 conflate 字段时启用)
+#define CONFLATE_DEFAULT_INTERVAL_MS 1000
+#define CONFLATE_DEFAULT_MAX_KEYS 10000
+#define CONFLATE_DEFAULT_MAX_BYTES (16 * 1024 * 1024)
+#define CONFLATE_MAX_INTERVAL_MS 3600000
+#define CONFLATE_MAX_KEYS 1000000
+
+// 限速默认值 (规则配置 rate_limit 字段时启用)
+#define RATE_LIMIT_DEFAULT_MAX_DEVICES 4096
+#define RATE_LIMIT_MAX_DEVICES (1 << 20)
+#define RATE_LIMIT_DEFAULT_MAX_DELAY_MS 1000
+#define RATE_LIMIT_MAX_DELAY_MS 60000
+#define RATE_LIMIT_DEFAULT_SAMPLE_EVERY 10
+#define RATE_LIMIT_MAX_DELAYED 65536     // 每条规则等待发出的延迟消息上限, 超出时丢弃
+#define RATE_LIMIT_PROBES 8              // 设备令牌桶表的最大探测长度
+
+// 主循环周期, 用于重放等定时任务
+#define ENGINE_TICK_MS 10
+
+// epoll 引擎模式 (engine.mode = "epoll")
+#define ENGINE_MAX_LOOPS 16
+#define EVENT_LOOP_MAX_EVENTS 64
+#define EVENT_LOOP_READ_BATCH 64    // 每个连接每轮最多处理的入站报文数, 保证各连接公平
+
+// 配置热加载
+#define RCU_SYNC_POLL_US 100             // 等待读者退出临界区的轮询间隔
+#define WORKER_DRAIN_POLL_US 200         // 等待工作线程处理完已提交任务的轮询间隔
+#define CONFIG_WATCH_POLL_MS 200         // 监视线程检查 SIGHUP 请求和文件变化的间隔
+#define CONFIG_RELOAD_DEBOUNCE_MS 500    // 配置文件最后一次变化后等待多久再加载
+
 #endif
@@ -1,5 +1,7 @@
 #include "config_json.h"
+#include "config.h"
 #include "logger.h"
+#include "topic_rewrite.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,6 +46,14 @@ static int get_int_value(cJSON *json, const char *key, int default_value) {
     return default_value;
 }
 
+static double get_double_value(cJSON *json, const char *key, double default_value) {
+    cJSON *item = cJSON_GetObjectItem(json, key);
+    if (item && cJSON_IsNumber(item)) {
+        return item->valuedouble;
+    }
+    return default_value;
+}
+
 static int get_bool_value(cJSON *json, const char *key, int default_value) {
     cJSON *item = cJSON_GetObjectItem(json, key);
     if (item && cJSON_IsBool(item)) {
@@ -69,6 +79,212 @@ static int parse_mqtt_config(cJSON *mqtt_json, mqtt_config_t *mqtt_config) {
     return 0;
 }
 
+static int parse_queue_config(cJSON *queue_json, queue_config_t *queue) {
+    queue->max_messages = get_int_value(queue_json, "max_messages", QUEUE_DEFAULT_MAX_MESSAGES);
+    queue->max_bytes = get_int_value(queue_json, "max_bytes", QUEUE_DEFAULT_MAX_BYTES);
+    queue->replay_rate = get_int_value(queue_json, "replay_rate", QUEUE_DEFAULT_REPLAY_RATE);
+    queue->policy = QUEUE_DROP_OLDEST;
+
+    char *policy = get_string_value(queue_json, "policy", NULL);
+    if (policy) {
+        if (strcmp(policy, "drop_newest") == 0) {
+            queue->policy = QUEUE_DROP_NEWEST;
+        } else if (strcmp(policy, "drop_oldest") != 0) {
+            LOG_ERROR("Invalid queue policy: %s (must be drop_oldest or drop_newest)", policy);
+            free(policy);
+            return -1;
+        }
+        free(policy);
+    }
+    return 0;
+}
+
+static int parse_engine_config(cJSON *engine_json, engine_config_t *engine) {
+    engine->mode = ENGINE_MODE_THREADED;
+    engine->loops = get_int_value(engine_json, "loops", 1);
+
+    char *mode = get_string_value(engine_json, "mode", NULL);
+    if (mode) {
+        if (strcmp(mode, "epoll") == 0) {
+            engine->mode = ENGINE_MODE_EPOLL;
+        } else if (strcmp(mode, "threaded") != 0) {
+            LOG_ERROR("Invalid engine mode: %s (must be threaded or epoll)", mode);
+            free(mode);
+            return -1;
+        }
+        free(mode);
+    }
+    return 0;
+}
+
+static void parse_metrics_config(cJSON *metrics_json, metrics_config_t *metrics) {
+    memset(metrics, 0, sizeof(metrics_config_t));
+    char *listen = get_string_value(metrics_json, "listen", NULL);
+    if (listen) {
+        strncpy(metrics->listen, listen, sizeof(metrics->listen) - 1);
+        free(listen);
+    }
+    metrics->profile_sample = get_int_value(metrics_json, "profile_sample", 0);
+}
+
+static void parse_spill_config(cJSON *spill_json, spill_config_t *spill) {
+    memset(spill, 0, sizeof(spill_config_t));
+    char *dir = get_string_value(spill_json, "dir", NULL);
+    if (dir) {
+        strncpy(spill->dir, dir, sizeof(spill->dir) - 1);
+        free(dir);
+    }
+    spill->segment_bytes = get_int_value(spill_json, "segment_bytes", SPILL_DEFAULT_SEGMENT_BYTES);
+    spill->max_segments = get_int_value(spill_json, "max_segments", SPILL_DEFAULT_MAX_SEGMENTS);
+    spill->fsync_every = get_int_value(spill_json, "fsync_every", SPILL_DEFAULT_FSYNC_EVERY);
+    spill->fsync_interval_ms = get_int_value(spill_json, "fsync_interval_ms", SPILL_DEFAULT_FSYNC_INTERVAL_MS);
+}
+
+static int parse_batch_config(cJSON *batch_json, const char *rule_name, batch_config_t *batch) {
+    memset(batch, 0, sizeof(batch_config_t));
+    if (!batch_json || cJSON_IsNull(batch_json)) {
+        return 0;
+    }
+    if (!cJSON_IsObject(batch_json)) {
+        LOG_ERROR("Rule '%s' batch must be an object", rule_name);
+        return -1;
+    }
+    batch->enabled = 1;
+    batch->max_messages = get_int_value(batch_json, "max_messages", BATCH_DEFAULT_MAX_MESSAGES);
+    batch->max_bytes = get_int_value(batch_json, "max_bytes", BATCH_DEFAULT_MAX_BYTES);
+    batch->max_delay_ms = get_int_value(batch_json, "max_delay_ms", BATCH_DEFAULT_MAX_DELAY_MS);
+    return 0;
+}
+
+static int parse_conflate_config(cJSON *conflate_json, const char *rule_name, conflate_config_t *conflate) {
+    memset(conflate, 0, sizeof(conflate_config_t));
+    if (!conflate_json || cJSON_IsNull(conflate_json)) {
+        return 0;
+    }
+    if (!cJSON_IsObject(conflate_json)) {
+        LOG_ERROR("Rule '%s' conflate must be an object", rule_name);
+        return -1;
+    }
+    conflate->enabled = 1;
+    conflate->interval_ms = get_int_value(conflate_json, "interval_ms", CONFLATE_DEFAULT_INTERVAL_MS);
+    conflate->max_keys = get_int_value(conflate_json, "max_keys", CONFLATE_DEFAULT_MAX_KEYS);
+    conflate->max_bytes = get_int_value(conflate_json, "max_bytes", CONFLATE_DEFAULT_MAX_BYTES);
+    return 0;
+}
+
+// 令牌桶容量默认为一秒的速率, 至少为1
+static int default_burst(double rate) {
+    int burst = (int)rate;
+    if (burst < rate) {
+        burst++;
+    }
+    return burst > 0 ? burst : 1;
+}
+
+static int parse_rate_limit_config(cJSON *rate_json, const char *rule_name, rate_limit_config_t *rate_limit) {
+    memset(rate_limit, 0, sizeof(rate_limit_config_t));
+    if (!rate_json || cJSON_IsNull(rate_json)) {
+        return 0;
+    }
+    if (!cJSON_IsObject(rate_json)) {
+        LOG_ERROR("Rule '%s' rate_limit must be an object", rule_name);
+        return -1;
+    }
+    rate_limit->enabled = 1;
+    rate_limit->rate = get_double_value(rate_json, "rate", 0);
+    rate_limit->burst = get_int_value(rate_json, "burst", default_burst(rate_limit->rate));
+    rate_limit->device_rate = get_double_value(rate_json, "device_rate", 0);
+    rate_limit->device_burst = get_int_value(rate_json, "device_burst", default_burst(rate_limit->device_rate));
+    rate_limit->max_devices = get_int_value(rate_json, "max_devices", RATE_LIMIT_DEFAULT_MAX_DEVICES);
+    rate_limit->max_delay_ms = get_int_value(rate_json, "max_delay_ms", RATE_LIMIT_DEFAULT_MAX_DELAY_MS);
+    rate_limit->sample_every = get_int_value(rate_json, "sample_every", RATE_LIMIT_DEFAULT_SAMPLE_EVERY);
+    rate_limit->policy = RATE_SHED_DROP;
+
+    char *policy = get_string_value(rate_json, "policy", NULL);
+    if (policy) {
+        int ret = 0;
+        if (strcmp(policy, "delay") == 0) {
+            rate_limit->policy = RATE_SHED_DELAY;
+        } else if (strcmp(policy, "sample") == 0) {
+            rate_limit->policy = RATE_SHED_SAMPLE;
+        } else if (strcmp(policy, "drop") != 0) {
+            LOG_ERROR("Invalid rate_limit policy for rule '%s': %s (must be drop, delay or sample)", rule_name, policy);
+            ret = -1;
+        }
+        free(policy);
+        return ret;
+    }
+    return 0;
+}
+
+static int parse_schedule_config(cJSON *schedule_json, const char *client_name, schedule_config_t *schedule) {
+    schedule->mode = SCHEDULE_STRICT;
+    schedule->weights[PRIORITY_HIGH] = LANE_DEFAULT_WEIGHT_HIGH;
+    schedule->weights[PRIORITY_NORMAL] = LANE_DEFAULT_WEIGHT_NORMAL;
+    schedule->weights[PRIORITY_LOW] = LANE_DEFAULT_WEIGHT_LOW;
+    if (!schedule_json || cJSON_IsNull(schedule_json)) {
+        return 0;
+    }
+    if (!cJSON_IsObject(schedule_json)) {
+        LOG_ERROR("Client '%s' scheduling must be an object", client_name);
+        return -1;
+    }
+
+    char *mode = get_string_value(schedule_json, "mode", NULL);
+    if (mode) {
+        if (strcmp(mode, "weighted") == 0) {
+            schedule->mode = SCHEDULE_WEIGHTED;
+        } else if (strcmp(mode, "strict") != 0) {
+            LOG_ERROR("Invalid scheduling mode for client '%s': %s (must be strict or weighted)", client_name, mode);
+            free(mode);
+            return -1;
+        }
+        free(mode);
+    }
+
+    cJSON *weights_json = cJSON_GetObjectItem(schedule_json, "weights");
+    schedule->weights[PRIORITY_HIGH] = get_int_value(weights_json, "high", schedule->weights[PRIORITY_HIGH]);
+    schedule->weights[PRIORITY_NORMAL] = get_int_value(weights_json, "normal", schedule->weights[PRIORITY_NORMAL]);
+    schedule->weights[PRIORITY_LOW] = get_int_value(weights_json, "low", schedule->weights[PRIORITY_LOW]);
+    return 0;
+}
+
+static int parse_priority(cJSON *rule_json, const char *rule_name, priority_t *priority) {
+    *priority = PRIORITY_NORMAL;
+    char *value = get_string_value(rule_json, "priority", NULL);
+    if (!value) {
+        return 0;
+    }
+    int ret = 0;
+    if (strcmp(value, "high") == 0) {
+        *priority = PRIORITY_HIGH;
+    } else if (strcmp(value, "low") == 0) {
+        *priority = PRIORITY_LOW;
+    } else if (strcmp(value, "normal") != 0) {
+        LOG_ERROR("Invalid priority for rule '%s': %s (must be high, normal or low)", rule_name, value);
+        ret = -1;
+    }
+    free(value);
+    return ret;
+}
+
+static int parse_protocol(cJSON *client_json, const char *client_name, protocol_t *protocol) {
+    *protocol = PROTOCOL_MQTT311;
+    char *value = get_string_value(client_json, "protocol", NULL);
+    if (!value) {
+        return 0;
+    }
+    int ret = 0;
+    if (strcmp(value, "mqttv5") == 0) {
+        *protocol = PROTOCOL_MQTT5;
+    } else if (strcmp(value, "mqttv311") != 0) {
+        LOG_ERROR("Invalid protocol for client '%s': %s (must be mqttv311 or mqttv5)", client_name, value);
+        ret = -1;
+    }
+    free(value);
+    return ret;
+}
+
 static int parse_clients_config(cJSON *clients_json, config_t *config) {
     if (!clients_json || !cJSON_IsArray(clients_json)) {
         LOG_ERROR("clients must be an array");
@@ -76,7 +292,7 @@ static int parse_clients_config(cJSON *clients_json, config_t *config) {
     }
 
     config->client_count = cJSON_GetArraySize(clients_json);
-    config->clients = malloc(sizeof(client_config_t) * config->client_count);
+    config->clients = calloc(config->client_count, sizeof(client_config_t));
 
     for (int i = 0; i < config->client_count; i++) {
         cJSON *client_json = cJSON_GetArrayItem(clients_json, i);
@@ -105,10 +321,35 @@ static int parse_clients_config(cJSON *clients_json, config_t *config) {
             snprintf(client->client_id, sizeof(client->client_id), "mqtt_forwarder_%s", uuid_suffix);
         }
         client->port = get_int_value(client_json, "port", config->mqtt.port);
+        client->qos = get_int_value(client_json, "qos", config->mqtt.qos);
+        client->max_inflight = get_int_value(client_json, "max_inflight", MQTT_DEFAULT_MAX_INFLIGHT);
+        client->topic_alias_max = get_int_value(client_json, "topic_alias_max", TOPIC_ALIAS_DEFAULT_MAX);
+        client->connections = get_int_value(client_json, "connections", 1);
 
         free(name);
         free(ip);
         free(client_id);
+
+        if (parse_protocol(client_json, client->name, &client->protocol) != 0) {
+            return -1;
+        }
+
+        if (parse_queue_config(cJSON_GetObjectItem(client_json, "queue"), &client->queue) != 0) {
+            return -1;
+        }
+        parse_spill_config(cJSON_GetObjectItem(client_json, "spill"), &client->spill);
+        client->workers = get_int_value(client_json, "workers", 0);
+        client->worker_queue_depth = get_int_value(client_json, "worker_queue_depth", WORKER_DEFAULT_QUEUE_DEPTH);
+        if (parse_schedule_config(cJSON_GetObjectItem(client_json, "scheduling"), client->name,
+                                  &client->schedule) != 0) {
+            return -1;
+        }
+
+        // 重名时索引保留第一个, 由 validate_config 报告
+        if (hash_index_insert(&config->client_index, client->name, 0, client) < 0) {
+            LOG_ERROR("Out of memory indexing clients");
+            return -1;
+        }
     }
 
     return 0;
@@ -121,7 +362,7 @@ static int parse_rules_config(cJSON *rules_json, config_t *config) {
     }
 
     config->rule_count = cJSON_GetArraySize(rules_json);
-    config->rules = malloc(sizeof(rule_config_t) * config->rule_count);
+    config->rules = calloc(config->rule_count, sizeof(rule_config_t));
 
     for (int i = 0; i < config->rule_count; i++) {
         cJSON *rule_json = cJSON_GetArrayItem(rules_json, i);
@@ -131,27 +372,75 @@ static int parse_rules_config(cJSON *rules_json, config_t *config) {
         char *description = get_string_value(rule_json, "description", "");
         char *callback = get_string_value(rule_json, "callback", NULL);
 
-        if (!name || !callback) {
-            LOG_ERROR("rule missing required fields: name, callback");
+        cJSON *transform_json = cJSON_GetObjectItem(rule_json, "transform");
+        if (transform_json && cJSON_IsNull(transform_json)) {
+            transform_json = NULL;
+        }
+
+        if (!name || (!callback && !transform_json)) {
+            LOG_ERROR("rule missing required fields: name, callback or transform");
             return -1;
         }
 
         strncpy(rule->name, name, sizeof(rule->name) - 1);
-        strncpy(rule->description, description, sizeof(rule->description) - 1);
-        strncpy(rule->callback, callback, sizeof(rule->callback) - 1);
+        if (description) {
+            strncpy(rule->description, description, sizeof(rule->description) - 1);
+        }
+        if (callback) {
+            strncpy(rule->callback, callback, sizeof(rule->callback) - 1);
+        }
         rule->enabled = get_bool_value(rule_json, "enabled", 1);
 
-        // 解析source
+        // 解析transform: 加载时编译, 转发时不再解析模板
+        if (transform_json) {
+            if (!cJSON_IsObject(transform_json)) {
+                LOG_ERROR("Rule '%s' transform must be an object", rule->name);
+                return -1;
+            }
+            rule->transform = transform_compile(rule->name, transform_json);
+            if (!rule->transform) {
+                return -1;
+            }
+        }
+
+        if (parse_rate_limit_config(cJSON_GetObjectItem(rule_json, "rate_limit"), rule->name,
+                                    &rule->publish.rate_limit) != 0
+            || parse_batch_config(cJSON_GetObjectItem(rule_json, "batch"), rule->name, &rule->publish.batch) != 0
+            || parse_conflate_config(cJSON_GetObjectItem(rule_json, "conflate"), rule->name,
+                                     &rule->publish.conflate) != 0
+            || parse_priority(rule_json, rule->name, &rule->publish.priority) != 0) {
+            return -1;
+        }
+
+        // 解析source, share 为共享订阅的组名 (也可直接在 topic 中写 $share/<组名>/<过滤器>)
         cJSON *source_json = cJSON_GetObjectItem(rule_json, "source");
         if (source_json) {
             char *source_client = get_string_value(source_json, "client", NULL);
             char *source_topic = get_string_value(source_json, "topic", NULL);
-            if (source_client && source_topic) {
-                strncpy(rule->source_client, source_client, sizeof(rule->source_client) - 1);
-                strncpy(rule->source_topic, source_topic, sizeof(rule->source_topic) - 1);
+            char *share = get_string_value(source_json, "share", NULL);
+            if (share && (share[0] == '\0' || strpbrk(share, "/+#"))) {
+                LOG_ERROR("Invalid share group for rule '%s': %s", rule->name, share);
                 free(source_client);
                 free(source_topic);
+                free(share);
+                return -1;
             }
+            if (source_client && source_topic) {
+                strncpy(rule->source_client, source_client, sizeof(rule->source_client) - 1);
+                int len = share ? snprintf(rule->source_topic, sizeof(rule->source_topic), "$share/%s/%s",
+                                           share, source_topic)
+                                : snprintf(rule->source_topic, sizeof(rule->source_topic), "%s", source_topic);
+                if (len >= (int)sizeof(rule->source_topic)) {
+                    LOG_ERROR("Source topic of rule '%s' is too long", rule->name);
+                    free(source_client);
+                    free(source_topic);
+                    free(share);
+                    return -1;
+                }
+            }
+            free(source_client);
+            free(source_topic);
+            free(share);
         }
 
         // 解析target
@@ -170,6 +459,11 @@ static int parse_rules_config(cJSON *rules_json, config_t *config) {
         free(name);
         free(description);
         free(callback);
+
+        if (hash_index_insert(&config->rule_index, rule->name, 0, rule) < 0) {
+            LOG_ERROR("Out of memory indexing rules");
+            return -1;
+        }
     }
 
     return 0;
@@ -229,6 +523,7 @@ int load_config_from_file(const char *filename, config_t *config) {
     char *log_level = get_string_value(json, "log_level", "info");
     strncpy(config->log_level, log_level, sizeof(config->log_level) - 1);
     free(log_level);
+    config->log_sample = get_int_value(json, "log_sample", 1);
 
     // 解析mqtt配置
     cJSON *mqtt_json = cJSON_GetObjectItem(json, "mqtt");
@@ -236,6 +531,14 @@ int load_config_from_file(const char *filename, config_t *config) {
         goto cleanup;
     }
 
+    // 解析引擎配置
+    if (parse_engine_config(cJSON_GetObjectItem(json, "engine"), &config->engine) != 0) {
+        goto cleanup;
+    }
+
+    // 解析运行指标配置
+    parse_metrics_config(cJSON_GetObjectItem(json, "metrics"), &config->metrics);
+
     // 解析clients配置
     cJSON *clients_json = cJSON_GetObjectItem(json, "clients");
     if (parse_clients_config(clients_json, config) != 0) {
@@ -263,17 +566,68 @@ void free_config(config_t *config) {
     if (config->mqtt.username) free(config->mqtt.username);
     if (config->mqtt.password) free(config->mqtt.password);
     if (config->clients) free(config->clients);
+    for (int i = 0; i < config->rule_count && config->rules; i++) {
+        transform_free(config->rules[i].transform);
+    }
     if (config->rules) free(config->rules);
+    hash_index_destroy(&config->client_index);
+    hash_index_destroy(&config->rule_index);
     memset(config, 0, sizeof(config_t));
 }
 
 int find_client_by_name(const config_t *config, const char *name) {
-    for (int i = 0; i < config->client_count; i++) {
-        if (strcmp(config->clients[i].name, name) == 0) {
-            return i;
+    const client_config_t *client = hash_index_find(&config->client_index, name, 0);
+    return client ? (int)(client - config->clients) : -1;
+}
+
+const char *split_shared_topic(const char *topic, char *group, size_t group_size) {
+    static const char prefix[] = "$share/";
+    group[0] = '\0';
+    if (strncmp(topic, prefix, sizeof(prefix) - 1) != 0) {
+        return topic;
+    }
+    const char *name = topic + sizeof(prefix) - 1;
+    const char *slash = strchr(name, '/');
+    size_t len = slash ? (size_t)(slash - name) : 0;
+    if (len == 0 || len >= group_size || slash[1] == '\0' || strcspn(name, "+#") < len) {
+        return NULL;
+    }
+    memcpy(group, name, len);
+    group[len] = '\0';
+    return slash + 1;
+}
+
+int publisher_identity(const client_config_t *client, int index,
+                       char *client_id, size_t id_size, char *name, size_t name_size) {
+    int id_len = snprintf(client_id, id_size, "%s-%d", client->client_id, index);
+    int name_len = snprintf(name, name_size, "%s#%d", client->name, index);
+    if (id_len < 0 || (size_t)id_len >= id_size || name_len < 0 || (size_t)name_len >= name_size) {
+        return -1;
+    }
+    return 0;
+}
+
+// 客户端ID或名称是否已被其他连接使用 (配置的客户端及其发布连接池, skip 为当前连接)
+static int identity_in_use(const config_t *config, int skip_client, int skip_index,
+                           const char *client_id, const char *name) {
+    for (int j = 0; j < config->client_count; j++) {
+        const client_config_t *other = &config->clients[j];
+        if (strcmp(other->client_id, client_id) == 0 || strcmp(other->name, name) == 0) {
+            return 1;
+        }
+        for (int m = 1; m < other->connections && m < PUBLISH_MAX_CONNECTIONS; m++) {
+            char other_id[sizeof(other->client_id)];
+            char other_name[sizeof(other->name)];
+            if ((j == skip_client && m == skip_index)
+                || publisher_identity(other, m, other_id, sizeof(other_id), other_name, sizeof(other_name)) != 0) {
+                continue;
+            }
+            if (strcmp(other_id, client_id) == 0 || strcmp(other_name, name) == 0) {
+                return 1;
+            }
         }
     }
-    return -1;
+    return 0;
 }
 
 static int is_valid_ip(const char *ip) {
@@ -329,6 +683,31 @@ int validate_config(const config_t *config) {
         return -1;
     }
     
+    // 验证引擎配置
+    if (config->engine.loops < 1 || config->engine.loops > ENGINE_MAX_LOOPS) {
+        LOG_ERROR("Invalid engine loops: %d (must be 1-%d)", config->engine.loops, ENGINE_MAX_LOOPS);
+        return -1;
+    }
+    
+    // 验证运行指标配置: "unix:/path" 或 "host:port"
+    const char *listen = config->metrics.listen;
+    if (listen[0] && strncmp(listen, "unix:", 5) != 0) {
+        const char *colon = strrchr(listen, ':');
+        char *end = NULL;
+        long port = colon ? strtol(colon + 1, &end, 10) : 0;
+        if (!colon || end == colon + 1 || *end != '\0' || port < 1 || port > 65535) {
+            LOG_ERROR("Invalid metrics listen address: %s (expected host:port or unix:/path)", listen);
+            return -1;
+        }
+    } else if (listen[0] && listen[5] == '\0') {
+        LOG_ERROR("Invalid metrics listen address: %s (missing socket path)", listen);
+        return -1;
+    }
+    if (config->metrics.profile_sample < 0) {
+        LOG_ERROR("Invalid metrics profile_sample: %d (must be >= 0)", config->metrics.profile_sample);
+        return -1;
+    }
+    
     // 验证客户端配置
     if (config->client_count < 1) {
         LOG_ERROR("At least one client must be configured");
@@ -350,12 +729,110 @@ int validate_config(const config_t *config) {
             return -1;
         }
         
-        // 检查客户端名称重复
-        for (int j = i + 1; j < config->client_count; j++) {
-            if (strcmp(client->name, config->clients[j].name) == 0) {
-                LOG_ERROR("Duplicate client name: %s", client->name);
+        // 验证离线队列配置
+        if (client->queue.max_messages < 0 || client->queue.max_bytes < 0) {
+            LOG_ERROR("Invalid queue limits for client '%s'", client->name);
+            return -1;
+        }
+
+        if (client->queue.replay_rate < 1) {
+            LOG_ERROR("Invalid queue replay_rate for client '%s': %d (must be >= 1)",
+                     client->name, client->queue.replay_rate);
+            return -1;
+        }
+        
+        // 验证磁盘溢出日志配置
+        if (client->spill.dir[0]) {
+            if (client->spill.segment_bytes < SPILL_MIN_SEGMENT_BYTES) {
+                LOG_ERROR("Invalid spill segment_bytes for client '%s': %ld (must be >= %d)",
+                         client->name, client->spill.segment_bytes, SPILL_MIN_SEGMENT_BYTES);
+                return -1;
+            }
+            if (client->spill.max_segments < 2) {
+                LOG_ERROR("Invalid spill max_segments for client '%s': %d (must be >= 2)",
+                         client->name, client->spill.max_segments);
+                return -1;
+            }
+            if (client->spill.fsync_every < 1 || client->spill.fsync_interval_ms < 1) {
+                LOG_ERROR("Invalid spill fsync settings for client '%s'", client->name);
+                return -1;
+            }
+            // 两个日志对象同时写一个目录会互相覆盖记录和确认位置
+            for (int j = 0; j < i; j++) {
+                if (strcmp(config->clients[j].spill.dir, client->spill.dir) == 0) {
+                    LOG_ERROR("Clients '%s' and '%s' use the same spill dir: %s",
+                             config->clients[j].name, client->name, client->spill.dir);
+                    return -1;
+                }
+            }
+        }
+        
+        if (client->qos < 0 || client->qos > 2) {
+            LOG_ERROR("Invalid qos for client '%s': %d (must be 0-2)", client->name, client->qos);
+            return -1;
+        }
+
+        if (client->max_inflight < 0 || client->max_inflight > MQTT_MAX_INFLIGHT) {
+            LOG_ERROR("Invalid max_inflight for client '%s': %d (must be 0-%d)",
+                     client->name, client->max_inflight, MQTT_MAX_INFLIGHT);
+            return -1;
+        }
+
+        if (client->topic_alias_max < 0 || client->topic_alias_max > TOPIC_ALIAS_MAX) {
+            LOG_ERROR("Invalid topic_alias_max for client '%s': %d (must be 0-%d)",
+                     client->name, client->topic_alias_max, TOPIC_ALIAS_MAX);
+            return -1;
+        }
+
+        if (client->connections < 1 || client->connections > PUBLISH_MAX_CONNECTIONS) {
+            LOG_ERROR("Invalid connections for client '%s': %d (must be 1-%d)",
+                     client->name, client->connections, PUBLISH_MAX_CONNECTIONS);
+            return -1;
+        }
+
+        // 附加连接的客户端ID与其他连接相同时, Broker 会让两者轮流踢掉对方
+        for (int n = 1; n < client->connections; n++) {
+            char id[sizeof(client->client_id)];
+            char name[sizeof(client->name)];
+            if (publisher_identity(client, n, id, sizeof(id), name, sizeof(name)) != 0) {
+                LOG_ERROR("Client '%s' has %d connections but its client_id or name is too long for the "
+                         "\"-%d\" / \"#%d\" suffix (at most %zu characters)",
+                         client->name, client->connections, n, n, sizeof(id) - 1);
                 return -1;
             }
+            if (identity_in_use(config, i, n, id, name)) {
+                LOG_ERROR("Connection %d of client '%s' (client_id %s, name %s) collides with another client",
+                         n, client->name, id, name);
+                return -1;
+            }
+        }
+
+        // 验证工作线程配置
+        if (client->workers < 0 || client->workers > WORKER_MAX_THREADS) {
+            LOG_ERROR("Invalid workers for client '%s': %d (must be 0-%d)",
+                     client->name, client->workers, WORKER_MAX_THREADS);
+            return -1;
+        }
+
+        if (client->worker_queue_depth < 1) {
+            LOG_ERROR("Invalid worker_queue_depth for client '%s': %d (must be >= 1)",
+                     client->name, client->worker_queue_depth);
+            return -1;
+        }
+
+        // 验证通道调度权重
+        for (int lane = 0; lane < PRIORITY_LANES; lane++) {
+            if (client->schedule.weights[lane] < 1 || client->schedule.weights[lane] > LANE_MAX_WEIGHT) {
+                LOG_ERROR("Invalid scheduling weights for client '%s' (must be 1-%d)",
+                         client->name, LANE_MAX_WEIGHT);
+                return -1;
+            }
+        }
+        
+        // 检查客户端名称重复 (索引中保存的是第一个同名客户端)
+        if (find_client_by_name(config, client->name) != i) {
+            LOG_ERROR("Duplicate client name: %s", client->name);
+            return -1;
         }
     }
     
@@ -369,11 +846,9 @@ int validate_config(const config_t *config) {
         const rule_config_t *rule = &config->rules[i];
         
         // 验证规则名称重复
-        for (int j = i + 1; j < config->rule_count; j++) {
-            if (strcmp(rule->name, config->rules[j].name) == 0) {
-                LOG_ERROR("Duplicate rule name: %s", rule->name);
-                return -1;
-            }
+        if (hash_index_find(&config->rule_index, rule->name, 0) != rule) {
+            LOG_ERROR("Duplicate rule name: %s", rule->name);
+            return -1;
         }
         
         // 验证客户端引用
@@ -396,8 +871,10 @@ int validate_config(const config_t *config) {
             return -1;
         }
         
-        // 验证主题格式
-        if (!is_valid_topic(rule->source_topic)) {
+        // 验证主题格式 (共享订阅验证组名和其中的过滤器)
+        char share_group[64];
+        const char *source_filter = split_shared_topic(rule->source_topic, share_group, sizeof(share_group));
+        if (!source_filter || !is_valid_topic(source_filter)) {
             LOG_ERROR("Rule '%s' has invalid source topic: %s", 
                      rule->name, rule->source_topic);
             return -1;
@@ -408,12 +885,100 @@ int validate_config(const config_t *config) {
                      rule->name, rule->target_topic);
             return -1;
         }
+
+        // 验证目标主题引用的通配符
+        topic_rewrite_t *rewrite = topic_rewrite_compile(source_filter, rule->target_topic);
+        if (!rewrite) {
+            LOG_ERROR("Rule '%s' has invalid target topic rewrite: %s", 
+                     rule->name, rule->target_topic);
+            return -1;
+        }
+        topic_rewrite_free(rewrite);
         
-        // 验证回调函数名称
-        if (strlen(rule->callback) == 0) {
+        // 验证回调函数名称 (transform 与 callback 二选一)
+        if (rule->transform && strlen(rule->callback) > 0) {
+            LOG_ERROR("Rule '%s' sets both callback and transform", rule->name);
+            return -1;
+        }
+
+        if (!rule->transform && strlen(rule->callback) == 0) {
             LOG_ERROR("Rule '%s' has empty callback", rule->name);
             return -1;
         }
+
+        // 验证批量发布配置: 只合并事件包装, 数组整体不能超过单条消息上限
+        const batch_config_t *batch = &rule->publish.batch;
+        if (batch->enabled) {
+            if (strcmp(rule->callback, "EventCall") != 0) {
+                LOG_ERROR("Rule '%s' sets batch, which is only supported with the EventCall callback", rule->name);
+                return -1;
+            }
+            if (batch->max_messages < 1) {
+                LOG_ERROR("Invalid batch max_messages for rule '%s': %d (must be >= 1)",
+                         rule->name, batch->max_messages);
+                return -1;
+            }
+            if (batch->max_bytes < 2 || batch->max_bytes > MAX_MESSAGE_SIZE) {
+                LOG_ERROR("Invalid batch max_bytes for rule '%s': %ld (must be 2-%d)",
+                         rule->name, batch->max_bytes, MAX_MESSAGE_SIZE);
+                return -1;
+            }
+            if (batch->max_delay_ms < 1 || batch->max_delay_ms > BATCH_MAX_DELAY_MS) {
+                LOG_ERROR("Invalid batch max_delay_ms for rule '%s': %d (must be 1-%d)",
+                         rule->name, batch->max_delay_ms, BATCH_MAX_DELAY_MS);
+                return -1;
+            }
+        }
+
+        // 验证最新值合并配置
+        const conflate_config_t *conflate = &rule->publish.conflate;
+        if (conflate->enabled) {
+            if (conflate->interval_ms < 1 || conflate->interval_ms > CONFLATE_MAX_INTERVAL_MS) {
+                LOG_ERROR("Invalid conflate interval_ms for rule '%s': %d (must be 1-%d)",
+                         rule->name, conflate->interval_ms, CONFLATE_MAX_INTERVAL_MS);
+                return -1;
+            }
+            if (conflate->max_keys < 1 || conflate->max_keys > CONFLATE_MAX_KEYS) {
+                LOG_ERROR("Invalid conflate max_keys for rule '%s': %d (must be 1-%d)",
+                         rule->name, conflate->max_keys, CONFLATE_MAX_KEYS);
+                return -1;
+            }
+            if (conflate->max_bytes < 1) {
+                LOG_ERROR("Invalid conflate max_bytes for rule '%s': %ld (must be >= 1)",
+                         rule->name, conflate->max_bytes);
+                return -1;
+            }
+        }
+
+        // 验证限速配置
+        const rate_limit_config_t *rate_limit = &rule->publish.rate_limit;
+        if (rate_limit->enabled) {
+            if (rate_limit->rate < 0 || rate_limit->device_rate < 0
+                || (rate_limit->rate == 0 && rate_limit->device_rate == 0)) {
+                LOG_ERROR("Rule '%s' rate_limit needs rate or device_rate > 0", rule->name);
+                return -1;
+            }
+            if (rate_limit->burst < 1 || rate_limit->device_burst < 1) {
+                LOG_ERROR("Invalid rate_limit burst for rule '%s': %d/%d (must be >= 1)",
+                         rule->name, rate_limit->burst, rate_limit->device_burst);
+                return -1;
+            }
+            if (rate_limit->max_devices < 1 || rate_limit->max_devices > RATE_LIMIT_MAX_DEVICES) {
+                LOG_ERROR("Invalid rate_limit max_devices for rule '%s': %d (must be 1-%d)",
+                         rule->name, rate_limit->max_devices, RATE_LIMIT_MAX_DEVICES);
+                return -1;
+            }
+            if (rate_limit->max_delay_ms < 1 || rate_limit->max_delay_ms > RATE_LIMIT_MAX_DELAY_MS) {
+                LOG_ERROR("Invalid rate_limit max_delay_ms for rule '%s': %d (must be 1-%d)",
+                         rule->name, rate_limit->max_delay_ms, RATE_LIMIT_MAX_DELAY_MS);
+                return -1;
+            }
+            if (rate_limit->sample_every < 1) {
+                LOG_ERROR("Invalid rate_limit sample_every for rule '%s': %d (must be >= 1)",
+                         rule->name, rate_limit->sample_every);
+                return -1;
+            }
+        }
     }
     
     LOG_INFO("Configuration validation passed");
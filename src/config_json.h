@@ -3,6 +3,11 @@
 
 #include <cjson/cJSON.h>
 
+#include "config.h"
+#include "hash_index.h"
+#include "metrics.h"
+#include "transform.h"
+
 // MQTT配置结构
 typedef struct {
     int port;
@@ -14,40 +19,167 @@ typedef struct {
     char *password;
 } mqtt_config_t;
 
+// 离线队列溢出策略
+typedef enum {
+    QUEUE_DROP_OLDEST = 0,
+    QUEUE_DROP_NEWEST = 1
+} queue_policy_t;
+
+// 离线队列配置 (目标客户端断开期间缓存待发送消息)
+typedef struct {
+    int max_messages;      // 最大缓存条数, 0表示不缓存
+    long max_bytes;        // 最大缓存字节数
+    queue_policy_t policy;
+    int replay_rate;       // 重连后每秒重放条数
+} queue_config_t;
+
+// 磁盘溢出日志配置 (内存队列放不下时写入磁盘, dir为空表示不启用)
+typedef struct {
+    char dir[256];
+    long segment_bytes;    // 单个段文件大小
+    int max_segments;      // 最多保留的段数, 超出时丢弃最旧段
+    int fsync_every;       // 每追加N条记录同步一次
+    int fsync_interval_ms; // 有未同步数据时的最长同步间隔
+} spill_config_t;
+
+// 规则优先级, 即消息所在的通道 (数值越小越优先)
+typedef enum {
+    PRIORITY_HIGH = 0,
+    PRIORITY_NORMAL = 1,
+    PRIORITY_LOW = 2
+} priority_t;
+
+// 通道调度方式
+typedef enum {
+    SCHEDULE_STRICT = 0,    // 总是先处理优先级高的通道
+    SCHEDULE_WEIGHTED = 1   // 按权重轮流处理, 低优先级通道不会饿死
+} schedule_mode_t;
+
+// 客户端的通道调度配置: 用于该客户端的工作线程队列 (作为源) 和离线队列 (作为目标)
+typedef struct {
+    schedule_mode_t mode;
+    int weights[PRIORITY_LANES];  // 加权调度时各通道每轮可处理的条数
+} schedule_config_t;
+
+// 与 Broker 之间的协议版本
+typedef enum {
+    PROTOCOL_MQTT311 = 0,
+    PROTOCOL_MQTT5 = 1     // 支持主题别名, 并转发消息过期时间和用户属性
+} protocol_t;
+
 // 客户端配置结构
 typedef struct {
     char name[64];
     char ip[64];
     int port;  // 端口号，如果JSON中未指定则使用全局默认值
     char client_id[64];
+    int qos;                 // 订阅该客户端主题的 QoS, 以及发布到该客户端的最低 QoS; 默认为 mqtt.qos
+    int max_inflight;        // 发布到该客户端时等待确认的 QoS 1/2 消息数上限, 0表示不限
+    protocol_t protocol;
+    int topic_alias_max;     // MQTT v5 下发布到该客户端时使用的主题别名数上限, 0表示不使用
+    int connections;         // 发布到该客户端的连接数 (含订阅所用的主连接), 同一主题总走同一连接
+    queue_config_t queue;
+    spill_config_t spill;
+    int workers;             // 处理该客户端消息的工作线程数, 0表示在网络线程上处理
+    int worker_queue_depth;  // 每个工作线程每个通道的队列深度
+    schedule_config_t schedule;
 } client_config_t;
 
+// 网络引擎模式
+typedef enum {
+    ENGINE_MODE_THREADED = 0,  // 每个客户端一个 libmosquitto 网络线程
+    ENGINE_MODE_EPOLL = 1      // 少量 epoll 事件循环驱动所有客户端
+} engine_mode_t;
+
+typedef struct {
+    engine_mode_t mode;
+    int loops;             // epoll 模式下的事件循环数 (线程数)
+} engine_config_t;
+
+// 批量发布配置: 同一目标主题的事件合并为一个JSON数组发布 (仅 EventCall 规则)
+typedef struct {
+    int enabled;           // 规则配置了 batch 时为1
+    int max_messages;      // 每批最多合并的事件数
+    long max_bytes;        // 每批 (整个数组) 的最大字节数
+    int max_delay_ms;      // 最早一条事件的最长等待时间, 即批量引入的延迟上限
+} batch_config_t;
+
+// 最新值合并配置: 同一源主题 (设备) 每个周期最多发出一次, 只发最新值
+typedef struct {
+    int enabled;           // 规则配置了 conflate 时为1
+    int interval_ms;       // 同一设备两次发布的最小间隔
+    int max_keys;          // 最多跟踪的设备数, 超出时淘汰最久未用的
+    long max_bytes;        // 保存的最新值等占用的字节数上限
+} conflate_config_t;
+
+// 超出限速时的处理方式
+typedef enum {
+    RATE_SHED_DROP = 0,    // 丢弃
+    RATE_SHED_DELAY = 1,   // 延迟到有令牌时再发出, 需等待超过 max_delay_ms 的丢弃
+    RATE_SHED_SAMPLE = 2   // 每 sample_every 条超限消息放行1条, 其余丢弃
+} shed_policy_t;
+
+// 限速配置: 整条规则和每个设备 (源主题) 各一个令牌桶, 速率为0的不限
+typedef struct {
+    int enabled;           // 规则配置了 rate_limit 时为1
+    double rate;           // 整条规则每秒条数
+    int burst;             // 整条规则的桶容量
+    double device_rate;    // 每个设备每秒条数
+    int device_burst;      // 每个设备的桶容量
+    int max_devices;       // 设备令牌桶表的容量
+    shed_policy_t policy;
+    int max_delay_ms;      // delay: 最长延迟
+    int sample_every;      // sample: 放行间隔
+} rate_limit_config_t;
+
+// 规则的发布方式 (限速、合并和批量均为可选, 未启用时逐条直接发布)
+typedef struct {
+    rate_limit_config_t rate_limit;
+    conflate_config_t conflate;
+    batch_config_t batch;
+    priority_t priority;   // 消息在工作线程队列和目标离线队列中的通道
+} publish_config_t;
+
 // 转发规则配置结构
 typedef struct {
     char name[64];
     char description[256];
     char source_client[64];
-    char source_topic[256];
+    char source_topic[256];    // 共享订阅时为 $share/<组名>/<过滤器>
     char target_client[64];
     char target_topic[256];
     char callback[128];
+    transform_t *transform;  // 编译后的 transform 模板, 未配置时为NULL
+    publish_config_t publish;
     int enabled;
 } rule_config_t;
 
 // 全局配置结构
 typedef struct {
     char log_level[16];
+    int log_sample;  // 逐条消息日志的采样间隔
     mqtt_config_t mqtt;
+    engine_config_t engine;
+    metrics_config_t metrics;
     client_config_t *clients;
     int client_count;
     rule_config_t *rules;
     int rule_count;
+    hash_index_t client_index;  // 名称 -> client_config_t
+    hash_index_t rule_index;    // 名称 -> rule_config_t
 } config_t;
 
 // 函数声明
 int load_config_from_file(const char *filename, config_t *config);
 void free_config(config_t *config);
 int find_client_by_name(const config_t *config, const char *name);
+// 拆分共享订阅 $share/<组名>/<过滤器>: 返回过滤器部分, 组名写入 group (非共享订阅为空串);
+// 格式错误 (组名为空、含通配符或过长, 或没有过滤器) 时返回NULL
+const char *split_shared_topic(const char *topic, char *group, size_t group_size);
+// 发布连接池中第 index 个附加连接 (从1开始) 的客户端ID "<client_id>-<index>" 和名称 "<name>#<index>",
+// 放不下时返回-1
+int publisher_identity(const client_config_t *client, int index,
+                       char *client_id, size_t id_size, char *name, size_t name_size);
 int validate_config(const config_t *config);
 
 #endif
@@ -0,0 +1,377 @@
+#include "conflate.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "time_util.h"
+
+// 侵入式双向链表, 表头为哨兵
+typedef struct link
+{
+    struct link *prev;
+    struct link *next;
+} link_t;
+
+typedef struct conflate_entry
+{
+    struct conflate_entry *hash_next;
+    link_t                 lru;        // 最近使用顺序, 表头最久未用
+    link_t                 due;        // 本周期已发出过的键, 按发出时间排序
+    unsigned int           hash;
+    bool                   throttled;  // 在 due 列表中, 新消息需等待周期结束
+    bool                   pending;    // 有尚未发出的最新值
+    int                    qos;
+    bool                   retain;
+    long long              received_ns;
+    long long              published_ns;
+    char                  *payload;
+    size_t                 len;
+    size_t                 capacity;
+    size_t                 size;       // 计入字节上限的大小 (条目本身 + 负载缓冲区)
+    char                  *topic;      // 目标主题, 与键一起分配
+    char                   key[];
+} conflate_entry_t;
+
+struct conflater
+{
+    pthread_mutex_t    lock;
+    conflate_config_t  config;
+    long long          interval_ns;
+    conflate_publish_t publish;
+    void              *ctx;
+    conflate_entry_t **buckets;
+    unsigned int       mask;
+    int                keys;
+    size_t             bytes;
+    link_t             lru;
+    link_t             due;
+    unsigned long      evicted;
+};
+
+#define ENTRY_OF(ptr, member) ((conflate_entry_t *)((char *)(ptr) - offsetof(conflate_entry_t, member)))
+
+static void list_init(link_t *head)
+{
+    head->prev = head;
+    head->next = head;
+}
+
+static void list_remove(link_t *link)
+{
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+}
+
+static void list_append(link_t *head, link_t *link)
+{
+    link->prev       = head->prev;
+    link->next       = head;
+    head->prev->next = link;
+    head->prev       = link;
+}
+
+static unsigned int key_hash(const char *key)
+{
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++)
+    {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+conflater_t *conflater_create(const conflate_config_t *config, conflate_publish_t publish, void *ctx)
+{
+    conflater_t *conflater = calloc(1, sizeof(conflater_t));
+    if (!conflater)
+    {
+        return NULL;
+    }
+    unsigned int buckets = 16;
+    while (buckets < (unsigned int)config->max_keys)
+    {
+        buckets *= 2;
+    }
+    conflater->buckets = calloc(buckets, sizeof(conflate_entry_t *));
+    if (!conflater->buckets)
+    {
+        free(conflater);
+        return NULL;
+    }
+    pthread_mutex_init(&conflater->lock, NULL);
+    conflater->config      = *config;
+    conflater->interval_ns = (long long)config->interval_ms * 1000000LL;
+    conflater->publish     = publish;
+    conflater->ctx         = ctx;
+    conflater->mask        = buckets - 1;
+    list_init(&conflater->lru);
+    list_init(&conflater->due);
+    return conflater;
+}
+
+void conflater_destroy(conflater_t *conflater)
+{
+    if (!conflater)
+    {
+        return;
+    }
+    for (unsigned int i = 0; i <= conflater->mask; i++)
+    {
+        conflate_entry_t *entry = conflater->buckets[i];
+        while (entry)
+        {
+            conflate_entry_t *next = entry->hash_next;
+            free(entry->payload);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(conflater->buckets);
+    pthread_mutex_destroy(&conflater->lock);
+    free(conflater);
+}
+
+static void publish_entry(conflater_t *conflater, conflate_entry_t *entry, const void *payload, size_t len,
+                          int qos, bool retain, long long received_ns)
+{
+    conflated_message_t message = {
+        .topic       = entry->topic,
+        .payload     = payload,
+        .len         = len,
+        .qos         = qos,
+        .retain      = retain,
+        .received_ns = received_ns,
+    };
+    conflater->publish(conflater->ctx, &message);
+}
+
+// 发出保存的最新值; 调用方持锁
+static void publish_pending(conflater_t *conflater, conflate_entry_t *entry)
+{
+    entry->pending = false;
+    publish_entry(conflater, entry, entry->payload, entry->len, entry->qos, entry->retain, entry->received_ns);
+}
+
+// 淘汰一个键, 未发出的值先发出; 调用方持锁
+static void evict(conflater_t *conflater, conflate_entry_t *entry)
+{
+    if (entry->pending)
+    {
+        publish_pending(conflater, entry);
+    }
+    conflate_entry_t **slot = &conflater->buckets[entry->hash & conflater->mask];
+    while (*slot != entry)
+    {
+        slot = &(*slot)->hash_next;
+    }
+    *slot = entry->hash_next;
+    list_remove(&entry->lru);
+    if (entry->throttled)
+    {
+        list_remove(&entry->due);
+    }
+    conflater->keys--;
+    conflater->bytes -= entry->size;
+    conflater->evicted++;
+    free(entry->payload);
+    free(entry);
+}
+
+// 超出键数或字节上限时淘汰最久未用的键, keep 除外
+static void evict_excess(conflater_t *conflater, const conflate_entry_t *keep)
+{
+    while (conflater->keys > conflater->config.max_keys
+           || conflater->bytes > (size_t)conflater->config.max_bytes)
+    {
+        link_t *oldest = conflater->lru.next;
+        if (oldest == &keep->lru)
+        {
+            oldest = oldest->next;
+        }
+        if (oldest == &conflater->lru)
+        {
+            return;
+        }
+        evict(conflater, ENTRY_OF(oldest, lru));
+    }
+}
+
+// 处理周期已结束的键: 有最新值的发出并开始新周期, 没有的退出限流; 调用方持锁
+static void expire_due(conflater_t *conflater, long long now_ns)
+{
+    while (conflater->due.next != &conflater->due)
+    {
+        conflate_entry_t *entry = ENTRY_OF(conflater->due.next, due);
+        if (now_ns - entry->published_ns < conflater->interval_ns)
+        {
+            break;
+        }
+        list_remove(&entry->due);
+        if (entry->pending)
+        {
+            publish_pending(conflater, entry);
+            entry->published_ns = now_ns;
+            list_append(&conflater->due, &entry->due);
+        }
+        else
+        {
+            entry->throttled = false;
+        }
+    }
+}
+
+static conflate_entry_t *find_entry(conflater_t *conflater, const char *key, unsigned int hash)
+{
+    for (conflate_entry_t *entry = conflater->buckets[hash & conflater->mask]; entry; entry = entry->hash_next)
+    {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static conflate_entry_t *add_entry(conflater_t *conflater, const char *key, unsigned int hash, const char *topic)
+{
+    size_t            key_len   = strlen(key) + 1;
+    size_t            topic_len = strlen(topic) + 1;
+    conflate_entry_t *entry     = calloc(1, sizeof(conflate_entry_t) + key_len + topic_len);
+    if (!entry)
+    {
+        return NULL;
+    }
+    memcpy(entry->key, key, key_len);
+    entry->topic = entry->key + key_len;
+    memcpy(entry->topic, topic, topic_len);
+    conflate_entry_t **bucket = &conflater->buckets[hash & conflater->mask];
+    entry->hash      = hash;
+    entry->size      = sizeof(conflate_entry_t) + key_len + topic_len;
+    entry->hash_next = *bucket;
+    *bucket          = entry;
+    list_append(&conflater->lru, &entry->lru);
+    conflater->keys++;
+    conflater->bytes += entry->size;
+    return entry;
+}
+
+// 保存为该键的最新值, 缓冲区按需扩大
+static int store_value(conflater_t *conflater, conflate_entry_t *entry, const void *payload, size_t len)
+{
+    if (len > entry->capacity)
+    {
+        size_t capacity = entry->capacity ? entry->capacity : 64;
+        while (capacity < len)
+        {
+            capacity *= 2;
+        }
+        char *grown = realloc(entry->payload, capacity);
+        if (!grown)
+        {
+            return -1;
+        }
+        conflater->bytes += capacity - entry->capacity;
+        entry->size      += capacity - entry->capacity;
+        entry->payload    = grown;
+        entry->capacity   = capacity;
+    }
+    memcpy(entry->payload, payload, len);
+    entry->len = len;
+    return 0;
+}
+
+int conflater_offer(conflater_t *conflater,
+                    const char  *key,
+                    const char  *topic,
+                    const void  *payload,
+                    size_t       len,
+                    int          qos,
+                    bool         retain,
+                    long long    received_ns)
+{
+    pthread_mutex_lock(&conflater->lock);
+    long long now_ns = monotonic_ns();
+    expire_due(conflater, now_ns);
+
+    unsigned int      hash  = key_hash(key);
+    conflate_entry_t *entry = find_entry(conflater, key, hash);
+    if (entry)
+    {
+        list_remove(&entry->lru);
+        list_append(&conflater->lru, &entry->lru);
+    }
+    else
+    {
+        entry = add_entry(conflater, key, hash, topic);
+        if (!entry)
+        {
+            pthread_mutex_unlock(&conflater->lock);
+            return -1;
+        }
+        evict_excess(conflater, entry);
+    }
+
+    // 本周期内还未发出过: 立即发出并开始计时
+    if (!entry->throttled)
+    {
+        publish_entry(conflater, entry, payload, len, qos, retain, received_ns);
+        entry->throttled    = true;
+        entry->published_ns = now_ns;
+        list_append(&conflater->due, &entry->due);
+        pthread_mutex_unlock(&conflater->lock);
+        return 0;
+    }
+
+    int replaced = entry->pending ? 1 : 0;
+    if (store_value(conflater, entry, payload, len) != 0)
+    {
+        pthread_mutex_unlock(&conflater->lock);
+        return -1;
+    }
+    entry->pending     = true;
+    entry->qos         = qos;
+    entry->retain      = retain;
+    entry->received_ns = received_ns;
+    evict_excess(conflater, entry);
+    pthread_mutex_unlock(&conflater->lock);
+    return replaced;
+}
+
+void conflater_flush_due(conflater_t *conflater)
+{
+    pthread_mutex_lock(&conflater->lock);
+    expire_due(conflater, monotonic_ns());
+    pthread_mutex_unlock(&conflater->lock);
+}
+
+void conflater_flush(conflater_t *conflater)
+{
+    pthread_mutex_lock(&conflater->lock);
+    for (link_t *link = conflater->due.next; link != &conflater->due; link = link->next)
+    {
+        conflate_entry_t *entry = ENTRY_OF(link, due);
+        if (entry->pending)
+        {
+            publish_pending(conflater, entry);
+        }
+    }
+    pthread_mutex_unlock(&conflater->lock);
+}
+
+void conflater_stats(conflater_t *conflater, conflater_stats_t *stats)
+{
+    pthread_mutex_lock(&conflater->lock);
+    stats->keys    = conflater->keys;
+    stats->pending = 0;
+    stats->evicted = conflater->evicted;
+    for (link_t *link = conflater->due.next; link != &conflater->due; link = link->next)
+    {
+        if (ENTRY_OF(link, due)->pending)
+        {
+            stats->pending++;
+        }
+    }
+    pthread_mutex_unlock(&conflater->lock);
+}
@@ -0,0 +1,58 @@
+#ifndef CONFLATE_H
+#define CONFLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config_json.h"
+
+// 最新值合并: 按键 (源主题, 即设备) 限制发布频率。一个键在 interval_ms 内的第一条消息立即发出,
+// 其后的消息只保留最新一条, 周期结束时发出; 被新值替换的旧值计为已合并。
+// 键数和缓存字节数有上限, 超出时淘汰最久未用的键 (有未发出的值时先发出)。
+// 发布函数在锁内调用, 同一键的值按顺序发出, 发布函数不能再调用本合并器。
+
+// 发出的一条消息, 字段在发布函数返回前有效
+typedef struct
+{
+    const char *topic;
+    const void *payload;
+    size_t      len;
+    int         qos;
+    bool        retain;
+    long long   received_ns;   // 该值进入 on_message 的时间
+} conflated_message_t;
+
+typedef void (*conflate_publish_t)(void *ctx, const conflated_message_t *message);
+
+typedef struct
+{
+    int           keys;
+    int           pending;     // 等待周期结束的值
+    unsigned long evicted;     // 被淘汰的键
+} conflater_stats_t;
+
+typedef struct conflater conflater_t;
+
+conflater_t *conflater_create(const conflate_config_t *config, conflate_publish_t publish, void *ctx);
+void         conflater_destroy(conflater_t *conflater);
+
+// 提交一条消息: 立即发出或保存为该键的最新值。
+// 返回0表示已接收, 1表示同时替换了尚未发出的旧值, -1表示内存不足 (该消息未被接收)
+int conflater_offer(conflater_t *conflater,
+                    const char  *key,
+                    const char  *topic,
+                    const void  *payload,
+                    size_t       len,
+                    int          qos,
+                    bool         retain,
+                    long long    received_ns);
+
+// 发出周期已结束的键的最新值, 由目标客户端的定时任务调用
+void conflater_flush_due(conflater_t *conflater);
+
+// 立即发出所有保存的值
+void conflater_flush(conflater_t *conflater);
+
+void conflater_stats(conflater_t *conflater, conflater_stats_t *stats);
+
+#endif
@@ -0,0 +1,258 @@
+#include "event_batch.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+#define SLOT_COUNT (BATCH_MAX_TOPICS * 2)   // 开放寻址, 装载率不超过一半
+
+// 一个目标主题的批
+typedef struct
+{
+    char     *topic;      // NULL 表示空槽
+    char     *data;       // "[" 之后是以逗号分隔的事件, 发出时补上 "]"
+    size_t    len;        // 不含结尾的 "]"
+    size_t    capacity;
+    int       count;
+    int       qos;
+    bool      retain;
+    long long first_ns;
+    int       open_pos;   // 在 open 中的位置, 批为空时为-1
+} batch_slot_t;
+
+struct event_batcher
+{
+    pthread_mutex_t       lock;
+    batch_config_t        config;
+    long long             max_delay_ns;
+    event_batch_publish_t publish;
+    void                 *ctx;
+    int                   topic_count;
+    int                   open_count;
+    int                   open[BATCH_MAX_TOPICS];   // 有未发出事件的槽位, 定时任务只扫描这些
+    batch_slot_t          slots[SLOT_COUNT];
+};
+
+static unsigned int topic_hash(const char *topic)
+{
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)topic; *p; p++)
+    {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+// 查找主题所在的槽位, 不存在时返回应插入的空槽
+static batch_slot_t *probe(event_batcher_t *batcher, const char *topic)
+{
+    unsigned int i = topic_hash(topic) & (SLOT_COUNT - 1);
+    for (;; i = (i + 1) & (SLOT_COUNT - 1))
+    {
+        batch_slot_t *slot = &batcher->slots[i];
+        if (!slot->topic || strcmp(slot->topic, topic) == 0)
+        {
+            return slot;
+        }
+    }
+}
+
+event_batcher_t *event_batcher_create(const batch_config_t *config, event_batch_publish_t publish, void *ctx)
+{
+    event_batcher_t *batcher = calloc(1, sizeof(event_batcher_t));
+    if (!batcher)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&batcher->lock, NULL);
+    batcher->config       = *config;
+    batcher->max_delay_ns = (long long)config->max_delay_ms * 1000000LL;
+    batcher->publish      = publish;
+    batcher->ctx          = ctx;
+    return batcher;
+}
+
+// 释放所有主题的缓冲区, 调用方持锁 (或独占) 且所有批已发出或放弃
+static void reset_topics(event_batcher_t *batcher)
+{
+    for (int i = 0; i < SLOT_COUNT; i++)
+    {
+        free(batcher->slots[i].topic);
+        free(batcher->slots[i].data);
+    }
+    memset(batcher->slots, 0, sizeof(batcher->slots));
+    batcher->topic_count = 0;
+    batcher->open_count  = 0;
+}
+
+void event_batcher_destroy(event_batcher_t *batcher)
+{
+    if (!batcher)
+    {
+        return;
+    }
+    reset_topics(batcher);
+    pthread_mutex_destroy(&batcher->lock);
+    free(batcher);
+}
+
+// 补上 "]" 后交给发布函数, 然后清空该批; 调用方持锁
+static void emit(event_batcher_t *batcher, batch_slot_t *slot)
+{
+    slot->data[slot->len] = ']';
+
+    long by_count = (long)slot->count * 1000 / batcher->config.max_messages;
+    long by_bytes = (long)(slot->len + 1) * 1000 / batcher->config.max_bytes;
+    long fill     = by_count > by_bytes ? by_count : by_bytes;
+
+    event_batch_t batch = {
+        .topic         = slot->topic,
+        .payload       = slot->data,
+        .len           = slot->len + 1,
+        .qos           = slot->qos,
+        .retain        = slot->retain,
+        .messages      = slot->count,
+        .first_ns      = slot->first_ns,
+        .fill_permille = fill < 1000 ? (int)fill : 1000,
+    };
+    batcher->publish(batcher->ctx, &batch);
+
+    slot->len   = 0;
+    slot->count = 0;
+    int last                      = batcher->open[--batcher->open_count];
+    batcher->open[slot->open_pos] = last;
+    batcher->slots[last].open_pos = slot->open_pos;
+    slot->open_pos                = -1;
+}
+
+static void flush_locked(event_batcher_t *batcher)
+{
+    while (batcher->open_count > 0)
+    {
+        emit(batcher, &batcher->slots[batcher->open[batcher->open_count - 1]]);
+    }
+}
+
+// 追加一条事件 (第一条前加 "[", 之后加 ","), 预留结尾 "]" 的空间
+static int append(batch_slot_t *slot, const void *item, size_t len)
+{
+    size_t needed = slot->len + len + 2;
+    if (needed > slot->capacity)
+    {
+        size_t capacity = slot->capacity ? slot->capacity : 256;
+        while (capacity < needed)
+        {
+            capacity *= 2;
+        }
+        char *data = realloc(slot->data, capacity);
+        if (!data)
+        {
+            return -1;
+        }
+        slot->data     = data;
+        slot->capacity = capacity;
+    }
+    slot->data[slot->len++] = slot->count == 0 ? '[' : ',';
+    memcpy(slot->data + slot->len, item, len);
+    slot->len += len;
+    slot->count++;
+    return 0;
+}
+
+int event_batcher_add(event_batcher_t *batcher,
+                      const char      *topic,
+                      const void      *item,
+                      size_t           len,
+                      int              qos,
+                      bool             retain,
+                      long long        received_ns)
+{
+    pthread_mutex_lock(&batcher->lock);
+
+    batch_slot_t *slot = probe(batcher, topic);
+    if (!slot->topic)
+    {
+        if (batcher->topic_count >= BATCH_MAX_TOPICS)
+        {
+            // 目标主题过多: 先发出全部批, 再从空表开始
+            flush_locked(batcher);
+            reset_topics(batcher);
+            slot = probe(batcher, topic);
+        }
+        slot->topic = strdup(topic);
+        if (!slot->topic)
+        {
+            pthread_mutex_unlock(&batcher->lock);
+            return -1;
+        }
+        slot->open_pos = -1;
+        batcher->topic_count++;
+    }
+
+    // 发布参数不同或加入后超出字节上限时, 先发出当前批
+    if (slot->count > 0
+        && (slot->qos != qos || slot->retain != retain
+            || slot->len + len + 2 > (size_t)batcher->config.max_bytes))
+    {
+        emit(batcher, slot);
+    }
+    if (append(slot, item, len) != 0)
+    {
+        pthread_mutex_unlock(&batcher->lock);
+        return -1;
+    }
+    if (slot->count == 1)
+    {
+        slot->first_ns                       = received_ns;
+        slot->qos                            = qos;
+        slot->retain                         = retain;
+        slot->open_pos                       = batcher->open_count;
+        batcher->open[batcher->open_count++] = (int)(slot - batcher->slots);
+    }
+
+    if (slot->count >= batcher->config.max_messages
+        || slot->len + 1 >= (size_t)batcher->config.max_bytes
+        || received_ns - slot->first_ns >= batcher->max_delay_ns)
+    {
+        emit(batcher, slot);
+    }
+
+    pthread_mutex_unlock(&batcher->lock);
+    return 0;
+}
+
+void event_batcher_flush_due(event_batcher_t *batcher, long long now_ns)
+{
+    pthread_mutex_lock(&batcher->lock);
+    // 从尾部向前扫描: emit 把最后一个槽位移到被移除的位置, 该位置已检查过
+    for (int i = batcher->open_count - 1; i >= 0; i--)
+    {
+        batch_slot_t *slot = &batcher->slots[batcher->open[i]];
+        if (now_ns - slot->first_ns >= batcher->max_delay_ns)
+        {
+            emit(batcher, slot);
+        }
+    }
+    pthread_mutex_unlock(&batcher->lock);
+}
+
+void event_batcher_flush(event_batcher_t *batcher)
+{
+    pthread_mutex_lock(&batcher->lock);
+    flush_locked(batcher);
+    pthread_mutex_unlock(&batcher->lock);
+}
+
+int event_batcher_pending(event_batcher_t *batcher)
+{
+    pthread_mutex_lock(&batcher->lock);
+    int pending = 0;
+    for (int i = 0; i < batcher->open_count; i++)
+    {
+        pending += batcher->slots[batcher->open[i]].count;
+    }
+    pthread_mutex_unlock(&batcher->lock);
+    return pending;
+}
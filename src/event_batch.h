@@ -0,0 +1,51 @@
+#ifndef EVENT_BATCH_H
+#define EVENT_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config_json.h"
+
+// 事件批量发布: 同一目标主题的事件包装按到达顺序拼成一个JSON数组 [e1,e2,...],
+// 条数或字节数达到上限、或最早一条等待超过 max_delay_ms 时整批发出。
+// 追加和发出在同一把锁内完成, 同一主题的批按顺序交给发布函数, 发布函数不能再调用本批量器。
+
+// 发出的一批, 字段在发布函数返回前有效
+typedef struct
+{
+    const char *topic;
+    const char *payload;        // JSON数组
+    size_t      len;
+    int         qos;
+    bool        retain;
+    int         messages;       // 合并的事件数
+    long long   first_ns;       // 最早一条事件进入 on_message 的时间
+    int         fill_permille;  // 填充率: 条数和字节数相对上限的较大者, 千分比
+} event_batch_t;
+
+typedef void (*event_batch_publish_t)(void *ctx, const event_batch_t *batch);
+
+typedef struct event_batcher event_batcher_t;
+
+event_batcher_t *event_batcher_create(const batch_config_t *config, event_batch_publish_t publish, void *ctx);
+void             event_batcher_destroy(event_batcher_t *batcher);
+
+// 追加一条事件, 达到上限时在调用线程上发出; 内存不足时返回-1, 该事件未被接收
+int event_batcher_add(event_batcher_t *batcher,
+                      const char      *topic,
+                      const void      *item,
+                      size_t           len,
+                      int              qos,
+                      bool             retain,
+                      long long        received_ns);
+
+// 发出等待已超过 max_delay_ms 的批, 由目标客户端的定时任务调用
+void event_batcher_flush_due(event_batcher_t *batcher, long long now_ns);
+
+// 发出全部未满的批
+void event_batcher_flush(event_batcher_t *batcher);
+
+// 尚未发出的事件数
+int event_batcher_pending(event_batcher_t *batcher);
+
+#endif
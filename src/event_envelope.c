@@ -0,0 +1,136 @@
+#include "event_envelope.h"
+
+#include <cjson/cJSON.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_scan.h"
+#include "scratch_arena.h"
+
+// JSON包装常量
+#define EVENT_JSON_OPERATION_TYPE "uploadRtd"
+#define EVENT_JSON_PROJECT_ID "X2View"
+#define EVENT_JSON_REQUEST_TYPE "wrequest"
+#define EVENT_JSON_SERIAL_NO 0
+
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
+// 与 cJSON_PrintUnformatted 按插入顺序输出的字段一致
+static const char envelope_head[] = "{\"data\":";
+static const char envelope_tail[] = ",\"operationType\":\"" EVENT_JSON_OPERATION_TYPE
+                                    "\",\"projectID\":\"" EVENT_JSON_PROJECT_ID
+                                    "\",\"requestType\":\"" EVENT_JSON_REQUEST_TYPE
+                                    "\",\"serialNo\":" STRINGIFY(EVENT_JSON_SERIAL_NO)
+                                    ",\"webtalkID\":\"";
+
+// 从topic中提取设备ID (最后一个/后面的值)
+static const char *device_id_of(const char *topic)
+{
+    const char *device_id = strrchr(topic, '/');
+    if (!device_id || !*(device_id + 1))
+    {
+        return NULL;
+    }
+    return device_id + 1;
+}
+
+event_envelope_status_t event_envelope_build_cjson(const char *topic,
+                                                   const void *payload,
+                                                   int         payloadlen,
+                                                   char      **out,
+                                                   size_t     *out_len)
+{
+    cJSON *original_data = cJSON_ParseWithLength((const char *)payload, payloadlen);
+    if (!original_data)
+    {
+        return EVENT_ENVELOPE_PARSE_ERROR;
+    }
+
+    const char *device_id = device_id_of(topic);
+    if (!device_id)
+    {
+        cJSON_Delete(original_data);
+        return EVENT_ENVELOPE_NO_DEVICE_ID;
+    }
+
+    cJSON *wrapper = cJSON_CreateObject();
+    cJSON_AddItemToObject(wrapper, "data", original_data);
+    cJSON_AddStringToObject(wrapper, "operationType", EVENT_JSON_OPERATION_TYPE);
+    cJSON_AddStringToObject(wrapper, "projectID", EVENT_JSON_PROJECT_ID);
+    cJSON_AddStringToObject(wrapper, "requestType", EVENT_JSON_REQUEST_TYPE);
+    cJSON_AddNumberToObject(wrapper, "serialNo", EVENT_JSON_SERIAL_NO);
+    cJSON_AddStringToObject(wrapper, "webtalkID", device_id);
+
+    char *message_buffer = cJSON_PrintUnformatted(wrapper);
+    cJSON_Delete(wrapper);
+    if (!message_buffer)
+    {
+        return EVENT_ENVELOPE_SERIALIZE_ERROR;
+    }
+
+    *out     = message_buffer;
+    *out_len = strlen(message_buffer);
+    return EVENT_ENVELOPE_OK;
+}
+
+event_envelope_status_t event_envelope_build(const char  *topic,
+                                             const void  *payload,
+                                             int          payloadlen,
+                                             const char **out,
+                                             size_t      *out_len)
+{
+    if (!json_is_canonical((const char *)payload, payloadlen))
+    {
+        // 非规范形式交给 cJSON 处理, 保证输出与原实现一致
+        char                   *message_buffer;
+        event_envelope_status_t status = event_envelope_build_cjson(topic, payload, payloadlen,
+                                                                    &message_buffer, out_len);
+        if (status != EVENT_ENVELOPE_OK)
+        {
+            return status;
+        }
+        char *buffer = scratch_output(*out_len);
+        if (buffer)
+        {
+            memcpy(buffer, message_buffer, *out_len);
+        }
+        cJSON_free(message_buffer);
+        if (!buffer)
+        {
+            return EVENT_ENVELOPE_SERIALIZE_ERROR;
+        }
+        *out = buffer;
+        return EVENT_ENVELOPE_OK;
+    }
+
+    const char *device_id = device_id_of(topic);
+    if (!device_id)
+    {
+        return EVENT_ENVELOPE_NO_DEVICE_ID;
+    }
+
+    size_t id_len = strlen(device_id);
+    size_t size   = sizeof(envelope_head) - 1 + (size_t)payloadlen + sizeof(envelope_tail) - 1
+                  + json_escaped_max(id_len) + 2;
+    char *buffer = scratch_output(size);
+    if (!buffer)
+    {
+        return EVENT_ENVELOPE_SERIALIZE_ERROR;
+    }
+
+    char *p = buffer;
+    memcpy(p, envelope_head, sizeof(envelope_head) - 1);
+    p += sizeof(envelope_head) - 1;
+    memcpy(p, payload, (size_t)payloadlen);
+    p += payloadlen;
+    memcpy(p, envelope_tail, sizeof(envelope_tail) - 1);
+    p += sizeof(envelope_tail) - 1;
+    p += json_escape(p, device_id, id_len);
+    *p++ = '"';
+    *p++ = '}';
+
+    *out     = buffer;
+    *out_len = (size_t)(p - buffer);
+    return EVENT_ENVELOPE_OK;
+}
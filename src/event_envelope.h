@@ -0,0 +1,32 @@
+#ifndef EVENT_ENVELOPE_H
+#define EVENT_ENVELOPE_H
+
+#include <stddef.h>
+
+// 属性事件包装结果
+typedef enum
+{
+    EVENT_ENVELOPE_OK = 0,
+    EVENT_ENVELOPE_PARSE_ERROR,      // 负载不是合法JSON
+    EVENT_ENVELOPE_NO_DEVICE_ID,     // 无法从主题中提取设备ID
+    EVENT_ENVELOPE_SERIALIZE_ERROR
+} event_envelope_status_t;
+
+// 构建属性事件包装:
+// {"data":<负载>,"operationType":...,"projectID":...,"requestType":...,"serialNo":0,"webtalkID":<设备ID>}
+// 负载为规范紧凑JSON时直接拼接原始字节, 否则退回 cJSON 路径, 两者输出逐字节一致。
+// 结果写入线程私有的复用缓冲区, 在本线程下一次调用前有效。
+event_envelope_status_t event_envelope_build(const char  *topic,
+                                             const void  *payload,
+                                             int          payloadlen,
+                                             const char **out,
+                                             size_t      *out_len);
+
+// 原有的 cJSON 解析-包装-序列化实现, 返回的缓冲区由调用方 cJSON_free
+event_envelope_status_t event_envelope_build_cjson(const char *topic,
+                                                   const void *payload,
+                                                   int         payloadlen,
+                                                   char      **out,
+                                                   size_t     *out_len);
+
+#endif
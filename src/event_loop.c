@@ -0,0 +1,439 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "logger.h"
+#include "time_util.h"
+
+// 其他线程对循环的请求
+typedef enum
+{
+    REQUEST_ADD = 0,
+    REQUEST_REMOVE = 1
+} request_op_t;
+
+struct event_loop
+{
+    int             index;
+    int             epoll_fd;
+    int             wake_fd;
+    atomic_bool     wake_pending;   // 已写入 eventfd 尚未处理, 合并重复唤醒
+    volatile int    thread_running;
+    pthread_t       thread;
+    int             threaded;
+    mqtt_client_t **clients;
+    int             count;
+    int             capacity;
+    long long       next_tick;
+
+    // 其他线程请求加入/移除客户端: 循环运行时由循环线程处理, 请求方在 cond 上等待结果
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    int             active;           // 循环正在某个线程上运行
+    atomic_bool     request_pending;
+    mqtt_client_t  *request_client;
+    request_op_t    request_op;
+    int             request_result;
+};
+
+event_loop_t *event_loop_create(int index)
+{
+    event_loop_t *loop = calloc(1, sizeof(event_loop_t));
+    if (!loop)
+    {
+        return NULL;
+    }
+    loop->index    = index;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->wake_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    atomic_init(&loop->wake_pending, false);
+    atomic_init(&loop->request_pending, false);
+    pthread_mutex_init(&loop->mutex, NULL);
+    pthread_cond_init(&loop->cond, NULL);
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (loop->epoll_fd < 0 || loop->wake_fd < 0
+        || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) != 0)
+    {
+        LOG_ERROR("Failed to create event loop %d: %s", index, strerror(errno));
+        event_loop_destroy(loop);
+        return NULL;
+    }
+    return loop;
+}
+
+void event_loop_destroy(event_loop_t *loop)
+{
+    if (!loop)
+    {
+        return;
+    }
+    if (loop->epoll_fd >= 0)
+    {
+        close(loop->epoll_fd);
+    }
+    if (loop->wake_fd >= 0)
+    {
+        close(loop->wake_fd);
+    }
+    pthread_mutex_destroy(&loop->mutex);
+    pthread_cond_destroy(&loop->cond);
+    free(loop->clients);
+    free(loop);
+}
+
+static int attach_client(event_loop_t *loop, mqtt_client_t *client)
+{
+    if (loop->count == loop->capacity)
+    {
+        int             capacity = loop->capacity ? loop->capacity * 2 : 16;
+        mqtt_client_t **clients  = realloc(loop->clients, sizeof(mqtt_client_t *) * capacity);
+        if (!clients)
+        {
+            return -1;
+        }
+        loop->clients  = clients;
+        loop->capacity = capacity;
+    }
+
+    // 发布只入队, 由循环线程写出 (否则其他线程的 mosquitto_publish 会直接写套接字)
+    mosquitto_threaded_set(client->mosq, true);
+    client->loop        = loop;
+    client->loop_fd     = -1;
+    client->loop_events = 0;
+    loop->clients[loop->count++] = client;
+    return 0;
+}
+
+static void detach_client(event_loop_t *loop, mqtt_client_t *client)
+{
+    for (int i = 0; i < loop->count; i++)
+    {
+        if (loop->clients[i] == client)
+        {
+            loop->clients[i] = loop->clients[--loop->count];
+            break;
+        }
+    }
+    if (client->loop_fd >= 0)
+    {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client->loop_fd, NULL);
+    }
+    client->loop        = NULL;
+    client->loop_fd     = -1;
+    client->loop_events = 0;
+}
+
+// 在持有 mutex 时执行挂起的请求并通知请求方
+static void handle_request(event_loop_t *loop)
+{
+    if (!loop->request_client)
+    {
+        return;
+    }
+    if (loop->request_op == REQUEST_REMOVE)
+    {
+        detach_client(loop, loop->request_client);
+        loop->request_result = 0;
+    }
+    else
+    {
+        loop->request_result = attach_client(loop, loop->request_client);
+    }
+    loop->request_client = NULL;
+    atomic_store_explicit(&loop->request_pending, false, memory_order_relaxed);
+    pthread_cond_broadcast(&loop->cond);
+}
+
+// 循环未运行时直接执行, 否则交给循环线程并等待
+static int submit_request(event_loop_t *loop, mqtt_client_t *client, request_op_t op)
+{
+    pthread_mutex_lock(&loop->mutex);
+    while (loop->request_client)
+    {
+        pthread_cond_wait(&loop->cond, &loop->mutex);
+    }
+    loop->request_client = client;
+    loop->request_op     = op;
+    if (loop->active)
+    {
+        atomic_store_explicit(&loop->request_pending, true, memory_order_release);
+        event_loop_wake(loop);
+        while (loop->request_client == client)
+        {
+            pthread_cond_wait(&loop->cond, &loop->mutex);
+        }
+    }
+    else
+    {
+        handle_request(loop);
+    }
+    int result = loop->request_result;
+    pthread_mutex_unlock(&loop->mutex);
+    return result;
+}
+
+int event_loop_add(event_loop_t *loop, mqtt_client_t *client)
+{
+    return submit_request(loop, client, REQUEST_ADD);
+}
+
+void event_loop_remove(event_loop_t *loop, mqtt_client_t *client)
+{
+    submit_request(loop, client, REQUEST_REMOVE);
+}
+
+int event_loop_client_count(event_loop_t *loop)
+{
+    pthread_mutex_lock(&loop->mutex);
+    int count = loop->count;
+    pthread_mutex_unlock(&loop->mutex);
+    return count;
+}
+
+void event_loop_wake(event_loop_t *loop)
+{
+    if (atomic_exchange_explicit(&loop->wake_pending, true, memory_order_acq_rel))
+    {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(loop->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        atomic_store_explicit(&loop->wake_pending, false, memory_order_release);
+    }
+}
+
+// 使 epoll 关注的事件与连接当前状态一致: 套接字在重连后会变化, 有待发数据时关注可写
+static void watch_client(event_loop_t *loop, mqtt_client_t *client)
+{
+    int fd = mosquitto_socket(client->mosq);
+    if (fd != client->loop_fd)
+    {
+        // 旧套接字已被 libmosquitto 关闭, 关闭时内核已将其移出 epoll
+        if (client->loop_fd >= 0)
+        {
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client->loop_fd, NULL);
+        }
+        client->loop_fd     = -1;
+        client->loop_events = 0;
+        if (fd < 0)
+        {
+            return;
+        }
+    }
+    else if (fd < 0)
+    {
+        return;
+    }
+
+    unsigned int events = EPOLLIN | (mosquitto_want_write(client->mosq) ? EPOLLOUT : 0);
+    if (client->loop_fd == fd && events == client->loop_events)
+    {
+        return;
+    }
+
+    struct epoll_event event = {.events = events, .data.ptr = client};
+    int                op    = client->loop_fd == fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(loop->epoll_fd, op, fd, &event) != 0
+        && !(op == EPOLL_CTL_ADD && errno == EEXIST
+             && epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0))
+    {
+        LOG_ERROR("Failed to watch socket of %s:%d: %s", client->ip, client->port, strerror(errno));
+        return;
+    }
+    client->loop_fd     = fd;
+    client->loop_events = events;
+}
+
+// 读完套接字中已到达的数据。mosquitto_loop_read 每次只处理一个报文 (QoS 0 时),
+// 与 libmosquitto 自身的判断一样, 以 errno 为 EAGAIN 判断数据已读完
+static void read_client(mqtt_client_t *client)
+{
+    for (int i = 0; i < EVENT_LOOP_READ_BATCH; i++)
+    {
+        errno  = 0;
+        int rc = mosquitto_loop_read(client->mosq, 1);
+        if (rc != MOSQ_ERR_SUCCESS)
+        {
+            LOG_DEBUG("Read from %s:%d failed: %s", client->ip, client->port, mosquitto_strerror(rc));
+            return;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return;
+        }
+    }
+}
+
+static void write_client(mqtt_client_t *client)
+{
+    int rc = mosquitto_loop_write(client->mosq, 1);
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+        LOG_DEBUG("Write to %s:%d failed: %s", client->ip, client->port, mosquitto_strerror(rc));
+    }
+}
+
+// 断开后按 1, 2, 4 ... RECONNECT_DELAY 秒的间隔重连, 与线程模式的重连策略一致
+static void check_reconnect(mqtt_client_t *client, long long now_ms)
+{
+    if (mosquitto_socket(client->mosq) >= 0)
+    {
+        return;
+    }
+    if (client->reconnect_at == 0)
+    {
+        client->reconnect_at    = now_ms + client->reconnect_delay * 1000LL;
+        client->reconnect_delay = client->reconnect_delay * 2 > RECONNECT_DELAY
+                                      ? RECONNECT_DELAY
+                                      : client->reconnect_delay * 2;
+        return;
+    }
+    if (now_ms < client->reconnect_at)
+    {
+        return;
+    }
+
+    client->reconnect_at = 0;
+    int rc = mosquitto_reconnect_async(client->mosq);
+    if (rc == MOSQ_ERR_SUCCESS)
+    {
+        LOG_INFO("Reconnecting to %s:%d...", client->ip, client->port);
+    }
+    else
+    {
+        LOG_ERROR("Reconnect to %s:%d failed: %s", client->ip, client->port, mosquitto_strerror(rc));
+    }
+}
+
+static void tick(event_loop_t *loop, long long now_ms)
+{
+    for (int i = 0; i < loop->count; i++)
+    {
+        mqtt_client_t *client = loop->clients[i];
+        if (mosquitto_socket(client->mosq) >= 0)
+        {
+            mosquitto_loop_misc(client->mosq);   // 保活: 按需发送 PINGREQ, 超时则断开
+        }
+        check_reconnect(client, now_ms);
+        mqtt_client_tick(client, now_ms);
+    }
+    loop->next_tick = now_ms + ENGINE_TICK_MS;
+}
+
+static void loop_once(event_loop_t *loop)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    if (atomic_load_explicit(&loop->request_pending, memory_order_acquire))
+    {
+        pthread_mutex_lock(&loop->mutex);
+        handle_request(loop);
+        pthread_mutex_unlock(&loop->mutex);
+    }
+
+    long long now_ms  = monotonic_ms();
+    int       timeout = loop->next_tick > now_ms ? (int)(loop->next_tick - now_ms) : 0;
+    int       ready   = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout);
+
+    for (int i = 0; i < ready; i++)
+    {
+        mqtt_client_t *client = (mqtt_client_t *)events[i].data.ptr;
+        if (!client)
+        {
+            uint64_t count;
+            atomic_store_explicit(&loop->wake_pending, false, memory_order_release);
+            while (read(loop->wake_fd, &count, sizeof(count)) > 0)
+            {
+            }
+            continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        {
+            read_client(client);
+        }
+        if ((events[i].events & EPOLLOUT) && mosquitto_socket(client->mosq) >= 0)
+        {
+            write_client(client);
+        }
+    }
+
+    now_ms = monotonic_ms();
+    if (now_ms >= loop->next_tick)
+    {
+        tick(loop, now_ms);
+    }
+
+    // 写出本轮回调和其他线程入队的报文, 写不完的等待可写事件
+    for (int i = 0; i < loop->count; i++)
+    {
+        mqtt_client_t *client = loop->clients[i];
+        if (mosquitto_socket(client->mosq) >= 0 && mosquitto_want_write(client->mosq))
+        {
+            write_client(client);
+        }
+        watch_client(loop, client);
+    }
+}
+
+void event_loop_run(event_loop_t *loop, volatile int *running)
+{
+    pthread_mutex_lock(&loop->mutex);
+    loop->active = 1;
+    pthread_mutex_unlock(&loop->mutex);
+
+    LOG_INFO("Event loop %d running with %d clients", loop->index, loop->count);
+    loop->next_tick = monotonic_ms();
+    while (*running)
+    {
+        loop_once(loop);
+    }
+
+    // 退出后新的请求由请求方直接执行
+    pthread_mutex_lock(&loop->mutex);
+    loop->active = 0;
+    handle_request(loop);
+    pthread_mutex_unlock(&loop->mutex);
+}
+
+static void *loop_thread(void *arg)
+{
+    event_loop_t *loop = (event_loop_t *)arg;
+    event_loop_run(loop, &loop->thread_running);
+    return NULL;
+}
+
+int event_loop_start(event_loop_t *loop)
+{
+    loop->thread_running = 1;
+    if (pthread_create(&loop->thread, NULL, loop_thread, loop) != 0)
+    {
+        loop->thread_running = 0;
+        return -1;
+    }
+    loop->threaded = 1;
+    return 0;
+}
+
+void event_loop_stop(event_loop_t *loop)
+{
+    if (!loop->threaded)
+    {
+        return;
+    }
+    loop->thread_running = 0;
+    event_loop_wake(loop);
+    pthread_join(loop->thread, NULL);
+    loop->threaded = 0;
+}
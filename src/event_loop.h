@@ -0,0 +1,33 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "mqtt_engine.h"
+
+// epoll 事件循环: 一个线程驱动多个 mosquitto 连接 (engine.mode = "epoll")。
+// 每个客户端固定归属一个循环, 其收包、发包、保活、重连和积压重放都在该循环线程上执行;
+// 其他线程的发布只进入 libmosquitto 的发送队列, 再通过 eventfd 唤醒所属循环写出。
+
+typedef struct event_loop event_loop_t;
+
+event_loop_t *event_loop_create(int index);
+void          event_loop_destroy(event_loop_t *loop);
+
+// 把客户端加入循环 / 从循环移除。循环运行时由循环线程在两轮之间执行, 调用方等待完成;
+// 移除返回后循环不再访问该客户端
+int  event_loop_add(event_loop_t *loop, mqtt_client_t *client);
+void event_loop_remove(event_loop_t *loop, mqtt_client_t *client);
+
+// 循环当前驱动的客户端数
+int event_loop_client_count(event_loop_t *loop);
+
+// 在当前线程运行, 直到 *running 为0
+void event_loop_run(event_loop_t *loop, volatile int *running);
+
+// 在独立线程中运行, event_loop_stop 停止并回收线程
+int  event_loop_start(event_loop_t *loop);
+void event_loop_stop(event_loop_t *loop);
+
+// 通知循环有待写出的数据, 可在任意线程调用
+void event_loop_wake(event_loop_t *loop);
+
+#endif
@@ -0,0 +1,98 @@
+#include "hash_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_INDEX_MIN_CAPACITY 16
+
+static unsigned int hash_key(const char *key, int tag)
+{
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++)
+    {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return (hash ^ (unsigned int)tag) * 16777619u;
+}
+
+static hash_slot_t *find_slot(hash_slot_t *slots, size_t capacity, const char *key, int tag, unsigned int hash)
+{
+    size_t mask = capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        hash_slot_t *slot = &slots[i];
+        if (!slot->key
+            || (slot->hash == hash && slot->tag == tag && strcmp(slot->key, key) == 0))
+        {
+            return slot;
+        }
+    }
+}
+
+// 负载因子保持在 1/2 以下
+static int grow(hash_index_t *index)
+{
+    size_t       capacity = index->capacity ? index->capacity * 2 : HASH_INDEX_MIN_CAPACITY;
+    hash_slot_t *slots    = calloc(capacity, sizeof(hash_slot_t));
+    if (!slots)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < index->capacity; i++)
+    {
+        hash_slot_t *old = &index->slots[i];
+        if (old->key)
+        {
+            *find_slot(slots, capacity, old->key, old->tag, old->hash) = *old;
+        }
+    }
+    free(index->slots);
+    index->slots    = slots;
+    index->capacity = capacity;
+    return 0;
+}
+
+void hash_index_init(hash_index_t *index)
+{
+    index->slots    = NULL;
+    index->capacity = 0;
+    index->count    = 0;
+}
+
+void hash_index_destroy(hash_index_t *index)
+{
+    free(index->slots);
+    hash_index_init(index);
+}
+
+int hash_index_insert(hash_index_t *index, const char *key, int tag, void *value)
+{
+    if ((index->count + 1) * 2 > index->capacity && grow(index) != 0)
+    {
+        return -1;
+    }
+
+    unsigned int hash = hash_key(key, tag);
+    hash_slot_t *slot = find_slot(index->slots, index->capacity, key, tag, hash);
+    if (slot->key)
+    {
+        return 1;
+    }
+    slot->key   = key;
+    slot->tag   = tag;
+    slot->hash  = hash;
+    slot->value = value;
+    index->count++;
+    return 0;
+}
+
+void *hash_index_find(const hash_index_t *index, const char *key, int tag)
+{
+    if (index->count == 0)
+    {
+        return NULL;
+    }
+    hash_slot_t *slot = find_slot(index->slots, index->capacity, key, tag, hash_key(key, tag));
+    return slot->key ? slot->value : NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <stddef.h>
+
+// 字符串键的哈希索引 (开放寻址, 线性探测), 用于按名称或 (主机, 端口) 查找客户端和规则。
+// 键由 字符串 + 整数标签 组成 (按名称查找时标签为0); 键字符串不复制,
+// 调用方须保证其在索引生命周期内有效。
+
+typedef struct
+{
+    const char  *key;
+    int          tag;
+    unsigned int hash;
+    void        *value;
+} hash_slot_t;
+
+typedef struct
+{
+    hash_slot_t *slots;
+    size_t       capacity;   // 2的幂
+    size_t       count;
+} hash_index_t;
+
+void hash_index_init(hash_index_t *index);
+void hash_index_destroy(hash_index_t *index);
+
+// 插入键值, 返回0成功, 1表示键已存在 (保留原值), -1表示内存不足
+int hash_index_insert(hash_index_t *index, const char *key, int tag, void *value);
+
+void *hash_index_find(const hash_index_t *index, const char *key, int tag);
+
+#endif
@@ -0,0 +1,96 @@
+#include "inflight.h"
+
+#include <stdlib.h>
+
+int inflight_init(inflight_t *inflight)
+{
+    // 按需分配物理页: 只有用过的标识符所在的页才占用内存
+    inflight->sent_ns = calloc(INFLIGHT_SLOTS, sizeof(atomic_llong));
+    return inflight->sent_ns ? 0 : -1;
+}
+
+void inflight_destroy(inflight_t *inflight)
+{
+    free(inflight->sent_ns);
+    inflight->sent_ns = NULL;
+}
+
+inflight_track_t inflight_track(inflight_t *inflight, int mid, long long sent_ns, long long *latency)
+{
+    if (!inflight->sent_ns)
+    {
+        return INFLIGHT_TRACKED;
+    }
+    atomic_llong *slot = &inflight->sent_ns[mid & (INFLIGHT_SLOTS - 1)];
+    if (sent_ns <= 0)
+    {
+        sent_ns = 1;
+    }
+    long long old = atomic_load_explicit(slot, memory_order_relaxed);
+    for (;;)
+    {
+        if (old < 0 && -old >= sent_ns)
+        {
+            // 本次发布开始后收到的确认, 即本次发布的确认
+            if (atomic_compare_exchange_weak_explicit(slot, &old, 0, memory_order_relaxed, memory_order_relaxed))
+            {
+                *latency = -old - sent_ns;
+                return INFLIGHT_ACKED_EARLY;
+            }
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(slot, &old, sent_ns, memory_order_relaxed, memory_order_relaxed))
+        {
+            return old > 0 ? INFLIGHT_REPLACED : INFLIGHT_TRACKED;
+        }
+    }
+}
+
+long long inflight_complete(inflight_t *inflight, int mid, long long now_ns)
+{
+    if (!inflight->sent_ns)
+    {
+        return -1;
+    }
+    atomic_llong *slot = &inflight->sent_ns[mid & (INFLIGHT_SLOTS - 1)];
+    if (now_ns <= 0)
+    {
+        now_ns = 1;
+    }
+    long long sent = atomic_load_explicit(slot, memory_order_relaxed);
+    for (;;)
+    {
+        if (sent > 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(slot, &sent, 0, memory_order_relaxed, memory_order_relaxed))
+            {
+                return now_ns > sent ? now_ns - sent : 0;
+            }
+            continue;
+        }
+        // 记录尚未写入 (或为 QoS 0 发布), 留下确认时间
+        if (atomic_compare_exchange_weak_explicit(slot, &sent, -now_ns, memory_order_relaxed, memory_order_relaxed))
+        {
+            return -1;
+        }
+    }
+}
+
+long inflight_reset(inflight_t *inflight)
+{
+    if (!inflight->sent_ns)
+    {
+        return 0;
+    }
+    long cleared = 0;
+    for (int i = 0; i < INFLIGHT_SLOTS; i++)
+    {
+        // 只写非空槽位, 未用过的页保持未分配
+        if (atomic_load_explicit(&inflight->sent_ns[i], memory_order_relaxed) != 0
+            && atomic_exchange_explicit(&inflight->sent_ns[i], 0, memory_order_relaxed) > 0)
+        {
+            cleared++;
+        }
+    }
+    return cleared;
+}
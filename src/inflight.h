@@ -0,0 +1,39 @@
+#ifndef INFLIGHT_H
+#define INFLIGHT_H
+
+#include <stdatomic.h>
+
+// 等待确认的 QoS 1/2 发布: 按报文标识符 (16位) 记录发出时间, 收到确认 (PUBACK/PUBCOMP) 时算出确认延迟。
+// 发布可在任意线程进行, 确认在驱动该连接的线程上处理, 每个标识符一个原子槽位, 无锁。
+// 标识符在 mosquitto_publish 返回后才知道, 确认可能先于记录到达: 此时槽位中留下确认时间 (取负),
+// 记录时据此直接完成。QoS 0 的发布完成时 libmosquitto 也会回调, 同样留下确认时间, 但早于下一次
+// 使用该标识符的发布开始的时间, 记录时忽略。
+
+#define INFLIGHT_SLOTS 65536
+
+typedef struct
+{
+    atomic_llong *sent_ns;   // 按报文标识符: >0 为发出时间, <0 为未记录时收到确认的时间, 0 为空
+} inflight_t;
+
+typedef enum
+{
+    INFLIGHT_TRACKED = 0,
+    INFLIGHT_REPLACED,       // 覆盖了同一标识符上未完成的旧记录 (标识符已循环一轮), 旧记录应视为已完成
+    INFLIGHT_ACKED_EARLY     // 确认已先到达, 发布已完成
+} inflight_track_t;
+
+int  inflight_init(inflight_t *inflight);
+void inflight_destroy(inflight_t *inflight);
+
+// 记录一条已交给 libmosquitto 的 QoS 1/2 发布, sent_ns 为调用 mosquitto_publish 之前的时间。
+// 返回 INFLIGHT_ACKED_EARLY 时 *latency 为确认延迟 (纳秒)
+inflight_track_t inflight_track(inflight_t *inflight, int mid, long long sent_ns, long long *latency);
+
+// 发布完成: 返回确认延迟 (纳秒), 该标识符没有记录时留下确认时间并返回-1
+long long inflight_complete(inflight_t *inflight, int mid, long long now_ns);
+
+// 清空全部记录 (连接断开时), 返回清除的未完成记录数
+long inflight_reset(inflight_t *inflight);
+
+#endif
@@ -0,0 +1,613 @@
+#include "json_scan.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef const unsigned char *cursor_t;
+
+static cursor_t scan_value(cursor_t p, cursor_t end, int depth);
+
+static int hex_value(unsigned char c)
+{
+    // cJSON 输出小写十六进制, 大写形式不是规范形式
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// p 指向起始引号, 返回结束引号之后的位置
+static cursor_t scan_string(cursor_t p, cursor_t end)
+{
+    for (p++; p < end; p++)
+    {
+        unsigned char c = *p;
+        if (c == '"')
+        {
+            return p + 1;
+        }
+        if (c < 0x20)
+        {
+            return NULL;   // 原始控制字符会被 cJSON 转义输出
+        }
+        if (c != '\\')
+        {
+            continue;
+        }
+
+        if (++p >= end)
+        {
+            return NULL;
+        }
+        switch (*p)
+        {
+        case '"':
+        case '\\':
+        case 'b':
+        case 'f':
+        case 'n':
+        case 'r':
+        case 't':
+            break;
+        case 'u':
+        {
+            // 只有 cJSON 自身会输出的 \u00XX (其余控制字符) 是规范形式
+            if (end - p < 5)
+            {
+                return NULL;
+            }
+            int code = 0;
+            for (int i = 1; i <= 4; i++)
+            {
+                int v = hex_value(p[i]);
+                if (v < 0)
+                {
+                    return NULL;
+                }
+                code = code * 16 + v;
+            }
+            if (code == 0 || code >= 0x20 || code == '\b' || code == '\f' || code == '\n'
+                || code == '\r' || code == '\t')
+            {
+                return NULL;
+            }
+            p += 4;
+            break;
+        }
+        default:
+            return NULL;   // 包括 "\/", cJSON 会输出为 "/"
+        }
+    }
+    return NULL;
+}
+
+// 只接受 int 范围内的整数, 小数和指数由 cJSON 重新格式化, 走慢路径
+static cursor_t scan_number(cursor_t p, cursor_t end)
+{
+    int negative = 0;
+    if (*p == '-')
+    {
+        negative = 1;
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9')
+    {
+        return NULL;
+    }
+
+    cursor_t digits = p;
+    if (*p == '0')
+    {
+        p++;
+        if (negative)
+        {
+            return NULL;   // -0 输出为 0
+        }
+    }
+    else
+    {
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            p++;
+        }
+    }
+    if (p - digits > 9)
+    {
+        return NULL;
+    }
+    if (p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E'))
+    {
+        return NULL;
+    }
+    return p;
+}
+
+static cursor_t scan_literal(cursor_t p, cursor_t end, const char *literal)
+{
+    size_t len = strlen(literal);
+    if ((size_t)(end - p) < len || memcmp(p, literal, len) != 0)
+    {
+        return NULL;
+    }
+    return p + len;
+}
+
+static cursor_t scan_container(cursor_t p, cursor_t end, int depth, unsigned char close)
+{
+    if (depth >= JSON_SCAN_MAX_DEPTH)
+    {
+        return NULL;
+    }
+    p++;
+    if (p < end && *p == close)
+    {
+        return p + 1;
+    }
+
+    while (p && p < end)
+    {
+        if (close == '}')
+        {
+            if (*p != '"')
+            {
+                return NULL;
+            }
+            p = scan_string(p, end);
+            if (!p || p >= end || *p != ':')
+            {
+                return NULL;
+            }
+            p++;
+        }
+
+        p = scan_value(p, end, depth + 1);
+        if (!p || p >= end)
+        {
+            return NULL;
+        }
+        if (*p == close)
+        {
+            return p + 1;
+        }
+        if (*p != ',')
+        {
+            return NULL;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static cursor_t scan_value(cursor_t p, cursor_t end, int depth)
+{
+    if (p >= end)
+    {
+        return NULL;
+    }
+
+    switch (*p)
+    {
+    case '{':
+        return scan_container(p, end, depth, '}');
+    case '[':
+        return scan_container(p, end, depth, ']');
+    case '"':
+        return scan_string(p, end);
+    case 't':
+        return scan_literal(p, end, "true");
+    case 'f':
+        return scan_literal(p, end, "false");
+    case 'n':
+        return scan_literal(p, end, "null");
+    default:
+        return scan_number(p, end);
+    }
+}
+
+/* ---- 严格 RFC 8259 扫描 ---- */
+
+static int hex_any(unsigned char c)
+{
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return hex_value(c);
+}
+
+// 解析 \uXXXX (p 指向'\'), 成功返回码点并把 *next 置于序列之后
+static long parse_unicode_escape(cursor_t p, cursor_t end, cursor_t *next)
+{
+    long code = 0;
+    if (end - p < 6 || p[0] != '\\' || p[1] != 'u')
+    {
+        return -1;
+    }
+    for (int i = 2; i < 6; i++)
+    {
+        int v = hex_any(p[i]);
+        if (v < 0)
+        {
+            return -1;
+        }
+        code = code * 16 + v;
+    }
+    *next = p + 6;
+    return code;
+}
+
+// 解析一个转义序列 (p 指向'\'), 返回码点; 代理对按 cJSON 规则组合
+static long parse_escape(cursor_t p, cursor_t end, cursor_t *next)
+{
+    if (end - p < 2)
+    {
+        return -1;
+    }
+    *next = p + 2;
+    switch (p[1])
+    {
+    case '"':
+    case '\\':
+    case '/':
+        return p[1];
+    case 'b':
+        return '\b';
+    case 'f':
+        return '\f';
+    case 'n':
+        return '\n';
+    case 'r':
+        return '\r';
+    case 't':
+        return '\t';
+    case 'u':
+        break;
+    default:
+        return -1;
+    }
+
+    long first = parse_unicode_escape(p, end, next);
+    if (first < 0 || (first >= 0xDC00 && first <= 0xDFFF))
+    {
+        return -1;
+    }
+    if (first < 0xD800 || first > 0xDBFF)
+    {
+        return first;
+    }
+    long second = parse_unicode_escape(*next, end, next);
+    if (second < 0xDC00 || second > 0xDFFF)
+    {
+        return -1;
+    }
+    return 0x10000 + (((first & 0x3FF) << 10) | (second & 0x3FF));
+}
+
+static int encode_utf8(long code, unsigned char *out)
+{
+    if (code < 0x80)
+    {
+        out[0] = (unsigned char)code;
+        return 1;
+    }
+    if (code < 0x800)
+    {
+        out[0] = (unsigned char)(0xC0 | (code >> 6));
+        out[1] = (unsigned char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000)
+    {
+        out[0] = (unsigned char)(0xE0 | (code >> 12));
+        out[1] = (unsigned char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (unsigned char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (unsigned char)(0xF0 | (code >> 18));
+    out[1] = (unsigned char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (unsigned char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (unsigned char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+const char *json_unescape(const char *p, const char *end, char *out, size_t cap, int *truncated)
+{
+    cursor_t c   = (cursor_t)p;
+    cursor_t e   = (cursor_t)end;
+    size_t   len = 0;
+    int      terminated = 0;   // 已遇到转义得到的'\0'
+
+    *truncated = 0;
+    if (c >= e || *c != '"')
+    {
+        return NULL;
+    }
+    for (c++; c < e;)
+    {
+        unsigned char bytes[4];
+        int           count;
+
+        if (*c == '"')
+        {
+            out[len] = '\0';
+            return (const char *)(c + 1);
+        }
+        if (*c < 0x20)
+        {
+            return NULL;
+        }
+        if (*c == '\\')
+        {
+            long code = parse_escape(c, e, &c);
+            if (code < 0)
+            {
+                return NULL;
+            }
+            count = encode_utf8(code, bytes);
+        }
+        else
+        {
+            bytes[0] = *c++;
+            count    = 1;
+        }
+
+        for (int i = 0; i < count && !terminated; i++)
+        {
+            if (bytes[i] == '\0')
+            {
+                terminated = 1;
+            }
+            else if (len + 1 < cap)
+            {
+                out[len++] = (char)bytes[i];
+            }
+            else
+            {
+                *truncated = 1;
+            }
+        }
+    }
+    return NULL;
+}
+
+static cursor_t skip_string_strict(cursor_t p, cursor_t end)
+{
+    for (p++; p < end;)
+    {
+        if (*p == '"')
+        {
+            return p + 1;
+        }
+        if (*p < 0x20)
+        {
+            return NULL;
+        }
+        if (*p == '\\')
+        {
+            if (parse_escape(p, end, &p) < 0)
+            {
+                return NULL;
+            }
+            continue;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+// cJSON 只读取数字的前63个字符, 更长的数字交给 cJSON 自行判定
+#define JSON_NUMBER_MAX 63
+
+static cursor_t skip_number_strict(cursor_t p, cursor_t end)
+{
+    cursor_t start = p;
+    if (p < end && *p == '-')
+    {
+        p++;
+    }
+    if (p >= end || !isdigit(*p))
+    {
+        return NULL;
+    }
+    if (*p == '0')
+    {
+        p++;
+    }
+    else
+    {
+        while (p < end && isdigit(*p))
+        {
+            p++;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+        if (p >= end || !isdigit(*p))
+        {
+            return NULL;
+        }
+        while (p < end && isdigit(*p))
+        {
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+        {
+            p++;
+        }
+        if (p >= end || !isdigit(*p))
+        {
+            return NULL;
+        }
+        while (p < end && isdigit(*p))
+        {
+            p++;
+        }
+    }
+    if (p - start > JSON_NUMBER_MAX)
+    {
+        return NULL;
+    }
+    return p;
+}
+
+const char *json_skip_ws(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+    {
+        p++;
+    }
+    return p;
+}
+
+static cursor_t skip_value_strict(cursor_t p, cursor_t end, int depth);
+
+static cursor_t skip_container_strict(cursor_t p, cursor_t end, int depth, unsigned char close)
+{
+    if (depth >= JSON_SCAN_MAX_DEPTH)
+    {
+        return NULL;
+    }
+    p = (cursor_t)json_skip_ws((const char *)p + 1, (const char *)end);
+    if (p < end && *p == close)
+    {
+        return p + 1;
+    }
+
+    while (p && p < end)
+    {
+        if (close == '}')
+        {
+            if (*p != '"')
+            {
+                return NULL;
+            }
+            p = skip_string_strict(p, end);
+            if (!p)
+            {
+                return NULL;
+            }
+            p = (cursor_t)json_skip_ws((const char *)p, (const char *)end);
+            if (p >= end || *p != ':')
+            {
+                return NULL;
+            }
+            p++;
+        }
+
+        p = skip_value_strict(p, end, depth + 1);
+        if (!p)
+        {
+            return NULL;
+        }
+        p = (cursor_t)json_skip_ws((const char *)p, (const char *)end);
+        if (p >= end)
+        {
+            return NULL;
+        }
+        if (*p == close)
+        {
+            return p + 1;
+        }
+        if (*p != ',')
+        {
+            return NULL;
+        }
+        p = (cursor_t)json_skip_ws((const char *)p + 1, (const char *)end);
+    }
+    return NULL;
+}
+
+static cursor_t skip_value_strict(cursor_t p, cursor_t end, int depth)
+{
+    p = (cursor_t)json_skip_ws((const char *)p, (const char *)end);
+    if (p >= end)
+    {
+        return NULL;
+    }
+
+    switch (*p)
+    {
+    case '{':
+        return skip_container_strict(p, end, depth, '}');
+    case '[':
+        return skip_container_strict(p, end, depth, ']');
+    case '"':
+        return skip_string_strict(p, end);
+    case 't':
+        return scan_literal(p, end, "true");
+    case 'f':
+        return scan_literal(p, end, "false");
+    case 'n':
+        return scan_literal(p, end, "null");
+    default:
+        return skip_number_strict(p, end);
+    }
+}
+
+const char *json_skip_value(const char *p, const char *end)
+{
+    return (const char *)skip_value_strict((cursor_t)p, (cursor_t)end, 0);
+}
+
+int json_is_canonical(const char *json, size_t len)
+{
+    cursor_t begin = (cursor_t)json;
+    cursor_t end   = begin + len;
+    return scan_value(begin, end, 0) == end;
+}
+
+size_t json_escape(char *out, const char *in, size_t len)
+{
+    char *o = out;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)in[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+        {
+            *o++ = (char)c;
+            continue;
+        }
+
+        *o++ = '\\';
+        switch (c)
+        {
+        case '"':
+            *o++ = '"';
+            break;
+        case '\\':
+            *o++ = '\\';
+            break;
+        case '\b':
+            *o++ = 'b';
+            break;
+        case '\f':
+            *o++ = 'f';
+            break;
+        case '\n':
+            *o++ = 'n';
+            break;
+        case '\r':
+            *o++ = 'r';
+            break;
+        case '\t':
+            *o++ = 't';
+            break;
+        default:
+            snprintf(o, 6, "u%04x", c);
+            o += 5;
+            break;
+        }
+    }
+    return (size_t)(o - out);
+}
@@ -0,0 +1,37 @@
+#ifndef JSON_SCAN_H
+#define JSON_SCAN_H
+
+#include <stddef.h>
+
+// 轻量级流式JSON工具, 不构建DOM、不分配内存。
+// 输出格式与 cJSON_PrintUnformatted 保持字节级一致, 供转换快速路径使用。
+
+#define JSON_SCAN_MAX_DEPTH 64
+
+// 判断数据是否恰好是一个"规范紧凑"的JSON值: 经 cJSON 解析再无格式打印后
+// 与原始字节完全相同 (无多余空白、整数、cJSON会原样输出的字符串转义)。
+// 返回0时调用方应退回 cJSON 路径, 由其给出原有的解析/序列化结果。
+int json_is_canonical(const char *json, size_t len);
+
+// 跳过 RFC 8259 空白字符
+const char *json_skip_ws(const char *p, const char *end);
+
+// 按严格 RFC 8259 语法跳过一个JSON值 (含前导空白), 返回值之后的位置, 语法错误返回NULL。
+// 严格语法是 cJSON 可接受语法的子集, \u 代理对规则与 cJSON 一致,
+// 因此通过检查的文档 cJSON 一定能解析出相同的结构。
+const char *json_skip_value(const char *p, const char *end);
+
+// 反转义字符串 (p 指向起始引号) 到 out 并以'\0'结尾, 结果超出 cap-1 字节时截断并置 *truncated。
+// 与 cJSON 一样, 转义得到的'\0'会提前结束C字符串。返回结束引号之后的位置, 语法错误返回NULL。
+const char *json_unescape(const char *p, const char *end, char *out, size_t cap, int *truncated);
+
+// 按 cJSON 的规则转义字符串内容 (不含两侧引号), 返回写入的字节数。
+// out 至少需要 json_escaped_max(len) 字节。
+size_t json_escape(char *out, const char *in, size_t len);
+
+static inline size_t json_escaped_max(size_t len)
+{
+    return len * 6;
+}
+
+#endif
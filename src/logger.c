@@ -0,0 +1,285 @@
+#include "logger.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "config.h"
+
+// 日志级别定义
+log_level_t  current_log_level;
+unsigned int log_sample_every = 1;
+
+// 环形缓冲区中的一条日志, 文件名和函数名都是字符串常量, 只保存指针
+typedef struct
+{
+    log_level_t level;
+    int         line;
+    const char *file;
+    const char *func;
+    time_t      timestamp;
+    char        text[LOG_MESSAGE_MAX];
+} log_entry_t;
+
+// 每线程单生产者/单消费者环形缓冲区
+typedef struct log_ring
+{
+    log_entry_t      entries[LOG_RING_SIZE];
+    atomic_uint      head;     // 生产者写入位置
+    atomic_uint      tail;     // 消费者读取位置
+    atomic_ulong     dropped;  // 缓冲区满时丢弃的条数
+    atomic_bool      closed;   // 所属线程已退出, 排空后释放
+    struct log_ring *next;
+} log_ring_t;
+
+static log_ring_t     *rings       = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t sync_mutex  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t   ring_key;
+static pthread_t       writer_thread;
+static atomic_bool     running     = false;
+static atomic_llong    cached_now  = 0;   // 由写线程每轮刷新的秒级时间戳
+
+static _Thread_local log_ring_t *thread_ring = NULL;
+
+static const char *level_name(log_level_t level)
+{
+    switch (level)
+    {
+    case LOG_LEVEL_DEBUG:
+        return "DEBUG";
+    case LOG_LEVEL_ERROR:
+        return "ERROR";
+    default:
+        return "INFO";
+    }
+}
+
+static const char *level_color(log_level_t level)
+{
+    switch (level)
+    {
+    case LOG_LEVEL_DEBUG:
+        return COLOR_DEBUG;
+    case LOG_LEVEL_ERROR:
+        return COLOR_ERROR;
+    default:
+        return COLOR_INFO;
+    }
+}
+
+// 时间格式化缓存, 同一秒内的日志复用同一个字符串 (调用方须持有sync_mutex)
+static const char *format_time(time_t timestamp)
+{
+    static time_t last = (time_t)-1;
+    static char   formatted[32];
+    if (timestamp != last)
+    {
+        struct tm tm_info;
+        localtime_r(&timestamp, &tm_info);
+        if (strftime(formatted, sizeof(formatted), "%Y-%m-%d %H:%M:%S", &tm_info) == 0)
+        {
+            formatted[0] = '\0';
+        }
+        last = timestamp;
+    }
+    return formatted;
+}
+
+static void print_entry(const log_entry_t *entry)
+{
+    fprintf(stdout, "%s[%s] [%s] [%s:%d %s] %s%s\n",
+            level_color(entry->level),
+            format_time(entry->timestamp),
+            level_name(entry->level),
+            entry->file,
+            entry->line,
+            entry->func,
+            entry->text,
+            COLOR_RESET);
+}
+
+// 线程退出时标记其缓冲区, 由写线程排空后释放
+static void release_ring(void *arg)
+{
+    log_ring_t *ring = (log_ring_t *)arg;
+    atomic_store_explicit(&ring->closed, true, memory_order_release);
+}
+
+static log_ring_t *get_thread_ring(void)
+{
+    if (thread_ring)
+    {
+        return thread_ring;
+    }
+
+    log_ring_t *ring = calloc(1, sizeof(log_ring_t));
+    if (!ring)
+    {
+        return NULL;
+    }
+    pthread_setspecific(ring_key, ring);
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = rings;
+    rings      = ring;
+    pthread_mutex_unlock(&rings_mutex);
+
+    thread_ring = ring;
+    return ring;
+}
+
+static void write_sync(const log_entry_t *entry)
+{
+    pthread_mutex_lock(&sync_mutex);
+    print_entry(entry);
+    fflush(stdout);
+    pthread_mutex_unlock(&sync_mutex);
+}
+
+void log_write(log_level_t level, const char *file, int line, const char *func, const char *fmt, ...)
+{
+    va_list args;
+
+    if (!atomic_load_explicit(&running, memory_order_acquire))
+    {
+        log_entry_t entry = {level, line, file, func, time(NULL), {0}};
+        va_start(args, fmt);
+        vsnprintf(entry.text, sizeof(entry.text), fmt, args);
+        va_end(args);
+        write_sync(&entry);
+        return;
+    }
+
+    log_ring_t *ring = get_thread_ring();
+    if (!ring)
+    {
+        return;
+    }
+
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= LOG_RING_SIZE)
+    {
+        // 缓冲区已满, 绝不阻塞业务线程
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    log_entry_t *entry = &ring->entries[head % LOG_RING_SIZE];
+    entry->level       = level;
+    entry->line        = line;
+    entry->file        = file;
+    entry->func        = func;
+    entry->timestamp   = (time_t)atomic_load_explicit(&cached_now, memory_order_relaxed);
+    va_start(args, fmt);
+    vsnprintf(entry->text, sizeof(entry->text), fmt, args);
+    va_end(args);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// 排空一个缓冲区, 返回输出的条数
+static int drain_ring(log_ring_t *ring)
+{
+    unsigned int tail  = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head  = atomic_load_explicit(&ring->head, memory_order_acquire);
+    int          count = 0;
+
+    for (; tail != head; tail++, count++)
+    {
+        print_entry(&ring->entries[tail % LOG_RING_SIZE]);
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    unsigned long dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+    if (dropped > 0)
+    {
+        log_entry_t notice = {LOG_LEVEL_ERROR, __LINE__, __FILENAME__, __func__,
+                              (time_t)atomic_load_explicit(&cached_now, memory_order_relaxed), {0}};
+        snprintf(notice.text, sizeof(notice.text), "Log buffer full, dropped %lu messages", dropped);
+        print_entry(&notice);
+        count++;
+    }
+    return count;
+}
+
+static int drain_all(void)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&rings_mutex);
+    pthread_mutex_lock(&sync_mutex);
+    log_ring_t **link = &rings;
+    while (*link)
+    {
+        log_ring_t *ring   = *link;
+        bool        closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+        count += drain_ring(ring);
+        if (closed)
+        {
+            *link = ring->next;
+            free(ring);
+            continue;
+        }
+        link = &ring->next;
+    }
+    if (count > 0)
+    {
+        fflush(stdout);
+    }
+    pthread_mutex_unlock(&sync_mutex);
+    pthread_mutex_unlock(&rings_mutex);
+    return count;
+}
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+    while (atomic_load_explicit(&running, memory_order_acquire))
+    {
+        atomic_store_explicit(&cached_now, (long long)time(NULL), memory_order_relaxed);
+        if (drain_all() == 0)
+        {
+            usleep(LOG_FLUSH_INTERVAL_MS * 1000);
+        }
+    }
+    return NULL;
+}
+
+int log_start(void)
+{
+    if (atomic_load(&running))
+    {
+        return 0;
+    }
+    if (pthread_key_create(&ring_key, release_ring) != 0)
+    {
+        return -1;
+    }
+
+    atomic_store(&cached_now, (long long)time(NULL));
+    atomic_store(&running, true);
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0)
+    {
+        atomic_store(&running, false);
+        pthread_key_delete(ring_key);
+        return -1;
+    }
+    return 0;
+}
+
+void log_stop(void)
+{
+    if (!atomic_load(&running))
+    {
+        return;
+    }
+
+    // 之后的日志走同步路径, 再排空已缓冲的内容
+    atomic_store(&running, false);
+    pthread_join(writer_thread, NULL);
+    drain_all();
+}
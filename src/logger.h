@@ -17,6 +17,9 @@ typedef enum
 // 全局日志级别变量
 extern log_level_t current_log_level;
 
+// 采样日志的间隔 (每N条输出1条, 1表示不采样)
+extern unsigned int log_sample_every;
+
 // 日志级别初始化函数
 static inline void init_log_level() {
     const char* level_str = getenv("LOG_LEVEL");
@@ -58,6 +61,20 @@ static inline void set_log_level_from_config(const char* json_level) {
     }
 }
 
+// 设置采样间隔 (优先级: 环境变量LOG_SAMPLE > JSON配置 > 默认值1)
+static inline void set_log_sample_from_config(int json_sample) {
+    const char* env_sample = getenv("LOG_SAMPLE");
+    int sample = env_sample ? atoi(env_sample) : json_sample;
+    log_sample_every = sample > 0 ? (unsigned int)sample : 1;
+}
+
+// 异步日志后端: 每个线程写入自己的无锁环形缓冲区, 后台线程负责格式化输出。
+// 未启动后台线程时 (或已停止) 退化为同步输出。
+int  log_start(void);
+void log_stop(void);
+void log_write(log_level_t level, const char *file, int line, const char *func, const char *fmt, ...)
+    __attribute__((format(printf, 5, 6)));
+
 // 获取文件名（不包含路径）
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 
@@ -68,33 +85,29 @@ static inline void set_log_level_from_config(const char* json_level) {
 #define COLOR_ERROR   "\033[31m"    // 红色
 
 // 通用日志宏
-#define LOG(level, level_str, color, fmt, ...)                                  \
+#define LOG(level, fmt, ...)                                                    \
     do                                                                          \
     {                                                                           \
         if (current_log_level <= level)                                         \
         {                                                                       \
-            time_t     now     = time(NULL);                                    \
-            struct tm *tm_info = localtime(&now);                               \
-            printf("%s[%04d-%02d-%02d %02d:%02d:%02d] [%s] [%s:%d %s] " fmt "%s\n", \
-                   color,                                                       \
-                   tm_info->tm_year + 1900,                                     \
-                   tm_info->tm_mon + 1,                                         \
-                   tm_info->tm_mday,                                            \
-                   tm_info->tm_hour,                                            \
-                   tm_info->tm_min,                                             \
-                   tm_info->tm_sec,                                             \
-                   level_str,                                                   \
-                   __FILENAME__,                                                \
-                   __LINE__,                                                    \
-                   __func__,                                                    \
-                   ##__VA_ARGS__,                                               \
-                   COLOR_RESET);                                                \
-            fflush(stdout);                                                     \
+            log_write(level, __FILENAME__, __LINE__, __func__, fmt, ##__VA_ARGS__); \
+        }                                                                       \
+    } while (0)
+
+// 采样日志宏: 每个调用点、每个线程独立计数, 每 log_sample_every 条输出1条
+#define LOG_SAMPLED(level, fmt, ...)                                            \
+    do                                                                          \
+    {                                                                           \
+        static _Thread_local unsigned int log_sample_counter_;                  \
+        if (current_log_level <= level && log_sample_counter_++ % log_sample_every == 0) \
+        {                                                                       \
+            log_write(level, __FILENAME__, __LINE__, __func__, fmt, ##__VA_ARGS__); \
         }                                                                       \
     } while (0)
 
-#define LOG_INFO(fmt, ...) LOG(LOG_LEVEL_INFO, "INFO", COLOR_INFO, fmt, ##__VA_ARGS__)
-#define LOG_ERROR(fmt, ...) LOG(LOG_LEVEL_ERROR, "ERROR", COLOR_ERROR, fmt, ##__VA_ARGS__)
-#define LOG_DEBUG(fmt, ...) LOG(LOG_LEVEL_DEBUG, "DEBUG", COLOR_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOG(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO_SAMPLED(fmt, ...) LOG_SAMPLED(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
 
 #endif
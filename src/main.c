@@ -4,13 +4,21 @@
 #include <signal.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
 #include <mosquitto.h>
 #include <time.h>
 
+#include "config.h"
 #include "config_json.h"
 #include "logger.h"
 #include "message_handlers.h"
+#include "metrics.h"
 #include "mqtt_engine.h"
+#include "scratch_arena.h"
+#include "time_util.h"
 
 static config_t global_config;
 static char *config_file = NULL;
@@ -19,7 +27,7 @@ static volatile int running = 1;
 // 回调函数映射
 typedef struct {
     const char *name;
-    void (*callback)(mqtt_client_t *, mqtt_client_t *, const struct mosquitto_message *);
+    forward_callback_t callback;
 } callback_mapping_t;
 
 static callback_mapping_t callback_mappings[] = {
@@ -28,7 +36,7 @@ static callback_mapping_t callback_mappings[] = {
     {NULL, NULL}
 };
 
-static void (*find_callback_by_name(const char *name))(mqtt_client_t *, mqtt_client_t *, const struct mosquitto_message *) {
+static forward_callback_t find_callback_by_name(const char *name) {
     for (int i = 0; callback_mappings[i].name; i++) {
         if (strcmp(callback_mappings[i].name, name) == 0) {
             return callback_mappings[i].callback;
@@ -41,26 +49,32 @@ static void print_usage(const char *program_name) {
     printf("Usage: %s [OPTIONS]\n", program_name);
     printf("Options:\n");
     printf("  -c, --config=FILE    Configuration file path\n");
+    printf("  -w, --watch          Reload configuration when the file changes (SIGHUP always reloads)\n");
     printf("  --validate-only      Validate configuration and exit\n");
     printf("  -h, --help          Show this help message\n");
 }
 
 static int validate_only = 0;
+static int watch_config = 0;
 
 static int parse_arguments(int argc, char *argv[]) {
     static struct option long_options[] = {
         {"config", required_argument, 0, 'c'},
+        {"watch", no_argument, 0, 'w'},
         {"validate-only", no_argument, 0, 'v'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
 
     int c;
-    while ((c = getopt_long(argc, argv, "c:h", long_options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "c:wh", long_options, NULL)) != -1) {
         switch (c) {
             case 'c':
                 config_file = strdup(optarg);
                 break;
+            case 'w':
+                watch_config = 1;
+                break;
             case 'v':
                 validate_only = 1;
                 break;
@@ -75,18 +89,225 @@ static int parse_arguments(int argc, char *argv[]) {
     return 0;
 }
 
+static volatile sig_atomic_t received_signal = 0;
+
 static void signal_handler(int sig) {
     if (!running) return;
-    LOG_INFO("Received signal %d, shutting down gracefully...", sig);
+    received_signal = sig;
     running = 0;
     signal(SIGINT, SIG_DFL);
     signal(SIGTERM, SIG_DFL);
 }
 
+// SIGUSR1: 把运行指标输出到日志
+static void dump_signal_handler(int sig) {
+    (void)sig;
+    metrics_request_dump();
+}
+
+// SIGHUP: 由配置监视线程重新加载配置
+static volatile sig_atomic_t reload_requested = 0;
+
+static void reload_signal_handler(int sig) {
+    (void)sig;
+    reload_requested = 1;
+}
+
+// 按配置连接客户端并添加转发规则, 启动和热加载共用; 单个客户端或规则失败时记录并跳过
+static int add_clients_and_rules(const config_t *config) {
+    // 连接所有客户端, 按配置下标记录句柄供规则引用
+    mqtt_client_t **client_handles = calloc(config->client_count, sizeof(mqtt_client_t *));
+    if (!client_handles) {
+        LOG_ERROR("Out of memory");
+        return -1;
+    }
+    for (int i = 0; i < config->client_count; i++) {
+        const client_config_t *client_cfg = &config->clients[i];
+        mqtt_client_t *client = mqtt_connect(client_cfg, &config->mqtt);
+        if (!client) {
+            LOG_ERROR("Failed to connect to %s:%d", client_cfg->ip, client_cfg->port);
+            continue;
+        }
+        client_handles[i] = client;
+        LOG_INFO("Connected to %s (%s:%d)", client_cfg->name, client_cfg->ip, client_cfg->port);
+    }
+
+    // 添加转发规则
+    for (int i = 0; i < config->rule_count; i++) {
+        const rule_config_t *rule = &config->rules[i];
+        
+        if (!rule->enabled) {
+            LOG_INFO("Rule '%s' is disabled, skipping", rule->name);
+            continue;
+        }
+
+        // 查找回调函数 (配置了转换模板的规则使用 TransformCall)
+        forward_callback_t callback = rule->transform ? TransformCall : find_callback_by_name(rule->callback);
+        if (!callback) {
+            LOG_ERROR("Unknown callback function: %s", rule->callback);
+            continue;
+        }
+
+        // 查找客户端
+        int source_idx = find_client_by_name(config, rule->source_client);
+        int target_idx = find_client_by_name(config, rule->target_client);
+        
+        if (source_idx < 0 || target_idx < 0) {
+            LOG_ERROR("Client not found for rule '%s'", rule->name);
+            continue;
+        }
+
+        // 添加转发规则 (源或目标客户端创建失败时跳过)
+        if (add_forward_rule(client_handles[source_idx], rule->source_topic,
+                           client_handles[target_idx], rule->target_topic,
+                           callback, rule->transform, &rule->publish, rule->name) == 0) {
+            LOG_INFO("Added rule: %s (%s)", rule->name, rule->description);
+        } else {
+            LOG_ERROR("Failed to add rule: %s", rule->name);
+        }
+    }
+    free(client_handles);
+    return 0;
+}
+
+// 重新加载配置: 在监视线程上解析和校验, 失败时保留当前配置;
+// 成功后由引擎替换规则表, 规则引用新配置中的转换模板, 因此旧配置在替换完成后才释放
+static void reload_configuration(void) {
+    config_t next;
+
+    LOG_INFO("Reloading configuration");
+    if (load_config_from_file(config_file, &next) != 0) {
+        LOG_ERROR("Failed to load configuration, keeping current configuration");
+        return;
+    }
+    if (validate_config(&next) != 0) {
+        LOG_ERROR("Configuration validation failed, keeping current configuration");
+        free_config(&next);
+        return;
+    }
+
+    // 引擎和指标导出在启动时确定, 保留正在使用的设置
+    if (next.engine.mode != global_config.engine.mode || next.engine.loops != global_config.engine.loops) {
+        LOG_ERROR("Engine settings changed, restart to apply them");
+    }
+    if (strcmp(next.metrics.listen, global_config.metrics.listen) != 0
+        || next.metrics.profile_sample != global_config.metrics.profile_sample) {
+        LOG_ERROR("Metrics settings changed, restart to apply them");
+    }
+    next.engine = global_config.engine;
+    next.metrics = global_config.metrics;
+
+    mqtt_engine_reload_begin();
+    if (add_clients_and_rules(&next) != 0) {
+        mqtt_engine_reload_abort();
+        free_config(&next);
+        return;
+    }
+    if (mqtt_engine_reload_commit() != 0) {
+        free_config(&next);
+        return;
+    }
+
+    set_log_level_from_config(next.log_level);
+    set_log_sample_from_config(next.log_sample);
+    free_config(&global_config);
+    global_config = next;
+    LOG_INFO("Configuration reloaded: %d clients, %d rules", global_config.client_count, global_config.rule_count);
+}
+
+// 配置监视线程
+static pthread_t reload_thread;
+static volatile int reload_thread_running = 0;
+
+// 监视配置文件所在目录 (编辑器常以 写临时文件 + 重命名 的方式保存, 文件本身会被替换)
+static int open_config_watch(char *name, size_t name_size) {
+    if (!config_file) {
+        LOG_ERROR("--watch requires --config, reload with SIGHUP instead");
+        return -1;
+    }
+
+    char *dir_copy = strdup(config_file);
+    char *base_copy = strdup(config_file);
+    int fd = -1;
+    if (dir_copy && base_copy) {
+        snprintf(name, name_size, "%s", basename(base_copy));
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd >= 0 && inotify_add_watch(fd, dirname(dir_copy), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd < 0) {
+            LOG_ERROR("Failed to watch %s, reload with SIGHUP instead", config_file);
+        }
+    }
+    free(dir_copy);
+    free(base_copy);
+    return fd;
+}
+
+// 读出所有事件, 返回其中是否有配置文件的变化
+static int config_file_changed(int fd, const char *name) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t len;
+
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->len > 0 && strcmp(event->name, name) == 0) {
+                changed = 1;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+// 处理 SIGHUP 请求和配置文件变化 (最后一次变化后稍等再加载, 避免读到写了一半的文件)
+static void *reload_thread_main(void *arg) {
+    (void)arg;
+    char name[256] = "";
+    int fd = watch_config ? open_config_watch(name, sizeof(name)) : -1;
+    long long changed_at = 0;
+
+    while (reload_thread_running) {
+        if (fd >= 0) {
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            if (poll(&pfd, 1, CONFIG_WATCH_POLL_MS) > 0 && config_file_changed(fd, name)) {
+                changed_at = monotonic_ms();
+            }
+        } else {
+            usleep(CONFIG_WATCH_POLL_MS * 1000);
+        }
+
+        if (reload_requested
+            || (changed_at && monotonic_ms() - changed_at >= CONFIG_RELOAD_DEBOUNCE_MS)) {
+            reload_requested = 0;
+            changed_at = 0;
+            reload_configuration();
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+static void stop_reload_thread(void) {
+    if (reload_thread_running) {
+        reload_thread_running = 0;
+        pthread_join(reload_thread, NULL);
+    }
+}
+
 static void cleanup_and_exit() {
+    stop_reload_thread();
     cleanup_forwarder();
+    metrics_stop();
     free_config(&global_config);
     if (config_file) free(config_file);
+    log_stop();
 }
 
 int main(int argc, char *argv[]) {
@@ -97,11 +318,15 @@ int main(int argc, char *argv[]) {
 
     // 初始化mosquitto库
     mosquitto_lib_init();
+    // cJSON 的分配钩子: 处理消息期间使用线程私有的临时内存
+    scratch_init_hooks();
     srand(time(NULL));
 
     // 注册信号处理
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGUSR1, dump_signal_handler);
+    signal(SIGHUP, reload_signal_handler);
 
     // 加载配置文件
     if (load_config_from_file(config_file, &global_config) != 0) {
@@ -118,6 +343,7 @@ int main(int argc, char *argv[]) {
 
     // 设置日志级别 (优先级: 环境变量 > JSON配置 > 默认值)
     set_log_level_from_config(global_config.log_level);
+    set_log_sample_from_config(global_config.log_sample);
     
     // 如果只是验证配置，则退出
     if (validate_only) {
@@ -126,6 +352,19 @@ int main(int argc, char *argv[]) {
         return 0;
     }
     
+    // 启动异步日志写线程
+    if (log_start() != 0) {
+        LOG_ERROR("Failed to start log writer, falling back to synchronous logging");
+    }
+
+    // 启动运行指标导出线程
+    if (metrics_start(&global_config.metrics) != 0) {
+        LOG_ERROR("Failed to start metrics exporter");
+        log_stop();
+        free_config(&global_config);
+        return 1;
+    }
+
     LOG_INFO("MQTT Message Forwarder");
     LOG_INFO("======================");
     LOG_INFO("Configuration loaded successfully");
@@ -133,63 +372,32 @@ int main(int argc, char *argv[]) {
     LOG_INFO("MQTT port: %d, keepalive: %d", global_config.mqtt.port, global_config.mqtt.keepalive);
     LOG_INFO("Found %d clients, %d rules", global_config.client_count, global_config.rule_count);
 
-    // 添加转发规则
-    for (int i = 0; i < global_config.rule_count; i++) {
-        rule_config_t *rule = &global_config.rules[i];
-        
-        if (!rule->enabled) {
-            LOG_INFO("Rule '%s' is disabled, skipping", rule->name);
-            continue;
-        }
-
-        // 查找回调函数
-        void (*callback)(mqtt_client_t *, mqtt_client_t *, const struct mosquitto_message *) = 
-            find_callback_by_name(rule->callback);
-        if (!callback) {
-            LOG_ERROR("Unknown callback function: %s", rule->callback);
-            continue;
-        }
-
-        // 查找客户端
-        int source_idx = find_client_by_name(&global_config, rule->source_client);
-        int target_idx = find_client_by_name(&global_config, rule->target_client);
-        
-        if (source_idx < 0 || target_idx < 0) {
-            LOG_ERROR("Client not found for rule '%s'", rule->name);
-            continue;
-        }
-
-        client_config_t *source_client = &global_config.clients[source_idx];
-        client_config_t *target_client = &global_config.clients[target_idx];
+    // 连接客户端并添加转发规则
+    if (add_clients_and_rules(&global_config) != 0) {
+        cleanup_and_exit();
+        return 1;
+    }
 
-        // 添加转发规则
-        if (add_forward_rule(source_client->ip, source_client->port, rule->source_topic,
-                           target_client->ip, target_client->port, rule->target_topic,
-                           callback, rule->name) == 0) {
-            LOG_INFO("Added rule: %s (%s)", rule->name, rule->description);
-        } else {
-            LOG_ERROR("Failed to add rule: %s", rule->name);
-        }
+    // 编译规则表并启动网络循环
+    if (mqtt_engine_start(&global_config.engine) != 0) {
+        LOG_ERROR("Failed to start forwarding engine");
+        cleanup_and_exit();
+        return 1;
     }
 
-    // 连接所有客户端
-    for (int i = 0; i < global_config.client_count; i++) {
-        client_config_t *client_cfg = &global_config.clients[i];
-        mqtt_client_t *client = mqtt_connect(client_cfg, &global_config.mqtt);
-        if (!client) {
-            LOG_ERROR("Failed to connect to %s:%d", client_cfg->ip, client_cfg->port);
-            continue;
-        }
-        LOG_INFO("Connected to %s (%s:%d)", client_cfg->name, client_cfg->ip, client_cfg->port);
+    // 启动配置监视线程 (失败时不影响转发, 只是不能热加载)
+    reload_thread_running = 1;
+    if (pthread_create(&reload_thread, NULL, reload_thread_main, NULL) != 0) {
+        reload_thread_running = 0;
+        LOG_ERROR("Failed to start config reload thread, hot reload disabled");
     }
 
     LOG_INFO("Press Ctrl+C to exit");
     LOG_INFO("MQTT Message Forwarder started");
 
-    // 主循环
-    while (running) {
-        sleep(1);
-    }
+    // 主循环 (epoll 模式下当前线程即第一个事件循环)
+    mqtt_engine_run(&running);
+    LOG_INFO("Received signal %d, shutting down gracefully...", (int)received_signal);
 
     // 清理资源
     cleanup_and_exit();
@@ -1,166 +1,188 @@
 #include "message_handlers.h"
 
-#include <cjson/cJSON.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "command_convert.h"
 #include "config.h"
+#include "event_envelope.h"
 #include "logger.h"
+#include "transform.h"
 
-// JSON包装常量
-#define EVENT_JSON_OPERATION_TYPE "uploadRtd"
-#define EVENT_JSON_PROJECT_ID "X2View"
-#define EVENT_JSON_REQUEST_TYPE "wrequest"
-#define EVENT_JSON_SERIAL_NO 0
+// 按规则改写目标主题, 失败时记录日志并返回NULL
+static const char *target_topic_of(const forward_rule_t *rule, const struct mosquitto_message *message)
+{
+    long long   start        = stage_begin();
+    const char *target_topic = topic_rewrite_apply(rule->topic_rewrite, message->topic);
+    stage_end(rule->stage_ids[STAGE_REWRITE], start);
+    if (!target_topic)
+    {
+        LOG_ERROR("Rule %s: cannot rewrite topic %s to %s", rule->rule_name, message->topic, rule->target_topic);
+        metrics_add(rule->metrics_id, METRIC_PARSE_ERRORS, 1);
+    }
+    return target_topic;
+}
 
 // 事件转发回调 (属性事件转发: 下游->上游)
-void EventCall(mqtt_client_t                  *source,
+void EventCall(const forward_rule_t           *rule,
+               mqtt_client_t                  *source,
                mqtt_client_t                  *target,
                const struct mosquitto_message *message)
 {
-    cJSON *original_data = cJSON_ParseWithLength((char *)message->payload, message->payloadlen);
-    if (!original_data)
+    const char *message_buffer;
+    size_t      message_len;
+
+    long long               start  = stage_begin();
+    event_envelope_status_t status = event_envelope_build(
+        message->topic, message->payload, message->payloadlen, &message_buffer, &message_len);
+    stage_end(rule->stage_ids[STAGE_CONVERT], start);
+    if (status != EVENT_ENVELOPE_OK)
     {
-        LOG_ERROR("Failed to parse JSON payload");
-        return;
+        metrics_add(rule->metrics_id, METRIC_PARSE_ERRORS, 1);
     }
-
-    // 从topic中提取设备ID (最后一个/后面的值)
-    const char *device_id = strrchr(message->topic, '/');
-    if (!device_id || !*(device_id + 1))
+    switch (status)
     {
+    case EVENT_ENVELOPE_OK:
+        break;
+    case EVENT_ENVELOPE_PARSE_ERROR:
+        LOG_ERROR("Failed to parse JSON payload");
+        return;
+    case EVENT_ENVELOPE_NO_DEVICE_ID:
         LOG_ERROR("Failed to extract device ID from topic: %s", message->topic);
-        cJSON_Delete(original_data);
+        return;
+    default:
+        LOG_ERROR("Failed to serialize JSON");
         return;
     }
-    device_id++; // 跳过'/'
-
-    cJSON *wrapper = cJSON_CreateObject();
-    cJSON_AddItemToObject(wrapper, "data", original_data);
-    cJSON_AddStringToObject(wrapper, "operationType", EVENT_JSON_OPERATION_TYPE);
-    cJSON_AddStringToObject(wrapper, "projectID", EVENT_JSON_PROJECT_ID);
-    cJSON_AddStringToObject(wrapper, "requestType", EVENT_JSON_REQUEST_TYPE);
-    cJSON_AddNumberToObject(wrapper, "serialNo", EVENT_JSON_SERIAL_NO);
-    cJSON_AddStringToObject(wrapper, "webtalkID", device_id);
 
-    char *message_buffer = cJSON_PrintUnformatted(wrapper);
-    if (!message_buffer)
+    const char *target_topic = target_topic_of(rule, message);
+    if (!target_topic)
     {
-        LOG_ERROR("Failed to serialize JSON");
-        cJSON_Delete(wrapper);
         return;
     }
 
-    int ret = mosquitto_publish(
-        target->mosq, NULL, message->topic, strlen(message_buffer), message_buffer, 
+    int ret = forward_publish(
+        rule, target_topic, (int)message_len, message_buffer, 
         message->qos, message->retain);
     if (ret == MOSQ_ERR_SUCCESS)
     {
-        LOG_DEBUG("Forwarded %s->%s: %s", source->ip, target->ip, message_buffer);
+        LOG_DEBUG("Forwarded %s->%s: %.*s", source->ip, target->ip, (int)message_len, message_buffer);
     }
     else
     {
         LOG_ERROR("Publish failed: %s", mosquitto_strerror(ret));
     }
-
-    free(message_buffer);
-    cJSON_Delete(wrapper);
 }
 
 // 指令转发回调 (指令转发: 上游->下游)
-void CommandCall(mqtt_client_t                  *source,
+void CommandCall(const forward_rule_t           *rule,
+                 mqtt_client_t                  *source,
                  mqtt_client_t                  *target,
                  const struct mosquitto_message *message)
 {
-    cJSON *input_json = cJSON_ParseWithLength((char *)message->payload, message->payloadlen);
-    if (!input_json)
+    command_output_t output;
+
+    long long                start  = stage_begin();
+    command_convert_status_t status = command_convert(message->payload, message->payloadlen, &output);
+    stage_end(rule->stage_ids[STAGE_CONVERT], start);
+    if (status != COMMAND_CONVERT_OK)
     {
-        LOG_ERROR("Failed to parse JSON from source");
-        return;
+        metrics_add(rule->metrics_id, METRIC_PARSE_ERRORS, 1);
     }
-
-    cJSON *output_json    = NULL;
-    char  *message_buffer = NULL;
-
-    cJSON *data_array = cJSON_GetObjectItem(input_json, "data");
-    if (!cJSON_IsArray(data_array) || cJSON_GetArraySize(data_array) == 0)
+    switch (status)
     {
+    case COMMAND_CONVERT_OK:
+        break;
+    case COMMAND_CONVERT_PARSE_ERROR:
+        LOG_ERROR("Failed to parse JSON from source");
+        return;
+    case COMMAND_CONVERT_INVALID_DATA:
         LOG_ERROR("Invalid or empty data array");
-        goto cleanup;
+        return;
+    case COMMAND_CONVERT_MISSING_FIELD:
+        LOG_ERROR("Missing name or value in data item");
+        return;
+    case COMMAND_CONVERT_BAD_NAME:
+        LOG_ERROR("Invalid name format: expected 3 dots, found %d in '%s'", output.dot_count, output.name);
+        return;
+    default:
+        LOG_ERROR("Failed to serialize output JSON");
+        return;
     }
 
-    cJSON      *data_item = cJSON_GetArrayItem(data_array, 0);
-    const char *name      = cJSON_GetStringValue(cJSON_GetObjectItem(data_item, "name"));
-    const char *value     = cJSON_GetStringValue(cJSON_GetObjectItem(data_item, "value"));
-
-    if (!name || !value)
+    const char *target_topic = target_topic_of(rule, message);
+    if (!target_topic)
     {
-        LOG_ERROR("Missing name or value in data item");
-        goto cleanup;
+        command_output_release(&output);
+        return;
     }
 
-    char name_copy[256];
-    snprintf(name_copy, sizeof(name_copy), "%s", name);
-
-    int dot_count = 0;
-    for (char *p = name_copy; *p; p++)
+    int ret = forward_publish(
+        rule, target_topic, (int)output.len, output.data, 
+        message->qos, message->retain);
+    if (ret == MOSQ_ERR_SUCCESS)
     {
-        if (*p == '.')
-            dot_count++;
+        LOG_INFO_SAMPLED("Converted and forwarded %s->%s: %.*s", source->ip, target->ip, (int)output.len, output.data);
     }
-
-    if (dot_count != 3)
+    else
     {
-        LOG_ERROR("Invalid name format: expected 3 dots, found %d in '%s'", dot_count, name);
-        goto cleanup;
+        LOG_ERROR("Publish failed: %s", mosquitto_strerror(ret));
     }
 
-    char *last_dot = strrchr(name_copy, '.');
-    *last_dot      = '\0';
-    char *key      = last_dot + 1;
+    command_output_release(&output);
+}
 
-    for (char *p = name_copy; *p; p++)
+// 模板转换回调 (转换逻辑由配置中的 transform 模板决定)
+void TransformCall(const forward_rule_t           *rule,
+                   mqtt_client_t                  *source,
+                   mqtt_client_t                  *target,
+                   const struct mosquitto_message *message)
+{
+    const char *message_buffer;
+    size_t      message_len;
+
+    long long          start  = stage_begin();
+    transform_status_t status = transform_apply(
+        rule->transform, message->topic, message->payload, message->payloadlen, &message_buffer, &message_len);
+    stage_end(rule->stage_ids[STAGE_CONVERT], start);
+    if (status != TRANSFORM_OK)
     {
-        if (*p == '.')
-            *p = '|';
+        metrics_add(rule->metrics_id, METRIC_PARSE_ERRORS, 1);
+    }
+    switch (status)
+    {
+    case TRANSFORM_OK:
+        break;
+    case TRANSFORM_PARSE_ERROR:
+        LOG_ERROR("Failed to parse JSON payload");
+        return;
+    case TRANSFORM_MISSING_FIELD:
+        LOG_ERROR("Rule %s: payload is missing a field used by the template", rule->rule_name);
+        return;
+    case TRANSFORM_NO_TOPIC_SEGMENT:
+        LOG_ERROR("Rule %s: topic segment used by the template not found in: %s", rule->rule_name, message->topic);
+        return;
+    default:
+        LOG_ERROR("Failed to serialize JSON");
+        return;
     }
 
-    output_json        = cJSON_CreateObject();
-    cJSON *body_obj    = cJSON_CreateObject();
-    cJSON *dl_obj      = cJSON_CreateObject();
-    cJSON *header_obj  = cJSON_CreateObject();
-
-    cJSON_AddStringToObject(dl_obj, key, value);
-    cJSON_AddItemToObject(body_obj, "dl", dl_obj);
-    cJSON_AddItemToObject(output_json, "b", body_obj);
-
-    cJSON_AddStringToObject(header_obj, "rt", name_copy);
-    cJSON_AddItemToObject(output_json, "h", header_obj);
-
-    message_buffer = cJSON_PrintUnformatted(output_json);
-    if (!message_buffer)
+    const char *target_topic = target_topic_of(rule, message);
+    if (!target_topic)
     {
-        LOG_ERROR("Failed to serialize output JSON");
-        goto cleanup;
+        return;
     }
 
-    int ret = mosquitto_publish(
-        target->mosq, NULL, message->topic, strlen(message_buffer), message_buffer, 
+    int ret = forward_publish(
+        rule, target_topic, (int)message_len, message_buffer, 
         message->qos, message->retain);
     if (ret == MOSQ_ERR_SUCCESS)
     {
-        LOG_INFO("Converted and forwarded %s->%s: %s", source->ip, target->ip, message_buffer);
+        LOG_DEBUG("Forwarded %s->%s: %.*s", source->ip, target->ip, (int)message_len, message_buffer);
     }
     else
     {
         LOG_ERROR("Publish failed: %s", mosquitto_strerror(ret));
     }
-
-cleanup:
-    if (message_buffer)
-        free(message_buffer);
-    if (output_json)
-        cJSON_Delete(output_json);
-    cJSON_Delete(input_json);
 }
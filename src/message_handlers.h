@@ -6,11 +6,18 @@
 #include "mqtt_engine.h"
 
 // 转发回调函数声明 - 添加目标客户端参数
-void EventCall(mqtt_client_t                  *source,
+void EventCall(const forward_rule_t           *rule,
+               mqtt_client_t                  *source,
                mqtt_client_t                  *target,
                const struct mosquitto_message *message);
-void CommandCall(mqtt_client_t                  *source,
+void CommandCall(const forward_rule_t           *rule,
+                 mqtt_client_t                  *source,
                  mqtt_client_t                  *target,
                  const struct mosquitto_message *message);
+// 按规则的 transform 模板转换 (规则配置了 transform 而非 callback 时使用)
+void TransformCall(const forward_rule_t           *rule,
+                   mqtt_client_t                  *source,
+                   mqtt_client_t                  *target,
+                   const struct mosquitto_message *message);
 
 #endif
@@ -0,0 +1,108 @@
+#include "message_props.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "time_util.h"
+
+message_props_t *message_props_extract(const mosquitto_property *properties)
+{
+    bool     has_expiry = false;
+    uint32_t expiry_s   = 0;
+    char    *names[MESSAGE_PROPS_MAX_USER];
+    char    *values[MESSAGE_PROPS_MAX_USER];
+    int      count = 0;
+    size_t   bytes = 0;
+
+    for (const mosquitto_property *p = properties; p; p = mosquitto_property_next(p))
+    {
+        switch (mosquitto_property_identifier(p))
+        {
+            case MQTT_PROP_MESSAGE_EXPIRY_INTERVAL:
+                has_expiry = mosquitto_property_read_int32(p, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, &expiry_s, false)
+                             != NULL;
+                break;
+            case MQTT_PROP_USER_PROPERTY:
+                if (count < MESSAGE_PROPS_MAX_USER
+                    && mosquitto_property_read_string_pair(p, MQTT_PROP_USER_PROPERTY, &names[count], &values[count],
+                                                           false))
+                {
+                    bytes += strlen(names[count]) + strlen(values[count]) + 2;
+                    count++;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    if (!has_expiry && count == 0)
+    {
+        return NULL;
+    }
+
+    // 结构和全部字符串放在一次分配中, 便于随任务传递和释放
+    message_props_t *props = malloc(sizeof(message_props_t) + sizeof(user_property_t) * (size_t)count + bytes);
+    if (props)
+    {
+        props->has_expiry = has_expiry;
+        props->expiry_s   = expiry_s;
+        props->user_count = count;
+        char *strings     = (char *)&props->user[count];
+        for (int i = 0; i < count; i++)
+        {
+            size_t name_len  = strlen(names[i]) + 1;
+            size_t value_len = strlen(values[i]) + 1;
+            memcpy(strings, names[i], name_len);
+            props->user[i].name = strings;
+            strings += name_len;
+            memcpy(strings, values[i], value_len);
+            props->user[i].value = strings;
+            strings += value_len;
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        free(names[i]);
+        free(values[i]);
+    }
+    return props;
+}
+
+void message_props_free(message_props_t *props)
+{
+    free(props);
+}
+
+int message_props_build(const message_props_t *props,
+                        long long              received_ns,
+                        int                    alias,
+                        mosquitto_property   **list)
+{
+    *list   = NULL;
+    int ret = MOSQ_ERR_SUCCESS;
+    if (props && props->has_expiry)
+    {
+        long long waited_s = (monotonic_ns() - received_ns) / 1000000000LL;
+        uint32_t  expiry_s = props->expiry_s;
+        if (waited_s > 0)
+        {
+            expiry_s = (long long)expiry_s > waited_s ? expiry_s - (uint32_t)waited_s : 1;
+        }
+        ret = mosquitto_property_add_int32(list, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, expiry_s);
+    }
+    for (int i = 0; props && ret == MOSQ_ERR_SUCCESS && i < props->user_count; i++)
+    {
+        ret = mosquitto_property_add_string_pair(list, MQTT_PROP_USER_PROPERTY, props->user[i].name,
+                                                 props->user[i].value);
+    }
+    if (ret == MOSQ_ERR_SUCCESS && alias > 0)
+    {
+        ret = mosquitto_property_add_int16(list, MQTT_PROP_TOPIC_ALIAS, (uint16_t)alias);
+    }
+    if (ret != MOSQ_ERR_SUCCESS)
+    {
+        mosquitto_property_free_all(list);
+    }
+    return ret;
+}
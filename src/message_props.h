@@ -0,0 +1,36 @@
+#ifndef MESSAGE_PROPS_H
+#define MESSAGE_PROPS_H
+
+#include <mosquitto.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// 随消息转发的 MQTT v5 属性: 消息过期时间和用户属性 (其余属性只对入站连接有意义或会被转换改变, 不转发)。
+// 从入站属性中提取为一次分配的只读结构, 可随工作线程任务传递; 发布到 v5 目标时再构造出站属性列表。
+
+typedef struct
+{
+    const char *name;
+    const char *value;
+} user_property_t;
+
+typedef struct
+{
+    bool            has_expiry;
+    uint32_t        expiry_s;     // 消息过期时间 (秒), 从收到消息时算起
+    int             user_count;
+    user_property_t user[];       // 其后紧跟字符串
+} message_props_t;
+
+// 提取需要转发的属性, 没有时返回NULL
+message_props_t *message_props_extract(const mosquitto_property *properties);
+void             message_props_free(message_props_t *props);
+
+// 构造出站属性: 过期时间扣除消息在转发器内停留的整秒数 (至少保留1秒), alias 非0时加上主题别名。
+// *list 需由调用方以 mosquitto_property_free_all 释放
+int message_props_build(const message_props_t *props,
+                        long long              received_ns,
+                        int                    alias,
+                        mosquitto_property   **list);
+
+#endif
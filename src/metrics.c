@@ -0,0 +1,990 @@
+// accept4 为 GNU 扩展
+#define _GNU_SOURCE
+
+#include "metrics.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "hash_index.h"
+#include "logger.h"
+
+#define SUB_COUNT (1 << METRICS_HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((METRICS_HISTOGRAM_MAX_BITS - METRICS_HISTOGRAM_SUB_BITS + 1) * SUB_COUNT)
+#define MAX_SERIES (METRICS_BLOCK_SERIES * METRICS_MAX_BLOCKS)
+#define SUB_SERIES 8   // 每类对象的子序列数上限 (阶段, 或队列*通道)
+
+// 一个指标对象在一个线程分片中的数据, 只由所属线程写入
+typedef struct
+{
+    atomic_ulong counters[METRIC_COUNT];
+    atomic_ulong latency_count;
+    atomic_ulong latency_sum;   // 纳秒
+    atomic_ulong latency_max;
+    atomic_ulong buckets[HISTOGRAM_BUCKETS];
+} series_t;
+
+typedef struct
+{
+    series_t series[METRICS_BLOCK_SERIES];
+} block_t;
+
+// 线程分片, 块在首次使用时由所属线程分配
+typedef struct shard
+{
+    _Atomic(block_t *) blocks[METRICS_MAX_BLOCKS];
+    struct shard      *next;
+} shard_t;
+
+typedef struct
+{
+    metrics_kind_t kind;
+    int            sub;     // METRICS_STAGE 的阶段, METRICS_LANE 的 队列*PRIORITY_LANES+通道
+    char          *name;
+} series_info_t;
+
+// 合并后的数据
+typedef struct
+{
+    unsigned long counters[METRIC_COUNT];
+    unsigned long latency_count;
+    unsigned long latency_sum;
+    unsigned long latency_max;
+    unsigned long buckets[HISTOGRAM_BUCKETS];
+} snapshot_t;
+
+typedef struct
+{
+    char  *data;
+    size_t len;
+    size_t capacity;
+} text_t;
+
+static const char *const kind_names[] = {"rule", "client", "stage", "batch", "lane", "ack"};
+
+static const char *const stage_names[STAGE_COUNT] = {"match", "handoff", "convert", "rewrite", "publish"};
+
+static const char *const lane_names[PRIORITY_LANES] = {"high", "normal", "low"};
+
+static const char *const lane_queue_names[LANE_QUEUE_COUNT] = {"worker", "offline"};
+
+_Static_assert(STAGE_COUNT <= SUB_SERIES && LANE_QUEUE_COUNT * PRIORITY_LANES <= SUB_SERIES,
+               "series tags assume sub-series indexes below SUB_SERIES");
+
+static const char *const metric_names[METRIC_COUNT] = {
+    "received", "matched", "forwarded", "queued", "dropped",
+    "parse_errors", "publish_errors", "bytes_in", "bytes_out", "conflated",
+    "over_rule_limit", "over_device_limit", "shed", "delayed", "qos_published", "acked",
+    "published", "heap_allocs"};
+
+// 各类对象导出的计数器
+static const unsigned int kind_metrics[] = {
+    [METRICS_RULE]   = 1u << METRIC_MATCHED | 1u << METRIC_FORWARDED | 1u << METRIC_QUEUED
+                     | 1u << METRIC_DROPPED | 1u << METRIC_PARSE_ERRORS | 1u << METRIC_PUBLISH_ERRORS
+                     | 1u << METRIC_BYTES_OUT | 1u << METRIC_CONFLATED | 1u << METRIC_OVER_RULE_LIMIT
+                     | 1u << METRIC_OVER_DEVICE_LIMIT | 1u << METRIC_SHED | 1u << METRIC_DELAYED
+                     | 1u << METRIC_HEAP_ALLOCS,
+    [METRICS_CLIENT] = 1u << METRIC_RECEIVED | 1u << METRIC_MATCHED | 1u << METRIC_FORWARDED
+                     | 1u << METRIC_QUEUED | 1u << METRIC_DROPPED | 1u << METRIC_PUBLISH_ERRORS
+                     | 1u << METRIC_BYTES_IN | 1u << METRIC_BYTES_OUT | 1u << METRIC_QOS_PUBLISHED
+                     | 1u << METRIC_ACKED | 1u << METRIC_PUBLISHED,
+    [METRICS_STAGE]  = 0,
+    [METRICS_BATCH]  = 0,
+    [METRICS_LANE]   = 0,
+    [METRICS_ACK]    = 0};
+
+// Prometheus 直方图的桶边界 (秒)
+static const double latency_bounds[] = {
+    0.00001, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+    0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static series_info_t  *series_info     = NULL;
+static int             series_count    = 0;
+static int             series_capacity = 0;
+static hash_index_t    series_index;   // (名称, 类型*SUB_SERIES+子序列) -> 编号+1
+
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+static shard_t        *shards       = NULL;
+static _Thread_local shard_t *thread_shard = NULL;
+
+static pthread_t   exporter_thread;
+static atomic_bool exporter_running = false;
+static atomic_bool dump_requested   = false;
+static int         listen_fd        = -1;
+static int         sample_interval  = 0;
+static char        unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+// ---------------------------------------------------------------------------
+// 注册与热路径
+// ---------------------------------------------------------------------------
+
+_Thread_local bool metrics_stage_sampled = false;
+
+static _Thread_local int sample_countdown = 0;
+
+static int register_series(metrics_kind_t kind, int sub, const char *name)
+{
+    int tag = (int)kind * SUB_SERIES + sub;
+    pthread_mutex_lock(&registry_mutex);
+    int id = (int)(long)hash_index_find(&series_index, name, tag) - 1;
+    if (id >= 0 || series_count >= MAX_SERIES)
+    {
+        pthread_mutex_unlock(&registry_mutex);
+        return id;
+    }
+
+    if (series_count == series_capacity)
+    {
+        int            capacity = series_capacity ? series_capacity * 2 : 64;
+        series_info_t *info     = realloc(series_info, sizeof(series_info_t) * capacity);
+        if (!info)
+        {
+            pthread_mutex_unlock(&registry_mutex);
+            return -1;
+        }
+        series_info     = info;
+        series_capacity = capacity;
+    }
+
+    char *copy = strdup(name);
+    if (!copy || hash_index_insert(&series_index, copy, tag, (void *)(long)(series_count + 1)) != 0)
+    {
+        free(copy);
+        pthread_mutex_unlock(&registry_mutex);
+        return -1;
+    }
+    series_info[series_count] = (series_info_t){.kind = kind, .sub = sub, .name = copy};
+    id = series_count++;
+    pthread_mutex_unlock(&registry_mutex);
+    return id;
+}
+
+int metrics_register(metrics_kind_t kind, const char *name)
+{
+    return register_series(kind, 0, name);
+}
+
+void metrics_register_stages(const char *rule, int ids[STAGE_COUNT])
+{
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+    {
+        ids[stage] = register_series(METRICS_STAGE, stage, rule);
+    }
+}
+
+void metrics_register_lanes(const char *client, int ids[LANE_QUEUE_COUNT][PRIORITY_LANES])
+{
+    for (int queue = 0; queue < LANE_QUEUE_COUNT; queue++)
+    {
+        for (int lane = 0; lane < PRIORITY_LANES; lane++)
+        {
+            ids[queue][lane] = register_series(METRICS_LANE, queue * PRIORITY_LANES + lane, client);
+        }
+    }
+}
+
+// 每个线程独立倒数, 不在线程间共享计数器
+bool metrics_sample_message(void)
+{
+    if (sample_interval <= 0 || --sample_countdown > 0)
+    {
+        return false;
+    }
+    sample_countdown = sample_interval;
+    return true;
+}
+
+static shard_t *create_shard(void)
+{
+    shard_t *shard = calloc(1, sizeof(shard_t));
+    if (!shard)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&shards_mutex);
+    shard->next = shards;
+    shards      = shard;
+    pthread_mutex_unlock(&shards_mutex);
+    thread_shard = shard;
+    return shard;
+}
+
+static series_t *thread_series(int id)
+{
+    if (id < 0)
+    {
+        return NULL;
+    }
+    shard_t *shard = thread_shard ? thread_shard : create_shard();
+    if (!shard)
+    {
+        return NULL;
+    }
+
+    _Atomic(block_t *) *slot  = &shard->blocks[id / METRICS_BLOCK_SERIES];
+    block_t            *block = atomic_load_explicit(slot, memory_order_relaxed);
+    if (!block)
+    {
+        block = calloc(1, sizeof(block_t));
+        if (!block)
+        {
+            return NULL;
+        }
+        atomic_store_explicit(slot, block, memory_order_release);
+    }
+    return &block->series[id % METRICS_BLOCK_SERIES];
+}
+
+// 单写者计数: 普通的读-加-写, 不需要带锁前缀的原子指令
+static inline void bump(atomic_ulong *counter, unsigned long value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+void metrics_add(int series, metric_t metric, unsigned long value)
+{
+    series_t *data = thread_series(series);
+    if (data)
+    {
+        bump(&data->counters[metric], value);
+    }
+}
+
+// 对数-线性分桶: 小于 SUB_COUNT 的值各占一档, 之后每个2的幂区间细分为 SUB_COUNT 档
+static int bucket_of(unsigned long value)
+{
+    if (value < SUB_COUNT)
+    {
+        return (int)value;
+    }
+    int msb    = 63 - __builtin_clzl(value);
+    int bucket = ((msb - METRICS_HISTOGRAM_SUB_BITS + 1) * SUB_COUNT)
+               + (int)((value >> (msb - METRICS_HISTOGRAM_SUB_BITS)) & (SUB_COUNT - 1));
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+// 桶的上界 (不含)
+static unsigned long bucket_upper(int bucket)
+{
+    if (bucket < SUB_COUNT)
+    {
+        return (unsigned long)bucket + 1;
+    }
+    int           shift = bucket / SUB_COUNT - 1;
+    unsigned long sub   = (unsigned long)(bucket % SUB_COUNT) + SUB_COUNT;
+    return (sub + 1) << shift;
+}
+
+void metrics_record_latency(int series, long long ns)
+{
+    series_t *data = thread_series(series);
+    if (!data || ns < 0)
+    {
+        return;
+    }
+    unsigned long value = (unsigned long)ns;
+    bump(&data->latency_count, 1);
+    bump(&data->latency_sum, value);
+    bump(&data->buckets[bucket_of(value)], 1);
+    if (value > atomic_load_explicit(&data->latency_max, memory_order_relaxed))
+    {
+        atomic_store_explicit(&data->latency_max, value, memory_order_relaxed);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 合并与格式化
+// ---------------------------------------------------------------------------
+
+// 合并所有线程分片中编号为 id 的数据, 调用方持有 shards_mutex
+static void merge_series(int id, snapshot_t *out)
+{
+    memset(out, 0, sizeof(snapshot_t));
+    for (shard_t *shard = shards; shard; shard = shard->next)
+    {
+        block_t *block = atomic_load_explicit(&shard->blocks[id / METRICS_BLOCK_SERIES], memory_order_acquire);
+        if (!block)
+        {
+            continue;
+        }
+        series_t *data = &block->series[id % METRICS_BLOCK_SERIES];
+        for (int i = 0; i < METRIC_COUNT; i++)
+        {
+            out->counters[i] += atomic_load_explicit(&data->counters[i], memory_order_relaxed);
+        }
+        out->latency_count += atomic_load_explicit(&data->latency_count, memory_order_relaxed);
+        out->latency_sum += atomic_load_explicit(&data->latency_sum, memory_order_relaxed);
+        unsigned long max = atomic_load_explicit(&data->latency_max, memory_order_relaxed);
+        if (max > out->latency_max)
+        {
+            out->latency_max = max;
+        }
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            out->buckets[i] += atomic_load_explicit(&data->buckets[i], memory_order_relaxed);
+        }
+    }
+}
+
+// 分位数 (纳秒), 取所在桶的上界, 不超过最大值
+static unsigned long quantile(const snapshot_t *snapshot, double q)
+{
+    if (snapshot->latency_count == 0)
+    {
+        return 0;
+    }
+    unsigned long rank = (unsigned long)(q * (double)snapshot->latency_count);
+    unsigned long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += snapshot->buckets[i];
+        if (seen > rank)
+        {
+            unsigned long upper = bucket_upper(i);
+            return upper < snapshot->latency_max ? upper : snapshot->latency_max;
+        }
+    }
+    return snapshot->latency_max;
+}
+
+// 合并全部指标对象, 调用方持有 registry_mutex
+static snapshot_t *snapshot_all(void)
+{
+    snapshot_t *snapshots = malloc(sizeof(snapshot_t) * (series_count > 0 ? series_count : 1));
+    if (!snapshots)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&shards_mutex);
+    for (int i = 0; i < series_count; i++)
+    {
+        merge_series(i, &snapshots[i]);
+    }
+    pthread_mutex_unlock(&shards_mutex);
+    return snapshots;
+}
+
+static void text_printf(text_t *text, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void text_printf(text_t *text, const char *fmt, ...)
+{
+    for (;;)
+    {
+        size_t  room = text->capacity - text->len;
+        va_list args;
+        va_start(args, fmt);
+        int written = text->data ? vsnprintf(text->data + text->len, room, fmt, args) : -1;
+        va_end(args);
+        if (written >= 0 && (size_t)written < room)
+        {
+            text->len += (size_t)written;
+            return;
+        }
+
+        size_t capacity = text->capacity ? text->capacity * 2 : 16384;
+        char  *grown    = realloc(text->data, capacity);
+        if (!grown)
+        {
+            return;
+        }
+        text->data     = grown;
+        text->capacity = capacity;
+    }
+}
+
+// 标签值转义 (Prometheus 文本格式)
+static void text_label(text_t *text, const char *value)
+{
+    for (const char *p = value; *p; p++)
+    {
+        if (*p == '\\' || *p == '"')
+        {
+            text_printf(text, "\\%c", *p);
+        }
+        else if (*p == '\n')
+        {
+            text_printf(text, "\\n");
+        }
+        else
+        {
+            text_printf(text, "%c", *p);
+        }
+    }
+}
+
+static void text_series(text_t *text, const char *family, const char *suffix, int id)
+{
+    const series_info_t *info = &series_info[id];
+    text_printf(text, "mqtt_forwarder_%s_%s%s{%s=\"", kind_names[info->kind], family, suffix,
+                kind_names[info->kind]);
+    text_label(text, info->name);
+}
+
+static void text_stage(text_t *text, const char *suffix, int id)
+{
+    text_printf(text, "mqtt_forwarder_rule_stage_seconds%s{rule=\"", suffix);
+    text_label(text, series_info[id].name);
+    text_printf(text, "\",stage=\"%s\"", stage_names[series_info[id].sub]);
+}
+
+// 阶段耗时 (采样), 以 summary 形式导出分位数
+static void format_stages(text_t *text, const snapshot_t *snapshots)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+
+    text_printf(text, "# TYPE mqtt_forwarder_rule_stage_seconds summary\n");
+    for (int i = 0; i < series_count; i++)
+    {
+        if (series_info[i].kind != METRICS_STAGE)
+        {
+            continue;
+        }
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+        {
+            text_stage(text, "", i);
+            text_printf(text, ",quantile=\"%g\"} %.9f\n", quantiles[q], quantile(&snapshots[i], quantiles[q]) / 1e9);
+        }
+        text_stage(text, "_sum", i);
+        text_printf(text, "} %.9f\n", snapshots[i].latency_sum / 1e9);
+        text_stage(text, "_count", i);
+        text_printf(text, "} %lu\n", snapshots[i].latency_count);
+    }
+
+    text_printf(text, "# TYPE mqtt_forwarder_rule_stage_max_seconds gauge\n");
+    for (int i = 0; i < series_count; i++)
+    {
+        if (series_info[i].kind == METRICS_STAGE)
+        {
+            text_printf(text, "mqtt_forwarder_rule_stage_max_seconds{rule=\"");
+            text_label(text, series_info[i].name);
+            text_printf(text, "\",stage=\"%s\"} %.9f\n", stage_names[series_info[i].sub],
+                        snapshots[i].latency_max / 1e9);
+        }
+    }
+}
+
+static void text_batch(text_t *text, const char *suffix, int id)
+{
+    text_printf(text, "mqtt_forwarder_rule_batch_fill_ratio%s{rule=\"", suffix);
+    text_label(text, series_info[id].name);
+    text_printf(text, "\"");
+}
+
+// 批量发布: 每批的填充率 (0-1), 以 summary 形式导出, _count 即发出的批数
+static void format_batches(text_t *text, const snapshot_t *snapshots)
+{
+    static const double quantiles[] = {0.1, 0.5, 0.9};
+
+    text_printf(text, "# TYPE mqtt_forwarder_rule_batch_fill_ratio summary\n");
+    for (int i = 0; i < series_count; i++)
+    {
+        if (series_info[i].kind != METRICS_BATCH)
+        {
+            continue;
+        }
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+        {
+            text_batch(text, "", i);
+            text_printf(text, ",quantile=\"%g\"} %.3f\n", quantiles[q], quantile(&snapshots[i], quantiles[q]) / 1e3);
+        }
+        text_batch(text, "_sum", i);
+        text_printf(text, "} %.3f\n", snapshots[i].latency_sum / 1e3);
+        text_batch(text, "_count", i);
+        text_printf(text, "} %lu\n", snapshots[i].latency_count);
+    }
+}
+
+static void text_lane(text_t *text, const char *suffix, int id)
+{
+    text_printf(text, "mqtt_forwarder_client_lane_queue_seconds%s{client=\"", suffix);
+    text_label(text, series_info[id].name);
+    text_printf(text, "\",queue=\"%s\",lane=\"%s\"", lane_queue_names[series_info[id].sub / PRIORITY_LANES],
+                lane_names[series_info[id].sub % PRIORITY_LANES]);
+}
+
+// 优先级通道的排队时间, 工作线程队列和离线队列分别以 summary 形式导出, 只输出有过消息的通道
+static void format_lanes(text_t *text, const snapshot_t *snapshots)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+
+    text_printf(text, "# TYPE mqtt_forwarder_client_lane_queue_seconds summary\n");
+    for (int i = 0; i < series_count; i++)
+    {
+        if (series_info[i].kind != METRICS_LANE || snapshots[i].latency_count == 0)
+        {
+            continue;
+        }
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+        {
+            text_lane(text, "", i);
+            text_printf(text, ",quantile=\"%g\"} %.9f\n", quantiles[q], quantile(&snapshots[i], quantiles[q]) / 1e9);
+        }
+        text_lane(text, "_sum", i);
+        text_printf(text, "} %.9f\n", snapshots[i].latency_sum / 1e9);
+        text_lane(text, "_count", i);
+        text_printf(text, "} %lu\n", snapshots[i].latency_count);
+    }
+
+    text_printf(text, "# TYPE mqtt_forwarder_client_lane_queue_max_seconds gauge\n");
+    for (int i = 0; i < series_count; i++)
+    {
+        if (series_info[i].kind == METRICS_LANE && snapshots[i].latency_count > 0)
+        {
+            text_printf(text, "mqtt_forwarder_client_lane_queue_max_seconds{client=\"");
+            text_label(text, series_info[i].name);
+            text_printf(text, "\",queue=\"%s\",lane=\"%s\"} %.9f\n",
+                        lane_queue_names[series_info[i].sub / PRIORITY_LANES],
+                        lane_names[series_info[i].sub % PRIORITY_LANES], snapshots[i].latency_max / 1e9);
+        }
+    }
+}
+
+static void text_ack(text_t *text, const char *suffix, int id)
+{
+    text_printf(text, "mqtt_forwarder_client_ack_seconds%s{client=\"", suffix);
+    text_label(text, series_info[id].name);
+    text_printf(text, "\"");
+}
+
+// QoS 1/2 发布的确认延迟 (summary) 和等待确认的消息数, 只输出有过确认的客户端
+static void format_acks(text_t *text, const snapshot_t *snapshots)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+
+    text_printf(text, "# TYPE mqtt_forwarder_client_ack_seconds summary\n");
+    for (int i = 0; i < series_count; i++)
+    {
+        if (series_info[i].kind != METRICS_ACK || snapshots[i].latency_count == 0)
+        {
+            continue;
+        }
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+        {
+            text_ack(text, "", i);
+            text_printf(text, ",quantile=\"%g\"} %.9f\n", quantiles[q], quantile(&snapshots[i], quantiles[q]) / 1e9);
+        }
+        text_ack(text, "_sum", i);
+        text_printf(text, "} %.9f\n", snapshots[i].latency_sum / 1e9);
+        text_ack(text, "_count", i);
+        text_printf(text, "} %lu\n", snapshots[i].latency_count);
+    }
+
+    text_printf(text, "# TYPE mqtt_forwarder_client_ack_max_seconds gauge\n");
+    for (int i = 0; i < series_count; i++)
+    {
+        if (series_info[i].kind == METRICS_ACK && snapshots[i].latency_count > 0)
+        {
+            text_printf(text, "mqtt_forwarder_client_ack_max_seconds{client=\"");
+            text_label(text, series_info[i].name);
+            text_printf(text, "\"} %.9f\n", snapshots[i].latency_max / 1e9);
+        }
+    }
+
+    // 两个计数器在不同线程的分片中累加, 合并时可能短暂出现确认数多于发出数
+    text_printf(text, "# TYPE mqtt_forwarder_client_inflight_messages gauge\n");
+    for (int i = 0; i < series_count; i++)
+    {
+        if (series_info[i].kind == METRICS_CLIENT)
+        {
+            unsigned long published = snapshots[i].counters[METRIC_QOS_PUBLISHED];
+            unsigned long acked     = snapshots[i].counters[METRIC_ACKED];
+            text_series(text, "inflight_messages", "", i);
+            text_printf(text, "\"} %lu\n", published > acked ? published - acked : 0);
+        }
+    }
+}
+
+static void format_prometheus(text_t *text, const snapshot_t *snapshots)
+{
+    for (int kind = METRICS_RULE; kind <= METRICS_CLIENT; kind++)
+    {
+        for (int metric = 0; metric < METRIC_COUNT; metric++)
+        {
+            if (!(kind_metrics[kind] & (1u << metric)))
+            {
+                continue;
+            }
+            text_printf(text, "# TYPE mqtt_forwarder_%s_%s_total counter\n", kind_names[kind], metric_names[metric]);
+            for (int i = 0; i < series_count; i++)
+            {
+                if ((int)series_info[i].kind == kind)
+                {
+                    text_series(text, metric_names[metric], "_total", i);
+                    text_printf(text, "\"} %lu\n", snapshots[i].counters[metric]);
+                }
+            }
+        }
+    }
+
+    // 规则延迟: 从 on_message 进入到 mosquitto_publish 返回
+    text_printf(text, "# TYPE mqtt_forwarder_rule_latency_seconds histogram\n");
+    for (int i = 0; i < series_count; i++)
+    {
+        if (series_info[i].kind != METRICS_RULE)
+        {
+            continue;
+        }
+        const snapshot_t *snapshot = &snapshots[i];
+        int               bucket   = 0;
+        unsigned long     below    = 0;
+        for (size_t b = 0; b < sizeof(latency_bounds) / sizeof(latency_bounds[0]); b++)
+        {
+            unsigned long bound_ns = (unsigned long)(latency_bounds[b] * 1e9);
+            while (bucket < HISTOGRAM_BUCKETS && bucket_upper(bucket) <= bound_ns)
+            {
+                below += snapshot->buckets[bucket++];
+            }
+            text_series(text, "latency_seconds", "_bucket", i);
+            text_printf(text, "\",le=\"%g\"} %lu\n", latency_bounds[b], below);
+        }
+        text_series(text, "latency_seconds", "_bucket", i);
+        text_printf(text, "\",le=\"+Inf\"} %lu\n", snapshot->latency_count);
+        text_series(text, "latency_seconds", "_sum", i);
+        text_printf(text, "\"} %.9f\n", snapshot->latency_sum / 1e9);
+        text_series(text, "latency_seconds", "_count", i);
+        text_printf(text, "\"} %lu\n", snapshot->latency_count);
+    }
+
+    text_printf(text, "# TYPE mqtt_forwarder_rule_latency_max_seconds gauge\n");
+    for (int i = 0; i < series_count; i++)
+    {
+        if (series_info[i].kind == METRICS_RULE)
+        {
+            text_series(text, "latency_max_seconds", "", i);
+            text_printf(text, "\"} %.9f\n", snapshots[i].latency_max / 1e9);
+        }
+    }
+
+    format_stages(text, snapshots);
+    format_batches(text, snapshots);
+    format_lanes(text, snapshots);
+    format_acks(text, snapshots);
+}
+
+static void dump_to_log(void)
+{
+    pthread_mutex_lock(&registry_mutex);
+    snapshot_t *snapshots = snapshot_all();
+    for (int i = 0; snapshots && i < series_count; i++)
+    {
+        const snapshot_t *s    = &snapshots[i];
+        const char       *name = series_info[i].name;
+        if (series_info[i].kind == METRICS_CLIENT)
+        {
+            LOG_INFO("Metrics client=%s received=%lu matched=%lu forwarded=%lu queued=%lu dropped=%lu "
+                     "publish_errors=%lu bytes_in=%lu bytes_out=%lu qos_published=%lu acked=%lu published=%lu",
+                     name, s->counters[METRIC_RECEIVED], s->counters[METRIC_MATCHED],
+                     s->counters[METRIC_FORWARDED], s->counters[METRIC_QUEUED], s->counters[METRIC_DROPPED],
+                     s->counters[METRIC_PUBLISH_ERRORS], s->counters[METRIC_BYTES_IN],
+                     s->counters[METRIC_BYTES_OUT], s->counters[METRIC_QOS_PUBLISHED], s->counters[METRIC_ACKED],
+                     s->counters[METRIC_PUBLISHED]);
+            continue;
+        }
+        if (series_info[i].kind == METRICS_ACK)
+        {
+            if (s->latency_count > 0)
+            {
+                LOG_INFO("Ack client=%s acked=%lu ack_us p50=%.1f p99=%.1f max=%.1f",
+                         name, s->latency_count, quantile(s, 0.5) / 1e3, quantile(s, 0.99) / 1e3,
+                         s->latency_max / 1e3);
+            }
+            continue;
+        }
+        if (series_info[i].kind == METRICS_STAGE)
+        {
+            if (s->latency_count > 0)
+            {
+                LOG_INFO("Profile rule=%s stage=%s samples=%lu us p50=%.1f p99=%.1f max=%.1f",
+                         name, stage_names[series_info[i].sub], s->latency_count,
+                         quantile(s, 0.5) / 1e3, quantile(s, 0.99) / 1e3, s->latency_max / 1e3);
+            }
+            continue;
+        }
+        if (series_info[i].kind == METRICS_LANE)
+        {
+            if (s->latency_count > 0)
+            {
+                LOG_INFO("Lane client=%s queue=%s lane=%s messages=%lu queue_us p50=%.1f p99=%.1f max=%.1f",
+                         name, lane_queue_names[series_info[i].sub / PRIORITY_LANES],
+                         lane_names[series_info[i].sub % PRIORITY_LANES], s->latency_count,
+                         quantile(s, 0.5) / 1e3, quantile(s, 0.99) / 1e3, s->latency_max / 1e3);
+            }
+            continue;
+        }
+        if (series_info[i].kind == METRICS_BATCH)
+        {
+            if (s->latency_count > 0)
+            {
+                LOG_INFO("Batch rule=%s batches=%lu fill p10=%.3f p50=%.3f mean=%.3f",
+                         name, s->latency_count, quantile(s, 0.1) / 1e3, quantile(s, 0.5) / 1e3,
+                         (double)s->latency_sum / (double)s->latency_count / 1e3);
+            }
+            continue;
+        }
+        LOG_INFO("Metrics rule=%s matched=%lu forwarded=%lu queued=%lu dropped=%lu parse_errors=%lu "
+                 "publish_errors=%lu bytes_out=%lu conflated=%lu over_rule_limit=%lu over_device_limit=%lu "
+                 "shed=%lu delayed=%lu heap_allocs=%lu latency_us p50=%.1f p90=%.1f p99=%.1f max=%.1f",
+                 name, s->counters[METRIC_MATCHED], s->counters[METRIC_FORWARDED],
+                 s->counters[METRIC_QUEUED], s->counters[METRIC_DROPPED], s->counters[METRIC_PARSE_ERRORS],
+                 s->counters[METRIC_PUBLISH_ERRORS], s->counters[METRIC_BYTES_OUT], s->counters[METRIC_CONFLATED],
+                 s->counters[METRIC_OVER_RULE_LIMIT], s->counters[METRIC_OVER_DEVICE_LIMIT],
+                 s->counters[METRIC_SHED], s->counters[METRIC_DELAYED], s->counters[METRIC_HEAP_ALLOCS],
+                 quantile(s, 0.5) / 1e3, quantile(s, 0.9) / 1e3, quantile(s, 0.99) / 1e3,
+                 s->latency_max / 1e3);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    free(snapshots);
+}
+
+// ---------------------------------------------------------------------------
+// 导出线程
+// ---------------------------------------------------------------------------
+
+static int open_listener(const char *listen_addr)
+{
+    int fd = -1;
+    if (strncmp(listen_addr, "unix:", 5) == 0)
+    {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        snprintf(unix_path, sizeof(unix_path), "%s", listen_addr + 5);
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", unix_path);
+        unlink(unix_path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0))
+        {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    char        host[256];
+    const char *colon = strrchr(listen_addr, ':');
+    if (!colon || (size_t)(colon - listen_addr) >= sizeof(host))
+    {
+        return -1;
+    }
+    memcpy(host, listen_addr, (size_t)(colon - listen_addr));
+    host[colon - listen_addr] = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE};
+    struct addrinfo *result;
+    if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &result) != 0)
+    {
+        return -1;
+    }
+    for (struct addrinfo *ai = result; ai && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 16) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+static void send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            if (sent < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        data += sent;
+        len -= (size_t)sent;
+    }
+}
+
+// 处理一个 HTTP 请求: GET /metrics 返回 Prometheus 文本, 其他路径返回404
+static void serve_request(int fd)
+{
+    struct timeval timeout = {METRICS_HTTP_TIMEOUT_MS / 1000, (METRICS_HTTP_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char   request[1024];
+    size_t len = 0;
+    while (len < sizeof(request) - 1)
+    {
+        ssize_t received = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (received <= 0)
+        {
+            break;
+        }
+        len += (size_t)received;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n"))
+        {
+            break;
+        }
+    }
+    request[len] = '\0';
+
+    if (strncmp(request, "GET /metrics", 12) != 0 || (request[12] != ' ' && request[12] != '?'))
+    {
+        static const char not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send_all(fd, not_found, sizeof(not_found) - 1);
+        return;
+    }
+
+    text_t body = {0};
+    pthread_mutex_lock(&registry_mutex);
+    snapshot_t *snapshots = snapshot_all();
+    if (snapshots)
+    {
+        format_prometheus(&body, snapshots);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    free(snapshots);
+
+    char header[160];
+    int  header_len = snprintf(header, sizeof(header),
+                               "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                               "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                               body.len);
+    send_all(fd, header, (size_t)header_len);
+    send_all(fd, body.data, body.len);
+    free(body.data);
+}
+
+static void *exporter_main(void *arg)
+{
+    (void)arg;
+    while (atomic_load_explicit(&exporter_running, memory_order_acquire))
+    {
+        if (listen_fd >= 0)
+        {
+            struct pollfd pfd = {.fd = listen_fd, .events = POLLIN};
+            if (poll(&pfd, 1, METRICS_EXPORT_POLL_MS) > 0)
+            {
+                int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+                if (fd >= 0)
+                {
+                    serve_request(fd);
+                    close(fd);
+                }
+            }
+        }
+        else
+        {
+            usleep(METRICS_EXPORT_POLL_MS * 1000);
+        }
+
+        if (atomic_exchange_explicit(&dump_requested, false, memory_order_acq_rel))
+        {
+            dump_to_log();
+        }
+    }
+    return NULL;
+}
+
+int metrics_start(const metrics_config_t *config)
+{
+    sample_interval = config->profile_sample;
+    if (sample_interval > 0)
+    {
+        LOG_INFO("Profiling 1 in %d messages per thread", sample_interval);
+    }
+
+    if (config->listen[0])
+    {
+        listen_fd = open_listener(config->listen);
+        if (listen_fd < 0)
+        {
+            LOG_ERROR("Failed to listen for metrics on %s: %s", config->listen, strerror(errno));
+            return -1;
+        }
+        LOG_INFO("Serving metrics on %s/metrics", config->listen);
+    }
+
+    atomic_store(&exporter_running, true);
+    if (pthread_create(&exporter_thread, NULL, exporter_main, NULL) != 0)
+    {
+        atomic_store(&exporter_running, false);
+        LOG_ERROR("Failed to start metrics exporter");
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_request_dump(void)
+{
+    atomic_store_explicit(&dump_requested, true, memory_order_release);
+}
+
+void metrics_stop(void)
+{
+    if (atomic_exchange(&exporter_running, false))
+    {
+        pthread_join(exporter_thread, NULL);
+    }
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+        listen_fd = -1;
+        if (unix_path[0])
+        {
+            unlink(unix_path);
+            unix_path[0] = '\0';
+        }
+    }
+
+    // 所有线程已停止, 输出最终统计后释放
+    dump_to_log();
+
+    pthread_mutex_lock(&shards_mutex);
+    while (shards)
+    {
+        shard_t *shard = shards;
+        shards         = shard->next;
+        for (int i = 0; i < METRICS_MAX_BLOCKS; i++)
+        {
+            free(atomic_load(&shard->blocks[i]));
+        }
+        free(shard);
+    }
+    thread_shard = NULL;
+    pthread_mutex_unlock(&shards_mutex);
+
+    pthread_mutex_lock(&registry_mutex);
+    for (int i = 0; i < series_count; i++)
+    {
+        free(series_info[i].name);
+    }
+    free(series_info);
+    series_info     = NULL;
+    series_count    = 0;
+    series_capacity = 0;
+    hash_index_destroy(&series_index);
+    pthread_mutex_unlock(&registry_mutex);
+}
@@ -0,0 +1,116 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+
+#include "config.h"
+#include "time_util.h"
+
+// 运行指标: 按规则和客户端统计的计数器与延迟直方图。
+// 每个线程写入自己的分片 (单写者, 无原子读改写), 导出时合并所有线程的分片。
+// 导出方式: SIGUSR1 时输出到日志; 配置 metrics.listen 时提供 Prometheus 文本格式的 HTTP 接口。
+// 配置 metrics.profile_sample=N 时每个线程每N条消息抽取一条, 记录各处理阶段的耗时。
+
+// 指标对象类型
+typedef enum
+{
+    METRICS_RULE = 0,
+    METRICS_CLIENT,
+    METRICS_STAGE,   // 规则的一个处理阶段, 只有耗时分布
+    METRICS_BATCH,   // 规则的批量发布, 分布中记录每批的填充率 (千分比)
+    METRICS_LANE,    // 客户端一个队列中的一个优先级通道, 分布中记录消息在队列中的等待时间
+    METRICS_ACK      // 客户端作为目标时 QoS 1/2 发布的确认延迟
+} metrics_kind_t;
+
+// 处理阶段 (事件包装/指令转换的快速路径在一次扫描中完成解析和序列化, 合并为 convert)
+typedef enum
+{
+    STAGE_MATCH = 0,   // on_message 进入到规则匹配完成
+    STAGE_HANDOFF,     // 匹配完成到工作线程开始处理 (未启用工作线程时为0)
+    STAGE_CONVERT,     // 负载解析、转换和序列化
+    STAGE_REWRITE,     // 目标主题改写
+    STAGE_PUBLISH,     // forward_publish (mosquitto_publish 或进入离线队列)
+    STAGE_COUNT
+} stage_t;
+
+// 按优先级通道统计排队时间的队列
+typedef enum
+{
+    LANE_QUEUE_WORKER = 0,   // 源客户端的工作线程队列: 从收到到开始处理
+    LANE_QUEUE_OFFLINE,      // 目标客户端的离线队列: 从入队到重放
+    LANE_QUEUE_COUNT
+} lane_queue_t;
+
+// 计数器
+typedef enum
+{
+    METRIC_RECEIVED = 0,     // 客户端收到的消息
+    METRIC_MATCHED,          // 匹配到规则的消息
+    METRIC_FORWARDED,        // 直接发布成功的消息
+    METRIC_QUEUED,           // 目标断开或有积压时进入离线队列的消息
+    METRIC_DROPPED,          // 目标断开且离线队列拒绝的消息
+    METRIC_PARSE_ERRORS,     // 负载解析/转换失败
+    METRIC_PUBLISH_ERRORS,   // mosquitto_publish 返回其他错误
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_CONFLATED,        // 最新值合并: 发出前被同一设备的新值替换的消息
+    METRIC_OVER_RULE_LIMIT,  // 限速: 超出规则限额的消息
+    METRIC_OVER_DEVICE_LIMIT, // 限速: 超出设备限额的消息
+    METRIC_SHED,             // 限速: 超限被丢弃的消息
+    METRIC_DELAYED,          // 限速: 超限被延迟发出的消息
+    METRIC_QOS_PUBLISHED,    // 以 QoS 1/2 发出、需要确认的消息
+    METRIC_ACKED,            // 已收到确认的 QoS 1/2 消息
+    METRIC_PUBLISHED,        // 交给该连接发出的消息 (发布连接池中每个连接各自统计)
+    METRIC_HEAP_ALLOCS,      // 规则回调中的堆分配 (超出临时内存块、输出缓冲区扩大), 除以 matched 即每条消息的分配数
+    METRIC_COUNT
+} metric_t;
+
+// 指标配置
+typedef struct
+{
+    char listen[256];     // "host:port" 或 "unix:/path", 为空时不提供 HTTP 接口
+    int  profile_sample;  // 阶段耗时的采样间隔, 0表示不采样
+} metrics_config_t;
+
+// 注册一个指标对象, 返回其编号 (超出上限时返回-1, 此后对该编号的统计被忽略)。
+// 同类型同名的对象返回同一编号, 重新加载配置后计数延续。
+int metrics_register(metrics_kind_t kind, const char *name);
+
+// 热路径: 只修改当前线程的分片
+void metrics_add(int series, metric_t metric, unsigned long value);
+void metrics_record_latency(int series, long long ns);
+
+// 为规则注册各阶段的耗时分布, 编号写入 ids
+void metrics_register_stages(const char *rule, int ids[STAGE_COUNT]);
+
+// 为客户端注册各队列各优先级通道的排队时间分布, 编号写入 ids
+void metrics_register_lanes(const char *client, int ids[LANE_QUEUE_COUNT][PRIORITY_LANES]);
+
+// 当前线程正在处理的消息是否被抽中
+extern _Thread_local bool metrics_stage_sampled;
+
+// 在 on_message 中调用: 决定本条消息是否采样
+bool metrics_sample_message(void);
+
+// 阶段计时, 未抽中时只有一次线程局部变量读取
+static inline long long stage_begin(void)
+{
+    return metrics_stage_sampled ? monotonic_ns() : 0;
+}
+
+static inline void stage_end(int series, long long start)
+{
+    if (start)
+    {
+        metrics_record_latency(series, monotonic_ns() - start);
+    }
+}
+
+// 启动导出线程 (处理 HTTP 请求和 SIGUSR1 输出请求) / 停止并释放所有分片
+int  metrics_start(const metrics_config_t *config);
+void metrics_stop(void);
+
+// 请求把当前指标输出到日志, 可在信号处理函数中调用
+void metrics_request_dump(void);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,31 +10,103 @@
 #include <unistd.h>
 
 #include "config.h"
+#include "event_loop.h"
+#include "hash_index.h"
 #include "logger.h"
+#include "rcu.h"
+#include "scratch_arena.h"
+#include "time_util.h"
+#include "topic_trie.h"
 
-// 全局变量
-static mqtt_client_t  clients[MAX_CLIENTS];
-static int            client_count = 0;
-static forward_rule_t forward_rules[MAX_FORWARD_RULES];
-static int            rule_count = 0;
+// 以某个客户端为源的规则: 主题索引, 以及需要订阅的主题 (已去掉被其他过滤器覆盖的)
+typedef struct
+{
+    topic_trie_t *index;        // 只由该客户端的网络线程匹配
+    const char  **topics;       // 指向规则中的 source_topic
+    int           topic_count;
+} source_rules_t;
+
+// 以某个客户端为目标、需要定时发出 (最新值合并、批量发布) 的规则, 由该客户端的定时任务处理
+typedef struct
+{
+    forward_rule_t **rules;
+    int              count;
+} timed_rules_t;
 
-// 订阅记录结构体
+// 规则表: 构建完成后不再修改 (索引内部的匹配缓存除外), 热加载时整体替换
 typedef struct
 {
-    mqtt_client_t *client;
-    char           topic[256];
-} subscription_t;
+    forward_rule_t **rules;
+    int              rule_count;
+    source_rules_t  *sources;     // 按客户端槽位, 没有规则的槽位为空
+    timed_rules_t   *timed;       // 按目标客户端槽位
+    int              slot_count;
+} rule_table_t;
+
+// 全局变量: 客户端和规则逐个分配, 地址在运行期间不变, 规则和事件循环可直接持有指针
+static mqtt_client_t  **clients = NULL;
+static int              client_count = 0;
+static int              client_capacity = 0;
+static pthread_mutex_t  clients_lock = PTHREAD_MUTEX_INITIALIZER;  // 热加载增删客户端时与定时任务互斥
+static hash_index_t     client_index;   // (ip, port) -> 客户端
+static int              next_slot = 0;
+static forward_rule_t **pending_rules = NULL;   // 已添加、尚未发布到规则表的规则
+static int              pending_count = 0;
+static int              pending_capacity = 0;
+static engine_config_t engine_config;
+static event_loop_t  *event_loops[ENGINE_MAX_LOOPS];
+static int            event_loop_count = 0;
+static mqtt_config_t  connect_settings;         // 现有连接使用的 MQTT 设置 (字符串为副本)
+static int            connect_settings_saved = 0;
+
+// 当前规则表: on_message 在 RCU 读临界区内读取, 热加载原子替换;
+// on_connect 在 subscribe_lock 内读取, 使订阅与替换时的增删不会交错
+static _Atomic(rule_table_t *) active_table = NULL;
+static pthread_mutex_t         subscribe_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 热加载期间: 新配置使用的客户端 (保留的和新建的), 以及本次新建的客户端
+static int                  reloading = 0;
+static hash_index_t         reload_index;
+static mqtt_client_t      **reload_clients = NULL;
+static int                  reload_client_count = 0;
+static int                  reload_client_capacity = 0;
+static const mqtt_config_t *reload_mqtt = NULL;
 
+// 当前线程正在处理的消息进入 on_message 的时间 (用于规则延迟统计)、源主题 (最新值合并的键)
+// 和需要转发的 MQTT v5 属性
+static _Thread_local long long              message_start_ns = 0;
+static _Thread_local const char            *message_topic    = NULL;
+static _Thread_local const message_props_t *message_props    = NULL;
 
 
-// 日志级别定义
-log_level_t current_log_level;
 
 // 函数声明
 mqtt_client_t *find_client(const char *ip, int port);
 
 
 
+static const source_rules_t *source_rules_of(const rule_table_t *table, const mqtt_client_t *client)
+{
+    if (!table || client->slot >= table->slot_count)
+    {
+        return NULL;
+    }
+    return &table->sources[client->slot];
+}
+
+static void subscribe_topic(mqtt_client_t *client, const char *topic)
+{
+    int ret = mosquitto_subscribe(client->mosq, NULL, topic, client->config.qos);
+    if (ret == MOSQ_ERR_SUCCESS)
+    {
+        LOG_INFO("Subscribed to topic: %s (qos %d)", topic, client->config.qos);
+    }
+    else
+    {
+        LOG_ERROR("Subscribe failed for topic: %s", topic);
+    }
+}
+
 // 连接回调
 void on_connect(struct mosquitto *mosq, void *userdata, int result)
 {
@@ -43,67 +116,27 @@ void on_connect(struct mosquitto *mosq, void *userdata, int result)
     {
         LOG_INFO("Connected to broker %s", client->ip);
         client->connected = 1;
+        client->reconnect_delay = 1;
 
-        // 收集该客户端需要订阅的主题
-        char topics[MAX_FORWARD_RULES][256];
-        int topic_count = 0;
-        
-        for (int i = 0; i < rule_count; i++)
+        long backlog = outbound_queue_pending(&client->queue);
+        if (client->spill)
         {
-            if (strcmp(forward_rules[i].source_ip, client->ip) == 0 && 
-                forward_rules[i].source_port == client->port)
-            {
-                // 检查新主题是否会被现有主题覆盖
-                bool should_add = true;
-                for (int j = 0; j < topic_count; j++)
-                {
-                    bool matches;
-                    if (mosquitto_topic_matches_sub(topics[j], forward_rules[i].source_topic, &matches) == MOSQ_ERR_SUCCESS && matches)
-                    {
-                        should_add = false;
-                        break;
-                    }
-                }
-                
-                if (should_add && topic_count < MAX_FORWARD_RULES)
-                {
-                    // 检查新主题是否覆盖现有主题，需要取消被覆盖的订阅
-                    for (int j = topic_count - 1; j >= 0; j--)
-                    {
-                        bool matches;
-                        if (mosquitto_topic_matches_sub(forward_rules[i].source_topic, topics[j], &matches) == MOSQ_ERR_SUCCESS && matches)
-                        {
-                            mosquitto_unsubscribe(client->mosq, NULL, topics[j]);
-                            LOG_INFO("Unsubscribed redundant topic: %s (covered by %s)", topics[j], forward_rules[i].source_topic);
-                            
-                            // 移除被覆盖的主题
-                            for (int k = j; k < topic_count - 1; k++)
-                            {
-                                strcpy(topics[k], topics[k + 1]);
-                            }
-                            topic_count--;
-                        }
-                    }
-                    
-                    snprintf(topics[topic_count], sizeof(topics[topic_count]), "%s", forward_rules[i].source_topic);
-                    topic_count++;
-                }
-            }
+            backlog += spill_log_pending(client->spill);
         }
-        
-        // 订阅所有主题
-        for (int i = 0; i < topic_count; i++)
+        if (backlog > 0)
         {
-            int ret = mosquitto_subscribe(client->mosq, NULL, topics[i], 0);
-            if (ret == MOSQ_ERR_SUCCESS)
-            {
-                LOG_INFO("Subscribed to topic: %s", topics[i]);
-            }
-            else
-            {
-                LOG_ERROR("Subscribe failed for topic: %s", topics[i]);
-            }
+            LOG_INFO("Replaying %ld queued messages to %s at %d msg/s",
+                     backlog, client->ip, client->queue.config.replay_rate);
+        }
+
+        // 订阅当前规则表中以该客户端为源的主题
+        pthread_mutex_lock(&subscribe_lock);
+        const source_rules_t *rules = source_rules_of(atomic_load_explicit(&active_table, memory_order_acquire), client);
+        for (int i = 0; rules && i < rules->topic_count; i++)
+        {
+            subscribe_topic(client, rules->topics[i]);
         }
+        pthread_mutex_unlock(&subscribe_lock);
     }
     else
     {
@@ -112,6 +145,34 @@ void on_connect(struct mosquitto *mosq, void *userdata, int result)
     }
 }
 
+// MQTT v5 连接回调: 按 Broker 允许的主题别名数重置别名表, 之后与 v3.1.1 相同
+void on_connect_v5(struct mosquitto *mosq, void *userdata, int result, int flags, const mosquitto_property *props)
+{
+    mqtt_client_t *client = (mqtt_client_t *)userdata;
+
+    if (result == 0 && client->aliases)
+    {
+        uint16_t maximum = 0;
+        mosquitto_property_read_int16(props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &maximum, false);
+        int aliases = maximum < client->config.topic_alias_max ? maximum : client->config.topic_alias_max;
+        topic_alias_reset(client->aliases, aliases);
+        LOG_INFO("Using %d topic aliases for %s (broker allows %d)", aliases, client->ip, maximum);
+    }
+    on_connect(mosq, userdata, result);
+}
+
+// 发布完成回调: QoS 1/2 为收到确认 (PUBACK/PUBCOMP) 时, QoS 0 为写入套接字时 (没有记录, 忽略)
+void on_publish(struct mosquitto *mosq, void *userdata, int mid)
+{
+    mqtt_client_t *client  = (mqtt_client_t *)userdata;
+    long long      latency = inflight_complete(&client->inflight, mid, monotonic_ns());
+    if (latency >= 0)
+    {
+        metrics_add(client->metrics_id, METRIC_ACKED, 1);
+        metrics_record_latency(client->ack_metrics_id, latency);
+    }
+}
+
 // 断开连接回调
 void on_disconnect(struct mosquitto *mosq, void *userdata, int result)
 {
@@ -148,219 +209,2080 @@ void on_disconnect(struct mosquitto *mosq, void *userdata, int result)
 
     LOG_INFO("Disconnected from broker %s (result: %d - %s)", client->ip, result, reason);
     client->connected = 0;
+    // 别名只在一次连接内有效, 重连后由 on_connect_v5 按新的上限启用
+    if (client->aliases)
+    {
+        topic_alias_reset(client->aliases, 0);
+    }
+    // 断开前未确认的发布不再统计延迟 (重连后重发的确认只留下确认时间), 计为完成以保持等待确认数准确
+    long abandoned = inflight_reset(&client->inflight);
+    if (abandoned > 0)
+    {
+        metrics_add(client->metrics_id, METRIC_ACKED, (unsigned long)abandoned);
+    }
 }
 
-// 通用消息处理回调
-void on_message(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message)
+// 交给工作线程的转发任务: 规则在网络线程上匹配, 规则列表、主题和负载复制到同一块内存
+typedef struct
 {
-    mqtt_client_t *source_client = (mqtt_client_t *)userdata;
+    mqtt_client_t           *source;
+    long long                received_ns;   // 进入 on_message 的时间
+    long long                matched_ns;    // 规则匹配完成的时间, 未采样时为0
+    int                      lane;          // 匹配到的规则中最高的优先级
+    int                      rule_count;
+    message_props_t         *props;         // 需要转发的 MQTT v5 属性 (可选)
+    struct mosquitto_message message;
+    forward_rule_t          *rules[];   // 其后紧跟主题和负载
+} forward_job_t;
 
-    // 基础消息验证
-    if (!message->payload || message->payloadlen <= 0)
+// 限速检查, 返回 false 表示该消息不在此时转发 (已丢弃或延迟)
+static bool rate_admit(const forward_rule_t *rule, const struct mosquitto_message *message, long long received_ns)
+{
+    unsigned       over    = 0;
+    rate_verdict_t verdict = rate_limiter_admit(rule->limiter, message->topic, message->payload,
+                                                (size_t)message->payloadlen, message->qos, message->retain,
+                                                received_ns, &over);
+    if (over & RATE_OVER_RULE)
     {
-        LOG_ERROR("Invalid message received from topic: %s", message->topic);
-        return;
+        metrics_add(rule->metrics_id, METRIC_OVER_RULE_LIMIT, 1);
+    }
+    if (over & RATE_OVER_DEVICE)
+    {
+        metrics_add(rule->metrics_id, METRIC_OVER_DEVICE_LIMIT, 1);
+    }
+    if (verdict == RATE_SHED)
+    {
+        metrics_add(rule->metrics_id, METRIC_SHED, 1);
+        LOG_DEBUG("Rate limit shed message for rule %s: topic=%s", rule->rule_name, message->topic);
+    }
+    else if (verdict == RATE_DELAYED)
+    {
+        metrics_add(rule->metrics_id, METRIC_DELAYED, 1);
     }
+    return verdict == RATE_PASS;
+}
 
-    if (message->payloadlen > MAX_MESSAGE_SIZE)
+// 执行规则的回调, 回调中 cJSON 的分配使用线程私有的临时内存, 返回前整体复位
+static void run_callback(const forward_rule_t           *rule,
+                         mqtt_client_t                  *source,
+                         mqtt_client_t                  *target,
+                         const struct mosquitto_message *message)
+{
+    scratch_begin();
+    rule->message_callback(rule, source, target, message);
+    unsigned long allocs = scratch_end();
+    if (allocs)
     {
-        LOG_ERROR("Message too large (%d bytes), dropping from topic: %s",
-                  message->payloadlen,
-                  message->topic);
-        return;
+        metrics_add(rule->metrics_id, METRIC_HEAP_ALLOCS, allocs);
     }
+}
 
-    // 遍历转发规则，找到匹配的规则
+// 按顺序执行匹配到的规则
+static void dispatch_rules(mqtt_client_t                  *source_client,
+                           forward_rule_t *const          *rules,
+                           int                             rule_count,
+                           const struct mosquitto_message *message,
+                           const message_props_t          *props,
+                           long long                       received_ns,
+                           long long                       matched_ns)
+{
+    long long dispatch_ns = matched_ns ? monotonic_ns() : 0;
+    message_start_ns      = received_ns;
+    message_topic         = message->topic;
+    message_props         = props;
+    metrics_stage_sampled = matched_ns != 0;
     for (int i = 0; i < rule_count; i++)
     {
-        if (strcmp(forward_rules[i].source_ip, source_client->ip) == 0 && 
-            forward_rules[i].source_port == source_client->port)
+        forward_rule_t *rule = rules[i];
+        LOG_DEBUG("Rule matched: %s", rule->rule_name);
+        metrics_add(rule->metrics_id, METRIC_MATCHED, 1);
+        if (matched_ns)
         {
-            // 检查主题是否匹配
-            bool matches = false;
-            if (mosquitto_topic_matches_sub(forward_rules[i].source_topic, message->topic, &matches)
-                    == MOSQ_ERR_SUCCESS
-                && matches)
-            {
-                LOG_DEBUG("Rule matched: %s", forward_rules[i].rule_name);
+            metrics_record_latency(rule->stage_ids[STAGE_MATCH], matched_ns - received_ns);
+            metrics_record_latency(rule->stage_ids[STAGE_HANDOFF], dispatch_ns - matched_ns);
+        }
+        if (rule->limiter && !rate_admit(rule, message, received_ns))
+        {
+            continue;
+        }
 
-                // 查找目标客户端
-                mqtt_client_t *target_client = find_client(forward_rules[i].target_ip, forward_rules[i].target_port);
-                if (!target_client || !target_client->mosq || !target_client->connected)
-                {
-                    LOG_ERROR("Target client %s not found or not connected",
-                              forward_rules[i].target_ip);
-                    return;
-                }
+        // 目标断开时由 forward_publish 进入离线队列, 不影响后续规则
+        mqtt_client_t *target_client = rule->target;
+        if (!target_client->mosq)
+        {
+            LOG_ERROR("Target client %s not found", target_client->ip);
+            continue;
+        }
 
-                LOG_INFO("Forward %s: topic=%s, payload_length=%d",
-                         forward_rules[i].rule_name,
-                         message->topic,
-                         message->payloadlen);
+        LOG_INFO_SAMPLED("Forward %s: topic=%s, payload_length=%d",
+                 rule->rule_name,
+                 message->topic,
+                 message->payloadlen);
 
-                forward_rules[i].message_callback(source_client, target_client, message);
-            }
-        }
+        run_callback(rule, source_client, target_client, message);
     }
+    metrics_stage_sampled = false;
+    message_topic         = NULL;
+    message_props         = NULL;
 }
 
-// 查找现有客户端
-mqtt_client_t *find_client(const char *ip, int port)
+static void run_forward_job(void *arg)
 {
-    for (int i = 0; i < client_count; i++)
+    forward_job_t *job = (forward_job_t *)arg;
+    metrics_record_latency(job->source->lane_metrics_ids[LANE_QUEUE_WORKER][job->lane],
+                           monotonic_ns() - job->received_ns);
+    dispatch_rules(job->source, job->rules, job->rule_count, &job->message, job->props, job->received_ns,
+                   job->matched_ns);
+    message_props_free(job->props);
+    free(job);
+}
+
+// 同一主题 (即同一设备) 的消息总是落在同一个工作线程上, 保持顺序
+static unsigned int topic_shard(const char *topic)
+{
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)topic; *p; p++)
     {
-        if (strcmp(clients[i].ip, ip) == 0 && clients[i].port == port)
-        {
-            return &clients[i];
-        }
+        hash = (hash ^ *p) * 16777619u;
     }
-    return NULL;
+    return hash;
 }
 
-// 创建并连接客户端
-mqtt_client_t *mqtt_connect(const client_config_t *client_cfg, const mqtt_config_t *mqtt_cfg)
+// 客户端的连接数 (主连接加发布连接池中的其余连接) 和第i个连接, 0为主连接
+static int connection_count(const mqtt_client_t *client)
 {
-    if (!client_cfg || !mqtt_cfg) {
-        LOG_ERROR("Invalid client or mqtt configuration");
+    return client->publisher_count > 1 ? client->publisher_count : 1;
+}
+
+static mqtt_client_t *connection_of(mqtt_client_t *client, int i)
+{
+    return i == 0 ? client : client->publishers[i];
+}
+
+// 发布到客户端时使用的连接: 有发布连接池时按主题哈希选择, 同一主题总走同一连接以保持顺序
+static mqtt_client_t *publisher_of(mqtt_client_t *client, const char *topic)
+{
+    if (client->publisher_count <= 1)
+    {
+        return client;
+    }
+    return client->publishers[topic_shard(topic) % (unsigned int)client->publisher_count];
+}
+
+static forward_job_t *make_forward_job(mqtt_client_t                  *source_client,
+                                       void *const                    *matched,
+                                       int                             matched_count,
+                                       const struct mosquitto_message *message,
+                                       long long                       received_ns,
+                                       long long                       matched_ns)
+{
+    size_t rules_len = sizeof(forward_rule_t *) * (size_t)matched_count;
+    size_t topic_len = strlen(message->topic) + 1;
+    forward_job_t *job = malloc(sizeof(forward_job_t) + rules_len + topic_len + (size_t)message->payloadlen + 1);
+    if (!job)
+    {
         return NULL;
     }
 
-    // 查找现有客户端
-    mqtt_client_t *existing = find_client(client_cfg->ip, client_cfg->port);
-    if (existing) {
-        return existing;
+    job->source      = source_client;
+    job->received_ns = received_ns;
+    job->matched_ns  = matched_ns;
+    job->lane        = PRIORITY_LOW;
+    job->rule_count  = matched_count;
+    job->props       = NULL;
+    for (int i = 0; i < matched_count; i++)
+    {
+        job->rules[i] = (forward_rule_t *)matched[i];
+        if ((int)job->rules[i]->priority < job->lane)
+        {
+            job->lane = (int)job->rules[i]->priority;
+        }
     }
 
-    // 创建新客户端
-    if (client_count >= MAX_CLIENTS)
+    char *topic   = (char *)job->rules + rules_len;
+    char *payload = topic + topic_len;
+    memcpy(topic, message->topic, topic_len);
+    memcpy(payload, message->payload, (size_t)message->payloadlen);
+    payload[message->payloadlen] = '\0';
+
+    job->message.mid        = message->mid;
+    job->message.topic      = topic;
+    job->message.payload    = payload;
+    job->message.payloadlen = message->payloadlen;
+    job->message.qos        = message->qos;
+    job->message.retain     = message->retain;
+    return job;
+}
+
+// 按当前规则表匹配并分发一条消息, 在 RCU 读临界区内调用; 属性只在匹配到规则后提取
+static void route_message(mqtt_client_t                  *source_client,
+                          const struct mosquitto_message *message,
+                          const mosquitto_property       *properties,
+                          long long                       received_ns)
+{
+    // 通过源客户端的规则索引查找匹配的规则
+    const source_rules_t *rules = source_rules_of(atomic_load_explicit(&active_table, memory_order_acquire),
+                                                  source_client);
+    if (!rules || !rules->index)
     {
-        LOG_ERROR("Maximum clients (%d) exceeded", MAX_CLIENTS);
-        return NULL;
+        return;
     }
 
-    mqtt_client_t *client = &clients[client_count];
-    snprintf(client->ip, sizeof(client->ip), "%s", client_cfg->ip);
-    snprintf(client->client_id, sizeof(client->client_id), "%s", client_cfg->client_id);
-    client->connected = 0;
-    client->port = client_cfg->port;
+    void *const *matched;
+    int          matched_count = topic_trie_match(rules->index, message->topic, &matched);
+    if (matched_count == 0)
+    {
+        return;
+    }
+    metrics_add(source_client->metrics_id, METRIC_MATCHED, 1);
 
-    client->mosq = mosquitto_new(client->client_id, mqtt_cfg->clean_session, client);
-    if (!client->mosq)
+    // 抽中的消息记录各阶段耗时
+    long long matched_ns = metrics_sample_message() ? monotonic_ns() : 0;
+    message_props_t *props = properties ? message_props_extract(properties) : NULL;
+    if (!source_client->workers)
     {
-        LOG_ERROR("Failed to create mosquitto client for %s", client_cfg->ip);
-        return NULL;
+        dispatch_rules(source_client, (forward_rule_t *const *)matched, matched_count, message, props,
+                       received_ns, matched_ns);
+        message_props_free(props);
+        return;
     }
 
-    // 设置回调
-    mosquitto_connect_callback_set(client->mosq, on_connect);
-    mosquitto_disconnect_callback_set(client->mosq, on_disconnect);
-    mosquitto_message_callback_set(client->mosq, on_message);
-    mosquitto_reconnect_delay_set(client->mosq, 1, RECONNECT_DELAY, true);
+    // 转换和发布交给工作线程, 网络线程只负责收包和匹配;
+    // 任务持有的规则指针由热加载在回收旧规则表前等待工作线程处理完
+    forward_job_t *job = make_forward_job(source_client, matched, matched_count, message,
+                                          received_ns, matched_ns);
+    if (!job)
+    {
+        LOG_ERROR("Out of memory, dropping message from topic: %s", message->topic);
+        metrics_add(source_client->metrics_id, METRIC_DROPPED, 1);
+        message_props_free(props);
+        return;
+    }
+    job->props = props;
+    // 同一主题匹配的规则集合不变, 总是进入同一通道, 同一设备的消息仍按顺序处理
+    if (worker_pool_submit(source_client->workers, topic_shard(message->topic), job->lane, job) != 0)
+    {
+        metrics_add(source_client->metrics_id, METRIC_DROPPED, 1);
+        message_props_free(job->props);
+        free(job);
+    }
+}
 
-    // 设置用户名和密码
-    if (mqtt_cfg->username && mqtt_cfg->password) {
-        int ret = mosquitto_username_pw_set(client->mosq, mqtt_cfg->username, mqtt_cfg->password);
-        if (ret != MOSQ_ERR_SUCCESS) {
-            LOG_ERROR("Failed to set username/password for %s: %s", 
-                     client_cfg->ip, mosquitto_strerror(ret));
-            mosquitto_destroy(client->mosq);
-            return NULL;
-        }
-        LOG_INFO("Set authentication for %s", client_cfg->ip);
+static void receive_message(mqtt_client_t                  *source_client,
+                            const struct mosquitto_message *message,
+                            const mosquitto_property       *properties)
+{
+    long long received_ns = monotonic_ns();
+
+    metrics_add(source_client->metrics_id, METRIC_RECEIVED, 1);
+    if (message->payloadlen > 0)
+    {
+        metrics_add(source_client->metrics_id, METRIC_BYTES_IN, (unsigned long)message->payloadlen);
     }
 
-    // 异步连接
-    int ret = mosquitto_connect_async(client->mosq, client_cfg->ip, client_cfg->port, mqtt_cfg->keepalive);
-    if (ret != MOSQ_ERR_SUCCESS)
+    // 基础消息验证
+    if (!message->payload || message->payloadlen <= 0)
     {
-        LOG_ERROR("Failed to initiate connection to %s:%d: %s", 
-                 client_cfg->ip, client_cfg->port, mosquitto_strerror(ret));
-        mosquitto_destroy(client->mosq);
-        return NULL;
+        LOG_ERROR("Invalid message received from topic: %s", message->topic);
+        return;
     }
-    else
+
+    if (message->payloadlen > MAX_MESSAGE_SIZE)
     {
-        LOG_INFO("Connecting to %s:%d...", client_cfg->ip, client_cfg->port);
+        LOG_ERROR("Message too large (%d bytes), dropping from topic: %s",
+                  message->payloadlen,
+                  message->topic);
+        return;
     }
-    
-    mosquitto_loop_start(client->mosq);
 
-    client_count++;
-    LOG_INFO("Created client for %s with ID: %s", client_cfg->ip, client->client_id);
-    return client;
+    rcu_read_lock();
+    route_message(source_client, message, properties, received_ns);
+    rcu_read_unlock();
 }
 
-int add_forward_rule(const char *source_ip,
-                     int source_port,
-                     const char *source_topic,
-                     const char *target_ip,
-                     int target_port,
-                     const char *target_topic,
-                     void (*callback)(mqtt_client_t                  *source,
-                                      mqtt_client_t                  *target,
-                                      const struct mosquitto_message *message),
-                     const char *rule_name)
+// 通用消息处理回调
+void on_message(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *message)
+{
+    receive_message((mqtt_client_t *)userdata, message, NULL);
+}
+
+// MQTT v5 消息处理回调, 属性随消息转发
+void on_message_v5(struct mosquitto               *mosq,
+                   void                           *userdata,
+                   const struct mosquitto_message *message,
+                   const mosquitto_property       *props)
+{
+    receive_message((mqtt_client_t *)userdata, message, props);
+}
+
+// 目标客户端尚未发出的积压消息数 (各连接的内存队列 + 磁盘溢出日志)
+static long backlog_of(mqtt_client_t *client)
 {
-    if (rule_count >= MAX_FORWARD_RULES)
+    long backlog = 0;
+    for (int i = 0; i < connection_count(client); i++)
     {
-        LOG_ERROR("Maximum forward rules (%d) exceeded", MAX_FORWARD_RULES);
-        return -1;
+        backlog += outbound_queue_pending(&connection_of(client, i)->queue);
     }
+    if (client->spill)
+    {
+        backlog += spill_log_pending(client->spill);
+    }
+    return backlog;
+}
 
-    forward_rule_t *rule = &forward_rules[rule_count];
-
-    // 存储IP地址和端口
-    snprintf(rule->source_ip, sizeof(rule->source_ip), "%s", source_ip);
-    rule->source_port = source_port;
-    snprintf(rule->target_ip, sizeof(rule->target_ip), "%s", target_ip);
-    rule->target_port = target_port;
-    snprintf(rule->source_topic, sizeof(rule->source_topic), "%s", source_topic);
-    snprintf(rule->target_topic, sizeof(rule->target_topic), "%s", target_topic);
-    rule->message_callback = callback;
-    snprintf(rule->rule_name, sizeof(rule->rule_name), "%s", rule_name);
+// 经 publisher 发出的 lane 通道消息之前还有多少未发出: 该连接该通道的内存队列,
+// 以及不分连接和通道的磁盘溢出日志
+static long lane_backlog_of(mqtt_client_t *client, mqtt_client_t *publisher, int lane)
+{
+    long backlog = outbound_queue_lane_pending(&publisher->queue, lane);
+    if (client->spill)
+    {
+        backlog += spill_log_pending(client->spill);
+    }
+    return backlog;
+}
 
-    LOG_INFO("Added forward rule: %s (%s:%s -> %s:%s)",
-             rule_name,
-             source_ip,
-             source_topic,
-             target_ip,
-             target_topic);
-    rule_count++;
+// MQTT v5 发布: 带上转发的属性, QoS 0 消息使用主题别名。
+// 别名只用于 QoS 0: QoS 1/2 报文可能在 libmosquitto 内排队或重发, 那时别名可能已指向别的主题。
+// 持别名锁发布, 使报文进入发送队列的顺序与别名分配的顺序一致
+static int publish_v5(mqtt_client_t         *client,
+                      int                   *mid,
+                      const char            *topic,
+                      int                    payloadlen,
+                      const void            *payload,
+                      int                    qos,
+                      bool                   retain,
+                      const message_props_t *props,
+                      long long              received_ns)
+{
+    topic_alias_t *aliases = qos == 0 ? client->aliases : NULL;
+    if (!aliases && !props)
+    {
+        return mosquitto_publish(client->mosq, mid, topic, payloadlen, payload, qos, retain);
+    }
 
-    return 0;
+    int  alias = 0;
+    bool known = false;
+    if (aliases)
+    {
+        topic_alias_lock(aliases);
+        alias = topic_alias_lookup(aliases, topic, &known);
+    }
+    mosquitto_property *list = NULL;
+    int ret = message_props_build(props, received_ns, alias, &list);
+    if (ret == MOSQ_ERR_SUCCESS)
+    {
+        // 已建立的别名只发别名, 新分配的别名随完整主题发出以建立映射
+        ret = mosquitto_publish_v5(client->mosq, mid, known ? NULL : topic, payloadlen, payload, qos, retain, list);
+        mosquitto_property_free_all(&list);
+    }
+    if (aliases)
+    {
+        if (ret != MOSQ_ERR_SUCCESS && alias && !known)
+        {
+            topic_alias_cancel(aliases, alias);
+        }
+        topic_alias_unlock(aliases);
+    }
+    return ret;
 }
 
-int get_rule_count(void)
+// 发布到客户端: QoS 取消息 QoS 与该客户端配置的较大者, QoS 1/2 按报文标识符记录以统计确认延迟;
+// MQTT v5 客户端带上 props (可选, 其中的过期时间从 received_ns 起算)
+static int publish_to(mqtt_client_t         *client,
+                      const char            *topic,
+                      int                    payloadlen,
+                      const void            *payload,
+                      int                    qos,
+                      bool                   retain,
+                      const message_props_t *props,
+                      long long              received_ns)
 {
-    return rule_count;
+    int mid = 0;
+    if (qos < client->config.qos)
+    {
+        qos = client->config.qos;
+    }
+    // 确认可能在 mosquitto_publish 返回前就由网络线程处理, 发出时间须在调用前取得
+    long long sent_ns = qos > 0 ? monotonic_ns() : 0;
+    int       ret;
+    if (client->config.protocol == PROTOCOL_MQTT5)
+    {
+        ret = publish_v5(client, &mid, topic, payloadlen, payload, qos, retain, props, received_ns);
+    }
+    else
+    {
+        ret = mosquitto_publish(client->mosq, &mid, topic, payloadlen, payload, qos, retain);
+    }
+    if (ret == MOSQ_ERR_SUCCESS)
+    {
+        metrics_add(client->metrics_id, METRIC_PUBLISHED, 1);
+    }
+    if (ret == MOSQ_ERR_SUCCESS && qos > 0)
+    {
+        metrics_add(client->metrics_id, METRIC_QOS_PUBLISHED, 1);
+        long long latency = 0;
+        switch (inflight_track(&client->inflight, mid, sent_ns, &latency))
+        {
+        case INFLIGHT_ACKED_EARLY:
+            metrics_add(client->metrics_id, METRIC_ACKED, 1);
+            metrics_record_latency(client->ack_metrics_id, latency);
+            break;
+        case INFLIGHT_REPLACED:
+            // 旧记录的确认已经错过, 视为完成, 保持等待确认数准确
+            metrics_add(client->metrics_id, METRIC_ACKED, 1);
+            break;
+        default:
+            break;
+        }
+    }
+    return ret;
 }
 
-const forward_rule_t *get_forward_rule(int index)
+// 同时计入规则和目标客户端的指标: 规则按事件数计 (一批合并了 messages 条), 客户端按发出的消息计,
+// 延迟从 start_ns (批中最早一条进入 on_message 的时间) 算起
+static void count_publish(const forward_rule_t *rule, metric_t metric, int payloadlen, int messages, long long start_ns)
 {
-    if (index >= 0 && index < rule_count)
+    metrics_add(rule->metrics_id, metric, (unsigned long)messages);
+    metrics_add(rule->target->metrics_id, metric, 1);
+    if (metric == METRIC_FORWARDED)
     {
-        return &forward_rules[index];
+        metrics_add(rule->metrics_id, METRIC_BYTES_OUT, (unsigned long)payloadlen);
+        metrics_add(rule->target->metrics_id, METRIC_BYTES_OUT, (unsigned long)payloadlen);
+        metrics_record_latency(rule->metrics_id, monotonic_ns() - start_ns);
     }
-    return NULL;
 }
 
-void cleanup_forwarder(void)
+// 该主题所用的连接断开, 或该连接上规则所在通道仍有积压时进入该连接的离线队列以保持顺序;
+// 其他通道和其他连接的积压不影响直接发布。
+// props 只随直接发布转发, 离线队列和溢出日志不保存属性
+static int enqueue_or_publish(const forward_rule_t  *rule,
+                              const char            *topic,
+                              int                    payloadlen,
+                              const void            *payload,
+                              int                    qos,
+                              bool                   retain,
+                              const message_props_t *props,
+                              int                    messages,
+                              long long              start_ns)
 {
-    LOG_INFO("Stopping MQTT Message Forwarder...");
+    mqtt_client_t *target    = rule->target;
+    mqtt_client_t *publisher = publisher_of(target, topic);
+    int            lane      = (int)rule->priority;
+    if (publisher->connected && lane_backlog_of(target, publisher, lane) == 0)
+    {
+        int ret = publish_to(publisher, topic, payloadlen, payload, qos, retain, props, start_ns);
+        if (ret != MOSQ_ERR_NO_CONN && ret != MOSQ_ERR_CONN_LOST)
+        {
+            if (ret == MOSQ_ERR_SUCCESS && publisher->loop)
+            {
+                event_loop_wake(publisher->loop);
+            }
+            count_publish(rule, ret == MOSQ_ERR_SUCCESS ? METRIC_FORWARDED : METRIC_PUBLISH_ERRORS, payloadlen,
+                          messages, start_ns);
+            return ret;
+        }
+    }
 
-    for (int i = 0; i < client_count; i++)
+    if (target->spill)
     {
-        if (clients[i].mosq)
+        // 溢出日志非空时新消息必须追加到日志尾部, 保证重放顺序
+        if (spill_log_pending(target->spill) == 0
+            && outbound_queue_offer(&publisher->queue, lane, topic, payload, payloadlen, qos, retain) == 0)
+        {
+            LOG_DEBUG("Target %s not connected, queued message on %s", target->ip, topic);
+            count_publish(rule, METRIC_QUEUED, payloadlen, messages, start_ns);
+            return MOSQ_ERR_SUCCESS;
+        }
+        if (spill_log_append(target->spill, topic, payload, payloadlen, qos, retain) == 0)
         {
-            mosquitto_loop_stop(clients[i].mosq, true);
-            mosquitto_destroy(clients[i].mosq);
-            clients[i].mosq = NULL;
+            LOG_DEBUG("Target %s not connected, spilled message on %s", target->ip, topic);
+            count_publish(rule, METRIC_QUEUED, payloadlen, messages, start_ns);
+            return MOSQ_ERR_SUCCESS;
         }
+        LOG_DEBUG("Spill log for %s rejected message on %s", target->ip, topic);
+        count_publish(rule, METRIC_DROPPED, payloadlen, messages, start_ns);
+        return MOSQ_ERR_NO_CONN;
     }
 
+    if (outbound_queue_push(&publisher->queue, lane, topic, payload, payloadlen, qos, retain) != 0)
+    {
+        LOG_DEBUG("Queue full for %s, dropped message on %s", target->ip, topic);
+        count_publish(rule, METRIC_DROPPED, payloadlen, messages, start_ns);
+        return MOSQ_ERR_NO_CONN;
+    }
+    LOG_DEBUG("Target %s not connected, queued message on %s", target->ip, topic);
+    count_publish(rule, METRIC_QUEUED, payloadlen, messages, start_ns);
+    return MOSQ_ERR_SUCCESS;
+}
+
+// 启用批量发布时加入批, 否则直接发布或进入离线队列
+static int deliver(const forward_rule_t  *rule,
+                   const char            *topic,
+                   int                    payloadlen,
+                   const void            *payload,
+                   int                    qos,
+                   bool                   retain,
+                   const message_props_t *props,
+                   long long              received_ns)
+{
+    if (!rule->batcher)
+    {
+        return enqueue_or_publish(rule, topic, payloadlen, payload, qos, retain, props, 1, received_ns);
+    }
+    if (event_batcher_add(rule->batcher, topic, payload, (size_t)payloadlen, qos, retain, received_ns) != 0)
+    {
+        LOG_ERROR("Out of memory batching message for rule %s", rule->rule_name);
+        count_publish(rule, METRIC_DROPPED, payloadlen, 1, received_ns);
+        return MOSQ_ERR_NOMEM;
+    }
+    return MOSQ_ERR_SUCCESS;
+}
+
+// 按规则发布到目标客户端, 抽中时记录发布阶段耗时
+int forward_publish(const forward_rule_t *rule,
+                    const char           *topic,
+                    int                   payloadlen,
+                    const void           *payload,
+                    int                   qos,
+                    bool                  retain)
+{
+    long long start = stage_begin();
+    int       ret;
+    if (rule->conflater)
+    {
+        // 以源主题 (即设备) 为键, 不在消息处理线程上调用时退回目标主题
+        const char *key    = message_topic ? message_topic : topic;
+        int         status = conflater_offer(rule->conflater, key, topic, payload, (size_t)payloadlen, qos, retain,
+                                             message_start_ns);
+        ret = MOSQ_ERR_SUCCESS;
+        if (status > 0)
+        {
+            metrics_add(rule->metrics_id, METRIC_CONFLATED, 1);
+        }
+        else if (status < 0)
+        {
+            LOG_ERROR("Out of memory conflating message for rule %s", rule->rule_name);
+            count_publish(rule, METRIC_DROPPED, payloadlen, 1, message_start_ns);
+            ret = MOSQ_ERR_NOMEM;
+        }
+    }
+    else
+    {
+        ret = deliver(rule, topic, payloadlen, payload, qos, retain, message_props, message_start_ns);
+    }
+    stage_end(rule->stage_ids[STAGE_PUBLISH], start);
+    return ret;
+}
+
+// 合并器发出某个设备的最新值: 在提交消息的线程 (周期内首条) 或目标客户端的定时任务上调用
+static void publish_conflated(void *ctx, const conflated_message_t *message)
+{
+    const forward_rule_t *rule = (const forward_rule_t *)ctx;
+    int ret = deliver(rule, message->topic, (int)message->len, message->payload, message->qos, message->retain,
+                      NULL, message->received_ns);
+    if (ret != MOSQ_ERR_SUCCESS)
+    {
+        LOG_ERROR("Conflated publish failed for rule %s on %s: %s",
+                  rule->rule_name, message->topic, mosquitto_strerror(ret));
+    }
+}
+
+// 批量器发出一批: 在追加事件的线程 (达到上限时) 或目标客户端的定时任务上调用
+static void publish_batch(void *ctx, const event_batch_t *batch)
+{
+    const forward_rule_t *rule = (const forward_rule_t *)ctx;
+    metrics_record_latency(rule->batch_metrics_id, batch->fill_permille);
+    int ret = enqueue_or_publish(rule, batch->topic, (int)batch->len, batch->payload, batch->qos, batch->retain,
+                                 NULL, batch->messages, batch->first_ns);
+    if (ret != MOSQ_ERR_SUCCESS)
+    {
+        LOG_ERROR("Batch publish failed for rule %s (%d messages): %s",
+                  rule->rule_name, batch->messages, mosquitto_strerror(ret));
+    }
+}
+
+// 限速器发出一条到期的延迟消息: 在目标客户端的定时任务上调用, 按原消息执行规则的回调
+static void release_delayed(void *ctx, const rate_delayed_t *delayed)
+{
+    forward_rule_t          *rule    = (forward_rule_t *)ctx;
+    struct mosquitto_message message = {
+        .topic      = (char *)delayed->topic,
+        .payload    = (void *)delayed->payload,
+        .payloadlen = (int)delayed->len,
+        .qos        = delayed->qos,
+        .retain     = delayed->retain,
+    };
+    message_start_ns = delayed->received_ns;
+    message_topic    = delayed->topic;
+    run_callback(rule, rule->source, rule->target, &message);
+    message_topic = NULL;
+}
+
+// 发出以该客户端为目标、已到期的延迟消息、周期已结束的最新值和等待已到期的批
+static void flush_timed_rules(mqtt_client_t *client)
+{
+    rcu_read_lock();
+    const rule_table_t *table = atomic_load_explicit(&active_table, memory_order_acquire);
+    if (table && client->slot < table->slot_count && table->timed[client->slot].count > 0)
+    {
+        const timed_rules_t *timed  = &table->timed[client->slot];
+        long long            now_ns = monotonic_ns();
+        for (int i = 0; i < timed->count; i++)
+        {
+            forward_rule_t *rule = timed->rules[i];
+            // 按处理顺序: 延迟的消息可能进入合并器, 合并的值可能进入批
+            if (rule->limiter)
+            {
+                rate_limiter_release_due(rule->limiter, now_ns);
+            }
+            if (rule->conflater)
+            {
+                conflater_flush_due(rule->conflater);
+            }
+            if (rule->batcher)
+            {
+                event_batcher_flush_due(rule->batcher, now_ns);
+            }
+        }
+    }
+    rcu_read_unlock();
+}
+
+// 立即发出规则中延迟、合并和成批的消息 (热加载替换规则表时)
+static void flush_timed_rule(forward_rule_t *rule)
+{
+    if (rule->limiter)
+    {
+        rate_limiter_release_all(rule->limiter);
+    }
+    if (rule->conflater)
+    {
+        conflater_flush(rule->conflater);
+    }
+    if (rule->batcher)
+    {
+        event_batcher_flush(rule->batcher);
+    }
+}
+
+// 经 publisher (client 的连接之一) 重放一条积压消息, 不在本客户端的事件循环上时唤醒其所在循环
+static int replay_publish(mqtt_client_t *client, mqtt_client_t *publisher, const char *topic, int payloadlen,
+                          const void *payload, int qos, bool retain)
+{
+    int ret = publish_to(publisher, topic, payloadlen, payload, qos, retain, NULL, 0);
+    if (ret == MOSQ_ERR_SUCCESS && publisher != client && publisher->loop && publisher->loop != client->loop)
+    {
+        event_loop_wake(publisher->loop);
+    }
+    return ret;
+}
+
+// 重放溢出日志中的一条记录, 经该主题所用的连接发出, 连接断开时返回非0以便稍后重试
+static int publish_spilled(void       *ctx,
+                           const char *topic,
+                           const void *payload,
+                           int         payloadlen,
+                           int         qos,
+                           int         retain)
+{
+    mqtt_client_t *client = (mqtt_client_t *)ctx;
+    int ret = replay_publish(client, publisher_of(client, topic), topic, payloadlen, payload, qos, retain);
+    if (ret == MOSQ_ERR_NO_CONN || ret == MOSQ_ERR_CONN_LOST)
+    {
+        return -1;
+    }
+    if (ret != MOSQ_ERR_SUCCESS)
+    {
+        LOG_ERROR("Replay publish failed on %s: %s", topic, mosquitto_strerror(ret));
+        metrics_add(client->metrics_id, METRIC_PUBLISH_ERRORS, 1);
+        return 0;
+    }
+    metrics_add(client->metrics_id, METRIC_FORWARDED, 1);
+    metrics_add(client->metrics_id, METRIC_BYTES_OUT, (unsigned long)payloadlen);
+    return 0;
+}
+
+// 按该连接的速率重放其内存队列 (按通道调度), 连接断开时其余消息等重连后再发
+static void replay_connection(mqtt_client_t *client, mqtt_client_t *connection, long long now_ms)
+{
+    if (!connection->connected || outbound_queue_pending(&connection->queue) == 0)
+    {
+        return;
+    }
+
+    int budget = outbound_queue_replay_budget(&connection->queue, now_ms);
+    while (budget > 0)
+    {
+        queued_message_t *message = outbound_queue_pop(&connection->queue);
+        if (!message)
+        {
+            break;
+        }
+
+        int ret = replay_publish(client, connection, message->topic, message->payloadlen, message->payload,
+                                 message->qos, message->retain);
+        if (ret == MOSQ_ERR_NO_CONN || ret == MOSQ_ERR_CONN_LOST)
+        {
+            outbound_queue_requeue(&connection->queue, message);
+            return;
+        }
+        if (ret != MOSQ_ERR_SUCCESS)
+        {
+            LOG_ERROR("Replay publish failed on %s: %s", message->topic, mosquitto_strerror(ret));
+            metrics_add(client->metrics_id, METRIC_PUBLISH_ERRORS, 1);
+        }
+        else
+        {
+            metrics_add(client->metrics_id, METRIC_FORWARDED, 1);
+            metrics_add(client->metrics_id, METRIC_BYTES_OUT, (unsigned long)message->payloadlen);
+            metrics_record_latency(client->lane_metrics_ids[LANE_QUEUE_OFFLINE][message->lane],
+                                   monotonic_ns() - message->enqueued_ns);
+        }
+        outbound_queue_done(&connection->queue, message);
+        budget--;
+    }
+}
+
+// 重放积压: 各连接的内存队列分别重放, 一个连接断开只影响经它发出的主题;
+// 内存队列都排空后再按顺序重放磁盘溢出日志
+static void replay_queue(mqtt_client_t *client, long long now_ms)
+{
+    if (client->spill)
+    {
+        spill_log_sync(client->spill, now_ms);
+    }
+    if (backlog_of(client) == 0)
+    {
+        return;
+    }
+
+    bool queued = false;
+    for (int i = 0; i < connection_count(client); i++)
+    {
+        mqtt_client_t *connection = connection_of(client, i);
+        replay_connection(client, connection, now_ms);
+        queued = queued || outbound_queue_pending(&connection->queue) > 0;
+    }
+
+    if (!queued && client->spill && spill_log_pending(client->spill) > 0)
+    {
+        // 日志中的记录经各连接发出, 速率为各连接之和
+        int budget = outbound_queue_replay_budget(&client->queue, now_ms) * connection_count(client);
+        if (budget > 0)
+        {
+            spill_log_replay(client->spill, budget, publish_spilled, client);
+        }
+    }
+
+    if (backlog_of(client) == 0)
+    {
+        LOG_INFO("Queue for %s drained", client->ip);
+    }
+}
+
+// 客户端的定时任务, 在驱动该客户端的线程上调用
+void mqtt_client_tick(mqtt_client_t *client, long long now_ms)
+{
+    if (client->owner)
+    {
+        // 发布连接池中的连接: 其队列由所属客户端重放
+        return;
+    }
+    flush_timed_rules(client);
+    replay_queue(client, now_ms);
+}
+
+// 运行引擎直到 *running 为0: 线程模式下定时执行各客户端的定时任务,
+// epoll 模式下在当前线程运行第一个事件循环
+void mqtt_engine_run(volatile int *running)
+{
+    if (engine_config.mode == ENGINE_MODE_EPOLL)
+    {
+        event_loop_run(event_loops[0], running);
+        return;
+    }
+
+    while (*running)
+    {
+        long long now_ms = monotonic_ms();
+        pthread_mutex_lock(&clients_lock);
+        for (int i = 0; i < client_count; i++)
+        {
+            mqtt_client_tick(clients[i], now_ms);
+        }
+        pthread_mutex_unlock(&clients_lock);
+        usleep(ENGINE_TICK_MS * 1000);
+    }
+}
+
+// 查找现有客户端
+mqtt_client_t *find_client(const char *ip, int port)
+{
+    return (mqtt_client_t *)hash_index_find(&client_index, ip, port);
+}
+
+// 数组容量不足时按倍数扩容, 失败时返回NULL且原数组不变
+static void *reserve_slots(void *array, int *capacity, int needed, size_t item_size)
+{
+    if (needed <= *capacity)
+    {
+        return array;
+    }
+    int new_capacity = *capacity ? *capacity * 2 : 16;
+    while (new_capacity < needed)
+    {
+        new_capacity *= 2;
+    }
+    void *items = realloc(array, item_size * (size_t)new_capacity);
+    if (items)
+    {
+        *capacity = new_capacity;
+    }
+    return items;
+}
+
+static bool same_string(const char *a, const char *b)
+{
+    return (!a && !b) || (a && b && strcmp(a, b) == 0);
+}
+
+// 影响连接的 MQTT 设置是否相同 (qos/retain 只影响发布, 不需要重连)
+static bool mqtt_settings_equal(const mqtt_config_t *a, const mqtt_config_t *b)
+{
+    return a->keepalive == b->keepalive
+        && a->clean_session == b->clean_session
+        && same_string(a->username, b->username)
+        && same_string(a->password, b->password);
+}
+
+static bool spill_settings_equal(const spill_config_t *a, const spill_config_t *b)
+{
+    return strcmp(a->dir, b->dir) == 0
+        && a->segment_bytes == b->segment_bytes
+        && a->max_segments == b->max_segments
+        && a->fsync_every == b->fsync_every
+        && a->fsync_interval_ms == b->fsync_interval_ms;
+}
+
+static bool client_settings_equal(const client_config_t *a, const client_config_t *b)
+{
+    return strcmp(a->name, b->name) == 0
+        && strcmp(a->ip, b->ip) == 0
+        && a->port == b->port
+        && strcmp(a->client_id, b->client_id) == 0
+        && a->qos == b->qos
+        && a->max_inflight == b->max_inflight
+        && a->protocol == b->protocol
+        && a->topic_alias_max == b->topic_alias_max
+        && a->connections == b->connections
+        && a->queue.max_messages == b->queue.max_messages
+        && a->queue.max_bytes == b->queue.max_bytes
+        && a->queue.policy == b->queue.policy
+        && a->queue.replay_rate == b->queue.replay_rate
+        && spill_settings_equal(&a->spill, &b->spill)
+        && a->workers == b->workers
+        && a->worker_queue_depth == b->worker_queue_depth
+        && memcmp(&a->schedule, &b->schedule, sizeof(schedule_config_t)) == 0;
+}
+
+static void free_connect_settings(void)
+{
+    free(connect_settings.username);
+    free(connect_settings.password);
+    memset(&connect_settings, 0, sizeof(connect_settings));
+    connect_settings_saved = 0;
+}
+
+// 记录现有连接使用的 MQTT 设置, 热加载时与新配置比较
+static void save_connect_settings(const mqtt_config_t *mqtt_cfg)
+{
+    free_connect_settings();
+    connect_settings          = *mqtt_cfg;
+    connect_settings.username = mqtt_cfg->username ? strdup(mqtt_cfg->username) : NULL;
+    connect_settings.password = mqtt_cfg->password ? strdup(mqtt_cfg->password) : NULL;
+    connect_settings_saved    = 1;
+}
+
+// 释放未注册 (创建失败) 的客户端
+static void discard_client(mqtt_client_t *client)
+{
+    for (int i = 1; i < connection_count(client); i++)
+    {
+        discard_client(client->publishers[i]);
+    }
+    free(client->publishers);
+    if (client->mosq)
+    {
+        mosquitto_destroy(client->mosq);
+    }
+    worker_pool_destroy(client->workers);
+    if (client->spill)
+    {
+        spill_log_close(client->spill);
+    }
+    outbound_queue_destroy(&client->queue);
+    inflight_destroy(&client->inflight);
+    topic_alias_destroy(client->aliases);
+    free(client);
+}
+
+// 释放已停止网络循环的客户端, 输出其队列统计
+static void release_client(mqtt_client_t *client)
+{
+    for (int i = 1; i < connection_count(client); i++)
+    {
+        release_client(client->publishers[i]);
+    }
+    free(client->publishers);
+    client->publishers      = NULL;
+    client->publisher_count = 0;
+    if (client->workers)
+    {
+        worker_pool_stats_t stats;
+        worker_pool_stop(client->workers);
+        worker_pool_stats(client->workers, &stats);
+        LOG_INFO("Worker stats for %s: submitted=%lu completed=%lu stalls=%lu",
+                 client->ip, stats.submitted, stats.completed, stats.stalls);
+        worker_pool_destroy(client->workers);
+        client->workers = NULL;
+    }
+    if (client->mosq)
+    {
+        mosquitto_destroy(client->mosq);
+        client->mosq = NULL;
+    }
+    outbound_queue_t *queue = &client->queue;
+    LOG_INFO("Queue stats for %s: enqueued=%lu replayed=%lu dropped_oldest=%lu dropped_newest=%lu discarded=%d",
+             client->ip,
+             atomic_load(&queue->enqueued),
+             atomic_load(&queue->replayed),
+             atomic_load(&queue->dropped_oldest),
+             atomic_load(&queue->dropped_newest),
+             queue->count);
+    if (queue->count > 0)
+    {
+        metrics_add((client->owner ? client->owner : client)->metrics_id, METRIC_DROPPED,
+                    (unsigned long)queue->count);
+    }
+    outbound_queue_destroy(queue);
+    if (client->spill)
+    {
+        spill_stats_t stats;
+        spill_log_stats(client->spill, &stats);
+        LOG_INFO("Spill stats for %s: appended=%lu replayed=%lu dropped=%lu corrupted=%lu pending=%ld",
+                 client->ip, stats.appended, stats.replayed, stats.dropped,
+                 stats.corrupted, stats.pending);
+        spill_log_close(client->spill);
+        client->spill = NULL;
+    }
+    inflight_destroy(&client->inflight);
+    if (client->aliases)
+    {
+        topic_alias_stats_t stats;
+        topic_alias_stats(client->aliases, &stats);
+        LOG_INFO("Topic alias stats for %s: hits=%lu assigned=%lu evicted=%lu",
+                 client->ip, stats.hits, stats.assigned, stats.evicted);
+        topic_alias_destroy(client->aliases);
+        client->aliases = NULL;
+    }
+    free(client);
+}
+
+// 登记到客户端表和 (ip, port) 索引
+static int register_client(mqtt_client_t *client)
+{
+    mqtt_client_t **slots = reserve_slots(clients, &client_capacity, client_count + 1, sizeof(mqtt_client_t *));
+    if (!slots)
+    {
+        return -1;
+    }
+    clients = slots;
+    if (hash_index_insert(&client_index, client->ip, client->port, client) != 0)
+    {
+        return -1;
+    }
+    clients[client_count++] = client;
+    return 0;
+}
+
+static mqtt_client_t *create_client(const client_config_t *client_cfg, const mqtt_config_t *mqtt_cfg);
+
+// 客户端每个连接的离线队列设置: 连接数大于1时内存上限和重放速率按连接平分
+static queue_config_t connection_queue_config(const client_config_t *client_cfg)
+{
+    queue_config_t queue = client_cfg->queue;
+    int            n     = client_cfg->connections > 1 ? client_cfg->connections : 1;
+    queue.max_messages   = (queue.max_messages + n - 1) / n;
+    queue.max_bytes      = (queue.max_bytes + n - 1) / n;
+    queue.replay_rate    = (queue.replay_rate + n - 1) / n;
+    return queue;
+}
+
+// 创建发布连接池中除主连接外的连接: 客户端ID和指标名称加序号, 不处理收到的消息;
+// 每个连接有自己的离线队列, 由主连接的定时任务重放
+static int create_publishers(mqtt_client_t *client, const client_config_t *client_cfg, const mqtt_config_t *mqtt_cfg)
+{
+    client->publishers = calloc((size_t)client_cfg->connections, sizeof(mqtt_client_t *));
+    if (!client->publishers)
+    {
+        LOG_ERROR("Out of memory creating connections for %s", client_cfg->ip);
+        return -1;
+    }
+    client->publishers[0]   = client;
+    client->publisher_count = 1;
+    for (int i = 1; i < client_cfg->connections; i++)
+    {
+        client_config_t publisher_cfg = *client_cfg;
+        if (publisher_identity(client_cfg, i, publisher_cfg.client_id, sizeof(publisher_cfg.client_id),
+                               publisher_cfg.name, sizeof(publisher_cfg.name)) != 0)
+        {
+            LOG_ERROR("Client ID or name of %s is too long for connection %d", client_cfg->name, i);
+            return -1;
+        }
+        publisher_cfg.queue       = connection_queue_config(client_cfg);
+        publisher_cfg.connections = 1;
+        publisher_cfg.workers     = 0;
+        publisher_cfg.spill.dir[0] = '\0';
+        mqtt_client_t *publisher = create_client(&publisher_cfg, mqtt_cfg);
+        if (!publisher)
+        {
+            return -1;
+        }
+        publisher->owner = client;
+        client->publishers[client->publisher_count++] = publisher;
+    }
+    LOG_INFO("Client %s publishes over %d connections", client_cfg->name, client->publisher_count);
+    return 0;
+}
+
+// 创建客户端 (尚未连接)
+static mqtt_client_t *create_client(const client_config_t *client_cfg, const mqtt_config_t *mqtt_cfg)
+{
+    mqtt_client_t *client = calloc(1, sizeof(mqtt_client_t));
+    if (!client)
+    {
+        LOG_ERROR("Out of memory creating client for %s", client_cfg->ip);
+        return NULL;
+    }
+
+    snprintf(client->name, sizeof(client->name), "%s", client_cfg->name);
+    snprintf(client->ip, sizeof(client->ip), "%s", client_cfg->ip);
+    snprintf(client->client_id, sizeof(client->client_id), "%s", client_cfg->client_id);
+    client->metrics_id = metrics_register(METRICS_CLIENT, client_cfg->name);
+    metrics_register_lanes(client_cfg->name, client->lane_metrics_ids);
+    client->ack_metrics_id = metrics_register(METRICS_ACK, client_cfg->name);
+    client->connected = 0;
+    client->port = client_cfg->port;
+    client->slot = next_slot++;
+    client->config = *client_cfg;
+    queue_config_t queue_cfg = connection_queue_config(client_cfg);
+    outbound_queue_init(&client->queue, &queue_cfg, &client_cfg->schedule);
+    client->spill = NULL;
+    client->workers = NULL;
+    client->loop = NULL;
+    client->loop_fd = -1;
+    client->loop_events = 0;
+    client->reconnect_delay = 1;
+    client->reconnect_at = 0;
+    if (inflight_init(&client->inflight) != 0)
+    {
+        LOG_ERROR("Out of memory tracking acknowledgements for %s, ack metrics disabled", client_cfg->ip);
+    }
+
+    if (client_cfg->workers > 0)
+    {
+        client->workers = worker_pool_create(client_cfg->name, client_cfg->workers,
+                                             client_cfg->worker_queue_depth, &client_cfg->schedule, run_forward_job);
+        if (!client->workers)
+        {
+            LOG_ERROR("Failed to start workers for %s, processing messages on the network thread",
+                      client_cfg->ip);
+        }
+    }
+
+    client->mosq = mosquitto_new(client->client_id, mqtt_cfg->clean_session, client);
+    if (!client->mosq)
+    {
+        LOG_ERROR("Failed to create mosquitto client for %s", client_cfg->ip);
+        discard_client(client);
+        return NULL;
+    }
+
+    // 设置回调; MQTT v5 客户端使用带属性的回调 (libmosquitto 会同时调用两种回调, 只设置一种)
+    if (client_cfg->protocol == PROTOCOL_MQTT5)
+    {
+        int ret = mosquitto_int_option(client->mosq, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+        if (ret != MOSQ_ERR_SUCCESS)
+        {
+            LOG_ERROR("Failed to enable MQTT v5 for %s: %s", client_cfg->ip, mosquitto_strerror(ret));
+            discard_client(client);
+            return NULL;
+        }
+        mosquitto_connect_v5_callback_set(client->mosq, on_connect_v5);
+        mosquitto_message_v5_callback_set(client->mosq, on_message_v5);
+        if (client_cfg->topic_alias_max > 0)
+        {
+            client->aliases = topic_alias_create(client_cfg->topic_alias_max);
+            if (!client->aliases)
+            {
+                LOG_ERROR("Out of memory creating topic aliases for %s, publishing full topics", client_cfg->ip);
+            }
+        }
+    }
+    else
+    {
+        mosquitto_connect_callback_set(client->mosq, on_connect);
+        mosquitto_message_callback_set(client->mosq, on_message);
+    }
+    mosquitto_disconnect_callback_set(client->mosq, on_disconnect);
+    mosquitto_publish_callback_set(client->mosq, on_publish);
+    mosquitto_reconnect_delay_set(client->mosq, 1, RECONNECT_DELAY, true);
+
+    // QoS 1/2 发布窗口: 超出的消息在 libmosquitto 内排队, 等有确认后再发出
+    int ret = mosquitto_max_inflight_messages_set(client->mosq, (unsigned int)client_cfg->max_inflight);
+    if (ret != MOSQ_ERR_SUCCESS)
+    {
+        LOG_ERROR("Failed to set max_inflight for %s: %s", client_cfg->ip, mosquitto_strerror(ret));
+    }
+    if (client_cfg->qos > 0)
+    {
+        LOG_INFO("Client %s uses qos %d with up to %d messages in flight", client_cfg->name, client_cfg->qos,
+                 client_cfg->max_inflight);
+    }
+
+    // 设置用户名和密码
+    if (mqtt_cfg->username && mqtt_cfg->password) {
+        ret = mosquitto_username_pw_set(client->mosq, mqtt_cfg->username, mqtt_cfg->password);
+        if (ret != MOSQ_ERR_SUCCESS) {
+            LOG_ERROR("Failed to set username/password for %s: %s", 
+                     client_cfg->ip, mosquitto_strerror(ret));
+            discard_client(client);
+            return NULL;
+        }
+        LOG_INFO("Set authentication for %s", client_cfg->ip);
+    }
+
+    if (client_cfg->connections > 1 && create_publishers(client, client_cfg, mqtt_cfg) != 0)
+    {
+        discard_client(client);
+        return NULL;
+    }
+    return client;
+}
+
+// 打开客户端配置的磁盘溢出日志。与创建客户端分开: 热加载时旧客户端的日志在 commit 中
+// 移交给替代它的客户端或先关闭, 同一目录不会同时被两个日志对象打开
+static void open_spill(mqtt_client_t *client)
+{
+    const client_config_t *client_cfg = &client->config;
+    if (!client_cfg->spill.dir[0] || client->spill)
+    {
+        return;
+    }
+    client->spill = spill_log_open(&client_cfg->spill);
+    if (!client->spill)
+    {
+        LOG_ERROR("Failed to open spill log %s for %s, using memory queue only",
+                  client_cfg->spill.dir, client_cfg->ip);
+    }
+}
+
+// 异步连接
+static int connect_client(mqtt_client_t *client, int keepalive)
+{
+    int ret = mosquitto_connect_async(client->mosq, client->ip, client->port, keepalive);
+    if (ret != MOSQ_ERR_SUCCESS)
+    {
+        LOG_ERROR("Failed to initiate connection to %s:%d: %s", 
+                 client->ip, client->port, mosquitto_strerror(ret));
+        return -1;
+    }
+    LOG_INFO("Connecting to %s:%d...", client->ip, client->port);
+    for (int i = 1; i < connection_count(client); i++)
+    {
+        if (connect_client(client->publishers[i], keepalive) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 热加载期间按新配置取得客户端: 本次加载已取得的直接返回, 设置未变的保留原连接,
+// 其余新建, 连接推迟到 commit (在回收同地址的旧客户端之后, 避免两个连接争用同一客户端ID)
+static mqtt_client_t *reload_client(const client_config_t *client_cfg, const mqtt_config_t *mqtt_cfg)
+{
+    mqtt_client_t *client = hash_index_find(&reload_index, client_cfg->ip, client_cfg->port);
+    if (client)
+    {
+        return client;
+    }
+    reload_mqtt = mqtt_cfg;
+
+    mqtt_client_t *existing = find_client(client_cfg->ip, client_cfg->port);
+    if (existing && mqtt_settings_equal(&connect_settings, mqtt_cfg)
+        && client_settings_equal(&existing->config, client_cfg))
+    {
+        if (hash_index_insert(&reload_index, existing->ip, existing->port, existing) != 0)
+        {
+            LOG_ERROR("Out of memory reloading client %s", client_cfg->name);
+            return NULL;
+        }
+        LOG_DEBUG("Keeping connection to %s:%d", existing->ip, existing->port);
+        return existing;
+    }
+    if (existing)
+    {
+        LOG_INFO("Settings for %s:%d changed, the connection will be recreated", existing->ip, existing->port);
+    }
+
+    client = create_client(client_cfg, mqtt_cfg);
+    if (!client)
+    {
+        return NULL;
+    }
+    mqtt_client_t **slots = reserve_slots(reload_clients, &reload_client_capacity, reload_client_count + 1,
+                                          sizeof(mqtt_client_t *));
+    if (slots)
+    {
+        reload_clients = slots;
+    }
+    if (!slots || hash_index_insert(&reload_index, client->ip, client->port, client) != 0)
+    {
+        LOG_ERROR("Out of memory reloading client %s", client_cfg->name);
+        discard_client(client);
+        return NULL;
+    }
+    reload_clients[reload_client_count++] = client;
+    return client;
+}
+
+// 创建并连接客户端
+mqtt_client_t *mqtt_connect(const client_config_t *client_cfg, const mqtt_config_t *mqtt_cfg)
+{
+    if (!client_cfg || !mqtt_cfg) {
+        LOG_ERROR("Invalid client or mqtt configuration");
+        return NULL;
+    }
+
+    if (reloading)
+    {
+        return reload_client(client_cfg, mqtt_cfg);
+    }
+
+    // 查找现有客户端
+    mqtt_client_t *existing = find_client(client_cfg->ip, client_cfg->port);
+    if (existing) {
+        return existing;
+    }
+    if (!connect_settings_saved)
+    {
+        save_connect_settings(mqtt_cfg);
+    }
+
+    // 创建新客户端
+    mqtt_client_t *client = create_client(client_cfg, mqtt_cfg);
+    if (!client)
+    {
+        return NULL;
+    }
+    open_spill(client);
+    if (connect_client(client, mqtt_cfg->keepalive) != 0)
+    {
+        discard_client(client);
+        return NULL;
+    }
+
+    if (register_client(client) != 0)
+    {
+        LOG_ERROR("Out of memory registering client for %s", client_cfg->ip);
+        discard_client(client);
+        return NULL;
+    }
+    LOG_INFO("Created client for %s with ID: %s", client_cfg->ip, client->client_id);
+    return client;
+}
+
+int add_forward_rule(mqtt_client_t *source,
+                     const char *source_topic,
+                     mqtt_client_t *target,
+                     const char *target_topic,
+                     forward_callback_t callback,
+                     const transform_t *transform,
+                     const publish_config_t *publish,
+                     const char *rule_name)
+{
+    if (!source || !target)
+    {
+        LOG_ERROR("Rule %s references a client that failed to start", rule_name);
+        return -1;
+    }
+
+    char        share_group[64];
+    const char *source_filter = split_shared_topic(source_topic, share_group, sizeof(share_group));
+    if (!source_filter || strlen(source_topic) >= sizeof(((forward_rule_t *)0)->source_topic))
+    {
+        LOG_ERROR("Invalid source topic for rule %s: %s", rule_name, source_topic);
+        return -1;
+    }
+    topic_rewrite_t *topic_rewrite = topic_rewrite_compile(source_filter, target_topic);
+    if (!topic_rewrite)
+    {
+        LOG_ERROR("Invalid target topic for rule %s", rule_name);
+        return -1;
+    }
+
+    forward_rule_t  *rule  = malloc(sizeof(forward_rule_t));
+    forward_rule_t **slots = rule ? reserve_slots(pending_rules, &pending_capacity, pending_count + 1,
+                                                  sizeof(forward_rule_t *))
+                                  : NULL;
+    if (!slots)
+    {
+        LOG_ERROR("Out of memory adding forward rule %s", rule_name);
+        topic_rewrite_free(topic_rewrite);
+        free(rule);
+        return -1;
+    }
+    pending_rules = slots;
+
+    rule->source = source;
+    rule->target = target;
+    snprintf(rule->source_topic, sizeof(rule->source_topic), "%s", source_topic);
+    rule->source_filter = rule->source_topic + (source_filter - source_topic);
+    snprintf(rule->share_group, sizeof(rule->share_group), "%s", share_group);
+    snprintf(rule->target_topic, sizeof(rule->target_topic), "%s", target_topic);
+    rule->topic_rewrite = topic_rewrite;
+    rule->message_callback = callback;
+    rule->transform = transform;
+    snprintf(rule->rule_name, sizeof(rule->rule_name), "%s", rule_name);
+    // 同名规则在热加载后沿用原来的指标编号
+    rule->metrics_id = metrics_register(METRICS_RULE, rule_name);
+    metrics_register_stages(rule_name, rule->stage_ids);
+    rule->limiter = NULL;
+    rule->conflater = NULL;
+    rule->batcher = NULL;
+    rule->batch_metrics_id = -1;
+    rule->priority = publish ? publish->priority : PRIORITY_NORMAL;
+    if (publish && publish->rate_limit.enabled)
+    {
+        const rate_limit_config_t *rate_limit = &publish->rate_limit;
+        rule->limiter = rate_limiter_create(rate_limit, release_delayed, rule);
+        if (!rule->limiter)
+        {
+            LOG_ERROR("Out of memory creating rate limiter for rule %s", rule_name);
+            topic_rewrite_free(topic_rewrite);
+            free(rule);
+            return -1;
+        }
+        static const char *const policy_names[] = {"drop", "delay", "sample"};
+        LOG_INFO("Rule %s is rate limited to %.1f/s (burst %d) per rule and %.1f/s (burst %d) per device "
+                 "(%d devices), policy %s",
+                 rule_name, rate_limit->rate, rate_limit->burst, rate_limit->device_rate,
+                 rate_limit->device_burst, rate_limit->max_devices, policy_names[rate_limit->policy]);
+    }
+    if (publish && publish->conflate.enabled)
+    {
+        const conflate_config_t *conflate = &publish->conflate;
+        rule->conflater = conflater_create(conflate, publish_conflated, rule);
+        if (!rule->conflater)
+        {
+            LOG_ERROR("Out of memory creating conflater for rule %s", rule_name);
+            rate_limiter_destroy(rule->limiter);
+            topic_rewrite_free(topic_rewrite);
+            free(rule);
+            return -1;
+        }
+        LOG_INFO("Rule %s publishes the latest value per device at most every %d ms (%d devices, %ld bytes)",
+                 rule_name, conflate->interval_ms, conflate->max_keys, conflate->max_bytes);
+    }
+    if (publish && publish->batch.enabled)
+    {
+        const batch_config_t *batch = &publish->batch;
+        rule->batcher = event_batcher_create(batch, publish_batch, rule);
+        if (!rule->batcher)
+        {
+            LOG_ERROR("Out of memory creating batcher for rule %s", rule_name);
+            rate_limiter_destroy(rule->limiter);
+            conflater_destroy(rule->conflater);
+            topic_rewrite_free(topic_rewrite);
+            free(rule);
+            return -1;
+        }
+        rule->batch_metrics_id = metrics_register(METRICS_BATCH, rule_name);
+        LOG_INFO("Rule %s batches up to %d messages / %ld bytes / %d ms per target topic",
+                 rule_name, batch->max_messages, batch->max_bytes, batch->max_delay_ms);
+    }
+
+    if (rule->priority != PRIORITY_NORMAL)
+    {
+        LOG_INFO("Rule %s uses the %s priority lane", rule_name, rule->priority == PRIORITY_HIGH ? "high" : "low");
+    }
+
+    LOG_INFO("Added forward rule: %s (%s:%s -> %s:%s)",
+             rule_name,
+             source->ip,
+             source_topic,
+             target->ip,
+             target_topic);
+    pending_rules[pending_count++] = rule;
+
+    return 0;
+}
+
+static void free_rules(forward_rule_t **rules, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        topic_rewrite_free(rules[i]->topic_rewrite);
+        rate_limiter_destroy(rules[i]->limiter);
+        conflater_destroy(rules[i]->conflater);
+        event_batcher_destroy(rules[i]->batcher);
+        free(rules[i]);
+    }
+    free(rules);
+}
+
+static void free_rule_table(rule_table_t *table)
+{
+    if (!table)
+    {
+        return;
+    }
+    for (int i = 0; i < table->slot_count; i++)
+    {
+        if (table->sources[i].index)
+        {
+            topic_trie_destroy(table->sources[i].index);
+        }
+        free(table->sources[i].topics);
+        free(table->timed[i].rules);
+    }
+    free(table->sources);
+    free(table->timed);
+    free_rules(table->rules, table->rule_count);
+    free(table);
+}
+
+// 过滤器 sub 是否覆盖 filter (filter 含通配符时只有完全相同才算覆盖)
+static bool filter_covers(const char *sub, const char *filter)
+{
+    bool matches;
+    return strcmp(sub, filter) == 0
+        || (mosquitto_topic_matches_sub(sub, filter, &matches) == MOSQ_ERR_SUCCESS && matches);
+}
+
+// 收集需要订阅的主题: 被已有过滤器覆盖的不再订阅, 新过滤器覆盖已有的则替换。
+// 只在同一共享组 (或都不是共享订阅) 内比较过滤器: 不同组的订阅各自收到一份消息, 不能互相替代
+static void add_subscription_topic(source_rules_t *source, const forward_rule_t *rule)
+{
+    char group[64];
+    for (int j = 0; j < source->topic_count; j++)
+    {
+        const char *filter = split_shared_topic(source->topics[j], group, sizeof(group));
+        if (strcmp(group, rule->share_group) != 0)
+        {
+            if (filter_covers(filter, rule->source_filter) || filter_covers(rule->source_filter, filter))
+            {
+                LOG_INFO("Subscriptions %s and %s overlap in different share groups, "
+                         "matching messages may be forwarded twice", source->topics[j], rule->source_topic);
+            }
+            continue;
+        }
+        if (filter_covers(filter, rule->source_filter))
+        {
+            LOG_DEBUG("Topic %s is covered by %s", rule->source_topic, source->topics[j]);
+            return;
+        }
+    }
+
+    for (int j = source->topic_count - 1; j >= 0; j--)
+    {
+        const char *filter = split_shared_topic(source->topics[j], group, sizeof(group));
+        if (strcmp(group, rule->share_group) == 0 && filter_covers(rule->source_filter, filter))
+        {
+            LOG_DEBUG("Topic %s is covered by %s", source->topics[j], rule->source_topic);
+            for (int k = j; k < source->topic_count - 1; k++)
+            {
+                source->topics[k] = source->topics[k + 1];
+            }
+            source->topic_count--;
+        }
+    }
+    source->topics[source->topic_count++] = rule->source_topic;
+}
+
+// 由规则构建规则表, 成功后规则数组归规则表所有
+static rule_table_t *build_rule_table(forward_rule_t **rules, int count)
+{
+    rule_table_t *table = calloc(1, sizeof(rule_table_t));
+    if (!table)
+    {
+        return NULL;
+    }
+    table->slot_count = next_slot;
+    table->sources    = calloc(next_slot > 0 ? next_slot : 1, sizeof(source_rules_t));
+    table->timed      = calloc(next_slot > 0 ? next_slot : 1, sizeof(timed_rules_t));
+    if (!table->sources || !table->timed)
+    {
+        free(table->sources);
+        free(table->timed);
+        free(table);
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        forward_rule_t *rule   = rules[i];
+        source_rules_t *source = &table->sources[rule->source->slot];
+        if (!source->index)
+        {
+            source->index  = topic_trie_create();
+            source->topics = malloc(sizeof(const char *) * (size_t)count);
+            if (!source->index || !source->topics)
+            {
+                LOG_ERROR("Failed to create rule index for %s:%d", rule->source->ip, rule->source->port);
+                goto fail;
+            }
+        }
+        if (topic_trie_insert(source->index, rule->source_filter, rule) != 0)
+        {
+            LOG_ERROR("Failed to index rule %s (topic: %s)", rule->rule_name, rule->source_topic);
+            goto fail;
+        }
+        add_subscription_topic(source, rule);
+
+        if (rule->limiter || rule->conflater || rule->batcher)
+        {
+            timed_rules_t *timed = &table->timed[rule->target->slot];
+            if (!timed->rules)
+            {
+                timed->rules = malloc(sizeof(forward_rule_t *) * (size_t)count);
+                if (!timed->rules)
+                {
+                    LOG_ERROR("Failed to index timed rule %s", rule->rule_name);
+                    goto fail;
+                }
+            }
+            timed->rules[timed->count++] = rule;
+        }
+    }
+
+    table->rules      = rules;
+    table->rule_count = count;
+    LOG_DEBUG("Indexed %d rules for %d client slots", count, table->slot_count);
+    return table;
+
+fail:
+    // 规则仍归调用方所有
+    free_rule_table(table);
+    return NULL;
+}
+
+// 线程模式: 每个客户端启动一个 libmosquitto 网络线程
+static int start_network_threads(void)
+{
+    for (int i = 0; i < client_count; i++)
+    {
+        for (int j = 0; j < connection_count(clients[i]); j++)
+        {
+            mqtt_client_t *client = connection_of(clients[i], j);
+            int            ret    = mosquitto_loop_start(client->mosq);
+            if (ret != MOSQ_ERR_SUCCESS)
+            {
+                LOG_ERROR("Failed to start network loop for %s: %s",
+                          client->ip, mosquitto_strerror(ret));
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// epoll 模式: 客户端轮流分配到各事件循环, 第一个循环由 mqtt_engine_run 在调用线程上运行
+static int start_event_loops(void)
+{
+    int connections = 0;
+    for (int i = 0; i < client_count; i++)
+    {
+        connections += connection_count(clients[i]);
+    }
+    int loops = engine_config.loops;
+    if (loops > connections)
+    {
+        loops = connections > 0 ? connections : 1;
+    }
+
+    for (int i = 0; i < loops; i++)
+    {
+        event_loops[i] = event_loop_create(i);
+        if (!event_loops[i])
+        {
+            return -1;
+        }
+        event_loop_count++;
+    }
+    // 发布连接池中的连接依次分到不同的循环
+    int next = 0;
+    for (int i = 0; i < client_count; i++)
+    {
+        for (int j = 0; j < connection_count(clients[i]); j++)
+        {
+            mqtt_client_t *client = connection_of(clients[i], j);
+            if (event_loop_add(event_loops[next++ % loops], client) != 0)
+            {
+                LOG_ERROR("Failed to add %s:%d to event loop", client->ip, client->port);
+                return -1;
+            }
+        }
+    }
+    for (int i = 1; i < loops; i++)
+    {
+        if (event_loop_start(event_loops[i]) != 0)
+        {
+            LOG_ERROR("Failed to start event loop %d", i);
+            return -1;
+        }
+    }
+
+    LOG_INFO("Started %d event loops for %d clients (%d connections)", loops, client_count, connections);
+    return 0;
+}
+
+// 编译规则表并启动所有客户端的网络循环
+int mqtt_engine_start(const engine_config_t *engine)
+{
+    engine_config = *engine;
+
+    rule_table_t *table = build_rule_table(pending_rules, pending_count);
+    if (!table)
+    {
+        return -1;
+    }
+    pending_rules    = NULL;
+    pending_count    = 0;
+    pending_capacity = 0;
+    atomic_store_explicit(&active_table, table, memory_order_release);
+
+    if (engine_config.mode == ENGINE_MODE_EPOLL)
+    {
+        return start_event_loops();
+    }
+    return start_network_threads();
+}
+
+int get_rule_count(void)
+{
+    rule_table_t *table = atomic_load_explicit(&active_table, memory_order_acquire);
+    return table ? table->rule_count : 0;
+}
+
+const forward_rule_t *get_forward_rule(int index)
+{
+    rule_table_t *table = atomic_load_explicit(&active_table, memory_order_acquire);
+    if (table && index >= 0 && index < table->rule_count)
+    {
+        return table->rules[index];
+    }
+    return NULL;
+}
+
+static bool has_topic(const source_rules_t *rules, const char *topic)
+{
+    for (int i = 0; rules && i < rules->topic_count; i++)
+    {
+        if (strcmp(rules->topics[i], topic) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 按新旧规则表的差异增删订阅; 未连接的客户端在连接后由 on_connect 按新规则表订阅
+static void update_subscriptions(mqtt_client_t *client, const rule_table_t *before, const rule_table_t *after)
+{
+    if (!client->connected)
+    {
+        return;
+    }
+
+    const source_rules_t *old_rules = source_rules_of(before, client);
+    const source_rules_t *new_rules = source_rules_of(after, client);
+    for (int i = 0; new_rules && i < new_rules->topic_count; i++)
+    {
+        if (!has_topic(old_rules, new_rules->topics[i]))
+        {
+            subscribe_topic(client, new_rules->topics[i]);
+        }
+    }
+    for (int i = 0; old_rules && i < old_rules->topic_count; i++)
+    {
+        if (!has_topic(new_rules, old_rules->topics[i]))
+        {
+            int ret = mosquitto_unsubscribe(client->mosq, NULL, old_rules->topics[i]);
+            if (ret == MOSQ_ERR_SUCCESS)
+            {
+                LOG_INFO("Unsubscribed from topic: %s", old_rules->topics[i]);
+            }
+            else
+            {
+                LOG_ERROR("Unsubscribe failed for topic: %s", old_rules->topics[i]);
+            }
+        }
+    }
+    if (client->loop)
+    {
+        event_loop_wake(client->loop);
+    }
+}
+
+static bool kept_by_reload(const mqtt_client_t *client)
+{
+    return hash_index_find(&reload_index, client->ip, client->port) == client;
+}
+
+// 停止客户端 (包括发布连接池) 的网络循环并断开连接, 返回后不会再有该客户端的回调
+static void stop_client_network(mqtt_client_t *client)
+{
+    for (int i = 1; i < connection_count(client); i++)
+    {
+        stop_client_network(client->publishers[i]);
+    }
+    if (client->loop)
+    {
+        event_loop_remove(client->loop, client);
+        mosquitto_disconnect(client->mosq);
+        mosquitto_loop_write(client->mosq, 1);
+        return;
+    }
+    mosquitto_disconnect(client->mosq);
+    mosquitto_loop_stop(client->mosq, false);
+}
+
+static int start_client_network(mqtt_client_t *client)
+{
+    for (int i = 1; i < connection_count(client); i++)
+    {
+        if (start_client_network(client->publishers[i]) != 0)
+        {
+            return -1;
+        }
+    }
+    if (engine_config.mode != ENGINE_MODE_EPOLL)
+    {
+        int ret = mosquitto_loop_start(client->mosq);
+        if (ret != MOSQ_ERR_SUCCESS)
+        {
+            LOG_ERROR("Failed to start network loop for %s: %s", client->ip, mosquitto_strerror(ret));
+            return -1;
+        }
+        return 0;
+    }
+
+    // 加入客户端最少的事件循环
+    event_loop_t *loop  = event_loops[0];
+    int           count = event_loop_client_count(loop);
+    for (int i = 1; i < event_loop_count; i++)
+    {
+        int loop_count = event_loop_client_count(event_loops[i]);
+        if (loop_count < count)
+        {
+            loop  = event_loops[i];
+            count = loop_count;
+        }
+    }
+    if (event_loop_add(loop, client) != 0)
+    {
+        LOG_ERROR("Failed to add %s:%d to event loop", client->ip, client->port);
+        return -1;
+    }
+    return 0;
+}
+
+void mqtt_engine_reload_begin(void)
+{
+    hash_index_init(&reload_index);
+    reload_client_count = 0;
+    reload_mqtt         = NULL;
+    reloading           = 1;
+}
+
+void mqtt_engine_reload_abort(void)
+{
+    free_rules(pending_rules, pending_count);
+    pending_rules    = NULL;
+    pending_count    = 0;
+    pending_capacity = 0;
+
+    for (int i = 0; i < reload_client_count; i++)
+    {
+        discard_client(reload_clients[i]);
+    }
+    free(reload_clients);
+    reload_clients         = NULL;
+    reload_client_count    = 0;
+    reload_client_capacity = 0;
+    hash_index_destroy(&reload_index);
+    reload_mqtt = NULL;
+    reloading   = 0;
+}
+
+// 被替代客户端各连接离线队列中的消息按主题移到新客户端对应连接的队列 (连接数可能已改变),
+// 排在新客户端已收到的消息之前
+static void hand_over_queues(mqtt_client_t *client, mqtt_client_t *replacement)
+{
+    outbound_queue_t *queues[PUBLISH_MAX_CONNECTIONS];
+    int               count = connection_count(replacement);
+    for (int i = 0; i < count; i++)
+    {
+        queues[i] = &connection_of(replacement, i)->queue;
+    }
+
+    int moved   = 0;
+    int dropped = 0;
+    for (int i = 0; i < connection_count(client); i++)
+    {
+        outbound_queue_t *older = &connection_of(client, i)->queue;
+        if (older->count > 0)
+        {
+            moved += older->count;
+            dropped += outbound_queue_take_over(queues, count, older, topic_shard);
+        }
+    }
+    if (moved > 0)
+    {
+        LOG_INFO("Moved %d queued messages to the new connection to %s:%d (%d dropped by the new queue limits)",
+                 moved, client->ip, client->port, dropped);
+    }
+    if (dropped > 0)
+    {
+        metrics_add(replacement->metrics_id, METRIC_DROPPED, (unsigned long)dropped);
+    }
+}
+
+int mqtt_engine_reload_commit(void)
+{
+    // 先预留客户端表容量 (主循环可能正在遍历, 需持锁), 发布新规则表之后的步骤不再失败
+    pthread_mutex_lock(&clients_lock);
+    int             needed = client_count + reload_client_count;
+    mqtt_client_t **slots  = reserve_slots(clients, &client_capacity, needed, sizeof(mqtt_client_t *));
+    if (slots)
+    {
+        clients = slots;
+    }
+    pthread_mutex_unlock(&clients_lock);
+
+    rule_table_t *table = slots || needed == 0 ? build_rule_table(pending_rules, pending_count) : NULL;
+    if (!table)
+    {
+        LOG_ERROR("Failed to build rule table, keeping current rules");
+        mqtt_engine_reload_abort();
+        return -1;
+    }
+    pending_rules    = NULL;
+    pending_count    = 0;
+    pending_capacity = 0;
+
+    // 替代旧客户端且溢出目录不变的新客户端接管旧客户端的日志 (此时新客户端还未被任何规则表引用),
+    // 两者共用同一个日志对象直到旧客户端回收, 追加顺序不变
+    for (int i = 0; i < reload_client_count; i++)
+    {
+        mqtt_client_t *client   = reload_clients[i];
+        mqtt_client_t *replaced = find_client(client->ip, client->port);
+        if (replaced && replaced->spill && strcmp(replaced->config.spill.dir, client->config.spill.dir) == 0)
+        {
+            client->spill = replaced->spill;
+            if (!spill_settings_equal(&replaced->config.spill, &client->config.spill))
+            {
+                LOG_INFO("Spill log %s is kept open for %s, changed segment and fsync settings apply after restart",
+                         client->config.spill.dir, client->name);
+            }
+        }
+    }
+
+    // 发布新规则表, 保留的客户端只增删变化的订阅
+    pthread_mutex_lock(&subscribe_lock);
+    rule_table_t *old_table = atomic_exchange_explicit(&active_table, table, memory_order_acq_rel);
+    for (int i = 0; i < client_count; i++)
+    {
+        if (kept_by_reload(clients[i]))
+        {
+            update_subscriptions(clients[i], old_table, table);
+        }
+    }
+    pthread_mutex_unlock(&subscribe_lock);
+
+    // 等待旧规则表不再被使用: 网络线程上正在进行的匹配, 以及已交给工作线程的任务
+    rcu_synchronize();
+    for (int i = 0; i < client_count; i++)
+    {
+        if (clients[i]->workers)
+        {
+            worker_pool_drain(clients[i]->workers);
+        }
+    }
+
+    // 旧规则中合并和成批的消息立即发出 (目标客户端此时都还在), 不等到期
+    for (int i = 0; old_table && i < old_table->rule_count; i++)
+    {
+        flush_timed_rule(old_table->rules[i]);
+    }
+
+    // 回收新配置不再使用 (或设置已变化) 的客户端; 设置变化的客户端把离线队列中的消息交给替代它的新客户端,
+    // 不再使用的客户端的消息丢弃
+    int removed = 0;
+    for (int i = client_count - 1; i >= 0; i--)
+    {
+        mqtt_client_t *client = clients[i];
+        if (kept_by_reload(client))
+        {
+            continue;
+        }
+        stop_client_network(client);
+        pthread_mutex_lock(&clients_lock);
+        clients[i] = clients[--client_count];
+        pthread_mutex_unlock(&clients_lock);
+        LOG_INFO("Closed connection to %s:%d", client->ip, client->port);
+        mqtt_client_t *replacement = hash_index_find(&reload_index, client->ip, client->port);
+        if (replacement && replacement->spill == client->spill)
+        {
+            client->spill = NULL;
+        }
+        if (replacement)
+        {
+            hand_over_queues(client, replacement);
+        }
+        release_client(client);
+        removed++;
+    }
+
+    // 新配置的客户端表和索引生效, 连接新建的客户端
+    hash_index_destroy(&client_index);
+    client_index = reload_index;
+    memset(&reload_index, 0, sizeof(reload_index));
+    if (reload_mqtt)
+    {
+        save_connect_settings(reload_mqtt);
+    }
+    for (int i = 0; i < reload_client_count; i++)
+    {
+        mqtt_client_t *client = reload_clients[i];
+        // 其余新建客户端在旧客户端都已回收 (日志已关闭) 之后再打开溢出日志
+        open_spill(client);
+        pthread_mutex_lock(&clients_lock);
+        clients[client_count++] = client;
+        pthread_mutex_unlock(&clients_lock);
+        // 失败的客户端保留在表中, 其规则的消息进入离线队列
+        if (connect_client(client, connect_settings.keepalive) == 0)
+        {
+            start_client_network(client);
+        }
+    }
+    int added = reload_client_count;
+    free(reload_clients);
+    reload_clients         = NULL;
+    reload_client_count    = 0;
+    reload_client_capacity = 0;
+    reload_mqtt            = NULL;
+    reloading              = 0;
+
+    free_rule_table(old_table);
+    LOG_INFO("Reloaded %d rules for %d clients (%d connections added, %d closed)",
+             table->rule_count, client_count, added, removed);
+    return 0;
+}
+
+void cleanup_forwarder(void)
+{
+    LOG_INFO("Stopping MQTT Message Forwarder...");
+
+    // 先停止所有网络线程, 再让工作线程处理完已接收的消息 (可能发往任意客户端)
+    if (engine_config.mode == ENGINE_MODE_EPOLL)
+    {
+        for (int i = 0; i < event_loop_count; i++)
+        {
+            event_loop_stop(event_loops[i]);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < client_count; i++)
+        {
+            for (int j = 0; j < connection_count(clients[i]); j++)
+            {
+                mqtt_client_t *client = connection_of(clients[i], j);
+                if (client->mosq)
+                {
+                    mosquitto_loop_stop(client->mosq, true);
+                }
+            }
+        }
+    }
+    for (int i = 0; i < client_count; i++)
+    {
+        if (clients[i]->workers)
+        {
+            worker_pool_stop(clients[i]->workers);
+        }
+    }
+
+    rule_table_t *table = atomic_exchange_explicit(&active_table, NULL, memory_order_acq_rel);
+    for (int i = 0; i < client_count; i++)
+    {
+        const source_rules_t *rules = source_rules_of(table, clients[i]);
+        if (rules && rules->index)
+        {
+            LOG_DEBUG("Rule index cache for %s: %lu hits, %lu misses",
+                      clients[i]->ip,
+                      topic_trie_cache_hits(rules->index),
+                      topic_trie_cache_misses(rules->index));
+        }
+        release_client(clients[i]);
+    }
+    for (int i = 0; table && i < table->rule_count; i++)
+    {
+        forward_rule_t *rule = table->rules[i];
+        int delayed = rule->limiter ? rate_limiter_pending(rule->limiter) : 0;
+        if (delayed > 0)
+        {
+            LOG_INFO("Discarded %d rate-limited messages for rule %s", delayed, rule->rule_name);
+        }
+        if (rule->conflater)
+        {
+            conflater_stats_t stats;
+            conflater_stats(rule->conflater, &stats);
+            LOG_INFO("Conflation stats for rule %s: devices=%d evicted=%lu discarded=%d",
+                     rule->rule_name, stats.keys, stats.evicted, stats.pending);
+        }
+        int pending = rule->batcher ? event_batcher_pending(rule->batcher) : 0;
+        if (pending > 0)
+        {
+            LOG_INFO("Discarded %d batched messages for rule %s", pending, rule->rule_name);
+        }
+    }
+    free_rule_table(table);
+    free_rules(pending_rules, pending_count);
+
+    for (int i = 0; i < event_loop_count; i++)
+    {
+        event_loop_destroy(event_loops[i]);
+        event_loops[i] = NULL;
+    }
+
+    free(clients);
+    hash_index_destroy(&client_index);
+    free_connect_settings();
+
     // 重置全局状态
-    client_count = 0;
-    rule_count   = 0;
+    clients          = NULL;
+    client_count     = 0;
+    client_capacity  = 0;
+    next_slot        = 0;
+    pending_rules    = NULL;
+    pending_count    = 0;
+    pending_capacity = 0;
+    event_loop_count = 0;
 
     mosquitto_lib_cleanup();
     LOG_INFO("MQTT Message Forwarder stopped");
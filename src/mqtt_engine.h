@@ -4,46 +4,111 @@
 #include <mosquitto.h>
 
 #include "config_json.h"
+#include "conflate.h"
+#include "event_batch.h"
+#include "inflight.h"
+#include "message_props.h"
+#include "metrics.h"
+#include "outbound_queue.h"
+#include "rate_limit.h"
+#include "spill_log.h"
+#include "topic_alias.h"
+#include "topic_rewrite.h"
+#include "transform.h"
+#include "worker_pool.h"
 
 // MQTT客户端结构体
-typedef struct
+typedef struct mqtt_client
 {
     struct mosquitto *mosq;
+    char              name[64];
     char              ip[64];
     char              client_id[64];
+    int               metrics_id;  // 运行指标编号
     int               connected;
     int               port;  // 添加端口字段用于比较
+    int               slot;        // 在规则表中的槽位, 创建后不变
+    client_config_t   config;      // 创建时的配置, 热加载时判断连接能否保留
+    outbound_queue_t  queue;       // 断开期间待发送的消息
+    spill_log_t      *spill;       // 内存队列放不下时的磁盘溢出日志 (可选)
+    worker_pool_t    *workers;     // 处理该客户端收到的消息的线程池 (可选)
+    int               lane_metrics_ids[LANE_QUEUE_COUNT][PRIORITY_LANES];  // 各队列各优先级通道排队时间的指标编号
+    inflight_t        inflight;          // 发布到该客户端、等待确认的 QoS 1/2 消息
+    int               ack_metrics_id;    // 确认延迟的指标编号
+    topic_alias_t    *aliases;           // MQTT v5 出站主题别名 (可选), 每次连接按 Broker 上限重置
+    struct mqtt_client **publishers;     // 发布连接池 (connections > 1 时), [0] 为本连接
+    int               publisher_count;
+    struct mqtt_client *owner;           // 发布连接池中的其余连接所属的客户端, 其他为NULL
+
+    // epoll 引擎模式下由所属事件循环维护
+    struct event_loop *loop;
+    int               loop_fd;          // 已注册到 epoll 的套接字
+    unsigned int      loop_events;
+    int               reconnect_delay;  // 下次重连前的等待秒数
+    long long         reconnect_at;     // 计划重连的时间 (毫秒), 0表示未计划
 } mqtt_client_t;
 
+typedef struct forward_rule forward_rule_t;
+
+// 转发回调: 按规则转换源客户端收到的消息并发布到目标客户端
+typedef void (*forward_callback_t)(const forward_rule_t           *rule,
+                                   mqtt_client_t                  *source,
+                                   mqtt_client_t                  *target,
+                                   const struct mosquitto_message *message);
+
 // 转发规则结构体
-typedef struct
+struct forward_rule
 {
-    char source_ip[64];
-    int  source_port;
-    char source_topic[256];
-    char target_ip[64];
-    int  target_port;
+    char source_topic[256];  // 订阅的主题, 共享订阅时带 $share/<组名>/ 前缀
+    const char *source_filter;  // source_topic 中的过滤器部分, 用于匹配消息主题
+    char share_group[64];  // 共享订阅的组名, 非共享订阅为空串
     char target_topic[256];
-    void (*message_callback)(mqtt_client_t                  *source,
-                             mqtt_client_t                  *target,
-                             const struct mosquitto_message *message);
+    topic_rewrite_t *topic_rewrite;  // 由 source_filter/target_topic 编译的目标主题改写计划
+    forward_callback_t message_callback;
+    const transform_t *transform;  // 声明式转换模板, 由 TransformCall 使用 (可选)
     char rule_name[64];
-} forward_rule_t;
+    int metrics_id;  // 运行指标编号
+    int stage_ids[STAGE_COUNT];  // 各处理阶段耗时的指标编号
+    rate_limiter_t *limiter;  // 规则和设备限速 (可选), 延迟的消息由目标客户端的定时任务发出
+    conflater_t *conflater;  // 按设备只发最新值 (可选), 由目标客户端的定时任务发出周期结束的值
+    event_batcher_t *batcher;  // 按目标主题合并发布 (可选), 由目标客户端的定时任务发出到期的批
+    int batch_metrics_id;  // 批填充率的指标编号
+    priority_t priority;  // 消息在源客户端工作线程队列和目标客户端离线队列中的通道
+    mqtt_client_t *source;  // 源/目标客户端, 热路径上不再按地址查找
+    mqtt_client_t *target;
+};
 
 // API函数声明
 mqtt_client_t        *mqtt_connect(const client_config_t *client_cfg, const mqtt_config_t *mqtt_cfg);
-int                   add_forward_rule(const char *source_ip,
-                                       int source_port,
+int                   add_forward_rule(mqtt_client_t *source,
                                        const char *source_topic,
-                                       const char *target_ip,
-                                       int target_port,
+                                       mqtt_client_t *target,
                                        const char *target_topic,
-                                       void (*callback)(mqtt_client_t                  *source,
-                                      mqtt_client_t                  *target,
-                                      const struct mosquitto_message *message),
+                                       forward_callback_t callback,
+                                       const transform_t *transform,
+                                       const publish_config_t *publish,
                                        const char *rule_name);
+int                   mqtt_engine_start(const engine_config_t *engine);
+void                  mqtt_engine_run(volatile int *running);
+void                  mqtt_client_tick(mqtt_client_t *client, long long now_ms);
+// 按规则发布到目标客户端; 规则启用最新值合并或批量发布时可能稍后才发出
+int                   forward_publish(const forward_rule_t *rule,
+                                      const char           *topic,
+                                      int                   payloadlen,
+                                      const void           *payload,
+                                      int                   qos,
+                                      bool                  retain);
+// 当前生效的规则, 只能在控制线程 (启动、热加载所在线程) 上调用
 int                   get_rule_count(void);
 const forward_rule_t *get_forward_rule(int index);
 void                  cleanup_forwarder(void);
 
+// 配置热加载, 在控制线程上调用, 不与 mqtt_engine_start/cleanup_forwarder 并发。
+// begin 之后按新配置调用 mqtt_connect 和 add_forward_rule: 设置未变的客户端返回原连接,
+// 其余新建并推迟到 commit 时连接。commit 原子替换规则表, 只增删变化的订阅,
+// 等待旧规则表不再被使用后回收它和不再需要的客户端; abort 放弃本次加载。
+void mqtt_engine_reload_begin(void);
+int  mqtt_engine_reload_commit(void);
+void mqtt_engine_reload_abort(void);
+
 #endif
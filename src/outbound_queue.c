@@ -0,0 +1,340 @@
+#include "outbound_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "time_util.h"
+
+void outbound_queue_init(outbound_queue_t *queue, const queue_config_t *config, const schedule_config_t *schedule)
+{
+    memset(queue, 0, sizeof(outbound_queue_t));
+    pthread_mutex_init(&queue->mutex, NULL);
+    queue->config   = *config;
+    queue->schedule = *schedule;
+    queue->credit   = schedule->weights[0];
+}
+
+void outbound_queue_destroy(outbound_queue_t *queue)
+{
+    for (int lane = 0; lane < PRIORITY_LANES; lane++)
+    {
+        queued_message_t *message = queue->head[lane];
+        while (message)
+        {
+            queued_message_t *next = message->next;
+            free(message);
+            message = next;
+        }
+        queue->head[lane] = NULL;
+        queue->tail[lane] = NULL;
+        atomic_store(&queue->lane_pending[lane], 0);
+    }
+    queue->count = 0;
+    queue->bytes = 0;
+    atomic_store(&queue->pending, 0);
+    pthread_mutex_destroy(&queue->mutex);
+}
+
+static queued_message_t *unlink_head(outbound_queue_t *queue, int lane)
+{
+    queued_message_t *message = queue->head[lane];
+    if (message)
+    {
+        queue->head[lane] = message->next;
+        if (!queue->head[lane])
+        {
+            queue->tail[lane] = NULL;
+        }
+        queue->count--;
+        queue->bytes -= message->size;
+        message->next = NULL;
+    }
+    return message;
+}
+
+// 淘汰对象: 优先级最低的非空通道中最旧的一条, 该通道比 lane 优先级高时返回-1
+static int victim_lane(const outbound_queue_t *queue, int lane)
+{
+    for (int i = PRIORITY_LANES - 1; i >= lane; i--)
+    {
+        if (queue->head[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int enqueue(outbound_queue_t *queue,
+                   int               lane,
+                   const char       *topic,
+                   const void       *payload,
+                   int               payloadlen,
+                   int               qos,
+                   int               retain,
+                   int               allow_drop)
+{
+    size_t topic_len = strlen(topic) + 1;
+    size_t size      = sizeof(queued_message_t) + topic_len + (size_t)payloadlen;
+
+    if (queue->config.max_messages <= 0 || size > (size_t)queue->config.max_bytes)
+    {
+        if (allow_drop)
+        {
+            atomic_fetch_add_explicit(&queue->dropped_newest, 1, memory_order_relaxed);
+        }
+        return -1;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+
+    // 超出上限时按策略处理
+    while (queue->count >= queue->config.max_messages
+           || queue->bytes + size > (size_t)queue->config.max_bytes)
+    {
+        if (!allow_drop)
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            return -1;
+        }
+        int victim = queue->config.policy == QUEUE_DROP_NEWEST ? -1 : victim_lane(queue, lane);
+        if (victim < 0)
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            atomic_fetch_add_explicit(&queue->dropped_newest, 1, memory_order_relaxed);
+            return -1;
+        }
+        free(unlink_head(queue, victim));
+        atomic_fetch_sub_explicit(&queue->lane_pending[victim], 1, memory_order_release);
+        atomic_fetch_sub_explicit(&queue->pending, 1, memory_order_release);
+        atomic_fetch_add_explicit(&queue->dropped_oldest, 1, memory_order_relaxed);
+    }
+
+    queued_message_t *message = malloc(size);
+    if (!message)
+    {
+        pthread_mutex_unlock(&queue->mutex);
+        atomic_fetch_add_explicit(&queue->dropped_newest, 1, memory_order_relaxed);
+        return -1;
+    }
+    message->next        = NULL;
+    message->topic       = (char *)(message + 1);
+    message->payload     = message->topic + topic_len;
+    message->payloadlen  = payloadlen;
+    message->qos         = qos;
+    message->retain      = retain;
+    message->lane        = lane;
+    message->enqueued_ns = monotonic_ns();
+    message->size        = size;
+    memcpy(message->topic, topic, topic_len);
+    memcpy(message->payload, payload, (size_t)payloadlen);
+
+    if (queue->tail[lane])
+    {
+        queue->tail[lane]->next = message;
+    }
+    else
+    {
+        queue->head[lane] = message;
+    }
+    queue->tail[lane] = message;
+    queue->count++;
+    queue->bytes += size;
+    atomic_fetch_add_explicit(&queue->lane_pending[lane], 1, memory_order_release);
+    atomic_fetch_add_explicit(&queue->pending, 1, memory_order_release);
+
+    pthread_mutex_unlock(&queue->mutex);
+    atomic_fetch_add_explicit(&queue->enqueued, 1, memory_order_relaxed);
+    return 0;
+}
+
+int outbound_queue_push(outbound_queue_t *queue,
+                        int               lane,
+                        const char       *topic,
+                        const void       *payload,
+                        int               payloadlen,
+                        int               qos,
+                        int               retain)
+{
+    return enqueue(queue, lane, topic, payload, payloadlen, qos, retain, 1);
+}
+
+int outbound_queue_offer(outbound_queue_t *queue,
+                         int               lane,
+                         const char       *topic,
+                         const void       *payload,
+                         int               payloadlen,
+                         int               qos,
+                         int               retain)
+{
+    return enqueue(queue, lane, topic, payload, payloadlen, qos, retain, 0);
+}
+
+// 超出上限时从最低优先级通道淘汰最旧的消息, 返回淘汰的条数, 调用方持锁
+static int trim(outbound_queue_t *queue)
+{
+    int dropped = 0;
+    while (queue->count > 0
+           && (queue->count > queue->config.max_messages || queue->bytes > (size_t)queue->config.max_bytes))
+    {
+        int victim = victim_lane(queue, 0);
+        free(unlink_head(queue, victim));
+        atomic_fetch_sub_explicit(&queue->lane_pending[victim], 1, memory_order_release);
+        atomic_fetch_sub_explicit(&queue->pending, 1, memory_order_release);
+        atomic_fetch_add_explicit(&queue->dropped_oldest, 1, memory_order_relaxed);
+        dropped++;
+    }
+    return dropped;
+}
+
+int outbound_queue_take_over(outbound_queue_t *const *queues,
+                             int                     count,
+                             outbound_queue_t       *older,
+                             unsigned int (*shard)(const char *topic))
+{
+    int dropped = 0;
+    pthread_mutex_lock(&older->mutex);
+    for (int k = 0; k < count; k++)
+    {
+        outbound_queue_t *queue = queues[k];
+        pthread_mutex_lock(&queue->mutex);
+        for (int lane = 0; lane < PRIORITY_LANES; lane++)
+        {
+            // 摘出属于该队列的消息, 保持原顺序
+            queued_message_t  *head  = NULL;
+            queued_message_t  *tail  = NULL;
+            queued_message_t **prev  = &older->head[lane];
+            int                moved = 0;
+            size_t             bytes = 0;
+            while (*prev)
+            {
+                queued_message_t *message = *prev;
+                if (count > 1 && shard(message->topic) % (unsigned int)count != (unsigned int)k)
+                {
+                    prev = &message->next;
+                    continue;
+                }
+                *prev         = message->next;
+                message->next = NULL;
+                if (tail)
+                {
+                    tail->next = message;
+                }
+                else
+                {
+                    head = message;
+                }
+                tail = message;
+                moved++;
+                bytes += message->size;
+            }
+            if (!head)
+            {
+                continue;
+            }
+
+            tail->next        = queue->head[lane];
+            queue->head[lane] = head;
+            if (!queue->tail[lane])
+            {
+                queue->tail[lane] = tail;
+            }
+            queue->count += moved;
+            queue->bytes += bytes;
+            older->count -= moved;
+            older->bytes -= bytes;
+            atomic_fetch_sub_explicit(&older->lane_pending[lane], moved, memory_order_release);
+            atomic_fetch_sub_explicit(&older->pending, moved, memory_order_release);
+            atomic_fetch_add_explicit(&queue->lane_pending[lane], moved, memory_order_release);
+            atomic_fetch_add_explicit(&queue->pending, moved, memory_order_release);
+        }
+        dropped += trim(queue);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+    for (int lane = 0; lane < PRIORITY_LANES; lane++)
+    {
+        older->tail[lane] = older->head[lane] ? older->tail[lane] : NULL;
+    }
+    pthread_mutex_unlock(&older->mutex);
+    return dropped;
+}
+
+// 严格优先时取最高的非空通道; 加权时当前通道用完份额或为空才轮到下一个通道
+queued_message_t *outbound_queue_pop(outbound_queue_t *queue)
+{
+    queued_message_t *message = NULL;
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->schedule.mode == SCHEDULE_STRICT)
+    {
+        for (int lane = 0; lane < PRIORITY_LANES && !message; lane++)
+        {
+            message = unlink_head(queue, lane);
+        }
+    }
+    else
+    {
+        for (int round = 0; round <= PRIORITY_LANES; round++)
+        {
+            if (queue->credit > 0 && (message = unlink_head(queue, queue->lane)) != NULL)
+            {
+                queue->credit--;
+                break;
+            }
+            queue->lane   = (queue->lane + 1) % PRIORITY_LANES;
+            queue->credit = queue->schedule.weights[queue->lane];
+        }
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return message;
+}
+
+void outbound_queue_done(outbound_queue_t *queue, queued_message_t *message)
+{
+    atomic_fetch_sub_explicit(&queue->lane_pending[message->lane], 1, memory_order_release);
+    free(message);
+    atomic_fetch_add_explicit(&queue->replayed, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&queue->pending, 1, memory_order_release);
+}
+
+void outbound_queue_requeue(outbound_queue_t *queue, queued_message_t *message)
+{
+    // 发送失败的消息放回所在通道的队首, 已计入上限, 不再检查
+    int lane = message->lane;
+    pthread_mutex_lock(&queue->mutex);
+    message->next     = queue->head[lane];
+    queue->head[lane] = message;
+    if (!queue->tail[lane])
+    {
+        queue->tail[lane] = message;
+    }
+    queue->count++;
+    queue->bytes += message->size;
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+int outbound_queue_replay_budget(outbound_queue_t *queue, long long now_ms)
+{
+    double burst = queue->config.replay_rate / 10.0;  // 最多积累100ms的令牌
+    if (burst < 1.0)
+    {
+        burst = 1.0;
+    }
+
+    if (queue->last_refill_ms == 0)
+    {
+        queue->tokens = 1.0;
+    }
+    else
+    {
+        queue->tokens += (now_ms - queue->last_refill_ms) * queue->config.replay_rate / 1000.0;
+    }
+    queue->last_refill_ms = now_ms;
+    if (queue->tokens > burst)
+    {
+        queue->tokens = burst;
+    }
+
+    int budget = (int)queue->tokens;
+    queue->tokens -= budget;
+    return budget;
+}
@@ -0,0 +1,97 @@
+#ifndef OUTBOUND_QUEUE_H
+#define OUTBOUND_QUEUE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "config_json.h"
+
+// 离线消息 (主题和负载与结构体一次分配)
+typedef struct queued_message
+{
+    struct queued_message *next;
+    char                  *topic;
+    void                  *payload;
+    int                    payloadlen;
+    int                    qos;
+    int                    retain;
+    int                    lane;         // 优先级通道
+    long long              enqueued_ns;  // 入队时间, 用于统计通道排队时间
+    size_t                 size;   // 计入内存上限的字节数
+} queued_message_t;
+
+// 目标客户端的有界离线队列: 业务线程写入, 主循环按速率重放。
+// 每个优先级通道一条链表, 通道内按顺序重放, 通道之间按调度配置选择;
+// 上限由所有通道共享, 超出时只淘汰同级或更低优先级的消息。
+typedef struct
+{
+    pthread_mutex_t   mutex;
+    queued_message_t *head[PRIORITY_LANES];
+    queued_message_t *tail[PRIORITY_LANES];
+    int               count;
+    size_t            bytes;
+    atomic_int        pending;     // 尚未成功发出的条数 (含正在重放的一条)
+    atomic_int        lane_pending[PRIORITY_LANES];
+    queue_config_t    config;
+    schedule_config_t schedule;
+    int               lane;        // 加权调度: 当前通道及其剩余份额
+    int               credit;
+    double            tokens;      // 重放令牌
+    long long         last_refill_ms;
+
+    // 统计
+    atomic_ulong      enqueued;
+    atomic_ulong      dropped_oldest;
+    atomic_ulong      dropped_newest;
+    atomic_ulong      replayed;
+} outbound_queue_t;
+
+void outbound_queue_init(outbound_queue_t *queue, const queue_config_t *config, const schedule_config_t *schedule);
+void outbound_queue_destroy(outbound_queue_t *queue);
+
+// 入队到 lane 通道, 超出上限时按策略丢弃; 返回0表示已入队, -1表示该消息被丢弃
+int outbound_queue_push(outbound_queue_t *queue,
+                        int               lane,
+                        const char       *topic,
+                        const void       *payload,
+                        int               payloadlen,
+                        int               qos,
+                        int               retain);
+
+// 仅在不超出上限时入队, 不触发丢弃策略; 返回0表示已入队
+int outbound_queue_offer(outbound_queue_t *queue,
+                         int               lane,
+                         const char       *topic,
+                         const void       *payload,
+                         int               payloadlen,
+                         int               qos,
+                         int               retain);
+
+// 热加载时接管被替代客户端的队列: older 中的消息 (都早于 queues 中的) 按 shard(主题) % count
+// 分到 count 个队列, 按通道移到队首, older 随后为空。合并后超出某个队列的上限时从其最低优先级通道
+// 淘汰最旧的消息, 返回淘汰的条数
+int outbound_queue_take_over(outbound_queue_t *const *queues,
+                             int                     count,
+                             outbound_queue_t       *older,
+                             unsigned int (*shard)(const char *topic));
+
+// 按调度方式取出某个通道的队首消息, 调用方负责发送后调用 outbound_queue_done 或 outbound_queue_requeue
+queued_message_t *outbound_queue_pop(outbound_queue_t *queue);
+void              outbound_queue_done(outbound_queue_t *queue, queued_message_t *message);
+void              outbound_queue_requeue(outbound_queue_t *queue, queued_message_t *message);
+
+// 按重放速率计算本轮可发送的条数
+int outbound_queue_replay_budget(outbound_queue_t *queue, long long now_ms);
+
+static inline int outbound_queue_pending(outbound_queue_t *queue)
+{
+    return atomic_load_explicit(&queue->pending, memory_order_acquire);
+}
+
+static inline int outbound_queue_lane_pending(outbound_queue_t *queue, int lane)
+{
+    return atomic_load_explicit(&queue->lane_pending[lane], memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,412 @@
+#include "rate_limit.h"
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+// 设备令牌桶, key 为源主题的64位哈希 (0表示空槽)
+typedef struct
+{
+    atomic_ullong key;
+    atomic_llong  tat;       // 理论到达时间: 不早于此时刻的消息才有令牌, 早于 now 时桶是满的
+    atomic_int    delayed;   // 该桶的设备尚未发出的延迟消息数
+} bucket_t;
+
+// 延迟消息 (主题和负载与结构体一次分配)
+typedef struct
+{
+    long long          release_ns;
+    unsigned long long seq;      // 同一时刻到期的按提交顺序发出
+    bucket_t          *bucket;   // 所属设备的桶, 未启用设备限速时为NULL
+    rate_delayed_t     message;
+} delayed_entry_t;
+
+struct rate_limiter
+{
+    alignas(64) atomic_llong rule_tat;
+    long long                rule_interval_ns;    // 0表示不限
+    long long                rule_limit_ns;       // 桶容量对应的时间
+    long long                device_interval_ns;
+    long long                device_limit_ns;
+    long long                max_wait_ns;         // 超限消息最多延迟多久, 非 delay 策略为0
+    rate_limit_config_t      config;
+    atomic_ulong             over_count;          // sample: 超限消息计数
+    bucket_t                *buckets;
+    size_t                   mask;
+
+    pthread_mutex_t          lock;                // 保护延迟消息堆
+    delayed_entry_t        **heap;
+    int                      heap_count;
+    int                      heap_capacity;
+    unsigned long long       next_seq;
+    atomic_int               pending;
+    rate_release_t           release;
+    void                    *ctx;
+};
+
+static unsigned long long topic_hash(const char *topic)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    for (const unsigned char *p = (const unsigned char *)topic; *p; p++)
+    {
+        hash = (hash ^ *p) * 1099511628211ull;
+    }
+    return hash ? hash : 1;
+}
+
+// 速率 (条/秒) 和容量换算为发放间隔和容量对应的时间
+static void bucket_params(double rate, int burst, long long *interval_ns, long long *limit_ns)
+{
+    *interval_ns = 0;
+    *limit_ns    = 0;
+    if (rate > 0)
+    {
+        *interval_ns = (long long)(1e9 / rate);
+        if (*interval_ns < 1)
+        {
+            *interval_ns = 1;
+        }
+        *limit_ns = *interval_ns * (long long)(burst > 0 ? burst : 1);
+    }
+}
+
+rate_limiter_t *rate_limiter_create(const rate_limit_config_t *config, rate_release_t release, void *ctx)
+{
+    rate_limiter_t *limiter = aligned_alloc(64, (sizeof(rate_limiter_t) + 63) & ~(size_t)63);
+    if (!limiter)
+    {
+        return NULL;
+    }
+    memset(limiter, 0, sizeof(rate_limiter_t));
+    limiter->config  = *config;
+    limiter->release = release;
+    limiter->ctx     = ctx;
+    bucket_params(config->rate, config->burst, &limiter->rule_interval_ns, &limiter->rule_limit_ns);
+    bucket_params(config->device_rate, config->device_burst, &limiter->device_interval_ns,
+                  &limiter->device_limit_ns);
+    if (config->policy == RATE_SHED_DELAY)
+    {
+        limiter->max_wait_ns = (long long)config->max_delay_ms * 1000000LL;
+    }
+
+    if (limiter->device_interval_ns)
+    {
+        // 装载率不超过一半
+        size_t slots = 16;
+        while (slots < (size_t)config->max_devices * 2)
+        {
+            slots *= 2;
+        }
+        limiter->buckets = calloc(slots, sizeof(bucket_t));
+        if (!limiter->buckets)
+        {
+            free(limiter);
+            return NULL;
+        }
+        limiter->mask = slots - 1;
+    }
+    pthread_mutex_init(&limiter->lock, NULL);
+    return limiter;
+}
+
+void rate_limiter_destroy(rate_limiter_t *limiter)
+{
+    if (!limiter)
+    {
+        return;
+    }
+    for (int i = 0; i < limiter->heap_count; i++)
+    {
+        free(limiter->heap[i]);
+    }
+    free(limiter->heap);
+    free(limiter->buckets);
+    pthread_mutex_destroy(&limiter->lock);
+    free(limiter);
+}
+
+// 取一个令牌: 返回还需等待的纳秒数, <=0 表示有令牌。需等待超过 max_wait 时不占用令牌,
+// 否则预占 (延迟发出的消息占用未来的令牌, 之后的消息排在它后面)
+static long long take(atomic_llong *tat, long long now, long long interval, long long limit, long long max_wait)
+{
+    long long old = atomic_load_explicit(tat, memory_order_relaxed);
+    for (;;)
+    {
+        long long next = (old > now ? old : now) + interval;
+        long long wait = next - now - limit;
+        if (wait > max_wait)
+        {
+            return wait;
+        }
+        if (atomic_compare_exchange_weak_explicit(tat, &old, next, memory_order_relaxed, memory_order_relaxed))
+        {
+            return wait;
+        }
+    }
+}
+
+// 查找或占用设备的桶, 不分配内存
+static bucket_t *device_bucket(rate_limiter_t *limiter, const char *topic, long long now)
+{
+    unsigned long long key   = topic_hash(topic);
+    size_t             first = (size_t)key & limiter->mask;
+    for (size_t i = 0; i < RATE_LIMIT_PROBES; i++)
+    {
+        bucket_t          *bucket = &limiter->buckets[(first + i) & limiter->mask];
+        unsigned long long found  = atomic_load_explicit(&bucket->key, memory_order_relaxed);
+        if (found == key)
+        {
+            return bucket;
+        }
+        if (found == 0
+            && (atomic_compare_exchange_strong_explicit(&bucket->key, &found, key, memory_order_relaxed,
+                                                        memory_order_relaxed)
+                || found == key))
+        {
+            return bucket;
+        }
+    }
+
+    // 探测范围已满: 复用令牌已满且没有延迟消息的桶, 它和新桶没有区别
+    for (size_t i = 0; i < RATE_LIMIT_PROBES; i++)
+    {
+        bucket_t          *bucket = &limiter->buckets[(first + i) & limiter->mask];
+        unsigned long long found  = atomic_load_explicit(&bucket->key, memory_order_relaxed);
+        if (atomic_load_explicit(&bucket->tat, memory_order_relaxed) <= now
+            && atomic_load_explicit(&bucket->delayed, memory_order_relaxed) == 0
+            && atomic_compare_exchange_strong_explicit(&bucket->key, &found, key, memory_order_relaxed,
+                                                       memory_order_relaxed))
+        {
+            return bucket;
+        }
+    }
+    return &limiter->buckets[first];
+}
+
+static bool entry_before(const delayed_entry_t *a, const delayed_entry_t *b)
+{
+    return a->release_ns < b->release_ns || (a->release_ns == b->release_ns && a->seq < b->seq);
+}
+
+// 保存一条延迟消息, 超出上限或内存不足时返回-1
+static int defer(rate_limiter_t *limiter,
+                 const char     *topic,
+                 const void     *payload,
+                 size_t          len,
+                 int             qos,
+                 bool            retain,
+                 long long       received_ns,
+                 long long       release_ns,
+                 bucket_t       *bucket)
+{
+    size_t           topic_len = strlen(topic) + 1;
+    delayed_entry_t *entry     = malloc(sizeof(delayed_entry_t) + topic_len + len);
+    if (!entry)
+    {
+        return -1;
+    }
+    char *data = (char *)(entry + 1);
+    memcpy(data, topic, topic_len);
+    memcpy(data + topic_len, payload, len);
+    entry->release_ns  = release_ns;
+    entry->bucket      = bucket;
+    entry->message     = (rate_delayed_t){
+            .topic       = data,
+            .payload     = data + topic_len,
+            .len         = len,
+            .qos         = qos,
+            .retain      = retain,
+            .received_ns = received_ns,
+    };
+
+    pthread_mutex_lock(&limiter->lock);
+    if (limiter->heap_count >= RATE_LIMIT_MAX_DELAYED)
+    {
+        pthread_mutex_unlock(&limiter->lock);
+        free(entry);
+        return -1;
+    }
+    if (limiter->heap_count == limiter->heap_capacity)
+    {
+        int               capacity = limiter->heap_capacity ? limiter->heap_capacity * 2 : 64;
+        delayed_entry_t **heap     = realloc(limiter->heap, sizeof(delayed_entry_t *) * (size_t)capacity);
+        if (!heap)
+        {
+            pthread_mutex_unlock(&limiter->lock);
+            free(entry);
+            return -1;
+        }
+        limiter->heap          = heap;
+        limiter->heap_capacity = capacity;
+    }
+    entry->seq = limiter->next_seq++;
+
+    // 上浮
+    int i = limiter->heap_count++;
+    while (i > 0 && entry_before(entry, limiter->heap[(i - 1) / 2]))
+    {
+        limiter->heap[i] = limiter->heap[(i - 1) / 2];
+        i                = (i - 1) / 2;
+    }
+    limiter->heap[i] = entry;
+    atomic_fetch_add_explicit(&limiter->pending, 1, memory_order_relaxed);
+    if (bucket)
+    {
+        atomic_fetch_add_explicit(&bucket->delayed, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&limiter->lock);
+    return 0;
+}
+
+rate_verdict_t rate_limiter_admit(rate_limiter_t *limiter,
+                                  const char     *topic,
+                                  const void     *payload,
+                                  size_t          len,
+                                  int             qos,
+                                  bool            retain,
+                                  long long       now_ns,
+                                  unsigned       *over)
+{
+    long long max_wait = limiter->max_wait_ns;
+    long long wait     = 0;
+    bucket_t *bucket   = NULL;
+    *over              = 0;
+
+    if (limiter->device_interval_ns)
+    {
+        bucket = device_bucket(limiter, topic, now_ns);
+        wait   = take(&bucket->tat, now_ns, limiter->device_interval_ns, limiter->device_limit_ns, max_wait);
+        if (wait > 0)
+        {
+            *over |= RATE_OVER_DEVICE;
+        }
+        if (wait > max_wait)
+        {
+            bucket = NULL;   // 未占用令牌
+        }
+    }
+    if (wait <= max_wait && limiter->rule_interval_ns)
+    {
+        long long rule_wait = take(&limiter->rule_tat, now_ns, limiter->rule_interval_ns, limiter->rule_limit_ns,
+                                   max_wait);
+        if (rule_wait > 0)
+        {
+            *over |= RATE_OVER_RULE;
+        }
+        if (rule_wait > max_wait && bucket)
+        {
+            // 规则限额不放行: 退还已占用的设备令牌
+            atomic_fetch_sub_explicit(&bucket->tat, limiter->device_interval_ns, memory_order_relaxed);
+        }
+        if (rule_wait > wait)
+        {
+            wait = rule_wait;
+        }
+    }
+
+    if (wait <= 0)
+    {
+        // 延迟的消息由定时任务发出, 到期后还可能在堆中等待一个周期; 同一设备 (未启用设备限速时为整条规则)
+        // 仍有延迟消息未发出时, 新消息排在其后, 以免先于它们发出
+        if (max_wait > 0 && atomic_load_explicit(&limiter->pending, memory_order_relaxed) > 0
+            && (!bucket || atomic_load_explicit(&bucket->delayed, memory_order_relaxed) > 0))
+        {
+            return defer(limiter, topic, payload, len, qos, retain, now_ns, now_ns, bucket) == 0 ? RATE_DELAYED
+                                                                                                : RATE_SHED;
+        }
+        return RATE_PASS;
+    }
+    if (limiter->config.policy == RATE_SHED_SAMPLE)
+    {
+        unsigned long count = atomic_fetch_add_explicit(&limiter->over_count, 1, memory_order_relaxed);
+        return count % (unsigned long)limiter->config.sample_every == 0 ? RATE_PASS : RATE_SHED;
+    }
+    if (wait > max_wait
+        || defer(limiter, topic, payload, len, qos, retain, now_ns, now_ns + wait, bucket) != 0)
+    {
+        return RATE_SHED;
+    }
+    return RATE_DELAYED;
+}
+
+// 取出堆顶 (force 时不论是否到期), 调用方持锁
+static delayed_entry_t *pop_due(rate_limiter_t *limiter, long long now_ns, bool force)
+{
+    if (limiter->heap_count == 0 || (!force && limiter->heap[0]->release_ns > now_ns))
+    {
+        return NULL;
+    }
+    delayed_entry_t *top  = limiter->heap[0];
+    delayed_entry_t *last = limiter->heap[--limiter->heap_count];
+
+    // 下沉
+    int i = 0;
+    for (;;)
+    {
+        int child = i * 2 + 1;
+        if (child >= limiter->heap_count)
+        {
+            break;
+        }
+        if (child + 1 < limiter->heap_count && entry_before(limiter->heap[child + 1], limiter->heap[child]))
+        {
+            child++;
+        }
+        if (!entry_before(limiter->heap[child], last))
+        {
+            break;
+        }
+        limiter->heap[i] = limiter->heap[child];
+        i                = child;
+    }
+    if (limiter->heap_count > 0)
+    {
+        limiter->heap[i] = last;
+    }
+    return top;
+}
+
+static void release_entries(rate_limiter_t *limiter, long long now_ns, bool force)
+{
+    if (atomic_load_explicit(&limiter->pending, memory_order_relaxed) == 0)
+    {
+        return;
+    }
+    for (;;)
+    {
+        pthread_mutex_lock(&limiter->lock);
+        delayed_entry_t *entry = pop_due(limiter, now_ns, force);
+        pthread_mutex_unlock(&limiter->lock);
+        if (!entry)
+        {
+            return;
+        }
+        atomic_fetch_sub_explicit(&limiter->pending, 1, memory_order_relaxed);
+        limiter->release(limiter->ctx, &entry->message);
+        if (entry->bucket)
+        {
+            // 发出后才减少, 发布期间到达的同一设备的消息仍排在其后
+            atomic_fetch_sub_explicit(&entry->bucket->delayed, 1, memory_order_relaxed);
+        }
+        free(entry);
+    }
+}
+
+void rate_limiter_release_due(rate_limiter_t *limiter, long long now_ns)
+{
+    release_entries(limiter, now_ns, false);
+}
+
+void rate_limiter_release_all(rate_limiter_t *limiter)
+{
+    release_entries(limiter, 0, true);
+}
+
+int rate_limiter_pending(rate_limiter_t *limiter)
+{
+    return atomic_load_explicit(&limiter->pending, memory_order_relaxed);
+}
@@ -0,0 +1,65 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "config_json.h"
+
+// 规则限速: 整条规则和每个设备 (源主题) 各一个令牌桶, 消息需两者都有令牌才放行。
+// 令牌桶以理论到达时间 (GCRA) 表示, 每个桶只有一个时间戳, 取令牌时惰性补充, 一次 CAS 完成,
+// 未超限时热路径上没有锁和内存分配。设备桶在固定大小的开放寻址表中按源主题的哈希查找,
+// 探测范围内都被占用时复用令牌已满的桶, 仍找不到时与首选槽位的设备共用一个桶 (只会更严格)。
+// 超限消息按策略丢弃、抽样放行或延迟; 延迟的消息按到期顺序在目标客户端的定时任务上交给发布函数,
+// 同一设备还有延迟消息未发出时, 未超限的新消息也排在其后, 保持设备内的顺序。
+
+// 超出的限额
+#define RATE_OVER_RULE 1u
+#define RATE_OVER_DEVICE 2u
+
+typedef enum
+{
+    RATE_PASS = 0,   // 放行 (包括抽样放行的超限消息)
+    RATE_SHED,       // 丢弃
+    RATE_DELAYED     // 已保存, 到期后交给发布函数
+} rate_verdict_t;
+
+// 延迟发出的一条消息, 字段在发布函数返回前有效
+typedef struct
+{
+    const char *topic;
+    const void *payload;
+    size_t      len;
+    int         qos;
+    bool        retain;
+    long long   received_ns;   // 进入 on_message 的时间
+} rate_delayed_t;
+
+typedef void (*rate_release_t)(void *ctx, const rate_delayed_t *message);
+
+typedef struct rate_limiter rate_limiter_t;
+
+rate_limiter_t *rate_limiter_create(const rate_limit_config_t *config, rate_release_t release, void *ctx);
+void            rate_limiter_destroy(rate_limiter_t *limiter);
+
+// 检查一条消息 (以 topic 为设备键), now_ns 为消息进入 on_message 的时间;
+// over 返回本条超出的限额 (RATE_OVER_RULE | RATE_OVER_DEVICE)
+rate_verdict_t rate_limiter_admit(rate_limiter_t *limiter,
+                                  const char     *topic,
+                                  const void     *payload,
+                                  size_t          len,
+                                  int             qos,
+                                  bool            retain,
+                                  long long       now_ns,
+                                  unsigned       *over);
+
+// 发出已到期的延迟消息, 由目标客户端的定时任务调用; 发布函数在锁外调用
+void rate_limiter_release_due(rate_limiter_t *limiter, long long now_ns);
+
+// 立即发出全部延迟消息
+void rate_limiter_release_all(rate_limiter_t *limiter);
+
+// 等待发出的延迟消息数
+int rate_limiter_pending(rate_limiter_t *limiter);
+
+#endif
@@ -0,0 +1,108 @@
+#include "rcu.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+
+// 读者记录: state 为奇数表示线程在读临界区内, 每次进入/退出加1
+typedef struct rcu_reader
+{
+    atomic_ulong       state;
+    atomic_bool        in_use;   // 已被某个线程占用
+    struct rcu_reader *next;
+} rcu_reader_t;
+
+// 读者记录只增不减 (数量以同时存在过的线程数为上限), 头插法无锁追加
+static _Atomic(rcu_reader_t *) readers = NULL;
+static _Thread_local rcu_reader_t *self = NULL;
+static pthread_key_t  reader_key;
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+
+// 线程退出时释放记录的占用, 留给新线程复用
+static void release_reader(void *arg)
+{
+    rcu_reader_t *reader = (rcu_reader_t *)arg;
+    atomic_store_explicit(&reader->in_use, false, memory_order_release);
+}
+
+static void create_reader_key(void)
+{
+    pthread_key_create(&reader_key, release_reader);
+}
+
+static rcu_reader_t *acquire_reader(void)
+{
+    pthread_once(&reader_key_once, create_reader_key);
+
+    rcu_reader_t *reader = atomic_load_explicit(&readers, memory_order_acquire);
+    for (; reader; reader = reader->next)
+    {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&reader->in_use, &expected, true))
+        {
+            break;
+        }
+    }
+
+    if (!reader)
+    {
+        reader = calloc(1, sizeof(rcu_reader_t));
+        if (!reader)
+        {
+            abort();   // 读方无法登记时不能安全地继续读取共享数据
+        }
+        atomic_init(&reader->state, 0);
+        atomic_init(&reader->in_use, true);
+        reader->next = atomic_load_explicit(&readers, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&readers, &reader->next, reader,
+                                                      memory_order_release, memory_order_relaxed))
+        {
+        }
+    }
+
+    pthread_setspecific(reader_key, reader);
+    self = reader;
+    return reader;
+}
+
+void rcu_read_lock(void)
+{
+    rcu_reader_t *reader = self ? self : acquire_reader();
+    unsigned long state  = atomic_load_explicit(&reader->state, memory_order_relaxed);
+    atomic_store_explicit(&reader->state, state + 1, memory_order_relaxed);
+    // 与 rcu_synchronize 中的屏障配对: 要么写方看到读者已进入, 要么读者读到新指针
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void rcu_read_unlock(void)
+{
+    unsigned long state = atomic_load_explicit(&self->state, memory_order_relaxed);
+    atomic_store_explicit(&self->state, state + 1, memory_order_release);
+}
+
+void rcu_synchronize(void)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+
+    for (rcu_reader_t *reader = atomic_load_explicit(&readers, memory_order_acquire); reader;
+         reader = reader->next)
+    {
+        unsigned long state = atomic_load_explicit(&reader->state, memory_order_acquire);
+        if ((state & 1) == 0)
+        {
+            continue;
+        }
+        // 读者在临界区内: 等到它退出 (state 变化即说明这一次读取已结束)
+        while (atomic_load_explicit(&reader->state, memory_order_acquire) == state)
+        {
+            struct timespec pause = {0, RCU_SYNC_POLL_US * 1000L};
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+}
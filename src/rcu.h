@@ -0,0 +1,15 @@
+#ifndef RCU_H
+#define RCU_H
+
+// 读多写少数据的无锁发布 (RCU 风格): 写方原子替换指针后调用 rcu_synchronize,
+// 等待替换前进入读临界区的线程全部退出, 之后即可释放旧数据。
+// 读方每个线程首次进入时登记一条读者记录, 之后进入/退出各只有一次原子写;
+// 线程退出时记录留给之后的新线程复用。读临界区不可嵌套, 也不能在其中等待写方。
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+// 等待调用前已进入读临界区的读者全部退出, 只能由单一写方调用
+void rcu_synchronize(void);
+
+#endif
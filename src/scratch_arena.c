@@ -0,0 +1,123 @@
+#include "scratch_arena.h"
+
+#include <cjson/cJSON.h>
+#include <stdalign.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "logger.h"
+
+#define SCRATCH_ALIGN alignof(max_align_t)
+
+static _Thread_local char         *arena_block    = NULL;
+static _Thread_local size_t        arena_capacity = 0;
+static _Thread_local size_t        arena_used     = 0;
+static _Thread_local size_t        arena_overflow = 0;  // 本条消息在内存块之外分配的字节数
+static _Thread_local int           arena_depth    = 0;
+static _Thread_local unsigned long heap_allocs    = 0;
+
+static _Thread_local char  *output_buffer   = NULL;
+static _Thread_local size_t output_capacity = 0;
+
+static int in_arena(const void *ptr)
+{
+    return arena_block && (const char *)ptr >= arena_block && (const char *)ptr < arena_block + arena_capacity;
+}
+
+static void *scratch_malloc(size_t size)
+{
+    if (arena_depth == 0)
+    {
+        return malloc(size);
+    }
+    if (!arena_block)
+    {
+        size_t capacity = arena_capacity ? arena_capacity : SCRATCH_ARENA_INITIAL_BYTES;
+        arena_block     = malloc(capacity);
+        arena_capacity  = arena_block ? capacity : 0;
+        heap_allocs++;
+    }
+
+    size_t size_aligned = (size + SCRATCH_ALIGN - 1) & ~(SCRATCH_ALIGN - 1);
+    if (arena_block && size_aligned <= arena_capacity - arena_used)
+    {
+        void *ptr = arena_block + arena_used;
+        arena_used += size_aligned;
+        return ptr;
+    }
+    arena_overflow += size_aligned;
+    heap_allocs++;
+    return malloc(size);
+}
+
+static void scratch_free(void *ptr)
+{
+    if (!in_arena(ptr))
+    {
+        free(ptr);
+    }
+}
+
+void scratch_init_hooks(void)
+{
+    cJSON_Hooks hooks = {.malloc_fn = scratch_malloc, .free_fn = scratch_free};
+    cJSON_InitHooks(&hooks);
+}
+
+void scratch_begin(void)
+{
+    arena_depth++;
+}
+
+unsigned long scratch_end(void)
+{
+    if (--arena_depth > 0)
+    {
+        return 0;
+    }
+
+    // 本条消息没有放下: 释放旧块, 下次按用量分配更大的块
+    if (arena_overflow > 0 && arena_capacity < SCRATCH_ARENA_MAX_BYTES)
+    {
+        size_t needed   = arena_used + arena_overflow;
+        size_t capacity = arena_capacity ? arena_capacity : SCRATCH_ARENA_INITIAL_BYTES;
+        while (capacity < needed && capacity < SCRATCH_ARENA_MAX_BYTES)
+        {
+            capacity *= 2;
+        }
+        free(arena_block);
+        arena_block    = NULL;
+        arena_capacity = capacity < SCRATCH_ARENA_MAX_BYTES ? capacity : SCRATCH_ARENA_MAX_BYTES;
+        LOG_DEBUG("Scratch arena grows to %zu bytes", arena_capacity);
+    }
+    arena_used     = 0;
+    arena_overflow = 0;
+
+    unsigned long allocs = heap_allocs;
+    heap_allocs          = 0;
+    return allocs;
+}
+
+char *scratch_output(size_t size)
+{
+    if (size > output_capacity)
+    {
+        size_t capacity = output_capacity ? output_capacity : 1024;
+        while (capacity < size)
+        {
+            capacity *= 2;
+        }
+        char *grown = realloc(output_buffer, capacity);
+        if (!grown)
+        {
+            return NULL;
+        }
+        output_buffer   = grown;
+        output_capacity = capacity;
+        if (arena_depth > 0)
+        {
+            heap_allocs++;
+        }
+    }
+    return output_buffer;
+}
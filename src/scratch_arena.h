@@ -0,0 +1,23 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <stddef.h>
+
+// 处理一条消息期间的线程私有临时内存。
+// scratch_begin/scratch_end 之间, cJSON 的分配从本线程的连续内存块中顺序切分, 释放为空操作,
+// scratch_end 时整体复位, 解析树、包装对象和打印缓冲区不再逐个 malloc/free。
+// 块不够用时退回 malloc, 复位时按本条消息的用量扩大内存块 (不超过 SCRATCH_ARENA_MAX_BYTES)。
+// 作用域外的 cJSON 调用 (加载配置、编译模板) 仍直接使用 malloc/free。
+
+// 安装 cJSON 的分配钩子, 须在启动其他线程前调用一次
+void scratch_init_hooks(void);
+
+// 开始/结束处理一条消息, 可以嵌套, 最外层结束时复位。
+// scratch_end 返回本次作用域内的堆分配次数 (内存块之外的分配和输出缓冲区扩大)
+void          scratch_begin(void);
+unsigned long scratch_end(void);
+
+// 线程私有输出缓冲区, 按需增长后复用; 返回的内存在本线程下一次调用前有效
+char *scratch_output(size_t size);
+
+#endif
@@ -0,0 +1,608 @@
+#include "spill_log.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "time_util.h"
+
+#define SEGMENT_NAME_FORMAT "seg-%010u.log"
+#define ACK_FILE_NAME "ack"
+#define ACK_MAGIC 0x4b434153u   // "SACK"
+
+// 记录格式: 头部 + 正文, 整体按8字节对齐; length为0表示段内数据结束
+typedef struct
+{
+    uint32_t length;   // 正文长度
+    uint32_t crc;      // 正文CRC32
+} record_header_t;
+
+typedef struct
+{
+    uint32_t payload_len;
+    uint16_t topic_len;   // 含结尾'\0'
+    uint8_t  qos;
+    uint8_t  retain;
+} record_body_t;
+
+// 确认位置: 下一条待重放记录所在的段和偏移
+typedef struct
+{
+    uint32_t magic;
+    uint32_t segment;
+    uint32_t offset;
+    uint32_t crc;
+} ack_record_t;
+
+typedef struct
+{
+    uint32_t id;
+    int      fd;
+    uint8_t *base;
+    long     records;   // 段内尚未重放的记录数
+} segment_t;
+
+struct spill_log
+{
+    pthread_mutex_t mutex;
+    spill_config_t  config;
+    segment_t      *segments;        // 按id升序, segments[0]为读取段, 最后一个为写入段
+    int             segment_count;
+    uint32_t        read_offset;     // segments[0] 中的读取位置
+    uint32_t        write_offset;    // 最后一个段中的写入位置
+    uint32_t        synced_offset;   // 写入段中已同步到磁盘的位置
+    int             unsynced;        // 自上次同步后追加的记录数
+    int             ack_dirty;
+    int             ack_fd;
+    long long       last_sync_ms;
+    atomic_long     pending;
+
+    unsigned long   appended;
+    unsigned long   replayed;
+    unsigned long   dropped;
+    unsigned long   corrupted;
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    crc              = ~crc;
+    while (len--)
+    {
+        crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t align8(uint32_t n)
+{
+    return (n + 7u) & ~7u;
+}
+
+static void segment_path(const spill_log_t *log, uint32_t id, char *path, size_t size)
+{
+    char name[32];
+    snprintf(name, sizeof(name), SEGMENT_NAME_FORMAT, id);
+    snprintf(path, size, "%s/%s", log->config.dir, name);
+}
+
+static int map_segment(spill_log_t *log, segment_t *segment, int create)
+{
+    char path[512];
+    segment_path(log, segment->id, path, sizeof(path));
+
+    segment->fd = open(path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0600);
+    if (segment->fd < 0)
+    {
+        LOG_ERROR("Cannot open spill segment %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if (create)
+    {
+        // 预分配磁盘空间, 避免写入mmap时因磁盘满触发SIGBUS
+        int err = posix_fallocate(segment->fd, 0, log->config.segment_bytes);
+        if (err != 0)
+        {
+            LOG_ERROR("Cannot allocate spill segment %s: %s", path, strerror(err));
+            close(segment->fd);
+            unlink(path);
+            return -1;
+        }
+    }
+    else
+    {
+        struct stat st;
+        if (fstat(segment->fd, &st) != 0 || st.st_size != log->config.segment_bytes)
+        {
+            LOG_ERROR("Spill segment %s has unexpected size, skipping", path);
+            close(segment->fd);
+            return -1;
+        }
+    }
+
+    segment->base = mmap(NULL, log->config.segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (segment->base == MAP_FAILED)
+    {
+        LOG_ERROR("Cannot map spill segment %s: %s", path, strerror(errno));
+        close(segment->fd);
+        return -1;
+    }
+    segment->records = 0;
+    return 0;
+}
+
+static void unmap_segment(spill_log_t *log, segment_t *segment, int remove)
+{
+    munmap(segment->base, log->config.segment_bytes);
+    close(segment->fd);
+    if (remove)
+    {
+        char path[512];
+        segment_path(log, segment->id, path, sizeof(path));
+        unlink(path);
+    }
+}
+
+static void write_ack(spill_log_t *log)
+{
+    if (log->ack_fd < 0 || !log->ack_dirty)
+    {
+        return;
+    }
+
+    ack_record_t ack = {ACK_MAGIC, 0, 0, 0};
+    if (log->segment_count > 0)
+    {
+        ack.segment = log->segments[0].id;
+        ack.offset  = log->read_offset;
+    }
+    ack.crc = crc32_update(0, &ack, offsetof(ack_record_t, crc));
+    if (pwrite(log->ack_fd, &ack, sizeof(ack), 0) != (ssize_t)sizeof(ack))
+    {
+        LOG_ERROR("Failed to write spill ack in %s: %s", log->config.dir, strerror(errno));
+        return;
+    }
+    fdatasync(log->ack_fd);
+    log->ack_dirty = 0;
+}
+
+// 删除读取段 (已读完或因保留上限被淘汰), 返回其中未重放的记录数
+static long drop_first_segment(spill_log_t *log)
+{
+    long lost = log->segments[0].records;
+    unmap_segment(log, &log->segments[0], 1);
+    memmove(&log->segments[0], &log->segments[1], sizeof(segment_t) * (log->segment_count - 1));
+    log->segment_count--;
+    log->read_offset = 0;
+    log->ack_dirty   = 1;
+    if (lost > 0)
+    {
+        atomic_fetch_sub(&log->pending, lost);
+    }
+    return lost;
+}
+
+static void sync_data(spill_log_t *log)
+{
+    if (log->segment_count == 0 || log->unsynced == 0)
+    {
+        return;
+    }
+
+    segment_t *segment = &log->segments[log->segment_count - 1];
+    long       page    = sysconf(_SC_PAGESIZE);
+    uint32_t   start   = log->synced_offset & ~(uint32_t)(page - 1);
+    msync(segment->base + start, log->write_offset - start, MS_SYNC);
+    log->synced_offset = log->write_offset;
+    log->unsynced      = 0;
+}
+
+// 扫描段内有效记录, 返回数据结束位置
+static uint32_t scan_segment(spill_log_t *log, segment_t *segment, uint32_t offset)
+{
+    uint32_t size = (uint32_t)log->config.segment_bytes;
+    while (offset + sizeof(record_header_t) <= size)
+    {
+        record_header_t header;
+        memcpy(&header, segment->base + offset, sizeof(header));
+        if (header.length < sizeof(record_body_t)
+            || header.length > size - offset - sizeof(record_header_t)
+            || crc32_update(0, segment->base + offset + sizeof(header), header.length) != header.crc)
+        {
+            break;
+        }
+        segment->records++;
+        offset += align8(sizeof(record_header_t) + header.length);
+    }
+    return offset;
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static int recover(spill_log_t *log)
+{
+    // 读取确认位置
+    ack_record_t ack;
+    int          ack_valid = 0;
+    if (pread(log->ack_fd, &ack, sizeof(ack), 0) == (ssize_t)sizeof(ack) && ack.magic == ACK_MAGIC
+        && ack.crc == crc32_update(0, &ack, offsetof(ack_record_t, crc)))
+    {
+        ack_valid = 1;
+    }
+
+    DIR *dir = opendir(log->config.dir);
+    if (!dir)
+    {
+        LOG_ERROR("Cannot open spill directory %s: %s", log->config.dir, strerror(errno));
+        return -1;
+    }
+
+    uint32_t      *ids      = NULL;
+    int            id_count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        unsigned int id;
+        char         check[32];
+        if (sscanf(entry->d_name, "seg-%10u.log", &id) != 1)
+        {
+            continue;
+        }
+        snprintf(check, sizeof(check), SEGMENT_NAME_FORMAT, id);
+        if (strcmp(check, entry->d_name) != 0)
+        {
+            continue;
+        }
+        uint32_t *grown = realloc(ids, sizeof(uint32_t) * (id_count + 1));
+        if (!grown)
+        {
+            break;
+        }
+        ids           = grown;
+        ids[id_count++] = id;
+    }
+    closedir(dir);
+    if (id_count > 1)
+    {
+        qsort(ids, id_count, sizeof(uint32_t), compare_ids);
+    }
+
+    log->segments = calloc(id_count + 1, sizeof(segment_t));
+    if (!log->segments)
+    {
+        free(ids);
+        return -1;
+    }
+
+    for (int i = 0; i < id_count; i++)
+    {
+        segment_t segment = {.id = ids[i]};
+        if (ack_valid && ids[i] < ack.segment)
+        {
+            // 已全部确认的段
+            char path[512];
+            segment_path(log, ids[i], path, sizeof(path));
+            unlink(path);
+            continue;
+        }
+        if (map_segment(log, &segment, 0) != 0)
+        {
+            continue;
+        }
+
+        uint32_t start = 0;
+        if (log->segment_count == 0 && ack_valid && ids[i] == ack.segment)
+        {
+            start            = ack.offset;
+            log->read_offset = ack.offset;
+        }
+        log->write_offset = scan_segment(log, &segment, start);
+        log->segments[log->segment_count++] = segment;
+        atomic_fetch_add(&log->pending, segment.records);
+    }
+    free(ids);
+
+    log->synced_offset = log->write_offset;
+    log->ack_dirty     = 1;
+    write_ack(log);
+
+    if (atomic_load(&log->pending) > 0)
+    {
+        LOG_INFO("Recovered %ld spilled messages from %s (%d segments)",
+                 atomic_load(&log->pending), log->config.dir, log->segment_count);
+    }
+    return 0;
+}
+
+spill_log_t *spill_log_open(const spill_config_t *config)
+{
+    pthread_once(&crc_once, crc_init);
+
+    spill_log_t *log = calloc(1, sizeof(spill_log_t));
+    if (!log)
+    {
+        return NULL;
+    }
+    log->config = *config;
+    log->ack_fd = -1;
+    pthread_mutex_init(&log->mutex, NULL);
+
+    if (mkdir(config->dir, 0700) != 0 && errno != EEXIST)
+    {
+        LOG_ERROR("Cannot create spill directory %s: %s", config->dir, strerror(errno));
+        spill_log_close(log);
+        return NULL;
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", config->dir, ACK_FILE_NAME);
+    log->ack_fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (log->ack_fd < 0)
+    {
+        LOG_ERROR("Cannot open spill ack file %s: %s", path, strerror(errno));
+        spill_log_close(log);
+        return NULL;
+    }
+
+    if (recover(log) != 0)
+    {
+        spill_log_close(log);
+        return NULL;
+    }
+    log->last_sync_ms = monotonic_ms();
+    return log;
+}
+
+void spill_log_close(spill_log_t *log)
+{
+    if (!log)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&log->mutex);
+    sync_data(log);
+    write_ack(log);
+    for (int i = 0; i < log->segment_count; i++)
+    {
+        unmap_segment(log, &log->segments[i], 0);
+    }
+    pthread_mutex_unlock(&log->mutex);
+
+    if (log->ack_fd >= 0)
+    {
+        close(log->ack_fd);
+    }
+    free(log->segments);
+    pthread_mutex_destroy(&log->mutex);
+    free(log);
+}
+
+// 创建新的写入段, 超出保留上限时淘汰最旧的段
+static int rotate(spill_log_t *log)
+{
+    if (log->segment_count > 0)
+    {
+        // 旧写入段完整落盘
+        sync_data(log);
+        msync(log->segments[log->segment_count - 1].base, log->config.segment_bytes, MS_SYNC);
+    }
+
+    while (log->segment_count >= log->config.max_segments)
+    {
+        long lost = drop_first_segment(log);
+        log->dropped += lost;
+        LOG_ERROR("Spill log %s reached %d segments, dropped %ld oldest messages",
+                  log->config.dir, log->config.max_segments, lost);
+    }
+
+    segment_t *grown = realloc(log->segments, sizeof(segment_t) * (log->segment_count + 1));
+    if (!grown)
+    {
+        return -1;
+    }
+    log->segments = grown;
+
+    segment_t segment = {.id = log->segment_count > 0 ? log->segments[log->segment_count - 1].id + 1 : 1};
+    if (map_segment(log, &segment, 1) != 0)
+    {
+        return -1;
+    }
+    log->segments[log->segment_count++] = segment;
+    if (log->segment_count == 1)
+    {
+        log->read_offset = 0;
+        log->ack_dirty   = 1;
+    }
+    log->write_offset  = 0;
+    log->synced_offset = 0;
+    return 0;
+}
+
+int spill_log_append(spill_log_t *log,
+                     const char  *topic,
+                     const void  *payload,
+                     int          payloadlen,
+                     int          qos,
+                     int          retain)
+{
+    size_t topic_len = strlen(topic) + 1;
+    if (topic_len > UINT16_MAX)
+    {
+        return -1;
+    }
+
+    uint32_t body_len = (uint32_t)(sizeof(record_body_t) + topic_len + (size_t)payloadlen);
+    uint32_t need     = align8(sizeof(record_header_t) + body_len);
+
+    pthread_mutex_lock(&log->mutex);
+    if (need > log->config.segment_bytes)
+    {
+        log->dropped++;
+        pthread_mutex_unlock(&log->mutex);
+        return -1;
+    }
+
+    if (log->segment_count == 0 || log->write_offset + need > log->config.segment_bytes)
+    {
+        if (rotate(log) != 0)
+        {
+            log->dropped++;
+            pthread_mutex_unlock(&log->mutex);
+            return -1;
+        }
+    }
+
+    segment_t     *segment = &log->segments[log->segment_count - 1];
+    uint8_t       *dest    = segment->base + log->write_offset;
+    record_body_t  body    = {(uint32_t)payloadlen, (uint16_t)topic_len, (uint8_t)qos, (uint8_t)retain};
+    uint8_t       *p       = dest + sizeof(record_header_t);
+    memcpy(p, &body, sizeof(body));
+    memcpy(p + sizeof(body), topic, topic_len);
+    memcpy(p + sizeof(body) + topic_len, payload, (size_t)payloadlen);
+
+    record_header_t header = {body_len, crc32_update(0, p, body_len)};
+    memcpy(dest, &header, sizeof(header));
+
+    log->write_offset += need;
+    segment->records++;
+    log->appended++;
+    atomic_fetch_add(&log->pending, 1);
+
+    if (++log->unsynced >= log->config.fsync_every)
+    {
+        sync_data(log);
+        log->last_sync_ms = monotonic_ms();
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return 0;
+}
+
+int spill_log_replay(spill_log_t *log, int max_records, spill_publish_fn publish, void *ctx)
+{
+    int replayed = 0;
+
+    pthread_mutex_lock(&log->mutex);
+    while (replayed < max_records && log->segment_count > 0)
+    {
+        segment_t *segment  = &log->segments[0];
+        int        is_write = log->segment_count == 1;
+        uint32_t   limit    = is_write ? log->write_offset : (uint32_t)log->config.segment_bytes;
+
+        record_header_t header = {0, 0};
+        if (log->read_offset + sizeof(record_header_t) <= limit)
+        {
+            memcpy(&header, segment->base + log->read_offset, sizeof(header));
+        }
+
+        if (header.length == 0 || header.length > limit - log->read_offset - sizeof(record_header_t))
+        {
+            // 段内数据读完
+            if (is_write)
+            {
+                break;
+            }
+            drop_first_segment(log);
+            continue;
+        }
+
+        const uint8_t *p = segment->base + log->read_offset + sizeof(record_header_t);
+        if (header.length < sizeof(record_body_t) || crc32_update(0, p, header.length) != header.crc)
+        {
+            // 记录损坏, 段内后续数据不可信, 跳过整个段
+            LOG_ERROR("Corrupted record in spill log %s segment %u at offset %u",
+                      log->config.dir, segment->id, log->read_offset);
+            log->corrupted++;
+            log->dropped += segment->records;
+            if (is_write)
+            {
+                atomic_fetch_sub(&log->pending, segment->records);
+                segment->records  = 0;
+                log->read_offset  = log->write_offset;
+                log->ack_dirty    = 1;
+                break;
+            }
+            drop_first_segment(log);
+            continue;
+        }
+
+        record_body_t body;
+        memcpy(&body, p, sizeof(body));
+        const char *topic   = (const char *)(p + sizeof(body));
+        const void *payload = p + sizeof(body) + body.topic_len;
+        if (publish(ctx, topic, payload, (int)body.payload_len, body.qos, body.retain) != 0)
+        {
+            break;
+        }
+
+        log->read_offset += align8(sizeof(record_header_t) + header.length);
+        segment->records--;
+        log->replayed++;
+        log->ack_dirty = 1;
+        atomic_fetch_sub(&log->pending, 1);
+        replayed++;
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return replayed;
+}
+
+void spill_log_sync(spill_log_t *log, long long now_ms)
+{
+    pthread_mutex_lock(&log->mutex);
+    if (now_ms - log->last_sync_ms >= log->config.fsync_interval_ms)
+    {
+        sync_data(log);
+        write_ack(log);
+        log->last_sync_ms = now_ms;
+    }
+    pthread_mutex_unlock(&log->mutex);
+}
+
+long spill_log_pending(spill_log_t *log)
+{
+    return atomic_load_explicit(&log->pending, memory_order_acquire);
+}
+
+void spill_log_stats(spill_log_t *log, spill_stats_t *stats)
+{
+    pthread_mutex_lock(&log->mutex);
+    stats->appended  = log->appended;
+    stats->replayed  = log->replayed;
+    stats->dropped   = log->dropped;
+    stats->corrupted = log->corrupted;
+    stats->pending   = atomic_load(&log->pending);
+    stats->segments  = log->segment_count;
+    pthread_mutex_unlock(&log->mutex);
+}
@@ -0,0 +1,53 @@
+#ifndef SPILL_LOG_H
+#define SPILL_LOG_H
+
+#include <stdatomic.h>
+
+#include "config_json.h"
+
+// 目标客户端的磁盘溢出日志: 追加写入的分段文件 (mmap), 每条记录带CRC,
+// 记录确认位置持久化到 ack 文件, 重启后从上次确认的位置继续重放。
+//
+// 追加来自各业务线程, 重放和同步由主循环执行, 内部用互斥锁串行化。
+
+typedef struct spill_log spill_log_t;
+
+// 重放回调, 返回0表示已发出 (记录被确认), 非0表示稍后重试
+typedef int (*spill_publish_fn)(void       *ctx,
+                                const char *topic,
+                                const void *payload,
+                                int         payloadlen,
+                                int         qos,
+                                int         retain);
+
+typedef struct
+{
+    unsigned long appended;
+    unsigned long replayed;
+    unsigned long dropped;     // 超出保留上限或无法写入而丢弃的记录
+    unsigned long corrupted;   // CRC校验失败而跳过的段
+    long          pending;
+    int           segments;
+} spill_stats_t;
+
+// 打开 (必要时创建) 日志目录并恢复未确认的记录
+spill_log_t *spill_log_open(const spill_config_t *config);
+void         spill_log_close(spill_log_t *log);
+
+int spill_log_append(spill_log_t *log,
+                     const char  *topic,
+                     const void  *payload,
+                     int          payloadlen,
+                     int          qos,
+                     int          retain);
+
+// 按顺序重放最多 max_records 条, 返回成功重放的条数
+int spill_log_replay(spill_log_t *log, int max_records, spill_publish_fn publish, void *ctx);
+
+// 批量同步数据和确认位置 (达到条数或时间间隔时)
+void spill_log_sync(spill_log_t *log, long long now_ms);
+
+long spill_log_pending(spill_log_t *log);
+void spill_log_stats(spill_log_t *log, spill_stats_t *stats);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef TIME_UTIL_H
+#define TIME_UTIL_H
+
+#include <time.h>
+
+// 单调时钟 (毫秒), 用于限速和超时计算, 不受系统时间调整影响
+static inline long long monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 单调时钟 (纳秒), 用于延迟统计
+static inline long long monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 系统时间 (Unix 毫秒), 用于消息中的时间戳
+static inline long long realtime_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#endif
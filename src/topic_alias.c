@@ -0,0 +1,270 @@
+#include "topic_alias.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+#define NIL (-1)
+
+typedef struct
+{
+    char        *topic;       // NULL 表示空闲
+    unsigned int hash;
+    int          hash_next;
+    int          prev;        // 最近使用顺序, head 最久未用
+    int          next;
+} alias_entry_t;
+
+struct topic_alias
+{
+    pthread_mutex_t     lock;
+    alias_entry_t      *entries;     // 下标+1 即别名
+    int                *buckets;
+    unsigned int        mask;
+    int                *free_slots;  // 空闲下标栈
+    int                 free_count;
+    int                 capacity;
+    int                 maximum;
+    int                 head;
+    int                 tail;
+    unsigned int        window;      // 最近的查找数和命中数, 每 TOPIC_ALIAS_WINDOW 次减半
+    unsigned int        window_hits;
+    unsigned int        admit_countdown;
+    topic_alias_stats_t stats;
+};
+
+static unsigned int topic_hash(const char *topic)
+{
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)topic; *p; p++)
+    {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+topic_alias_t *topic_alias_create(int capacity)
+{
+    topic_alias_t *aliases = calloc(1, sizeof(topic_alias_t));
+    if (!aliases)
+    {
+        return NULL;
+    }
+    unsigned int buckets = 16;
+    while (buckets < (unsigned int)capacity * 2)
+    {
+        buckets *= 2;
+    }
+    aliases->entries    = calloc((size_t)capacity, sizeof(alias_entry_t));
+    aliases->free_slots = malloc(sizeof(int) * (size_t)capacity);
+    aliases->buckets    = malloc(sizeof(int) * buckets);
+    if (!aliases->entries || !aliases->free_slots || !aliases->buckets)
+    {
+        free(aliases->entries);
+        free(aliases->free_slots);
+        free(aliases->buckets);
+        free(aliases);
+        return NULL;
+    }
+    pthread_mutex_init(&aliases->lock, NULL);
+    aliases->capacity = capacity;
+    aliases->mask     = buckets - 1;
+    topic_alias_reset(aliases, 0);
+    return aliases;
+}
+
+static void clear_entries(topic_alias_t *aliases)
+{
+    for (int i = 0; i < aliases->capacity; i++)
+    {
+        free(aliases->entries[i].topic);
+        aliases->entries[i].topic = NULL;
+    }
+}
+
+void topic_alias_destroy(topic_alias_t *aliases)
+{
+    if (!aliases)
+    {
+        return;
+    }
+    clear_entries(aliases);
+    pthread_mutex_destroy(&aliases->lock);
+    free(aliases->entries);
+    free(aliases->free_slots);
+    free(aliases->buckets);
+    free(aliases);
+}
+
+void topic_alias_reset(topic_alias_t *aliases, int maximum)
+{
+    pthread_mutex_lock(&aliases->lock);
+    clear_entries(aliases);
+    for (unsigned int i = 0; i <= aliases->mask; i++)
+    {
+        aliases->buckets[i] = NIL;
+    }
+    aliases->maximum    = maximum < aliases->capacity ? maximum : aliases->capacity;
+    aliases->free_count = 0;
+    for (int i = aliases->maximum - 1; i >= 0; i--)
+    {
+        aliases->free_slots[aliases->free_count++] = i;
+    }
+    aliases->head        = NIL;
+    aliases->tail        = NIL;
+    aliases->window      = 0;
+    aliases->window_hits = 0;
+    pthread_mutex_unlock(&aliases->lock);
+}
+
+void topic_alias_lock(topic_alias_t *aliases)
+{
+    pthread_mutex_lock(&aliases->lock);
+}
+
+void topic_alias_unlock(topic_alias_t *aliases)
+{
+    pthread_mutex_unlock(&aliases->lock);
+}
+
+static void lru_remove(topic_alias_t *aliases, int i)
+{
+    alias_entry_t *entry = &aliases->entries[i];
+    if (entry->prev != NIL)
+    {
+        aliases->entries[entry->prev].next = entry->next;
+    }
+    else
+    {
+        aliases->head = entry->next;
+    }
+    if (entry->next != NIL)
+    {
+        aliases->entries[entry->next].prev = entry->prev;
+    }
+    else
+    {
+        aliases->tail = entry->prev;
+    }
+}
+
+static void lru_append(topic_alias_t *aliases, int i)
+{
+    alias_entry_t *entry = &aliases->entries[i];
+    entry->prev          = aliases->tail;
+    entry->next          = NIL;
+    if (aliases->tail != NIL)
+    {
+        aliases->entries[aliases->tail].next = i;
+    }
+    else
+    {
+        aliases->head = i;
+    }
+    aliases->tail = i;
+}
+
+// 从哈希表和使用顺序中移除, 下标放回空闲栈
+static void release_entry(topic_alias_t *aliases, int i)
+{
+    alias_entry_t *entry = &aliases->entries[i];
+    int           *slot  = &aliases->buckets[entry->hash & aliases->mask];
+    while (*slot != i)
+    {
+        slot = &aliases->entries[*slot].hash_next;
+    }
+    *slot = entry->hash_next;
+    lru_remove(aliases, i);
+    free(entry->topic);
+    entry->topic                               = NULL;
+    aliases->free_slots[aliases->free_count++] = i;
+}
+
+// 表满时是否让未命中的主题替换最久未用的别名: 命中率低于一半时只放行少数, 保护仍在使用的别名
+static bool admit_miss(topic_alias_t *aliases)
+{
+    if (aliases->free_count > 0 || aliases->window_hits * 2 >= aliases->window)
+    {
+        return true;
+    }
+    if (aliases->admit_countdown > 0)
+    {
+        aliases->admit_countdown--;
+        return false;
+    }
+    aliases->admit_countdown = TOPIC_ALIAS_THRASH_ADMIT - 1;
+    return true;
+}
+
+int topic_alias_lookup(topic_alias_t *aliases, const char *topic, bool *known)
+{
+    *known = false;
+    if (aliases->maximum == 0 || strlen(topic) < TOPIC_ALIAS_MIN_TOPIC)
+    {
+        return 0;
+    }
+    if (++aliases->window > TOPIC_ALIAS_WINDOW)
+    {
+        aliases->window /= 2;
+        aliases->window_hits /= 2;
+    }
+
+    unsigned int hash = topic_hash(topic);
+    for (int i = aliases->buckets[hash & aliases->mask]; i != NIL; i = aliases->entries[i].hash_next)
+    {
+        alias_entry_t *entry = &aliases->entries[i];
+        if (entry->hash == hash && strcmp(entry->topic, topic) == 0)
+        {
+            lru_remove(aliases, i);
+            lru_append(aliases, i);
+            aliases->window_hits++;
+            aliases->stats.hits++;
+            *known = true;
+            return i + 1;
+        }
+    }
+
+    if (!admit_miss(aliases))
+    {
+        return 0;
+    }
+    char *copy = strdup(topic);
+    if (!copy)
+    {
+        return 0;
+    }
+    if (aliases->free_count == 0)
+    {
+        release_entry(aliases, aliases->head);
+        aliases->stats.evicted++;
+    }
+    int            i     = aliases->free_slots[--aliases->free_count];
+    alias_entry_t *entry = &aliases->entries[i];
+    int           *slot  = &aliases->buckets[hash & aliases->mask];
+    entry->topic         = copy;
+    entry->hash          = hash;
+    entry->hash_next     = *slot;
+    *slot                = i;
+    lru_append(aliases, i);
+    aliases->stats.assigned++;
+    return i + 1;
+}
+
+void topic_alias_cancel(topic_alias_t *aliases, int alias)
+{
+    int i = alias - 1;
+    if (i >= 0 && i < aliases->maximum && aliases->entries[i].topic)
+    {
+        release_entry(aliases, i);
+        aliases->stats.assigned--;
+    }
+}
+
+void topic_alias_stats(topic_alias_t *aliases, topic_alias_stats_t *stats)
+{
+    pthread_mutex_lock(&aliases->lock);
+    *stats = aliases->stats;
+    pthread_mutex_unlock(&aliases->lock);
+}
@@ -0,0 +1,39 @@
+#ifndef TOPIC_ALIAS_H
+#define TOPIC_ALIAS_H
+
+#include <stdbool.h>
+
+// 出站主题别名 (MQTT v5): 每个目标连接一张按最近使用淘汰的表, 主题 -> 别名 (1..上限)。
+// 上限取 Broker 在 CONNACK 中给出的 Topic Alias Maximum 与配置的较小者, 连接断开时清空。
+// 建立别名的发布 (带主题) 必须先于只带别名的发布到达 Broker, 调用方持锁完成查找和 mosquitto_publish_v5,
+// 使 libmosquitto 发送队列中的顺序与分配顺序一致。
+// 表满且命中率低 (设备数远多于别名数) 时大部分未命中的主题不再抢占别名, 避免每条消息都换别名。
+
+typedef struct
+{
+    unsigned long hits;       // 省略了主题的发布
+    unsigned long assigned;   // 新建立的别名
+    unsigned long evicted;    // 被新主题替换的别名
+} topic_alias_stats_t;
+
+typedef struct topic_alias topic_alias_t;
+
+// capacity 为配置的上限, 连接建立前上限为0 (不使用别名)
+topic_alias_t *topic_alias_create(int capacity);
+void           topic_alias_destroy(topic_alias_t *aliases);
+
+// 清空并设置新连接的上限 (不超过 capacity), 0表示不使用别名
+void topic_alias_reset(topic_alias_t *aliases, int maximum);
+
+void topic_alias_lock(topic_alias_t *aliases);
+void topic_alias_unlock(topic_alias_t *aliases);
+
+// 持锁调用: 返回主题的别名, 0表示不使用别名; *known 为 true 时 Broker 已知该别名, 发布可省略主题
+int topic_alias_lookup(topic_alias_t *aliases, const char *topic, bool *known);
+
+// 持锁调用: 刚分配的别名未能发出时撤销, 下次重新建立
+void topic_alias_cancel(topic_alias_t *aliases, int alias);
+
+void topic_alias_stats(topic_alias_t *aliases, topic_alias_stats_t *stats);
+
+#endif
@@ -0,0 +1,327 @@
+#include "topic_rewrite.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "logger.h"
+
+typedef enum
+{
+    PIECE_LITERAL = 0,
+    PIECE_LEVEL,    // 源主题的一个层级 ('+' 匹配的内容)
+    PIECE_TAIL      // 源主题从某层级开始的剩余部分 ('#' 匹配的内容)
+} piece_kind_t;
+
+typedef struct
+{
+    piece_kind_t kind;
+    int          level;
+    size_t       offset;   // 字面片段在 literals 中的位置
+    size_t       len;
+} piece_t;
+
+// 源过滤器中的通配符
+typedef struct
+{
+    char kind;   // '+' 或 '#'
+    int  level;
+} wildcard_t;
+
+struct topic_rewrite
+{
+    int      identity;
+    piece_t *pieces;
+    int      piece_count;
+    char    *literals;
+    size_t   literal_len;
+    int      captures;    // 层级/尾部片段数, 用于计算输出长度上界
+    int      max_level;   // 需要定位的最大层级
+};
+
+// 线程私有输出缓冲区, 按需增长后复用
+static _Thread_local char  *output_buffer   = NULL;
+static _Thread_local size_t output_capacity = 0;
+
+static char *reserve_output(size_t size)
+{
+    if (size > output_capacity)
+    {
+        size_t capacity = output_capacity ? output_capacity : 256;
+        while (capacity < size)
+        {
+            capacity *= 2;
+        }
+        char *grown = realloc(output_buffer, capacity);
+        if (!grown)
+        {
+            return NULL;
+        }
+        output_buffer   = grown;
+        output_capacity = capacity;
+    }
+    return output_buffer;
+}
+
+// 收集源过滤器中的通配符, 通配符过多或层级过深时返回-1
+static int scan_wildcards(const char *filter, wildcard_t *wildcards, int *count)
+{
+    int level = 0;
+    *count    = 0;
+    for (const char *p = filter; *p; p++)
+    {
+        if (*p == '/')
+        {
+            level++;
+        }
+        else if ((*p == '+' || *p == '#') && (p == filter || p[-1] == '/') && (p[1] == '/' || !p[1]))
+        {
+            if (*count >= TOPIC_REWRITE_MAX_LEVELS || level >= TOPIC_REWRITE_MAX_LEVELS)
+            {
+                return -1;
+            }
+            wildcards[(*count)++] = (wildcard_t){.kind = *p, .level = level};
+        }
+    }
+    return 0;
+}
+
+static void add_literal(topic_rewrite_t *rewrite, const char *data, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    piece_t *last = rewrite->piece_count > 0 ? &rewrite->pieces[rewrite->piece_count - 1] : NULL;
+    memcpy(rewrite->literals + rewrite->literal_len, data, len);
+    if (last && last->kind == PIECE_LITERAL)
+    {
+        last->len += len;
+    }
+    else
+    {
+        rewrite->pieces[rewrite->piece_count++] = (piece_t){
+            .kind = PIECE_LITERAL, .offset = rewrite->literal_len, .len = len};
+    }
+    rewrite->literal_len += len;
+}
+
+static void add_capture(topic_rewrite_t *rewrite, const wildcard_t *wildcard)
+{
+    rewrite->pieces[rewrite->piece_count++] = (piece_t){
+        .kind = wildcard->kind == '#' ? PIECE_TAIL : PIECE_LEVEL, .level = wildcard->level};
+    rewrite->captures++;
+    if (wildcard->level > rewrite->max_level)
+    {
+        rewrite->max_level = wildcard->level;
+    }
+}
+
+// 第 nth 个指定类型的通配符
+static const wildcard_t *find_wildcard(const wildcard_t *wildcards, int count, char kind, int nth)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (wildcards[i].kind == kind && nth-- == 0)
+        {
+            return &wildcards[i];
+        }
+    }
+    return NULL;
+}
+
+// 编译一个目标层级中的字面内容和 {N} 引用
+static int compile_level(topic_rewrite_t *rewrite, const wildcard_t *wildcards, int count,
+                         const char *p, const char *end)
+{
+    const char *literal = p;
+    while (p < end)
+    {
+        if (*p != '{' || p + 2 >= end || p[1] < '0' || p[1] > '9')
+        {
+            p++;
+            continue;
+        }
+
+        const char *close = p + 1;
+        int         index = 0;
+        while (close < end && *close >= '0' && *close <= '9' && index <= TOPIC_REWRITE_MAX_LEVELS)
+        {
+            index = index * 10 + (*close++ - '0');
+        }
+        if (close >= end || *close != '}')
+        {
+            p++;
+            continue;
+        }
+        if (index < 1 || index > count)
+        {
+            return -1;
+        }
+
+        add_literal(rewrite, literal, (size_t)(p - literal));
+        add_capture(rewrite, &wildcards[index - 1]);
+        p       = close + 1;
+        literal = p;
+    }
+    add_literal(rewrite, literal, (size_t)(p - literal));
+    return 0;
+}
+
+static int compile_target(topic_rewrite_t *rewrite, const wildcard_t *wildcards, int count, const char *target)
+{
+    int         plus_seen = 0;
+    const char *p         = target;
+    while (*p)
+    {
+        const char *level_end = strchr(p, '/');
+        if (!level_end)
+        {
+            level_end = p + strlen(p);
+        }
+
+        if (level_end - p == 1 && (*p == '+' || *p == '#'))
+        {
+            const wildcard_t *wildcard = find_wildcard(wildcards, count, *p, *p == '+' ? plus_seen++ : 0);
+            if (!wildcard)
+            {
+                return -1;
+            }
+            add_capture(rewrite, wildcard);
+        }
+        else if (compile_level(rewrite, wildcards, count, p, level_end) != 0)
+        {
+            return -1;
+        }
+
+        if (*level_end == '/')
+        {
+            add_literal(rewrite, "/", 1);
+            level_end++;
+        }
+        p = level_end;
+    }
+    return 0;
+}
+
+topic_rewrite_t *topic_rewrite_compile(const char *source_filter, const char *target_topic)
+{
+    topic_rewrite_t *rewrite = calloc(1, sizeof(topic_rewrite_t));
+    if (!rewrite)
+    {
+        return NULL;
+    }
+    if (strcmp(source_filter, target_topic) == 0)
+    {
+        rewrite->identity = 1;
+        return rewrite;
+    }
+
+    wildcard_t wildcards[TOPIC_REWRITE_MAX_LEVELS];
+    int        count;
+    if (scan_wildcards(source_filter, wildcards, &count) != 0)
+    {
+        LOG_ERROR("Source topic %s has too many levels to rewrite (max %d)",
+                  source_filter, TOPIC_REWRITE_MAX_LEVELS);
+        topic_rewrite_free(rewrite);
+        return NULL;
+    }
+
+    // 每个片段至少对应目标主题中的一个字符, 字面内容是目标主题的子集
+    size_t len        = strlen(target_topic);
+    rewrite->pieces   = malloc(sizeof(piece_t) * (len + 1));
+    rewrite->literals = malloc(len + 1);
+    if (!rewrite->pieces || !rewrite->literals)
+    {
+        topic_rewrite_free(rewrite);
+        return NULL;
+    }
+
+    if (compile_target(rewrite, wildcards, count, target_topic) != 0)
+    {
+        LOG_ERROR("Target topic %s references a wildcard not present in source topic %s",
+                  target_topic, source_filter);
+        topic_rewrite_free(rewrite);
+        return NULL;
+    }
+    return rewrite;
+}
+
+void topic_rewrite_free(topic_rewrite_t *rewrite)
+{
+    if (!rewrite)
+    {
+        return;
+    }
+    free(rewrite->pieces);
+    free(rewrite->literals);
+    free(rewrite);
+}
+
+const char *topic_rewrite_apply(const topic_rewrite_t *rewrite, const char *topic)
+{
+    if (rewrite->identity)
+    {
+        return topic;
+    }
+
+    // 定位所需层级的起始位置, levels 为已定位的层级数
+    size_t      starts[TOPIC_REWRITE_MAX_LEVELS + 1];
+    int         levels = 1;
+    const char *slash  = topic;
+    starts[0]          = 0;
+    while (levels <= rewrite->max_level && (slash = strchr(slash, '/')) != NULL)
+    {
+        starts[levels++] = (size_t)(++slash - topic);
+    }
+
+    size_t topic_len = strlen(topic);
+    char  *buffer    = reserve_output(rewrite->literal_len + (size_t)rewrite->captures * topic_len + 1);
+    if (!buffer)
+    {
+        return NULL;
+    }
+
+    char *p = buffer;
+    for (int i = 0; i < rewrite->piece_count; i++)
+    {
+        const piece_t *piece = &rewrite->pieces[i];
+        switch (piece->kind)
+        {
+        case PIECE_LITERAL:
+            memcpy(p, rewrite->literals + piece->offset, piece->len);
+            p += piece->len;
+            break;
+        case PIECE_LEVEL:
+        {
+            if (piece->level >= levels)
+            {
+                return NULL;
+            }
+            const char *start = topic + starts[piece->level];
+            const char *end   = strchr(start, '/');
+            size_t      len   = end ? (size_t)(end - start) : topic_len - starts[piece->level];
+            memcpy(p, start, len);
+            p += len;
+            break;
+        }
+        case PIECE_TAIL:
+            if (piece->level < levels)
+            {
+                memcpy(p, topic + starts[piece->level], topic_len - starts[piece->level]);
+                p += topic_len - starts[piece->level];
+            }
+            else if (p > buffer && p[-1] == '/')
+            {
+                p--;   // '#' 匹配零层
+            }
+            break;
+        }
+    }
+    if (p == buffer)
+    {
+        return NULL;
+    }
+    *p = '\0';
+    return buffer;
+}
@@ -0,0 +1,22 @@
+#ifndef TOPIC_REWRITE_H
+#define TOPIC_REWRITE_H
+
+// 目标主题改写: 规则的 target_topic 中可以引用 source_topic 通配符匹配到的内容,
+// 启动时编译为 "字面片段 / 源主题层级 / 源主题尾部" 的复制计划, 转发时按计划拼接。
+//
+//   target 中第i个 '+' 取 source 中第i个 '+' 匹配的层级, '#' 取 source 中 '#' 匹配的剩余层级;
+//   {N} 引用 source 中第N个通配符 (从1开始), 可以出现在层级内部, 如 "dev-{1}"。
+// 例: source "site/+/dev/#", target "cloud/{1}/#": "site/a/dev/x/y" -> "cloud/a/x/y"。
+// target 与 source 相同时不改写; '#' 匹配零层时 (如 "a/#" 匹配 "a") 去掉其前面的 '/'。
+
+typedef struct topic_rewrite topic_rewrite_t;
+
+// 编译改写计划, target 引用了 source 中不存在的通配符时记录日志并返回NULL
+topic_rewrite_t *topic_rewrite_compile(const char *source_filter, const char *target_topic);
+void             topic_rewrite_free(topic_rewrite_t *rewrite);
+
+// 改写与 source_filter 匹配的主题, 结果写入线程私有的复用缓冲区, 在本线程下一次调用前有效;
+// 不需要改写时直接返回 topic, 主题层级不足时返回NULL
+const char *topic_rewrite_apply(const topic_rewrite_t *rewrite, const char *topic);
+
+#endif
@@ -0,0 +1,375 @@
+#include "topic_trie.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+// 叶子节点上挂载的值, seq 为插入序号, 用于按规则顺序返回匹配结果
+typedef struct
+{
+    void *value;
+    int   seq;
+} trie_value_t;
+
+typedef struct trie_node
+{
+    char              *segment;      // 字面层级内容 (通配节点为NULL)
+    int                segment_len;
+    struct trie_node **children;     // 字面子节点, 按 (长度, 内容) 排序
+    int                child_count;
+    struct trie_node  *plus_child;   // '+' 子节点
+    struct trie_node  *hash_child;   // '#' 子节点
+    trie_value_t      *values;
+    int                value_count;
+} trie_node_t;
+
+// 精确主题缓存条目 (直接映射)
+typedef struct
+{
+    unsigned long hash;
+    int           topic_len;   // 0 表示空槽
+    int           value_count;
+    char          topic[TOPIC_CACHE_KEY_MAX];
+    void         *values[TOPIC_CACHE_MAX_VALUES];
+} cache_entry_t;
+
+struct topic_trie
+{
+    trie_node_t    root;
+    int            value_count;   // 插入的值总数, 也是单次匹配结果的上限
+    trie_value_t  *scratch;
+    int            scratch_count;
+    void         **results;
+    cache_entry_t *cache;
+    unsigned long  cache_hits;
+    unsigned long  cache_misses;
+};
+
+topic_trie_t *topic_trie_create(void)
+{
+    topic_trie_t *trie = calloc(1, sizeof(topic_trie_t));
+    if (!trie)
+    {
+        return NULL;
+    }
+
+    trie->cache = calloc(TOPIC_CACHE_SIZE, sizeof(cache_entry_t));
+    if (!trie->cache)
+    {
+        free(trie);
+        return NULL;
+    }
+    return trie;
+}
+
+static void free_node(trie_node_t *node)
+{
+    for (int i = 0; i < node->child_count; i++)
+    {
+        free_node(node->children[i]);
+        free(node->children[i]);
+    }
+    if (node->plus_child)
+    {
+        free_node(node->plus_child);
+        free(node->plus_child);
+    }
+    if (node->hash_child)
+    {
+        free_node(node->hash_child);
+        free(node->hash_child);
+    }
+    free(node->children);
+    free(node->values);
+    free(node->segment);
+}
+
+void topic_trie_destroy(topic_trie_t *trie)
+{
+    if (!trie)
+    {
+        return;
+    }
+    free_node(&trie->root);
+    free(trie->scratch);
+    free(trie->results);
+    free(trie->cache);
+    free(trie);
+}
+
+static int compare_segment(const trie_node_t *node, const char *segment, int len)
+{
+    if (node->segment_len != len)
+    {
+        return node->segment_len < len ? -1 : 1;
+    }
+    return memcmp(node->segment, segment, len);
+}
+
+// 二分查找字面子节点, 未找到时 *pos 为插入位置
+static trie_node_t *find_child(const trie_node_t *node, const char *segment, int len, int *pos)
+{
+    int lo = 0;
+    int hi = node->child_count - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        int cmp = compare_segment(node->children[mid], segment, len);
+        if (cmp == 0)
+        {
+            return node->children[mid];
+        }
+        if (cmp < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    if (pos)
+    {
+        *pos = lo;
+    }
+    return NULL;
+}
+
+static trie_node_t *add_child(trie_node_t *node, const char *segment, int len)
+{
+    int          pos;
+    trie_node_t *child = find_child(node, segment, len, &pos);
+    if (child)
+    {
+        return child;
+    }
+
+    child = calloc(1, sizeof(trie_node_t));
+    if (!child)
+    {
+        return NULL;
+    }
+    child->segment = malloc(len + 1);
+    if (!child->segment)
+    {
+        free(child);
+        return NULL;
+    }
+    memcpy(child->segment, segment, len);
+    child->segment[len] = '\0';
+    child->segment_len  = len;
+
+    trie_node_t **children = realloc(node->children, sizeof(trie_node_t *) * (node->child_count + 1));
+    if (!children)
+    {
+        free(child->segment);
+        free(child);
+        return NULL;
+    }
+    node->children = children;
+    memmove(&children[pos + 1], &children[pos], sizeof(trie_node_t *) * (node->child_count - pos));
+    children[pos] = child;
+    node->child_count++;
+    return child;
+}
+
+static trie_node_t *add_wildcard(trie_node_t **slot)
+{
+    if (!*slot)
+    {
+        *slot = calloc(1, sizeof(trie_node_t));
+    }
+    return *slot;
+}
+
+int topic_trie_insert(topic_trie_t *trie, const char *filter, void *value)
+{
+    if (!trie || !filter || !*filter)
+    {
+        return -1;
+    }
+
+    trie_node_t *node    = &trie->root;
+    const char  *segment = filter;
+    while (node)
+    {
+        const char *end = strchr(segment, '/');
+        int         len = end ? (int)(end - segment) : (int)strlen(segment);
+
+        if (len == 1 && segment[0] == '+')
+        {
+            node = add_wildcard(&node->plus_child);
+        }
+        else if (len == 1 && segment[0] == '#')
+        {
+            if (end)
+            {
+                return -1; // '#' 必须位于最后一层
+            }
+            node = add_wildcard(&node->hash_child);
+        }
+        else
+        {
+            node = add_child(node, segment, len);
+        }
+
+        if (!end)
+        {
+            break;
+        }
+        segment = end + 1;
+    }
+    if (!node)
+    {
+        return -1;
+    }
+
+    trie_value_t *values = realloc(node->values, sizeof(trie_value_t) * (node->value_count + 1));
+    if (!values)
+    {
+        return -1;
+    }
+    node->values = values;
+
+    // 扩容匹配临时数组, 保证任意主题的匹配结果都放得下
+    trie_value_t *scratch = realloc(trie->scratch, sizeof(trie_value_t) * (trie->value_count + 1));
+    if (!scratch)
+    {
+        return -1;
+    }
+    trie->scratch = scratch;
+    void **results = realloc(trie->results, sizeof(void *) * (trie->value_count + 1));
+    if (!results)
+    {
+        return -1;
+    }
+    trie->results = results;
+
+    values[node->value_count].value = value;
+    values[node->value_count].seq   = trie->value_count++;
+    node->value_count++;
+    return 0;
+}
+
+static void collect(topic_trie_t *trie, const trie_node_t *node)
+{
+    for (int i = 0; i < node->value_count; i++)
+    {
+        trie->scratch[trie->scratch_count++] = node->values[i];
+    }
+}
+
+// 逐层匹配; segment 为 NULL 表示主题已全部消费
+static void match_node(topic_trie_t      *trie,
+                       const trie_node_t *node,
+                       const char        *segment,
+                       int                wildcard_ok)
+{
+    // '#' 同时匹配父层级本身, 因此在消费下一层之前收集
+    if (node->hash_child && wildcard_ok)
+    {
+        collect(trie, node->hash_child);
+    }
+
+    if (!segment)
+    {
+        collect(trie, node);
+        return;
+    }
+
+    const char *end  = strchr(segment, '/');
+    int         len  = end ? (int)(end - segment) : (int)strlen(segment);
+    const char *next = end ? end + 1 : NULL;
+
+    const trie_node_t *child = find_child(node, segment, len, NULL);
+    if (child)
+    {
+        match_node(trie, child, next, 1);
+    }
+    if (node->plus_child && wildcard_ok)
+    {
+        match_node(trie, node->plus_child, next, 1);
+    }
+}
+
+static unsigned long hash_topic(const char *topic, size_t *len)
+{
+    unsigned long hash = 14695981039346656037UL;
+    const char   *p    = topic;
+    for (; *p; p++)
+    {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211UL;
+    }
+    *len = (size_t)(p - topic);
+    return hash;
+}
+
+int topic_trie_match(topic_trie_t *trie, const char *topic, void *const **values)
+{
+    size_t         len;
+    unsigned long  hash  = hash_topic(topic, &len);
+    cache_entry_t *entry = NULL;
+
+    if (len > 0 && len < TOPIC_CACHE_KEY_MAX)
+    {
+        entry = &trie->cache[hash & (TOPIC_CACHE_SIZE - 1)];
+        if (entry->hash == hash && entry->topic_len == (int)len && memcmp(entry->topic, topic, len) == 0)
+        {
+            trie->cache_hits++;
+            *values = entry->values;
+            return entry->value_count;
+        }
+    }
+    trie->cache_misses++;
+
+    // 以'$'开头的系统主题不匹配首层通配符
+    trie->scratch_count = 0;
+    match_node(trie, &trie->root, topic, topic[0] != '$');
+
+    // 按插入顺序排列 (匹配数量很少, 插入排序即可)
+    int count = trie->scratch_count;
+    for (int i = 1; i < count; i++)
+    {
+        trie_value_t item = trie->scratch[i];
+        int          j    = i - 1;
+        while (j >= 0 && trie->scratch[j].seq > item.seq)
+        {
+            trie->scratch[j + 1] = trie->scratch[j];
+            j--;
+        }
+        trie->scratch[j + 1] = item;
+    }
+
+    if (entry && count <= TOPIC_CACHE_MAX_VALUES)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            entry->values[i] = trie->scratch[i].value;
+        }
+        memcpy(entry->topic, topic, len);
+        entry->topic_len   = (int)len;
+        entry->hash        = hash;
+        entry->value_count = count;
+        *values            = entry->values;
+        return count;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        trie->results[i] = trie->scratch[i].value;
+    }
+    *values = trie->results;
+    return count;
+}
+
+unsigned long topic_trie_cache_hits(const topic_trie_t *trie)
+{
+    return trie->cache_hits;
+}
+
+unsigned long topic_trie_cache_misses(const topic_trie_t *trie)
+{
+    return trie->cache_misses;
+}
@@ -0,0 +1,26 @@
+#ifndef TOPIC_TRIE_H
+#define TOPIC_TRIE_H
+
+// MQTT主题前缀树: 将订阅过滤器(支持 + / # 通配符)编译为逐层匹配的树,
+// 叶子节点挂载匹配到的值(转发规则)。树前置一个精确主题结果缓存,
+// 重复出现的设备主题可直接命中缓存。
+//
+// 线程模型: 树在启动阶段构建完成后只读; 匹配会写入内部缓存和临时数组,
+// 因此同一棵树只能由一个线程匹配 (每个源客户端的网络线程)。
+
+typedef struct topic_trie topic_trie_t;
+
+topic_trie_t *topic_trie_create(void);
+void          topic_trie_destroy(topic_trie_t *trie);
+
+// 插入一个订阅过滤器及其关联值, 匹配结果按插入顺序返回
+int topic_trie_insert(topic_trie_t *trie, const char *filter, void *value);
+
+// 匹配主题, 返回匹配数量; *values 指向内部数组, 在下一次匹配前有效
+int topic_trie_match(topic_trie_t *trie, const char *topic, void *const **values);
+
+// 缓存统计
+unsigned long topic_trie_cache_hits(const topic_trie_t *trie);
+unsigned long topic_trie_cache_misses(const topic_trie_t *trie);
+
+#endif
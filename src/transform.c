@@ -0,0 +1,605 @@
+#include "transform.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json_scan.h"
+#include "logger.h"
+#include "scratch_arena.h"
+#include "time_util.h"
+
+#define TRANSFORM_KEY_MAX 256     // 含转义的字段名反转义后的最大长度
+#define TRANSFORM_NUMBER_MAX 24   // 时间戳的最大输出长度
+
+typedef enum
+{
+    OP_LITERAL = 0,
+    OP_TOPIC,
+    OP_TOPIC_SEGMENT,
+    OP_PAYLOAD,
+    OP_PAYLOAD_PATH,
+    OP_TIMESTAMP_MS,
+    OP_TIMESTAMP_S
+} opcode_t;
+
+typedef struct
+{
+    opcode_t opcode;
+    int      segment;   // OP_TOPIC_SEGMENT 的段下标
+    size_t   offset;    // 字面量在 literals 中的位置 / 路径在 steps 中的起始下标
+    size_t   len;       // 字面量长度 / 路径步数
+} op_t;
+
+// 字段路径的一步: 按名称取对象成员, 或按下标取数组元素
+typedef struct
+{
+    int    index;        // -1 表示按名称
+    size_t name_offset;  // 名称在 names 中的位置
+    size_t name_len;
+} step_t;
+
+struct transform
+{
+    op_t   *ops;
+    int     op_count;
+    char   *literals;
+    size_t  literal_len;
+    size_t  literal_cap;
+    step_t *steps;
+    int     step_count;
+    char   *names;
+    size_t  names_len;
+
+    // 输出长度上界: 字面量 + 每个负载占位符一份负载 + 每个主题占位符一份转义后的主题
+    int payload_ops;
+    int topic_ops;
+    int time_ops;
+};
+
+// ---------------------------------------------------------------------------
+// 编译
+// ---------------------------------------------------------------------------
+
+// 追加字面量, 与紧邻的上一条字面量指令合并
+static int emit_literal(transform_t *transform, const char *data, size_t len)
+{
+    if (len == 0)
+    {
+        return 0;
+    }
+    if (transform->literal_len + len > transform->literal_cap)
+    {
+        size_t capacity = transform->literal_cap ? transform->literal_cap : 256;
+        while (capacity < transform->literal_len + len)
+        {
+            capacity *= 2;
+        }
+        char *grown = realloc(transform->literals, capacity);
+        if (!grown)
+        {
+            return -1;
+        }
+        transform->literals    = grown;
+        transform->literal_cap = capacity;
+    }
+
+    memcpy(transform->literals + transform->literal_len, data, len);
+    op_t *last = transform->op_count > 0 ? &transform->ops[transform->op_count - 1] : NULL;
+    if (last && last->opcode == OP_LITERAL && last->offset + last->len == transform->literal_len)
+    {
+        last->len += len;
+    }
+    else
+    {
+        transform->ops[transform->op_count++] = (op_t){
+            .opcode = OP_LITERAL, .offset = transform->literal_len, .len = len};
+    }
+    transform->literal_len += len;
+    return 0;
+}
+
+// 去掉紧挨着负载占位符的开引号, 返回是否去掉
+static int drop_open_quote(transform_t *transform)
+{
+    op_t *last = transform->op_count > 0 ? &transform->ops[transform->op_count - 1] : NULL;
+    if (!last || last->opcode != OP_LITERAL || last->len == 0
+        || transform->literals[last->offset + last->len - 1] != '"')
+    {
+        return 0;
+    }
+    last->len--;
+    transform->literal_len--;
+    if (last->len == 0)
+    {
+        transform->op_count--;
+    }
+    return 1;
+}
+
+// 解析 payload 之后的 .name / [N] 序列
+static int compile_path(transform_t *transform, const char *p, const char *end)
+{
+    int first = transform->step_count;
+    while (p < end)
+    {
+        step_t *step = &transform->steps[transform->step_count];
+        if (*p == '.')
+        {
+            const char *name = ++p;
+            while (p < end && *p != '.' && *p != '[')
+            {
+                p++;
+            }
+            if (p == name)
+            {
+                return -1;
+            }
+            step->index       = -1;
+            step->name_offset = transform->names_len;
+            step->name_len    = (size_t)(p - name);
+            memcpy(transform->names + transform->names_len, name, step->name_len);
+            transform->names_len += step->name_len;
+        }
+        else if (*p == '[' && p + 1 < end && isdigit((unsigned char)p[1]))
+        {
+            char *number_end;
+            long  index = strtol(p + 1, &number_end, 10);
+            if (number_end >= end || *number_end != ']' || index > INT_MAX)
+            {
+                return -1;
+            }
+            step->index = (int)index;
+            p           = number_end + 1;
+        }
+        else
+        {
+            return -1;
+        }
+        transform->step_count++;
+    }
+
+    transform->ops[transform->op_count++] = (op_t){
+        .opcode = first == transform->step_count ? OP_PAYLOAD : OP_PAYLOAD_PATH,
+        .offset = (size_t)first,
+        .len    = (size_t)(transform->step_count - first)};
+    transform->payload_ops++;
+    return 0;
+}
+
+// 常量在编译时展开为字面量
+static int compile_constant(transform_t *transform, const char *rule_name, cJSON *constants,
+                            const char *name, size_t name_len)
+{
+    char key[TRANSFORM_KEY_MAX];
+    if (name_len == 0 || name_len >= sizeof(key))
+    {
+        LOG_ERROR("Rule '%s' transform has an invalid constant name", rule_name);
+        return -1;
+    }
+    memcpy(key, name, name_len);
+    key[name_len] = '\0';
+
+    cJSON *constant = cJSON_GetObjectItemCaseSensitive(constants, key);
+    if (!constant)
+    {
+        LOG_ERROR("Rule '%s' transform references undefined constant: %s", rule_name, key);
+        return -1;
+    }
+
+    int ret;
+    if (cJSON_IsString(constant))
+    {
+        size_t len     = strlen(constant->valuestring);
+        char  *escaped = malloc(json_escaped_max(len) + 1);
+        if (!escaped)
+        {
+            return -1;
+        }
+        ret = emit_literal(transform, escaped, json_escape(escaped, constant->valuestring, len));
+        free(escaped);
+    }
+    else
+    {
+        char *printed = cJSON_PrintUnformatted(constant);
+        if (!printed)
+        {
+            return -1;
+        }
+        ret = emit_literal(transform, printed, strlen(printed));
+        cJSON_free(printed);
+    }
+    return ret;
+}
+
+static int starts_with(const char *expr, size_t len, const char *prefix)
+{
+    size_t prefix_len = strlen(prefix);
+    return len >= prefix_len && memcmp(expr, prefix, prefix_len) == 0;
+}
+
+static int is_word(const char *expr, size_t len, const char *word)
+{
+    return len == strlen(word) && memcmp(expr, word, len) == 0;
+}
+
+// 编译一个占位符 (不含 ${ 和 }), 返回下一个待处理字符的位置, 出错返回NULL
+static const char *compile_placeholder(transform_t *transform, const char *rule_name, cJSON *constants,
+                                       const char *expr, const char *close)
+{
+    size_t len = (size_t)(close - expr);
+
+    if (is_word(expr, len, "topic"))
+    {
+        transform->ops[transform->op_count++] = (op_t){.opcode = OP_TOPIC};
+        transform->topic_ops++;
+        return close + 1;
+    }
+    if (starts_with(expr, len, "topic[") && expr[len - 1] == ']')
+    {
+        char *number_end;
+        long  segment = strtol(expr + 6, &number_end, 10);
+        if (number_end == expr + 6 || number_end != close - 1 || segment < INT_MIN || segment > INT_MAX)
+        {
+            return NULL;
+        }
+        transform->ops[transform->op_count++] = (op_t){.opcode = OP_TOPIC_SEGMENT, .segment = (int)segment};
+        transform->topic_ops++;
+        return close + 1;
+    }
+    if (is_word(expr, len, "payload") || starts_with(expr, len, "payload.")
+        || starts_with(expr, len, "payload["))
+    {
+        int quoted = close[1] == '"' && drop_open_quote(transform);
+        if (compile_path(transform, expr + 7, close) != 0)
+        {
+            return NULL;
+        }
+        return close + 1 + quoted;
+    }
+    if (starts_with(expr, len, "const."))
+    {
+        if (compile_constant(transform, rule_name, constants, expr + 6, len - 6) != 0)
+        {
+            return NULL;
+        }
+        return close + 1;
+    }
+    if (is_word(expr, len, "timestamp") || is_word(expr, len, "timestamp_s"))
+    {
+        transform->ops[transform->op_count++] = (op_t){
+            .opcode = len == 9 ? OP_TIMESTAMP_MS : OP_TIMESTAMP_S};
+        transform->time_ops++;
+        return close + 1;
+    }
+    return NULL;
+}
+
+static int compile_template(transform_t *transform, const char *rule_name, const char *text, cJSON *constants)
+{
+    const char *p = text;
+    while (*p)
+    {
+        const char *dollar = strchr(p, '$');
+        if (!dollar)
+        {
+            return emit_literal(transform, p, strlen(p));
+        }
+        if (emit_literal(transform, p, (size_t)(dollar - p)) != 0)
+        {
+            return -1;
+        }
+
+        if (dollar[1] == '$')
+        {
+            if (emit_literal(transform, "$", 1) != 0)
+            {
+                return -1;
+            }
+            p = dollar + 2;
+        }
+        else if (dollar[1] == '{')
+        {
+            const char *close = strchr(dollar + 2, '}');
+            if (!close)
+            {
+                LOG_ERROR("Rule '%s' transform has an unterminated placeholder", rule_name);
+                return -1;
+            }
+            p = compile_placeholder(transform, rule_name, constants, dollar + 2, close);
+            if (!p)
+            {
+                LOG_ERROR("Rule '%s' transform has an invalid placeholder: %.*s",
+                          rule_name, (int)(close - dollar + 1), dollar);
+                return -1;
+            }
+        }
+        else
+        {
+            if (emit_literal(transform, "$", 1) != 0)
+            {
+                return -1;
+            }
+            p = dollar + 1;
+        }
+    }
+    return 0;
+}
+
+transform_t *transform_compile(const char *rule_name, cJSON *spec)
+{
+    cJSON *template_json = cJSON_GetObjectItem(spec, "template");
+    cJSON *constants     = cJSON_GetObjectItem(spec, "constants");
+
+    if (!template_json || cJSON_IsNull(template_json))
+    {
+        LOG_ERROR("Rule '%s' transform missing template", rule_name);
+        return NULL;
+    }
+    if (constants && !cJSON_IsNull(constants) && !cJSON_IsObject(constants))
+    {
+        LOG_ERROR("Rule '%s' transform constants must be an object", rule_name);
+        return NULL;
+    }
+
+    // 模板可以直接写成JSON值, 按紧凑格式打印后作为模板文本
+    char       *printed = NULL;
+    const char *text    = template_json->valuestring;
+    if (!cJSON_IsString(template_json))
+    {
+        printed = cJSON_PrintUnformatted(template_json);
+        text    = printed;
+    }
+
+    // 每条指令、每个路径步至少对应模板中的一个字符
+    size_t       text_len  = text ? strlen(text) : 0;
+    transform_t *transform = calloc(1, sizeof(transform_t));
+    if (transform)
+    {
+        transform->ops   = malloc(sizeof(op_t) * (text_len + 1));
+        transform->steps = malloc(sizeof(step_t) * (text_len + 1));
+        transform->names = malloc(text_len + 1);
+    }
+    if (!text || !transform || !transform->ops || !transform->steps || !transform->names)
+    {
+        LOG_ERROR("Out of memory compiling transform for rule '%s'", rule_name);
+        cJSON_free(printed);
+        transform_free(transform);
+        return NULL;
+    }
+
+    int ret = compile_template(transform, rule_name, text, constants);
+    cJSON_free(printed);
+    if (ret != 0)
+    {
+        transform_free(transform);
+        return NULL;
+    }
+
+    LOG_DEBUG("Compiled transform for rule '%s': %d ops, %zu literal bytes",
+              rule_name, transform->op_count, transform->literal_len);
+    return transform;
+}
+
+void transform_free(transform_t *transform)
+{
+    if (!transform)
+    {
+        return;
+    }
+    free(transform->ops);
+    free(transform->literals);
+    free(transform->steps);
+    free(transform->names);
+    free(transform);
+}
+
+// ---------------------------------------------------------------------------
+// 执行
+// ---------------------------------------------------------------------------
+
+// 取第 index 个主题段 (负数从末尾计数), 不存在或为空时返回-1
+static int topic_segment(const char *topic, int index, const char **segment, size_t *len)
+{
+    int count = 1;
+    for (const char *p = topic; *p; p++)
+    {
+        count += *p == '/';
+    }
+    if (index < 0)
+    {
+        index += count;
+    }
+    if (index < 0 || index >= count)
+    {
+        return -1;
+    }
+
+    const char *start = topic;
+    for (int i = 0; i < index; i++)
+    {
+        start = strchr(start, '/') + 1;
+    }
+    const char *stop = strchr(start, '/');
+    *segment         = start;
+    *len             = stop ? (size_t)(stop - start) : strlen(start);
+    return *len > 0 ? 0 : -1;
+}
+
+// key 指向成员名的开引号, key_end 指向结束引号之后
+static int key_matches(const char *key, const char *key_end, const char *name, size_t name_len)
+{
+    const char *raw     = key + 1;
+    size_t      raw_len = (size_t)(key_end - 1 - raw);
+    if (!memchr(raw, '\\', raw_len))
+    {
+        return raw_len == name_len && memcmp(raw, name, name_len) == 0;
+    }
+
+    char unescaped[TRANSFORM_KEY_MAX];
+    int  truncated = 0;
+    json_unescape(key, key_end, unescaped, sizeof(unescaped), &truncated);
+    return !truncated && strlen(unescaped) == name_len && memcmp(unescaped, name, name_len) == 0;
+}
+
+// 以下查找函数的输入已通过 json_skip_value 的语法检查, p 指向值的第一个字符
+
+// 返回第一个同名成员的值
+static const char *find_member(const char *p, const char *end, const char *name, size_t name_len)
+{
+    if (*p != '{')
+    {
+        return NULL;
+    }
+    p = json_skip_ws(p + 1, end);
+    while (*p == '"')
+    {
+        const char *key_end = json_skip_value(p, end);
+        const char *value   = json_skip_ws(json_skip_ws(key_end, end) + 1, end);
+        if (key_matches(p, key_end, name, name_len))
+        {
+            return value;
+        }
+        p = json_skip_ws(json_skip_value(value, end), end);
+        if (*p != ',')
+        {
+            return NULL;
+        }
+        p = json_skip_ws(p + 1, end);
+    }
+    return NULL;
+}
+
+static const char *find_element(const char *p, const char *end, int index)
+{
+    if (*p != '[')
+    {
+        return NULL;
+    }
+    p = json_skip_ws(p + 1, end);
+    if (*p == ']')
+    {
+        return NULL;
+    }
+    for (int i = 0; i < index; i++)
+    {
+        p = json_skip_ws(json_skip_value(p, end), end);
+        if (*p != ',')
+        {
+            return NULL;
+        }
+        p = json_skip_ws(p + 1, end);
+    }
+    return p;
+}
+
+static const char *resolve_path(const transform_t *transform, const op_t *op, const char *p, const char *end)
+{
+    for (size_t i = 0; i < op->len && p; i++)
+    {
+        const step_t *step = &transform->steps[op->offset + i];
+        p = step->index < 0
+                ? find_member(p, end, transform->names + step->name_offset, step->name_len)
+                : find_element(p, end, step->index);
+    }
+    return p;
+}
+
+transform_status_t transform_apply(const transform_t *transform,
+                                   const char        *topic,
+                                   const void        *payload,
+                                   int                payloadlen,
+                                   const char       **out,
+                                   size_t            *out_len)
+{
+    const char *json      = (const char *)payload;
+    const char *json_end  = json + payloadlen;
+    const char *value     = NULL;
+    const char *value_end = NULL;
+
+    // 负载只做一次完整的语法检查, 之后的字段查找不再检查。
+    // 紧凑规范形式 (最常见) 用与 EventCall 相同的快速检查, 整个负载即为一个值
+    if (transform->payload_ops > 0 && json_is_canonical(json, (size_t)payloadlen))
+    {
+        value     = json;
+        value_end = json_end;
+    }
+    else if (transform->payload_ops > 0)
+    {
+        value_end = json_skip_value(json, json_end);
+        if (!value_end || json_skip_ws(value_end, json_end) != json_end)
+        {
+            return TRANSFORM_PARSE_ERROR;
+        }
+        value = json_skip_ws(json, json_end);
+    }
+
+    size_t topic_len = strlen(topic);
+    size_t size      = transform->literal_len + (size_t)transform->payload_ops * (size_t)payloadlen
+                  + (size_t)transform->topic_ops * json_escaped_max(topic_len)
+                  + (size_t)transform->time_ops * TRANSFORM_NUMBER_MAX;
+    char *buffer = scratch_output(size + 1);
+    if (!buffer)
+    {
+        return TRANSFORM_SERIALIZE_ERROR;
+    }
+
+    char     *p   = buffer;
+    long long now = 0;
+    for (int i = 0; i < transform->op_count; i++)
+    {
+        const op_t *op = &transform->ops[i];
+        switch (op->opcode)
+        {
+        case OP_LITERAL:
+            memcpy(p, transform->literals + op->offset, op->len);
+            p += op->len;
+            break;
+        case OP_TOPIC:
+            p += json_escape(p, topic, topic_len);
+            break;
+        case OP_TOPIC_SEGMENT:
+        {
+            const char *segment;
+            size_t      segment_len;
+            if (topic_segment(topic, op->segment, &segment, &segment_len) != 0)
+            {
+                return TRANSFORM_NO_TOPIC_SEGMENT;
+            }
+            p += json_escape(p, segment, segment_len);
+            break;
+        }
+        case OP_PAYLOAD:
+            memcpy(p, value, (size_t)(value_end - value));
+            p += value_end - value;
+            break;
+        case OP_PAYLOAD_PATH:
+        {
+            const char *field = resolve_path(transform, op, value, json_end);
+            if (!field)
+            {
+                return TRANSFORM_MISSING_FIELD;
+            }
+            const char *field_end = json_skip_value(field, json_end);
+            memcpy(p, field, (size_t)(field_end - field));
+            p += field_end - field;
+            break;
+        }
+        case OP_TIMESTAMP_MS:
+        case OP_TIMESTAMP_S:
+            if (now == 0)
+            {
+                now = realtime_ms();
+            }
+            p += snprintf(p, TRANSFORM_NUMBER_MAX, "%lld",
+                          op->opcode == OP_TIMESTAMP_MS ? now : now / 1000);
+            break;
+        }
+    }
+
+    *out     = buffer;
+    *out_len = (size_t)(p - buffer);
+    return TRANSFORM_OK;
+}
@@ -0,0 +1,45 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <cjson/cJSON.h>
+#include <stddef.h>
+
+// 声明式转换模板: 规则配置中的 transform 段在加载时编译为指令序列,
+// 转发时按指令把常量片段、主题段、负载字段和时间戳直接写入输出缓冲区, 不构建DOM。
+//
+// 模板占位符:
+//   ${topic}            完整主题 (按JSON字符串转义)
+//   ${topic[N]}         第N个主题段, 从0开始, 负数从末尾计数 (按JSON字符串转义)
+//   ${payload}          整个负载, 原样输出JSON值
+//   ${payload.a[0].b}   负载中的字段, 原样输出JSON值
+//   ${const.NAME}       constants 中的常量, 字符串按JSON转义, 其他类型输出JSON文本
+//   ${timestamp}        当前时间 (毫秒), ${timestamp_s} 为秒
+//   $$                  输出 $
+// 负载占位符两侧的引号会被去掉, 因此以JSON对象书写模板时可以写 "data": "${payload}"。
+
+typedef struct transform transform_t;
+
+// 转换结果
+typedef enum
+{
+    TRANSFORM_OK = 0,
+    TRANSFORM_PARSE_ERROR,       // 负载不是合法JSON
+    TRANSFORM_MISSING_FIELD,     // 负载中没有模板引用的字段
+    TRANSFORM_NO_TOPIC_SEGMENT,  // 主题中没有模板引用的段, 或该段为空
+    TRANSFORM_SERIALIZE_ERROR
+} transform_status_t;
+
+// 编译规则的 transform 配置 {"template": 字符串或JSON值, "constants": {...}},
+// 出错时记录日志并返回NULL
+transform_t *transform_compile(const char *rule_name, cJSON *spec);
+void         transform_free(transform_t *transform);
+
+// 按模板生成输出, 结果写入线程私有的复用缓冲区, 在本线程下一次调用前有效
+transform_status_t transform_apply(const transform_t *transform,
+                                   const char        *topic,
+                                   const void        *payload,
+                                   int                payloadlen,
+                                   const char       **out,
+                                   size_t            *out_len);
+
+#endif
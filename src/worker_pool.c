@@ -0,0 +1,415 @@
+#include "worker_pool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+#include "logger.h"
+
+// 有界 MPMC 队列的一个槽位, sequence 表示槽位当前可写/可读的轮次
+typedef struct
+{
+    atomic_size_t sequence;
+    void         *data;
+} cell_t;
+
+typedef struct
+{
+    cell_t *cells;
+    size_t  mask;
+    alignas(64) atomic_size_t enqueue_pos;
+    alignas(64) atomic_size_t dequeue_pos;
+} mpmc_queue_t;
+
+typedef struct
+{
+    mpmc_queue_t    queues[PRIORITY_LANES];
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    atomic_bool     sleeping;   // 线程空闲等待中, 提交方需要唤醒
+    atomic_size_t   finished[PRIORITY_LANES];   // 各通道已执行完的任务数, 与队列位置对应 (每个队列只有本线程消费)
+    int             lane;       // 加权调度: 当前通道及其剩余份额, 只由本线程访问
+    int             credit;
+    worker_pool_t  *pool;
+    int             started;
+} worker_t;
+
+struct worker_pool
+{
+    char              name[64];
+    worker_fn         fn;
+    schedule_config_t schedule;
+    atomic_bool   running;
+    atomic_ulong  submitted;
+    atomic_ulong  completed;
+    atomic_ulong  stalls;
+    int           count;
+    worker_t      workers[];
+};
+
+static int queue_init(mpmc_queue_t *queue, size_t depth)
+{
+    size_t capacity = 2;
+    while (capacity < depth)
+    {
+        capacity <<= 1;
+    }
+
+    queue->cells = malloc(sizeof(cell_t) * capacity);
+    if (!queue->cells)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < capacity; i++)
+    {
+        atomic_init(&queue->cells[i].sequence, i);
+        queue->cells[i].data = NULL;
+    }
+    queue->mask = capacity - 1;
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    return 0;
+}
+
+static int queue_push(mpmc_queue_t *queue, void *data)
+{
+    size_t  pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    cell_t *cell;
+
+    for (;;)
+    {
+        cell           = &queue->cells[pos & queue->mask];
+        size_t   seq   = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff  = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return -1;   // 队列已满
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->data = data;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return 0;
+}
+
+static void *queue_pop(mpmc_queue_t *queue)
+{
+    size_t  pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    cell_t *cell;
+
+    for (;;)
+    {
+        cell           = &queue->cells[pos & queue->mask];
+        size_t   seq   = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff  = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return NULL;   // 队列为空
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    void *data = cell->data;
+    atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+    return data;
+}
+
+static void wake_worker(worker_t *worker)
+{
+    // 与 worker_main 中设置 sleeping 后重新检查队列配对, 避免丢失唤醒
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&worker->sleeping, memory_order_relaxed))
+    {
+        pthread_mutex_lock(&worker->mutex);
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+    }
+}
+
+// 按调度方式取下一个任务: 严格优先时总是从最高的非空通道取;
+// 加权时当前通道用完份额或为空才轮到下一个通道, 所有通道都为空时返回NULL
+static void *next_job(worker_t *worker, int *lane)
+{
+    const schedule_config_t *schedule = &worker->pool->schedule;
+    if (schedule->mode == SCHEDULE_STRICT)
+    {
+        for (int i = 0; i < PRIORITY_LANES; i++)
+        {
+            void *job = queue_pop(&worker->queues[i]);
+            if (job)
+            {
+                *lane = i;
+                return job;
+            }
+        }
+        return NULL;
+    }
+
+    for (int round = 0; round <= PRIORITY_LANES; round++)
+    {
+        if (worker->credit > 0)
+        {
+            void *job = queue_pop(&worker->queues[worker->lane]);
+            if (job)
+            {
+                worker->credit--;
+                *lane = worker->lane;
+                return job;
+            }
+        }
+        worker->lane   = (worker->lane + 1) % PRIORITY_LANES;
+        worker->credit = schedule->weights[worker->lane];
+    }
+    return NULL;
+}
+
+static void run_job(worker_t *worker, int lane, void *job)
+{
+    worker->pool->fn(job);
+    atomic_fetch_add_explicit(&worker->finished[lane], 1, memory_order_release);
+    atomic_fetch_add_explicit(&worker->pool->completed, 1, memory_order_relaxed);
+}
+
+// 空闲时先短暂自旋, 再在条件变量上限时等待
+static void *worker_main(void *arg)
+{
+    worker_t      *worker = (worker_t *)arg;
+    worker_pool_t *pool   = worker->pool;
+    int            idle   = 0;
+    int            lane;
+
+    for (;;)
+    {
+        void *job = next_job(worker, &lane);
+        if (job)
+        {
+            run_job(worker, lane, job);
+            idle = 0;
+            continue;
+        }
+        if (!atomic_load_explicit(&pool->running, memory_order_acquire))
+        {
+            // 停止前排空剩余任务
+            while ((job = next_job(worker, &lane)) != NULL)
+            {
+                run_job(worker, lane, job);
+            }
+            break;
+        }
+        if (++idle < WORKER_SPIN_ROUNDS)
+        {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&worker->mutex);
+        atomic_store_explicit(&worker->sleeping, true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        job = next_job(worker, &lane);
+        if (!job && atomic_load_explicit(&pool->running, memory_order_acquire))
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += WORKER_IDLE_WAIT_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&worker->cond, &worker->mutex, &deadline);
+        }
+        atomic_store_explicit(&worker->sleeping, false, memory_order_relaxed);
+        pthread_mutex_unlock(&worker->mutex);
+
+        if (job)
+        {
+            run_job(worker, lane, job);
+        }
+        idle = 0;
+    }
+    return NULL;
+}
+
+worker_pool_t *worker_pool_create(const char              *name,
+                                  int                      workers,
+                                  int                      queue_depth,
+                                  const schedule_config_t *schedule,
+                                  worker_fn                fn)
+{
+    if (workers < 1 || queue_depth < 1 || !fn)
+    {
+        return NULL;
+    }
+
+    worker_pool_t *pool = calloc(1, sizeof(worker_pool_t) + sizeof(worker_t) * workers);
+    if (!pool)
+    {
+        return NULL;
+    }
+    snprintf(pool->name, sizeof(pool->name), "%s", name);
+    pool->fn       = fn;
+    pool->schedule = *schedule;
+    atomic_init(&pool->running, true);
+
+    for (int i = 0; i < workers; i++)
+    {
+        worker_t *worker = &pool->workers[i];
+        worker->pool     = pool;
+        atomic_init(&worker->sleeping, false);
+        pthread_mutex_init(&worker->mutex, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+        worker->lane   = 0;
+        worker->credit = schedule->weights[0];
+        pool->count++;
+
+        int ready = 1;
+        for (int lane = 0; lane < PRIORITY_LANES; lane++)
+        {
+            atomic_init(&worker->finished[lane], 0);
+            ready = ready && queue_init(&worker->queues[lane], (size_t)queue_depth) == 0;
+        }
+        if (!ready || pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+        {
+            LOG_ERROR("Failed to start worker %d for %s", i, pool->name);
+            worker_pool_destroy(pool);
+            return NULL;
+        }
+        worker->started = 1;
+    }
+
+    LOG_INFO("Started %d workers for %s (queue depth %zu per lane, %s scheduling)",
+             workers, pool->name, pool->workers[0].queues[0].mask + 1,
+             schedule->mode == SCHEDULE_WEIGHTED ? "weighted" : "strict");
+    return pool;
+}
+
+int worker_pool_submit(worker_pool_t *pool, unsigned int shard, int lane, void *job)
+{
+    worker_t     *worker  = &pool->workers[shard % (unsigned int)pool->count];
+    mpmc_queue_t *queue   = &worker->queues[lane];
+    int           stalled = 0;
+    int           rounds  = 0;
+
+    while (queue_push(queue, job) != 0)
+    {
+        if (!atomic_load_explicit(&pool->running, memory_order_acquire))
+        {
+            return -1;
+        }
+        if (!stalled)
+        {
+            stalled = 1;
+            atomic_fetch_add_explicit(&pool->stalls, 1, memory_order_relaxed);
+        }
+        wake_worker(worker);
+
+        // 队列满: 先让出CPU, 仍然满则短暂休眠
+        if (++rounds < WORKER_SPIN_ROUNDS)
+        {
+            sched_yield();
+        }
+        else
+        {
+            struct timespec pause = {0, WORKER_BACKOFF_US * 1000L};
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    atomic_fetch_add_explicit(&pool->submitted, 1, memory_order_relaxed);
+    wake_worker(worker);
+    return 0;
+}
+
+void worker_pool_drain(worker_pool_t *pool)
+{
+    for (int i = 0; i < pool->count; i++)
+    {
+        // 每个通道按顺序消费, 执行完的任务数追上此刻的入队位置即说明之前的任务都已完成
+        // (通道之间会交错, 因此按通道分别比较)
+        worker_t *worker = &pool->workers[i];
+        for (int lane = 0; lane < PRIORITY_LANES; lane++)
+        {
+            size_t target = atomic_load_explicit(&worker->queues[lane].enqueue_pos, memory_order_acquire);
+            while (worker->started
+                   && atomic_load_explicit(&worker->finished[lane], memory_order_acquire) < target)
+            {
+                wake_worker(worker);
+                struct timespec pause = {0, WORKER_DRAIN_POLL_US * 1000L};
+                nanosleep(&pause, NULL);
+            }
+        }
+    }
+}
+
+void worker_pool_stop(worker_pool_t *pool)
+{
+    atomic_store_explicit(&pool->running, false, memory_order_release);
+    for (int i = 0; i < pool->count; i++)
+    {
+        worker_t *worker = &pool->workers[i];
+        if (worker->started)
+        {
+            pthread_mutex_lock(&worker->mutex);
+            pthread_cond_signal(&worker->cond);
+            pthread_mutex_unlock(&worker->mutex);
+            pthread_join(worker->thread, NULL);
+            worker->started = 0;
+        }
+    }
+}
+
+void worker_pool_destroy(worker_pool_t *pool)
+{
+    if (!pool)
+    {
+        return;
+    }
+
+    worker_pool_stop(pool);
+    for (int i = 0; i < pool->count; i++)
+    {
+        worker_t *worker = &pool->workers[i];
+        pthread_mutex_destroy(&worker->mutex);
+        pthread_cond_destroy(&worker->cond);
+        for (int lane = 0; lane < PRIORITY_LANES; lane++)
+        {
+            free(worker->queues[lane].cells);
+        }
+    }
+    free(pool);
+}
+
+void worker_pool_stats(worker_pool_t *pool, worker_pool_stats_t *stats)
+{
+    stats->submitted = atomic_load(&pool->submitted);
+    stats->completed = atomic_load(&pool->completed);
+    stats->stalls    = atomic_load(&pool->stalls);
+}
@@ -0,0 +1,41 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "config_json.h"
+
+// 消息处理线程池: 每个工作线程每个优先级通道一条有界无锁 MPMC 队列 (Vyukov),
+// 调用方按分片键 (主题哈希) 选择线程, 同一分片同一通道内的任务按提交顺序执行。
+// 线程按调度配置在通道间选择: 严格优先或按权重轮流。
+
+typedef struct worker_pool worker_pool_t;
+
+// 在工作线程上执行一个任务, 由处理函数负责释放任务
+typedef void (*worker_fn)(void *job);
+
+typedef struct
+{
+    unsigned long submitted;
+    unsigned long completed;
+    unsigned long stalls;   // 队列满时提交方等待的次数
+} worker_pool_stats_t;
+
+// 创建并启动 workers 个线程, 每个通道的 queue_depth 向上取整为2的幂
+worker_pool_t *worker_pool_create(const char              *name,
+                                  int                      workers,
+                                  int                      queue_depth,
+                                  const schedule_config_t *schedule,
+                                  worker_fn                fn);
+
+// 提交任务到 lane 通道; 队列满时退避等待 (对网络线程形成背压), 线程池已停止时返回-1
+int worker_pool_submit(worker_pool_t *pool, unsigned int shard, int lane, void *job);
+
+// 等待调用前已提交的任务全部执行完, 不影响此后的提交
+void worker_pool_drain(worker_pool_t *pool);
+
+// 停止接收新任务, 执行完已排队的任务后回收线程; 调用前提交方须已停止
+void worker_pool_stop(worker_pool_t *pool);
+void worker_pool_destroy(worker_pool_t *pool);
+
+void worker_pool_stats(worker_pool_t *pool, worker_pool_stats_t *stats);
+
+#endif
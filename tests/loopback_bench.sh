@@ -0,0 +1,149 @@
+#!/bin/bash
+# 本机回环吞吐测试 (不依赖容器): 启动两个本地 mosquitto 作为下游/上游 Broker,
+# 按 perf_config.json 的拓扑生成转发器配置, 逐个速率运行 mqtt_loadgen, 得到饱和曲线。
+#
+# 用法: tests/loopback_bench.sh [构建目录]
+# 环境变量:
+#   RATES        逐个测试的总速率, 0 表示闭环饱和 (默认 "1000 5000 10000 20000 50000 0")
+#   DURATION     每个速率的发送时长, 秒 (默认 10)
+#   CONNECTIONS  发布连接数 (默认 4)
+#   PAYLOAD      负载字节数 (默认 256)
+#   QOS          (默认 0)
+#   MAX_INFLIGHT 上游客户端等待确认的 QoS 1/2 消息数上限, 0 表示不限 (默认 1000)
+#   PUBLISH_CONNECTIONS 发布到上游 Broker 的连接数 (默认 1)
+#   WORKERS      源客户端的工作线程数 (默认 0)
+#   ENGINE       threaded 或 epoll (默认 threaded)
+#   INSTANCES    逐个测试的转发器实例数, 多个实例通过共享订阅 $share/<SHARE_GROUP>/ 分摊负载 (默认 "1")
+#   SHARE_GROUP  共享订阅组名, 为空时不使用共享订阅 (INSTANCES 为 "1" 时默认为空, 否则默认 loopback)
+#   PORT_BASE    下游 Broker 端口, 上游为 PORT_BASE+1 (默认 18831)
+#   OUT          结果文件, 每个速率一行 JSON (默认 tests/results/loopback_<时间>.jsonl)
+
+set -euo pipefail
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+BUILD_DIR=${1:-"$SCRIPT_DIR/../build"}
+RATES=${RATES:-"1000 5000 10000 20000 50000 0"}
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-4}
+PAYLOAD=${PAYLOAD:-256}
+QOS=${QOS:-0}
+MAX_INFLIGHT=${MAX_INFLIGHT:-1000}
+PUBLISH_CONNECTIONS=${PUBLISH_CONNECTIONS:-1}
+WORKERS=${WORKERS:-0}
+ENGINE=${ENGINE:-threaded}
+INSTANCES=${INSTANCES:-1}
+if [ "$INSTANCES" = "1" ]; then
+    SHARE_GROUP=${SHARE_GROUP-}
+else
+    SHARE_GROUP=${SHARE_GROUP-loopback}
+fi
+PORT_BASE=${PORT_BASE:-18831}
+OUT=${OUT:-"$SCRIPT_DIR/results/loopback_$(date +%Y%m%d_%H%M%S).jsonl"}
+
+FORWARDER="$BUILD_DIR/mqtt_forwarder"
+LOADGEN="$BUILD_DIR/mqtt_loadgen"
+DOWNSTREAM_PORT=$PORT_BASE
+UPSTREAM_PORT=$((PORT_BASE + 1))
+
+for binary in "$FORWARDER" "$LOADGEN"; do
+    if [ ! -x "$binary" ]; then
+        echo "Missing $binary, build with: cmake -B build && cmake --build build" >&2
+        exit 1
+    fi
+done
+if ! command -v mosquitto >/dev/null; then
+    echo "mosquitto broker not found in PATH" >&2
+    exit 1
+fi
+
+WORK_DIR=$(mktemp -d)
+PIDS=()
+cleanup() {
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+start_broker() {
+    local port=$1
+    cat > "$WORK_DIR/mosquitto_$port.conf" <<EOF
+listener $port 127.0.0.1
+allow_anonymous true
+max_queued_messages 0
+EOF
+    mosquitto -c "$WORK_DIR/mosquitto_$port.conf" > "$WORK_DIR/mosquitto_$port.log" 2>&1 &
+    PIDS+=($!)
+}
+
+start_broker "$DOWNSTREAM_PORT"
+start_broker "$UPSTREAM_PORT"
+
+SHARE_FIELD=""
+if [ -n "$SHARE_GROUP" ]; then
+    SHARE_FIELD=", \"share\": \"$SHARE_GROUP\""
+fi
+
+# 与 perf_config.json 相同的规则, Broker 改为本地端口; 每个实例使用不同的客户端 ID
+write_config() {
+    local index=$1
+    cat > "$WORK_DIR/forwarder_$index.json" <<EOF
+{
+  "log_level": "error",
+  "mqtt": {"port": 1883, "keepalive": 60, "qos": $QOS, "retain": false, "clean_session": true},
+  "engine": {"mode": "$ENGINE"},
+  "clients": [
+    {"name": "upstream", "ip": "127.0.0.1", "port": $UPSTREAM_PORT, "client_id": "loopback_upstream_$index",
+     "max_inflight": $MAX_INFLIGHT, "connections": $PUBLISH_CONNECTIONS},
+    {"name": "downstream", "ip": "127.0.0.1", "port": $DOWNSTREAM_PORT, "client_id": "loopback_downstream_$index",
+     "workers": $WORKERS}
+  ],
+  "rules": [
+    {
+      "name": "ge_web_test",
+      "description": "/ge/web/action测试规则",
+      "source": {"client": "downstream", "topic": "/ge/web/#"$SHARE_FIELD},
+      "target": {"client": "upstream", "topic": "/ge/web/#"},
+      "callback": "EventCall",
+      "enabled": true
+    }
+  ]
+}
+EOF
+}
+sleep 0.5
+
+mkdir -p "$(dirname "$OUT")"
+echo "Results: $OUT"
+for instances in $INSTANCES; do
+    FORWARDER_PIDS=()
+    for index in $(seq 1 "$instances"); do
+        write_config "$index"
+        "$FORWARDER" -c "$WORK_DIR/forwarder_$index.json" > "$WORK_DIR/forwarder_$index.log" 2>&1 &
+        FORWARDER_PIDS+=($!)
+        PIDS+=($!)
+    done
+    sleep 0.5
+
+    for rate in $RATES; do
+        echo "=== instances=$instances rate=$rate ==="
+        "$LOADGEN" --pub-port="$DOWNSTREAM_PORT" --sub-port="$UPSTREAM_PORT" \
+            --connections="$CONNECTIONS" --rate="$rate" --duration="$DURATION" \
+            --payload="$PAYLOAD" --qos="$QOS" \
+            --label="engine=$ENGINE,workers=$WORKERS,max_inflight=$MAX_INFLIGHT,connections=$PUBLISH_CONNECTIONS,instances=$instances" --json="$OUT"
+        for index in "${!FORWARDER_PIDS[@]}"; do
+            if ! kill -0 "${FORWARDER_PIDS[$index]}" 2>/dev/null; then
+                echo "Forwarder $((index + 1)) exited, see log:" >&2
+                cat "$WORK_DIR/forwarder_$((index + 1)).log" >&2
+                exit 1
+            fi
+        done
+    done
+
+    for pid in "${FORWARDER_PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+        wait "$pid" 2>/dev/null || true
+    done
+done
@@ -0,0 +1,428 @@
+// 磁盘溢出日志的行为测试: 子进程写入后被 SIGKILL 杀掉 (不关闭日志), 父进程重新打开同一目录,
+// 检查恢复后重放的消息和顺序。覆盖: 半条记录 (写入中途崩溃)、写入段中损坏的记录、
+// 确认位置指向已被淘汰的段。
+//
+// 用法: spill_log_test  (成功返回0)
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "spill_log.h"
+#include "time_util.h"
+
+#define TEST_TOPIC "spill/test"
+#define SEGMENT_BYTES 4096
+// 每条记录 8字节头 + 8字节正文头 + 主题 + 6字节负载, 按8字节对齐为40字节
+#define RECORDS_PER_SEGMENT (SEGMENT_BYTES / 40)
+#define MAX_REPLAY 4096
+
+static int failures;
+
+#define CHECK(cond, ...)                                                 \
+    do                                                                   \
+    {                                                                    \
+        if (!(cond))                                                     \
+        {                                                                \
+            fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, __func__); \
+            fprintf(stderr, __VA_ARGS__);                                \
+            fprintf(stderr, "\n");                                       \
+            failures++;                                                  \
+            return;                                                      \
+        }                                                                \
+    } while (0)
+
+typedef struct
+{
+    int seq[MAX_REPLAY];
+    int count;
+    int bad;      // 主题或标志位与写入时不一致的记录数
+    int limit;    // 达到该条数后拒绝继续重放, 0表示不限
+} replay_t;
+
+static spill_config_t make_config(const char *root, const char *name, int max_segments)
+{
+    spill_config_t config = {0};
+    snprintf(config.dir, sizeof(config.dir), "%s/%s", root, name);
+    config.segment_bytes     = SEGMENT_BYTES;
+    config.max_segments      = max_segments;
+    config.fsync_every       = 1;
+    config.fsync_interval_ms = 0;
+    return config;
+}
+
+static int append_range(spill_log_t *log, int from, int to)
+{
+    for (int seq = from; seq < to; seq++)
+    {
+        char payload[16];
+        snprintf(payload, sizeof(payload), "%06d", seq);
+        if (spill_log_append(log, TEST_TOPIC, payload, 6, seq % 3, seq % 2) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int collect(void *ctx, const char *topic, const void *payload, int payloadlen, int qos, int retain)
+{
+    replay_t *replay = ctx;
+    if (replay->limit > 0 && replay->count >= replay->limit)
+    {
+        return -1;
+    }
+
+    char text[8] = {0};
+    memcpy(text, payload, payloadlen < 7 ? (size_t)payloadlen : 7);
+    int seq = atoi(text);
+    if (strcmp(topic, TEST_TOPIC) != 0 || payloadlen != 6 || qos != seq % 3 || retain != seq % 2)
+    {
+        replay->bad++;
+    }
+    if (replay->count < MAX_REPLAY)
+    {
+        replay->seq[replay->count++] = seq;
+    }
+    return 0;
+}
+
+// 重放全部待处理的记录
+static void replay_all(spill_log_t *log, replay_t *replay)
+{
+    while (spill_log_replay(log, 64, collect, replay) > 0)
+    {
+    }
+}
+
+// 检查 replay 中从 offset 开始的 count 条依次为 first, first+1, ...
+static int expect_run(const replay_t *replay, int offset, int first, int count)
+{
+    if (replay->count < offset + count)
+    {
+        fprintf(stderr, "  expected at least %d records, got %d\n", offset + count, replay->count);
+        return 0;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (replay->seq[offset + i] != first + i)
+        {
+            fprintf(stderr, "  record %d: expected %d, got %d\n", offset + i, first + i, replay->seq[offset + i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 在子进程中执行 writer, 完成后直接被 SIGKILL 杀掉, 日志不会被关闭
+static int run_killed(void (*writer)(const spill_config_t *), const spill_config_t *config)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        writer(config);
+        kill(getpid(), SIGKILL);
+        _exit(1);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL)
+    {
+        fprintf(stderr, "  writer process did not run to the kill point\n");
+        return -1;
+    }
+    return 0;
+}
+
+// 在段文件中找到负载为 seq 的记录, 返回负载在文件中的偏移
+static long find_record(const spill_config_t *config, unsigned int segment, int seq)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/seg-%010u.log", config->dir, segment);
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return -1;
+    }
+    char *data = malloc(SEGMENT_BYTES);
+    long  pos  = -1;
+    if (data && fread(data, 1, SEGMENT_BYTES, file) == SEGMENT_BYTES)
+    {
+        // 记录中主题以'\0'结尾, 紧跟负载
+        char   needle[32];
+        size_t topic_len = strlen(TEST_TOPIC) + 1;
+        memcpy(needle, TEST_TOPIC, topic_len);
+        snprintf(needle + topic_len, sizeof(needle) - topic_len, "%06d", seq);
+        char *hit = memmem(data, SEGMENT_BYTES, needle, topic_len + 6);
+        if (hit)
+        {
+            pos = (long)(hit - data) + (long)topic_len;
+        }
+    }
+    free(data);
+    fclose(file);
+    return pos;
+}
+
+// 用 fill 覆盖段文件中 [offset, offset+len) 的内容
+static int overwrite_segment(const spill_config_t *config, unsigned int segment, long offset, int fill, size_t len)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/seg-%010u.log", config->dir, segment);
+    int fd = open(path, O_WRONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    char buf[64];
+    memset(buf, fill, sizeof(buf));
+    int ok = len <= sizeof(buf) && pwrite(fd, buf, len, offset) == (ssize_t)len;
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+static int segment_exists(const spill_config_t *config, unsigned int segment)
+{
+    char        path[512];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/seg-%010u.log", config->dir, segment);
+    return stat(path, &st) == 0;
+}
+
+// ---- 进程被杀后重启: 从确认位置继续, 未确认的重放记录再次重放 ----
+
+static void kill_after_partial_replay(const spill_config_t *config)
+{
+    spill_log_t *log = spill_log_open(config);
+    if (!log || append_range(log, 0, 300) != 0)
+    {
+        _exit(1);
+    }
+    replay_t replay = {.limit = 150};
+    replay_all(log, &replay);
+    spill_log_sync(log, monotonic_ms());   // 确认位置落盘
+    replay.limit = 160;
+    replay_all(log, &replay);              // 已发出但确认位置未落盘
+}
+
+static void test_kill_and_restart(const char *root)
+{
+    spill_config_t config = make_config(root, "restart", 16);
+    CHECK(run_killed(kill_after_partial_replay, &config) == 0, "writer failed");
+
+    spill_log_t *log = spill_log_open(&config);
+    CHECK(log, "reopen failed");
+    CHECK(spill_log_pending(log) == 150, "pending %ld after restart, expected 150", spill_log_pending(log));
+
+    replay_t replay = {0};
+    replay_all(log, &replay);
+    CHECK(replay.bad == 0, "%d records with wrong topic or flags", replay.bad);
+    CHECK(replay.count == 150 && expect_run(&replay, 0, 150, 150), "replayed %d records out of order", replay.count);
+    CHECK(spill_log_pending(log) == 0, "pending %ld after replay", spill_log_pending(log));
+
+    // 新追加的记录排在恢复的记录之后, 正常关闭后不再重放
+    CHECK(append_range(log, 1000, 1010) == 0, "append after restart failed");
+    replay_all(log, &replay);
+    CHECK(replay.count == 160 && expect_run(&replay, 150, 1000, 10), "appended records not replayed in order");
+    spill_log_close(log);
+
+    log = spill_log_open(&config);
+    CHECK(log, "second reopen failed");
+    CHECK(spill_log_pending(log) == 0, "%ld acknowledged records came back", spill_log_pending(log));
+    spill_log_close(log);
+}
+
+// ---- 写入中途崩溃: 段内最后一条只写了头部 ----
+
+static void kill_after_append_50(const spill_config_t *config)
+{
+    spill_log_t *log = spill_log_open(config);
+    if (!log || append_range(log, 0, 50) != 0)
+    {
+        _exit(1);
+    }
+}
+
+static void test_partial_write(const char *root)
+{
+    spill_config_t config = make_config(root, "partial", 16);
+    CHECK(run_killed(kill_after_append_50, &config) == 0, "writer failed");
+
+    // 清除最后一条记录的正文 (主题和负载), 保留头部
+    long payload = find_record(&config, 1, 49);
+    CHECK(payload > 0, "record 49 not found in segment 1");
+    long body = payload - (long)strlen(TEST_TOPIC) - 1 - 8;
+    CHECK(overwrite_segment(&config, 1, body, 0, (size_t)(payload + 6 - body)) == 0, "cannot damage segment");
+
+    spill_log_t *log = spill_log_open(&config);
+    CHECK(log, "reopen failed");
+    CHECK(spill_log_pending(log) == 49, "pending %ld, expected 49", spill_log_pending(log));
+
+    // 新记录覆盖半条记录所在的位置
+    CHECK(append_range(log, 1000, 1002) == 0, "append after restart failed");
+    replay_t replay = {0};
+    replay_all(log, &replay);
+    CHECK(replay.bad == 0, "%d records with wrong topic or flags", replay.bad);
+    CHECK(replay.count == 51 && expect_run(&replay, 0, 0, 49) && expect_run(&replay, 49, 1000, 2),
+          "replayed %d records, expected 0..48 then 1000..1001", replay.count);
+
+    spill_stats_t stats;
+    spill_log_stats(log, &stats);
+    CHECK(stats.corrupted == 0, "torn tail counted as corruption");
+    spill_log_close(log);
+}
+
+// ---- 写入段中的损坏记录: 恢复时视为数据结尾, 运行中读到时跳过写入段的剩余记录 ----
+
+static void kill_after_append_200(const spill_config_t *config)
+{
+    spill_log_t *log = spill_log_open(config);
+    if (!log || append_range(log, 0, 200) != 0)
+    {
+        _exit(1);
+    }
+}
+
+static void test_corrupt_write_segment(const char *root)
+{
+    spill_config_t config = make_config(root, "corrupt", 16);
+    CHECK(run_killed(kill_after_append_200, &config) == 0, "writer failed");
+
+    // 段1写满 (0..101), 写入段为段2; 破坏其中的记录150
+    long payload = find_record(&config, 2, 150);
+    CHECK(payload > 0, "record 150 not found in segment 2");
+    CHECK(overwrite_segment(&config, 2, payload + 2, 'x', 1) == 0, "cannot damage segment");
+
+    spill_log_t *log = spill_log_open(&config);
+    CHECK(log, "reopen failed");
+    CHECK(spill_log_pending(log) == 150, "pending %ld, expected 150", spill_log_pending(log));
+
+    CHECK(append_range(log, 1000, 1003) == 0, "append after restart failed");
+    replay_t replay = {0};
+    replay_all(log, &replay);
+    CHECK(replay.bad == 0, "%d records with wrong topic or flags", replay.bad);
+    CHECK(replay.count == 153 && expect_run(&replay, 0, 0, 150) && expect_run(&replay, 150, 1000, 3),
+          "replayed %d records, expected 0..149 then 1000..1002", replay.count);
+
+    // 日志打开期间写入段被破坏: 损坏记录之前的照常重放, 之后的丢弃, 后续追加不受影响
+    CHECK(append_range(log, 2000, 2010) == 0, "append failed");
+    payload = find_record(&config, 2, 2005);
+    CHECK(payload > 0, "record 2005 not found in segment 2");
+    CHECK(overwrite_segment(&config, 2, payload, 'x', 1) == 0, "cannot damage segment");
+
+    replay.count = 0;
+    replay_all(log, &replay);
+    CHECK(replay.count == 5 && expect_run(&replay, 0, 2000, 5), "replayed %d records, expected 2000..2004",
+          replay.count);
+
+    spill_stats_t stats;
+    spill_log_stats(log, &stats);
+    CHECK(stats.corrupted == 1 && stats.dropped == 5, "corrupted %lu dropped %lu, expected 1 and 5",
+          stats.corrupted, stats.dropped);
+    CHECK(stats.pending == 0, "pending %ld after skipping the corrupted records", stats.pending);
+
+    CHECK(append_range(log, 3000, 3001) == 0, "append after corruption failed");
+    replay.count = 0;
+    replay_all(log, &replay);
+    CHECK(replay.count == 1 && replay.seq[0] == 3000, "record appended after corruption not replayed");
+    spill_log_close(log);
+}
+
+// ---- 确认位置落盘后读取段因保留上限被淘汰, 新的确认位置未落盘就崩溃 ----
+
+static void kill_after_segment_drop(const spill_config_t *config)
+{
+    spill_log_t *log = spill_log_open(config);
+    if (!log || append_range(log, 0, 100) != 0)
+    {
+        _exit(1);
+    }
+    replay_t replay = {.limit = 50};
+    replay_all(log, &replay);
+    spill_log_sync(log, monotonic_ms());   // 确认位置: 段1偏移50条
+    // 写到第4个段时淘汰段1
+    if (append_range(log, 100, 400) != 0)
+    {
+        _exit(1);
+    }
+}
+
+static void test_ack_in_dropped_segment(const char *root)
+{
+    spill_config_t config = make_config(root, "dropped", 3);
+    CHECK(run_killed(kill_after_segment_drop, &config) == 0, "writer failed");
+    CHECK(!segment_exists(&config, 1) && segment_exists(&config, 2), "segment 1 was not dropped by the writer");
+
+    spill_log_t *log = spill_log_open(&config);
+    CHECK(log, "reopen failed");
+
+    // 从最旧的现存段开头开始重放
+    int      first = RECORDS_PER_SEGMENT;
+    int      count = 400 - first;
+    replay_t replay = {0};
+    replay_all(log, &replay);
+    CHECK(replay.bad == 0, "%d records with wrong topic or flags", replay.bad);
+    CHECK(replay.count == count && expect_run(&replay, 0, first, count),
+          "replayed %d records, expected %d..399", replay.count, first);
+    CHECK(spill_log_pending(log) == 0, "pending %ld after replay", spill_log_pending(log));
+    spill_log_close(log);
+}
+
+static void remove_tree(const char *root)
+{
+    char command[512];
+    snprintf(command, sizeof(command), "rm -rf '%s'", root);
+    if (system(command) != 0)
+    {
+        fprintf(stderr, "Cannot remove %s\n", root);
+    }
+}
+
+int main(void)
+{
+    // 损坏记录的错误日志是预期输出, 默认只输出错误
+    if (getenv("LOG_LEVEL"))
+    {
+        init_log_level();
+    }
+    else
+    {
+        current_log_level = LOG_LEVEL_ERROR;
+    }
+
+    char root[] = "/tmp/spill_log_test.XXXXXX";
+    if (!mkdtemp(root))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    test_kill_and_restart(root);
+    test_partial_write(root);
+    test_corrupt_write_segment(root);
+    test_ack_in_dropped_segment(root);
+
+    remove_tree(root);
+    if (failures > 0)
+    {
+        fprintf(stderr, "spill_log_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("spill_log_test: OK\n");
+    return 0;
+}